@@ -0,0 +1,293 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define CRC32C_HARDWARE 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define CRC32C_TARGET
+#define CRC32C_FOLD_TARGET
+#else
+#define CRC32C_TARGET __attribute__((target("sse4.2")))
+#define CRC32C_FOLD_TARGET __attribute__((target("sse4.2,avx512f,vpclmulqdq")))
+#endif
+#endif
+
+
+/*
+CRC-32C (Castagnoli), as in iSCSI and SCTP. crc32c() picks once, at first use, the
+SSE4.2 crc32 instruction if the CPU has it and slice-by-8 tables otherwise.
+
+The crc32 instruction takes 3 cycles but a new one can start every cycle, so on
+long buffers three streams of crc32 run side by side over three consecutive
+blocks and the CRCs are combined after: shifting a block's CRC past the block
+after it is a multiplication by a constant, done with the tables of Crc32cShift.
+That tops out at 8 bytes a cycle. CPUs with AVX-512 VPCLMULQDQ get past it on
+whole 256 byte blocks by folding: four 64 byte registers of the data are carried
+forward, each 16 byte lane multiplied (carry-less) by x^2048 mod P and added to
+the lane 256 bytes later. What's left at the end folds down to 16 bytes, whose
+CRC is that of all the blocks.
+*/
+constexpr uint32_t CRC32C_POLY = 0x82f63b78;   // reflected
+
+struct Crc32cTables {
+    uint32_t slice[8][256];
+
+    Crc32cTables() {
+        for (uint32_t n = 0; n < 256; ++n) {
+            uint32_t crc = n;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLY : crc >> 1;
+            }
+            slice[0][n] = crc;
+        }
+        for (uint32_t n = 0; n < 256; ++n) {
+            for (int k = 1; k < 8; ++k) {
+                slice[k][n] = (slice[k - 1][n] >> 8) ^ slice[0][slice[k - 1][n] & 0xff];
+            }
+        }
+    }
+
+    static const Crc32cTables& get() {
+        static const Crc32cTables tables;
+        return tables;
+    }
+};
+
+// Slice-by-8, any CPU. crc: of the data before, to go on from
+inline uint32_t crc32cSoftware(const char* data, size_t len, uint32_t crc = 0) {
+    const uint32_t (&t)[8][256] = Crc32cTables::get().slice;
+    const unsigned char* next = reinterpret_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len > 0 && reinterpret_cast<uintptr_t>(next) % 8 != 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *next++) & 0xff];
+        --len;
+    }
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        word ^= crc;
+        crc = t[7][word & 0xff] ^ t[6][(word >> 8) & 0xff] ^ t[5][(word >> 16) & 0xff] ^ t[4][(word >> 24) & 0xff] ^
+              t[3][(word >> 32) & 0xff] ^ t[2][(word >> 40) & 0xff] ^ t[1][(word >> 48) & 0xff] ^ t[0][word >> 56];
+        next += 8;
+        len -= 8;
+    }
+#endif
+    while (len > 0) {
+        crc = (crc >> 8) ^ t[0][(crc ^ *next++) & 0xff];
+        --len;
+    }
+    return ~crc;
+}
+
+
+#ifdef CRC32C_HARDWARE
+// The operator appending len zero bytes to a CRC (len a power of 2), as byte tables
+struct Crc32cShift {
+    uint32_t zeros[4][256];
+
+    explicit Crc32cShift(size_t len) {
+        uint32_t op[32];
+        zerosOperator(op, len);
+        for (uint32_t n = 0; n < 256; ++n) {
+            zeros[0][n] = times(op, n);
+            zeros[1][n] = times(op, n << 8);
+            zeros[2][n] = times(op, n << 16);
+            zeros[3][n] = times(op, n << 24);
+        }
+    }
+
+    uint32_t operator()(uint32_t crc) const {
+        return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+    }
+
+    private:
+        // Matrices over GF(2), a column per bit
+        static uint32_t times(const uint32_t* mat, uint32_t vec) {
+            uint32_t sum = 0;
+            for (; vec != 0; vec >>= 1, ++mat) {
+                if (vec & 1) sum ^= *mat;
+            }
+            return sum;
+        }
+
+        static void square(uint32_t* out, const uint32_t* mat) {
+            for (int n = 0; n < 32; ++n) {
+                out[n] = times(mat, mat[n]);
+            }
+        }
+
+        static void zerosOperator(uint32_t* even, size_t len) {
+            uint32_t odd[32];
+            odd[0] = CRC32C_POLY;   // one zero bit
+            for (int n = 1; n < 32; ++n) {
+                odd[n] = 1u << (n - 1);
+            }
+            square(even, odd);   // two
+            square(odd, even);   // four
+            // Squared once per bit of len, up from one byte
+            while (true) {
+                square(even, odd);
+                len >>= 1;
+                if (len == 0) return;
+                square(odd, even);
+                len >>= 1;
+                if (len == 0) break;
+            }
+            memcpy(even, odd, sizeof(odd));
+        }
+};
+
+// x^n mod P, bit-reflected like the CRC
+inline uint32_t crc32cPowerOfX(size_t n) {
+    uint32_t v = 0x80000000;
+    for (; n > 0; --n) {
+        v = v & 1 ? (v >> 1) ^ CRC32C_POLY : v >> 1;
+    }
+    return v;
+}
+
+// Multipliers folding a 16 byte lane forward by bits: for its low and high 8 bytes
+struct Crc32cFoldKey {
+    int low;
+    int high;
+
+    explicit Crc32cFoldKey(size_t bits)
+        : low(static_cast<int>(crc32cPowerOfX(bits + 31))), high(static_cast<int>(crc32cPowerOfX(bits - 33))) {}
+
+    // In every lane
+    CRC32C_FOLD_TARGET __m512i lanes() const {
+        return _mm512_setr_epi32(low, 0, high, 0, low, 0, high, 0, low, 0, high, 0, low, 0, high, 0);
+    }
+};
+
+inline bool crc32cFoldSupported() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuidex(info, 7, 0);
+    bool cpu = (info[1] & (1 << 16)) != 0 && (info[2] & (1 << 10)) != 0;   // AVX512F, VPCLMULQDQ
+    return cpu && (_xgetbv(0) & 0xe6) == 0xe6;                            // and the OS saves the registers
+#else
+    return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("vpclmulqdq");
+#endif
+}
+
+// Every lane of x times key (low and high 8 bytes, each by its multiplier), plus next
+CRC32C_FOLD_TARGET inline __m512i crc32cFoldLanes(__m512i x, __m512i key, __m512i next) {
+    return _mm512_ternarylogic_epi64(_mm512_clmulepi64_epi128(x, key, 0x00), _mm512_clmulepi64_epi128(x, key, 0x11), next, 0x96);
+}
+
+// crc32cFoldSupported() only. len a multiple of 256, at least 256. Takes and returns crc0 of crc32cHardware()
+CRC32C_FOLD_TARGET inline uint32_t crc32cFold(const char* data, size_t len, uint32_t crc0) {
+    static const Crc32cFoldKey by2048(2048), by512(512), by384(384), by256(256), by128(128);
+
+    __m512i x0 = _mm512_xor_si512(_mm512_loadu_si512(data), _mm512_maskz_mov_epi32(1, _mm512_set1_epi32(static_cast<int>(crc0))));
+    __m512i x1 = _mm512_loadu_si512(data + 64), x2 = _mm512_loadu_si512(data + 128), x3 = _mm512_loadu_si512(data + 192);
+    __m512i key = by2048.lanes();
+    for (size_t offset = 256; offset < len; offset += 256) {
+        x0 = crc32cFoldLanes(x0, key, _mm512_loadu_si512(data + offset));
+        x1 = crc32cFoldLanes(x1, key, _mm512_loadu_si512(data + offset + 64));
+        x2 = crc32cFoldLanes(x2, key, _mm512_loadu_si512(data + offset + 128));
+        x3 = crc32cFoldLanes(x3, key, _mm512_loadu_si512(data + offset + 192));
+    }
+
+    key = by512.lanes();
+    x1 = crc32cFoldLanes(x0, key, x1);
+    x2 = crc32cFoldLanes(x1, key, x2);
+    x3 = crc32cFoldLanes(x2, key, x3);
+
+    // The lanes of x3 onto its last one
+    key = _mm512_setr_epi32(by384.low, 0, by384.high, 0, by256.low, 0, by256.high, 0, by128.low, 0, by128.high, 0, 0, 0, 0, 0);
+    __m512i folded = _mm512_xor_si512(_mm512_clmulepi64_epi128(x3, key, 0x00), _mm512_clmulepi64_epi128(x3, key, 0x11));
+    __m128i last = _mm_xor_si128(_mm512_maskz_extracti32x4_epi32(0xf, x3, 3), _mm512_maskz_extracti32x4_epi32(0xf, folded, 0));
+    last = _mm_xor_si128(last, _mm512_maskz_extracti32x4_epi32(0xf, folded, 1));
+    last = _mm_xor_si128(last, _mm512_maskz_extracti32x4_epi32(0xf, folded, 2));
+
+    uint64_t crc = _mm_crc32_u64(0, static_cast<uint64_t>(_mm_cvtsi128_si64(last)));
+    return static_cast<uint32_t>(_mm_crc32_u64(crc, static_cast<uint64_t>(_mm_extract_epi64(last, 1))));
+}
+
+inline bool crc32cHardwareSupported() {
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 1);
+    return (info[2] & (1 << 20)) != 0;
+#else
+    return __builtin_cpu_supports("sse4.2");
+#endif
+}
+
+// SSE4.2 only, crc32cHardwareSupported(). Folds with AVX-512 where it can
+CRC32C_TARGET inline uint32_t crc32cHardware(const char* data, size_t len, uint32_t crc = 0) {
+    constexpr size_t LONG_BLOCK = 8192;
+    constexpr size_t SHORT_BLOCK = 256;
+    static const Crc32cShift shiftLong(LONG_BLOCK);
+    static const Crc32cShift shiftShort(SHORT_BLOCK);
+
+    const char* next = data;
+    uint64_t crc0 = ~crc;
+    while (len > 0 && reinterpret_cast<uintptr_t>(next) % 8 != 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), static_cast<unsigned char>(*next++));
+        --len;
+    }
+
+    static const bool foldable = crc32cFoldSupported();
+    if (foldable && len >= 256) {
+        size_t blocks = len / 256 * 256;
+        crc0 = crc32cFold(next, blocks, static_cast<uint32_t>(crc0));
+        next += blocks;
+        len -= blocks;
+    }
+
+    for (size_t block : {LONG_BLOCK, SHORT_BLOCK}) {
+        const Crc32cShift& shift = block == LONG_BLOCK ? shiftLong : shiftShort;
+        while (len >= block * 3) {
+            uint64_t crc1 = 0, crc2 = 0;
+            const char* end = next + block;
+            do {
+                uint64_t word0, word1, word2;
+                memcpy(&word0, next, 8);
+                memcpy(&word1, next + block, 8);
+                memcpy(&word2, next + block * 2, 8);
+                crc0 = _mm_crc32_u64(crc0, word0);
+                crc1 = _mm_crc32_u64(crc1, word1);
+                crc2 = _mm_crc32_u64(crc2, word2);
+                next += 8;
+            } while (next < end);
+            crc0 = shift(static_cast<uint32_t>(crc0)) ^ crc1;
+            crc0 = shift(static_cast<uint32_t>(crc0)) ^ crc2;
+            next += block * 2;
+            len -= block * 3;
+        }
+    }
+
+    while (len >= 8) {
+        uint64_t word;
+        memcpy(&word, next, 8);
+        crc0 = _mm_crc32_u64(crc0, word);
+        next += 8;
+        len -= 8;
+    }
+    while (len > 0) {
+        crc0 = _mm_crc32_u8(static_cast<uint32_t>(crc0), static_cast<unsigned char>(*next++));
+        --len;
+    }
+    return ~static_cast<uint32_t>(crc0);
+}
+#endif
+
+
+// crc: of the data before, to go on from
+inline uint32_t crc32c(const char* data, size_t len, uint32_t crc = 0) {
+#ifdef CRC32C_HARDWARE
+    static const bool hardware = crc32cHardwareSupported();
+    if (hardware) return crc32cHardware(data, len, crc);
+#endif
+    return crc32cSoftware(data, len, crc);
+}
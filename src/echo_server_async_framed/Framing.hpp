@@ -1,86 +1,406 @@
 #pragma once
 
+#include <algorithm>
 #include <cstdint>
+#include <cstring>
+#include <deque>
 #include <memory>
+#include <string>
 #include <vector>
+
+#ifdef _WIN32
 #include <winsock2.h>
-#include <queue>
-#include <cstdint>
+#else
+#include <arpa/inet.h>
+#endif
+
+#include "Crc32c.hpp"
+
 
+/*
+A decoded frame, a view of the decoder's memory: valid until FrameDecoder::release()
 
+The header is the payload length, big-endian. With CHECKSUM_FLAG set in it, the
+CRC-32C of the payload follows, big-endian too: the header is then
+HEADER_LEN + CHECKSUM_LEN bytes and the decoder verifies the payload (unless it
+passes checksums through). Lengths
+never come near that bit, a decoder that doesn't know the extension rejects such
+a frame as too large rather than misreading it.
+*/
 struct Frame {
-    static constexpr uint32_t MAX_FRAME_SIZE = 1048576;
+    static constexpr uint32_t MAX_FRAME_SIZE = 1048576;      // held whole
+    static constexpr uint32_t MAX_STREAM_SIZE = 1073741824;  // streamed in chunks, by decoders that stream
     static constexpr uint32_t HEADER_LEN = sizeof(uint32_t);
+    static constexpr uint32_t CHECKSUM_FLAG = 0x80000000;
+    static constexpr uint32_t CHECKSUM_LEN = sizeof(uint32_t);
 
-    uint32_t length;              // header (message length)
-    std::unique_ptr<char[]> data; // message
+    uint32_t length = 0;          // header (message length)
+    const char* data = nullptr;   // message
+    bool checked = false;         // had a checksum, and matched it (or wasn't verified, see FrameDecoder)
+};
 
-    Frame() = default;
+// What FrameDecoder::nextPart() returns, views as Frame's
+struct FramePart {
+    enum Type {
+        FRAME,          // a whole frame
+        STREAM_BEGIN,   // the header of a frame past MAX_FRAME_SIZE, its payload follows in chunks
+        STREAM_CHUNK
+    };
+    Type type = FRAME;
+    uint32_t length = 0;          // of the frame
+    const char* data = nullptr;   // FRAME: the payload, STREAM_CHUNK: this part of it
+    size_t len = 0;
+    bool last = false;            // STREAM_CHUNK: the end of the payload
+    bool checked = false;         // FRAME, last STREAM_CHUNK: the payload matched the header's checksum,
+    uint32_t checksum = 0;        //   STREAM_BEGIN: the header has one, the last chunk is checked against
+};
 
-    Frame(const char* src, uint32_t len): length(len), data(std::make_unique<char[]>(len)) {
-        memcpy(data.get(), src, len);
-    }
 
-    Frame(Frame&&) = default;
-    Frame& operator=(Frame&&) = default;
+/*
+Splits the received byte stream into frames without copying them out.
 
-    Frame(const Frame&) = delete;
-    Frame& operator=(const Frame&) = delete;
+Bytes go into a ring buffer, preferably straight from the socket: writable() is the
+contiguous free space to receive into, commit() the part that arrived. nextFrame()
+returns frames as views of the ring, and the space they take is reused only after
+release(). A frame whose payload runs past the end of the ring is the only one
+copied, into a spill buffer that is allocated once and then reused (release() in
+order means at most one such frame is held at a time).
 
-};
+The ring is allocated on first use and grows, to fit a frame up to MAX_FRAME_SIZE,
+only while no frame is held. Whenever it runs empty it starts over at its beginning,
+so frames that arrive whole and are handled right away don't wrap at all.
 
+A decoder constructed with a maxStreamSize streams larger frames up to it instead
+of holding them: nextPart() returns their header, then their payload in chunks of
+whatever is in the ring, the ring doesn't grow for them. Chunks are released like
+frames, so a ring full of unreleased chunks is backpressure: no writable() space,
+no recv, and the sender is held back by TCP. A frame over the limit fails the
+decoder, nothing more comes out of it and failed() says why.
 
+A frame with a checksum comes out only if its payload matches, checked while it's
+still in cache from the recv. A streamed one is checked chunk by chunk and can only
+fail at the end: its last chunk doesn't come out and the decoder fails, what was
+already passed on of it has to be dropped by the receiver.
+A decoder that only forwards payloads with their checksum (an echo) can pass the
+checksums through instead: checked then says the frame has one, in checksum, and
+whoever receives it at the other end verifies the payload. The CRC is the one cost
+per payload byte a verifying decoder has, the frame bench measures what it adds.
+*/
 class FrameDecoder {
 
     public:
+        static constexpr size_t DEFAULT_CAPACITY = 16384;
+
+        struct Space {
+            char* data;
+            size_t len;   // 0: full of frames not released yet, or of a frame too large
+        };
 
-        void feed(const char* data, size_t len) {
-            buffer.insert(buffer.end(), data, data + len);
+        // maxStreamSize: frames past MAX_FRAME_SIZE up to this are streamed, 0 for none.
+        // verifyChecksums false: checksums are passed through, not checked
+        explicit FrameDecoder(size_t capacity = DEFAULT_CAPACITY, uint32_t maxStreamSize = 0, bool verifyChecksums = true)
+            : capacity_(std::max<size_t>(capacity, Frame::HEADER_LEN + Frame::CHECKSUM_LEN)), maxStreamSize_(maxStreamSize),
+              verify_(verifyChecksums) {}
+
+        FrameDecoder(const FrameDecoder&) = delete;
+        FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+        Space writable() {
+            if (!ring_) {
+                ring_ = std::make_unique<char[]>(capacity_);
+            }
+            size_t used = static_cast<size_t>(tail_ - head_);
+            if (used == capacity_ && !grow()) {
+                return {nullptr, 0};
+            }
+            size_t tailPos = position(tail_);
+            size_t end = used != 0 && position(head_) > tailPos ? position(head_) : capacity_;
+            return {ring_.get() + tailPos, end - tailPos};
+        }
+
+        void commit(size_t len) {
+            tail_ += len;
         }
 
+        // Whole frames only, for decoders that don't stream
         bool nextFrame(Frame& outFrame) {
-            if (buffer.size() < Frame::HEADER_LEN) return false;
-
-            uint32_t len = 0;
-            memcpy(&len, buffer.data(), Frame::HEADER_LEN);
-            len = ntohl(len);
-            
-            if (len > Frame::MAX_FRAME_SIZE) return false;
-            if (buffer.size() < Frame::HEADER_LEN + len) return false;
-
-            Frame tmp = Frame(buffer.data() + Frame::HEADER_LEN, len);
-            outFrame = std::move(tmp);
-            buffer.erase(buffer.begin(), buffer.begin() + Frame::HEADER_LEN + len);
+            FramePart part;
+            if (!nextPart(part)) return false;
+            outFrame.length = part.length;
+            outFrame.data = part.data;
+            outFrame.checked = part.checked;
+            return true;
+        }
+
+        bool nextPart(FramePart& outPart) {
+            if (failed_) return false;
+            if (streamLeft_ > 0) {
+                if (tail_ == read_) return false;
+                size_t pos = position(read_);
+                size_t len = std::min({static_cast<size_t>(tail_ - read_), capacity_ - pos, static_cast<size_t>(streamLeft_)});
+                const char* data = ring_.get() + pos;
+                bool last = len == streamLeft_;
+                if (streamChecked_ && verify_) {
+                    streamCrc_ = crc32c(data, len, streamCrc_);
+                    if (last && streamCrc_ != streamChecksum_) {
+                        failChecksum();
+                        return false;
+                    }
+                }
+                streamLeft_ -= static_cast<uint32_t>(len);
+                read_ += len;
+                outPart.type = FramePart::STREAM_CHUNK;
+                outPart.length = streamLength_;
+                outPart.data = data;
+                outPart.len = len;
+                outPart.last = last;
+                outPart.checked = last && streamChecked_;
+                outPart.checksum = streamChecksum_;
+                return true;
+            }
+
+            if (tail_ - read_ < Frame::HEADER_LEN) return false;
+
+            uint32_t header = peekWord(read_);
+            uint32_t len = header & ~Frame::CHECKSUM_FLAG;
+            bool checked = (header & Frame::CHECKSUM_FLAG) != 0;
+            uint32_t headerLen = checked ? Frame::HEADER_LEN + Frame::CHECKSUM_LEN : Frame::HEADER_LEN;
+            if (len > Frame::MAX_FRAME_SIZE && len > maxStreamSize_) {
+                failed_ = true;
+                rejectedLength_ = len;
+                return false;
+            }
+            if (tail_ - read_ < headerLen) return false;
+            uint32_t checksum = checked ? peekWord(read_ + Frame::HEADER_LEN) : 0;
+
+            outPart.checked = checked;
+            outPart.checksum = checksum;
+            if (len > Frame::MAX_FRAME_SIZE) {
+                read_ += headerLen;
+                streamLength_ = streamLeft_ = len;
+                streamChecked_ = checked;
+                streamChecksum_ = checksum;
+                streamCrc_ = 0;
+                outPart.type = FramePart::STREAM_BEGIN;
+                outPart.length = len;
+                outPart.data = nullptr;
+                outPart.len = 0;
+                outPart.last = false;
+                return true;
+            }
+            if (tail_ - read_ < headerLen + len) return false;
+
+            uint64_t payload = read_ + headerLen;
+            size_t payloadPos = position(payload);
+            outPart.type = FramePart::FRAME;
+            outPart.length = len;
+            outPart.len = len;
+            outPart.last = true;
+            if (payloadPos + len <= capacity_) {
+                outPart.data = ring_.get() + payloadPos;
+            } else {
+                if (spillCapacity_ < len) {
+                    spill_ = std::make_unique<char[]>(len);
+                    spillCapacity_ = len;
+                }
+                copyOut(payload, spill_.get(), len);
+                outPart.data = spill_.get();
+            }
+            if (checked && verify_ && crc32c(outPart.data, len) != checksum) {
+                failChecksum();
+                return false;
+            }
+            read_ = payload + len;
             return true;
         }
 
+        // A frame was over the limit, its length then, or didn't match its checksum
+        bool failed() const { return failed_; }
+        uint32_t rejectedLength() const { return rejectedLength_; }
+        bool checksumMismatch() const { return checksumMismatch_; }
+
+        // Stream offset past the last frame returned, for release(mark)
+        uint64_t mark() const { return read_; }
+
+        // Frames returned so far are done with, their space can be received into again
+        void release() { release(read_); }
+
+        // The frames returned before mark() was mark are done with
+        void release(uint64_t mark) {
+            head_ = std::max(head_, mark);
+            if (head_ == tail_) {
+                // Empty, start over at the beginning of the ring
+                head_ = read_ = tail_ = boundary(tail_, capacity_);
+            }
+        }
+
+        // Some returned frames aren't released yet
+        bool holding() const { return head_ != read_; }
+
+        // Bytes received but not returned as a frame yet
+        size_t buffered() const { return static_cast<size_t>(tail_ - read_); }
+
     private:
-        std::vector<char> buffer;
+        size_t position(uint64_t offset) const { return static_cast<size_t>(offset % capacity_); }
+
+        // First offset from offset on that starts a ring of capacity. Offsets only ever
+        // grow, so a mark taken earlier never points past the head
+        static uint64_t boundary(uint64_t offset, size_t capacity) {
+            return (offset + capacity - 1) / capacity * capacity;
+        }
+
+        void copyOut(uint64_t offset, char* dst, size_t len) const {
+            size_t pos = position(offset);
+            size_t first = std::min(len, capacity_ - pos);
+            memcpy(dst, ring_.get() + pos, first);
+            memcpy(dst + first, ring_.get(), len - first);
+        }
+
+        uint32_t peekWord(uint64_t offset) const {
+            uint32_t word = 0;
+            copyOut(offset, reinterpret_cast<char*>(&word), sizeof(word));
+            return ntohl(word);
+        }
+
+        void failChecksum() {
+            failed_ = true;
+            checksumMismatch_ = true;
+        }
+
+        // Full: room for the frame at read_ if it's larger than the ring and nothing is held.
+        // Streamed frames go through the ring as it is
+        bool grow() {
+            if (head_ != read_ || streamLeft_ > 0 || failed_) return false;
+            uint32_t header = peekWord(read_);
+            uint32_t len = header & ~Frame::CHECKSUM_FLAG;
+            size_t frameLen = (header & Frame::CHECKSUM_FLAG ? Frame::HEADER_LEN + Frame::CHECKSUM_LEN : Frame::HEADER_LEN) + size_t(len);
+            if (len > Frame::MAX_FRAME_SIZE || frameLen <= capacity_) return false;
+
+            size_t capacity = capacity_ * 2;
+            while (capacity < frameLen) capacity *= 2;
+            auto ring = std::make_unique<char[]>(capacity);
+            size_t used = static_cast<size_t>(tail_ - head_);
+            copyOut(head_, ring.get(), used);
+            ring_ = std::move(ring);
+            capacity_ = capacity;
+            head_ = read_ = boundary(tail_, capacity);
+            tail_ = head_ + used;
+            return true;
+        }
+
+        std::unique_ptr<char[]> ring_;
+        size_t capacity_;
+        // Stream offsets, released <= read <= received
+        uint64_t head_ = 0;
+        uint64_t read_ = 0;
+        uint64_t tail_ = 0;
+
+        std::unique_ptr<char[]> spill_;
+        size_t spillCapacity_ = 0;
+
+        uint32_t maxStreamSize_;
+        bool verify_;
+        uint32_t streamLength_ = 0;
+        uint32_t streamLeft_ = 0;    // payload bytes of the streamed frame not returned yet
+        bool streamChecked_ = false;
+        uint32_t streamChecksum_ = 0;
+        uint32_t streamCrc_ = 0;     // of the chunks returned so far
+        bool failed_ = false;
+        uint32_t rejectedLength_ = 0;
+        bool checksumMismatch_ = false;
 };
 
 
+/*
+Frames to go out together in one gather send. Each frame is its header, encoded here,
+and the payload as given, which isn't copied and has to stay valid until the send
+completes, or handed over as a string the encoder keeps until clear(). A streamed
+frame is its header and then its payload in as many pieces as it comes in.
+addChecked() puts the payload's CRC-32C in the header, one already known (an echo,
+a streamed payload) goes in with addHeader().
+*/
 class FrameEncoder {
-public:
-    FrameEncoder() {}
-
-    void feed(const char* data, size_t len) {
-        std::vector<char> frame(Frame::HEADER_LEN + len);
-        uint32_t netLen = htonl(static_cast<uint32_t>(len));
-        memcpy(frame.data(), &netLen, Frame::HEADER_LEN);
-        memcpy(frame.data() + Frame::HEADER_LEN, data, len);
-        frames.push(std::move(frame));
-    }
-
-    bool hasNext() const {
-        return !frames.empty();
-    }
-
-    std::vector<char> next() {
-        std::vector<char> out = std::move(frames.front());
-        frames.pop();
-        return out;
-    }
-
-private:
-    std::queue<std::vector<char>> frames;
-};
\ No newline at end of file
+
+    public:
+        struct Segment {
+            const char* data;
+            size_t len;
+        };
+
+        void add(const char* data, uint32_t len) {
+            addHeader(len);
+            addData(data, len);
+        }
+
+        void add(std::string payload) {
+            owned.push_back(std::move(payload));
+            add(owned.back().data(), static_cast<uint32_t>(owned.back().size()));
+        }
+
+        void addChecked(const char* data, uint32_t len) {
+            addHeader(len, crc32c(data, len));
+            addData(data, len);
+        }
+
+        void addHeader(uint32_t len) {
+            headers.push_back(htonl(len));
+            parts.push_back({nullptr, headers.size() - 1, Frame::HEADER_LEN});
+            byteCount += Frame::HEADER_LEN;
+            ++frameCount;
+        }
+
+        void addHeader(uint32_t len, uint32_t checksum) {
+            headers.push_back(htonl(len | Frame::CHECKSUM_FLAG));
+            headers.push_back(htonl(checksum));
+            parts.push_back({nullptr, headers.size() - 2, Frame::HEADER_LEN + Frame::CHECKSUM_LEN});
+            byteCount += Frame::HEADER_LEN + Frame::CHECKSUM_LEN;
+            ++frameCount;
+        }
+
+        void addData(const char* data, size_t len) {
+            if (len != 0) {
+                parts.push_back({data, len, 0});
+                byteCount += len;
+            }
+        }
+
+        bool empty() const { return parts.empty(); }
+        size_t frames() const { return frameCount; }
+        size_t bytes() const { return byteCount; }
+
+        // Header and payload segments in order. Valid until the next add or clear()
+        const std::vector<Segment>& segments() {
+            segmentList.clear();
+            for (const Part& part : parts) {
+                if (part.data == nullptr) {
+                    segmentList.push_back({reinterpret_cast<const char*>(&headers[part.len]), part.headerLen});
+                } else {
+                    segmentList.push_back({part.data, part.len});
+                }
+            }
+            return segmentList;
+        }
+
+        void clear() {
+            headers.clear();
+            parts.clear();
+            segmentList.clear();
+            owned.clear();
+            byteCount = 0;
+            frameCount = 0;
+        }
+
+    private:
+        struct Part {
+            const char* data;   // nullptr: the header at index len
+            size_t len;
+            size_t headerLen;
+        };
+
+        std::vector<uint32_t> headers;  // network order
+        std::vector<Part> parts;
+        std::vector<Segment> segmentList;
+        std::deque<std::string> owned;  // doesn't move its strings as it grows
+        size_t byteCount = 0;
+        size_t frameCount = 0;
+};
@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+
+#include "Framing.hpp"
+
+
+/*
+RPC on top of the framing: every frame's payload starts with an RpcHeader and the
+request or response body follows.
+
+A request carries an id its client picked and the method to call, the response
+comes back with the same id (and a status). Nothing ties a response to the order
+of the requests, so a client can keep any number of calls in flight on one
+connection and the server can answer them as they finish, on whichever thread.
+*/
+struct RpcHeader {
+    static constexpr uint32_t LEN = 8;
+
+    uint32_t requestId = 0;
+    uint16_t method = 0;
+    uint16_t status = 0;   // responses, RpcStatus
+
+    void encode(char* out) const {
+        uint32_t netId = htonl(requestId);
+        uint16_t netMethod = htons(method);
+        uint16_t netStatus = htons(status);
+        memcpy(out, &netId, 4);
+        memcpy(out + 4, &netMethod, 2);
+        memcpy(out + 6, &netStatus, 2);
+    }
+
+    // false if the payload is too short to have one
+    static bool decode(const char* payload, size_t len, RpcHeader& out) {
+        if (len < LEN) return false;
+        uint32_t netId;
+        uint16_t netMethod, netStatus;
+        memcpy(&netId, payload, 4);
+        memcpy(&netMethod, payload + 4, 2);
+        memcpy(&netStatus, payload + 6, 2);
+        out.requestId = ntohl(netId);
+        out.method = ntohs(netMethod);
+        out.status = ntohs(netStatus);
+        return true;
+    }
+
+    // Frame payload: this header and body
+    std::string payload(std::string_view body) const {
+        std::string out(LEN + body.size(), '\0');
+        encode(out.data());
+        memcpy(out.data() + LEN, body.data(), body.size());
+        return out;
+    }
+};
+
+enum RpcStatus : uint16_t {
+    RPC_OK = 0,
+    RPC_UNKNOWN_METHOD = 1,
+    RPC_DROPPED = 2      // the handler let go of its reply, or the connection ended first
+};
+
+
+// The connection replies go out on. Every RpcReply handed out retain()s it once and
+// ends in exactly one send(), which may come from any thread at any time
+class RpcSink {
+
+    public:
+        virtual ~RpcSink() = default;
+
+        virtual void retain() = 0;
+        virtual void send(const RpcHeader& header, std::string body) = 0;
+};
+
+
+// The answer a handler owes, move-only. One dropped without send() answers RPC_DROPPED
+class RpcReply {
+
+    public:
+        RpcReply(RpcSink* sink, uint32_t requestId, uint16_t method) : sink_(sink), requestId_(requestId), method_(method) {
+            sink_->retain();
+        }
+        ~RpcReply() {
+            if (sink_ != nullptr) send({}, RPC_DROPPED);
+        }
+
+        RpcReply(RpcReply&& other) noexcept
+            : sink_(std::exchange(other.sink_, nullptr)), requestId_(other.requestId_), method_(other.method_) {}
+        RpcReply& operator=(RpcReply&& other) noexcept {
+            if (this != &other) {
+                if (sink_ != nullptr) send({}, RPC_DROPPED);
+                sink_ = std::exchange(other.sink_, nullptr);
+                requestId_ = other.requestId_;
+                method_ = other.method_;
+            }
+            return *this;
+        }
+
+        RpcReply(const RpcReply&) = delete;
+        RpcReply& operator=(const RpcReply&) = delete;
+
+        void send(std::string body, uint16_t status = RPC_OK) {
+            RpcSink* sink = std::exchange(sink_, nullptr);
+            if (sink != nullptr) {
+                sink->send(RpcHeader{requestId_, method_, status}, std::move(body));
+            }
+        }
+
+        uint32_t requestId() const { return requestId_; }
+
+    private:
+        RpcSink* sink_;
+        uint32_t requestId_;
+        uint16_t method_;
+};
+
+
+/*
+Handlers by method id. A handler gets the request body, a view valid only during
+the call, and the reply: sent right away, or moved elsewhere (another thread, a
+queue) and sent when the answer is ready.
+*/
+class RpcRegistry {
+
+    public:
+        using Handler = std::function<void(std::string_view body, RpcReply reply)>;
+
+        void add(uint16_t method, Handler handler) {
+            handlers_[method] = std::move(handler);
+        }
+
+        // One request frame. false if it isn't one, the connection can't be trusted then
+        bool dispatch(const char* payload, size_t len, RpcSink* sink) const {
+            RpcHeader header;
+            if (!RpcHeader::decode(payload, len, header)) return false;
+
+            RpcReply reply(sink, header.requestId, header.method);
+            auto found = handlers_.find(header.method);
+            if (found == handlers_.end()) {
+                reply.send({}, RPC_UNKNOWN_METHOD);
+                return true;
+            }
+            found->second(std::string_view(payload + RpcHeader::LEN, len - RpcHeader::LEN), std::move(reply));
+            return true;
+        }
+
+    private:
+        std::unordered_map<uint16_t, Handler> handlers_;
+};
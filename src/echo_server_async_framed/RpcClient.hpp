@@ -0,0 +1,183 @@
+#pragma once
+
+#include <algorithm>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Framing.hpp"
+#include "Rpc.hpp"
+
+
+/*
+Client end of Rpc.hpp on one connected socket (blocking), any number of calls in flight.
+
+call() doesn't wait, from any thread: the request gets the next id and goes into the
+outgoing buffer, and the callback into the pending calls. A writer thread sends
+whatever has piled up in one send, the reader thread decodes responses, finds their
+call by id and runs its callback. So calls complete in the order the server answers
+them, and a callback may call() again. Calls still pending when the connection ends
+get RPC_DROPPED.
+*/
+class RpcClient {
+
+    public:
+#ifdef _WIN32
+        using Socket = SOCKET;
+#else
+        using Socket = int;
+#endif
+        using Callback = std::function<void(uint16_t status, std::string_view body)>;
+
+        explicit RpcClient(Socket socket) : socket_(socket) {
+            reader_ = std::thread([this] { readLoop(); });
+            writer_ = std::thread([this] { writeLoop(); });
+        }
+
+        ~RpcClient() {
+            close();
+            reader_.join();
+            writer_.join();
+        }
+
+        RpcClient(const RpcClient&) = delete;
+        RpcClient& operator=(const RpcClient&) = delete;
+
+        // false if the connection is closed, the callback is not called then
+        bool call(uint16_t method, std::string_view body, Callback callback) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_) return false;
+            RpcHeader header{nextId_++, method, 0};
+            uint32_t netLen = htonl(static_cast<uint32_t>(RpcHeader::LEN + body.size()));
+            size_t offset = outgoing_.size();
+            outgoing_.resize(offset + Frame::HEADER_LEN + RpcHeader::LEN + body.size());
+            memcpy(outgoing_.data() + offset, &netLen, Frame::HEADER_LEN);
+            header.encode(outgoing_.data() + offset + Frame::HEADER_LEN);
+            memcpy(outgoing_.data() + offset + Frame::HEADER_LEN + RpcHeader::LEN, body.data(), body.size());
+            pending_.emplace(header.requestId, std::move(callback));
+            writable_.notify_one();
+            return true;
+        }
+
+        // Ends the connection, the threads finish on their own
+        void close() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (closed_) return;
+            closed_ = true;
+#ifdef _WIN32
+            shutdown(socket_, SD_BOTH);
+#else
+            shutdown(socket_, SHUT_RDWR);
+#endif
+            writable_.notify_one();
+        }
+
+        size_t inFlight() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return pending_.size();
+        }
+
+    private:
+        void writeLoop() {
+            std::vector<char> sending;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                writable_.wait(lock, [this] { return closed_ || !outgoing_.empty(); });
+                if (closed_) break;
+                std::swap(sending, outgoing_);
+                lock.unlock();
+                bool ok = sendAll(sending.data(), sending.size());
+                sending.clear();
+                lock.lock();
+                if (!ok) break;
+            }
+            lock.unlock();
+            close();
+        }
+
+        void readLoop() {
+            FrameDecoder decoder;
+            Frame frame;
+            RpcHeader header;
+            while (true) {
+                FrameDecoder::Space space = decoder.writable();
+                if (space.len == 0) break;
+#ifdef _WIN32
+                int got = recv(socket_, space.data, static_cast<int>(space.len), 0);
+#else
+                ssize_t got = recv(socket_, space.data, space.len, 0);
+#endif
+                if (got <= 0) break;
+                decoder.commit(static_cast<size_t>(got));
+                while (decoder.nextFrame(frame)) {
+                    if (!RpcHeader::decode(frame.data, frame.length, header)) {
+                        decoder.release();
+                        close();
+                        failPending();
+                        return;
+                    }
+                    Callback callback;
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        auto found = pending_.find(header.requestId);
+                        if (found == pending_.end()) continue;
+                        callback = std::move(found->second);
+                        pending_.erase(found);
+                    }
+                    callback(header.status, std::string_view(frame.data + RpcHeader::LEN, frame.length - RpcHeader::LEN));
+                }
+                decoder.release();
+            }
+            close();
+            failPending();
+        }
+
+        void failPending() {
+            std::unordered_map<uint32_t, Callback> pending;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                pending.swap(pending_);
+            }
+            for (auto& [id, callback] : pending) {
+                callback(RPC_DROPPED, {});
+            }
+        }
+
+        bool sendAll(const char* data, size_t len) {
+            while (len > 0) {
+#ifdef _WIN32
+                int sent = ::send(socket_, data, static_cast<int>(std::min<size_t>(len, INT_MAX)), 0);
+#else
+                ssize_t sent = ::send(socket_, data, len, MSG_NOSIGNAL);
+#endif
+                if (sent <= 0) return false;
+                data += sent;
+                len -= static_cast<size_t>(sent);
+            }
+            return true;
+        }
+
+        Socket socket_;
+        std::thread reader_;
+        std::thread writer_;
+
+        std::mutex mutex_;
+        std::condition_variable writable_;
+        std::vector<char> outgoing_;   // encoded requests not sent yet
+        std::unordered_map<uint32_t, Callback> pending_;
+        uint32_t nextId_ = 0;
+        bool closed_ = false;
+};
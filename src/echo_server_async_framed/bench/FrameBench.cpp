@@ -0,0 +1,531 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <climits>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#endif
+
+#include "Framing.hpp"
+
+/*
+Single core frames/sec of the ring buffer FrameDecoder vs. the old vector based one,
+for 16 B, 1 KB and 64 KB frames arriving in 4 KB and 64 KB recvs.
+Then (not on Windows) the echo path over a socketpair: the old encoder copy and 4 KB
+chunked sends per frame vs. one gather send per recv, frames/sec and sends per frame.
+First of all a single frame of streamMB is echoed through a streaming decoder, with
+the growth of peak RSS it takes.
+Last CRC-32C MB/s, slice-by-8 and hardware, and the echo of 64 KB frames recv'd from
+a socketpair with and without a checksum to verify.
+The old decoder and encoder are kept here as-is only for comparison.
+*/
+
+struct LegacyFrame {
+    uint32_t length;
+    std::unique_ptr<char[]> data;
+
+    LegacyFrame() = default;
+
+    LegacyFrame(const char* src, uint32_t len): length(len), data(std::make_unique<char[]>(len)) {
+        memcpy(data.get(), src, len);
+    }
+};
+
+class LegacyFrameDecoder {
+
+    public:
+
+        void feed(const char* data, size_t len) {
+            buffer.insert(buffer.end(), data, data + len);
+        }
+
+        bool nextFrame(LegacyFrame& outFrame) {
+            if (buffer.size() < Frame::HEADER_LEN) return false;
+
+            uint32_t len = 0;
+            memcpy(&len, buffer.data(), Frame::HEADER_LEN);
+            len = ntohl(len);
+
+            if (len > Frame::MAX_FRAME_SIZE) return false;
+            if (buffer.size() < Frame::HEADER_LEN + len) return false;
+
+            LegacyFrame tmp = LegacyFrame(buffer.data() + Frame::HEADER_LEN, len);
+            outFrame = std::move(tmp);
+            buffer.erase(buffer.begin(), buffer.begin() + Frame::HEADER_LEN + len);
+            return true;
+        }
+
+    private:
+        std::vector<char> buffer;
+};
+
+
+class LegacyFrameEncoder {
+public:
+    LegacyFrameEncoder() {}
+
+    void feed(const char* data, size_t len) {
+        std::vector<char> frame(Frame::HEADER_LEN + len);
+        uint32_t netLen = htonl(static_cast<uint32_t>(len));
+        memcpy(frame.data(), &netLen, Frame::HEADER_LEN);
+        memcpy(frame.data() + Frame::HEADER_LEN, data, len);
+        frames.push(std::move(frame));
+    }
+
+    bool hasNext() const {
+        return !frames.empty();
+    }
+
+    std::vector<char> next() {
+        std::vector<char> out = std::move(frames.front());
+        frames.pop();
+        return out;
+    }
+
+private:
+    std::queue<std::vector<char>> frames;
+};
+
+
+// frameSize frames back to back, about totalBytes of them. checked: with the checksum extension
+static std::vector<char> makeStream(size_t frameSize, size_t totalBytes, bool checked = false) {
+    size_t headerLen = checked ? Frame::HEADER_LEN + Frame::CHECKSUM_LEN : Frame::HEADER_LEN;
+    size_t frames = std::max<size_t>(1, totalBytes / (frameSize + headerLen));
+    std::vector<char> stream;
+    stream.reserve(frames * (frameSize + headerLen));
+    uint32_t netLen = htonl(static_cast<uint32_t>(frameSize) | (checked ? Frame::CHECKSUM_FLAG : 0));
+    std::vector<char> payload(frameSize);
+    for (size_t i = 0; i < frames; ++i) {
+        std::fill(payload.begin(), payload.end(), static_cast<char>('a' + i % 26));
+        const char* header = reinterpret_cast<const char*>(&netLen);
+        stream.insert(stream.end(), header, header + Frame::HEADER_LEN);
+        if (checked) {
+            uint32_t netChecksum = htonl(crc32c(payload.data(), payload.size()));
+            const char* checksum = reinterpret_cast<const char*>(&netChecksum);
+            stream.insert(stream.end(), checksum, checksum + Frame::CHECKSUM_LEN);
+        }
+        stream.insert(stream.end(), payload.begin(), payload.end());
+    }
+    return stream;
+}
+
+
+template <typename Func>
+static void runBench(const std::string& name, size_t bytes, Func&& func) {
+    auto start = std::chrono::steady_clock::now();
+    size_t sink = 0;
+    size_t frames = func(sink);
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << static_cast<size_t>(static_cast<double>(frames) / seconds) << " frames/s, "
+              << static_cast<size_t>(static_cast<double>(bytes) / seconds / 1048576) << " MB/s ("
+              << seconds << " s, sink " << sink << ")" << std::endl;
+}
+
+
+#ifndef _WIN32
+// Writes everything, true if it did. Counts the calls
+static bool writeAll(int fd, struct iovec* iov, size_t count, size_t& calls) {
+    while (count > 0) {
+        ++calls;
+        ssize_t written = writev(fd, iov, static_cast<int>(std::min<size_t>(count, IOV_MAX)));
+        if (written < 0) return false;
+        size_t left = static_cast<size_t>(written);
+        while (count > 0 && left >= iov->iov_len) {
+            left -= iov->iov_len;
+            ++iov;
+            --count;
+        }
+        if (count > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+            iov->iov_len -= left;
+        }
+    }
+    return true;
+}
+
+// Decodes the stream in 64 KB recvs and echoes it into a socketpair drained by another thread
+template <typename Echo>
+static void runEcho(const std::string& name, Echo&& echo) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "socketpair failed" << std::endl;
+        return;
+    }
+    std::thread drain([fd = fds[1]] {
+        std::vector<char> buffer(1 << 18);
+        while (read(fd, buffer.data(), buffer.size()) > 0) {}
+    });
+
+    constexpr size_t RECV_SIZE = 65536;
+    size_t frames = 0;
+    size_t calls = 0;
+    auto start = std::chrono::steady_clock::now();
+    echo(fds[0], RECV_SIZE, frames, calls);
+    auto end = std::chrono::steady_clock::now();
+    close(fds[0]);
+    drain.join();
+    close(fds[1]);
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << static_cast<size_t>(static_cast<double>(frames) / seconds) << " frames/s, "
+              << static_cast<double>(calls) / static_cast<double>(frames) << " sends per frame (" << seconds << " s)" << std::endl;
+}
+
+static long peakRssKB() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// One frame of streamMB echoed as it streams in, sender and reader on their own threads
+static void benchStream(size_t streamMB) {
+    uint32_t length = static_cast<uint32_t>(std::min<size_t>(streamMB * 1048576, Frame::MAX_STREAM_SIZE));
+    int in[2], out[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, out) != 0) {
+        std::cerr << "socketpair failed" << std::endl;
+        return;
+    }
+    long rssBefore = peakRssKB();
+
+    std::thread sender([fd = in[1], length] {
+        std::vector<char> block(65536);
+        for (size_t i = 0; i < block.size(); ++i) block[i] = static_cast<char>(i * 31);
+        uint32_t netLen = htonl(length);
+        size_t calls = 0;
+        struct iovec header = {&netLen, Frame::HEADER_LEN};
+        writeAll(fd, &header, 1, calls);
+        for (size_t sent = 0; sent < length; sent += block.size()) {
+            struct iovec iov = {block.data(), std::min(block.size(), length - sent)};
+            if (!writeAll(fd, &iov, 1, calls)) break;
+        }
+    });
+    size_t echoed = 0;
+    std::thread reader([fd = out[1], &echoed] {
+        std::vector<char> buffer(65536);
+        ssize_t got;
+        while ((got = read(fd, buffer.data(), buffer.size())) > 0) echoed += static_cast<size_t>(got);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    FrameDecoder decoder(FrameDecoder::DEFAULT_CAPACITY, Frame::MAX_STREAM_SIZE);
+    FrameEncoder encoder;
+    FramePart part;
+    std::vector<struct iovec> iov;
+    size_t calls = 0;
+    bool done = false;
+    while (!done) {
+        FrameDecoder::Space space = decoder.writable();
+        ssize_t got = read(in[0], space.data, space.len);
+        if (got <= 0) break;
+        decoder.commit(static_cast<size_t>(got));
+        while (decoder.nextPart(part)) {
+            if (part.type == FramePart::STREAM_BEGIN) {
+                encoder.addHeader(part.length);
+            } else {
+                encoder.addData(part.data, part.len);
+                done = part.last;
+            }
+        }
+        iov.clear();
+        for (const FrameEncoder::Segment& segment : encoder.segments()) {
+            iov.push_back({const_cast<char*>(segment.data), segment.len});
+        }
+        if (!writeAll(out[0], iov.data(), iov.size(), calls)) break;
+        encoder.clear();
+        decoder.release();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    sender.join();
+    close(out[0]);
+    reader.join();
+    close(in[0]);
+    close(in[1]);
+    close(out[1]);
+
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << "stream " << length / 1048576 << " MB frame: " << (echoed == length + Frame::HEADER_LEN ? "echoed" : "FAILED")
+              << ", " << static_cast<size_t>(static_cast<double>(length) / seconds / 1048576) << " MB/s, peak RSS +"
+              << peakRssKB() - rssBefore << " KB (" << seconds << " s)" << std::endl;
+}
+
+static double threadCpuSeconds() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return static_cast<double>(ts.tv_sec) + static_cast<double>(ts.tv_nsec) / 1e9;
+}
+
+struct EchoRate {
+    double wall;   // frames/s
+    double cpu;    // frames per second of the echoing thread's CPU time, sender and reader left out
+};
+
+// The stream sent repeats times into one socketpair, recv'd into the decoder and echoed
+// into another as the server does, frames with a checksum echoed with it, verified or not
+static EchoRate echoThrough(const std::vector<char>& stream, size_t repeats, bool verify, size_t& echoedFrames) {
+    int in[2], out[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0 || socketpair(AF_UNIX, SOCK_STREAM, 0, out) != 0) {
+        std::cerr << "socketpair failed" << std::endl;
+        return {0, 0};
+    }
+    std::thread sender([fd = in[1], &stream, repeats] {
+        size_t calls = 0;
+        for (size_t repeat = 0; repeat < repeats; ++repeat) {
+            for (size_t sent = 0; sent < stream.size(); sent += 65536) {
+                struct iovec iov = {const_cast<char*>(stream.data()) + sent, std::min<size_t>(65536, stream.size() - sent)};
+                if (!writeAll(fd, &iov, 1, calls)) break;
+            }
+        }
+        shutdown(fd, SHUT_WR);
+    });
+    std::thread drain([fd = out[1]] {
+        std::vector<char> buffer(1 << 18);
+        while (read(fd, buffer.data(), buffer.size()) > 0) {}
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    double cpuStart = threadCpuSeconds();
+    FrameDecoder decoder(FrameDecoder::DEFAULT_CAPACITY, 0, verify);
+    FrameEncoder encoder;
+    FramePart part;
+    std::vector<struct iovec> iov;
+    size_t frames = 0;
+    size_t calls = 0;
+    while (true) {
+        FrameDecoder::Space space = decoder.writable();
+        ssize_t got = read(in[0], space.data, space.len);
+        if (got <= 0) break;
+        decoder.commit(static_cast<size_t>(got));
+        while (decoder.nextPart(part)) {
+            if (part.checked) {
+                encoder.addHeader(part.length, part.checksum);
+                encoder.addData(part.data, part.len);
+            } else {
+                encoder.add(part.data, part.length);
+            }
+        }
+        if (decoder.failed()) break;
+        if (!encoder.empty()) {
+            iov.clear();
+            for (const FrameEncoder::Segment& segment : encoder.segments()) {
+                iov.push_back({const_cast<char*>(segment.data), segment.len});
+            }
+            if (!writeAll(out[0], iov.data(), iov.size(), calls)) break;
+            frames += encoder.frames();
+            encoder.clear();
+        }
+        decoder.release();
+    }
+    double cpu = threadCpuSeconds() - cpuStart;
+    auto end = std::chrono::steady_clock::now();
+
+    sender.join();
+    close(out[0]);
+    drain.join();
+    close(in[0]);
+    close(in[1]);
+    close(out[1]);
+    echoedFrames = frames;
+    double wall = std::chrono::duration<double>(end - start).count();
+    return {static_cast<double>(frames) / wall, static_cast<double>(frames) / cpu};
+}
+
+// CRC-32C speed, and what checksums cost the echo of 64 KB frames: verified as RPC mode
+// does, and passed through as the echo does
+static void benchChecksum(size_t totalMB) {
+    std::vector<char> block(65536);
+    for (size_t i = 0; i < block.size(); ++i) block[i] = static_cast<char>(i * 31);
+    size_t rounds = std::max<size_t>(1, totalMB * 1048576 / block.size());
+    auto crcRate = [&](uint32_t (*crc)(const char*, size_t, uint32_t)) {
+        uint32_t sum = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < rounds; ++i) sum += crc(block.data(), block.size(), sum);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        return std::to_string(static_cast<size_t>(static_cast<double>(rounds * block.size()) / seconds / 1048576)) + " MB/s (sink " +
+               std::to_string(sum) + ")";
+    };
+    std::cout << "crc32c slice-by-8: " << crcRate(crc32cSoftware) << std::endl;
+#ifdef CRC32C_HARDWARE
+    if (crc32cHardwareSupported()) {
+        std::cout << "crc32c SSE4.2" << (crc32cFoldSupported() ? " + AVX-512 folding: " : ": ") << crcRate(crc32cHardware) << std::endl;
+    }
+#endif
+
+    // Taking turns so both see the same machine, each run about 1 GB. A run's cost is
+    // against the plain run just before it, the median of them is what it costs. Wall
+    // clock frames/s include the sender and reader threads, on few cores they're noisy;
+    // the echoing thread's own CPU time is what the server would spend
+    constexpr int RUNS = 9;
+    std::vector<char> plainStream = makeStream(65536, totalMB * 1048576);
+    std::vector<char> checkedStream = makeStream(65536, totalMB * 1048576, true);
+    size_t repeats = std::max<size_t>(1, 1024 / std::max<size_t>(totalMB, 1));
+    size_t frames = 0;
+    struct Series {
+        std::vector<double> wall, cpu, wallCosts, cpuCosts;
+    } plain, verified, passed;
+    auto add = [](Series& series, EchoRate rate, EchoRate base) {
+        series.wall.push_back(rate.wall);
+        series.cpu.push_back(rate.cpu);
+        series.wallCosts.push_back((base.wall - rate.wall) / base.wall * 100);
+        series.cpuCosts.push_back((base.cpu - rate.cpu) / base.cpu * 100);
+    };
+    for (int run = 0; run < RUNS; ++run) {
+        EchoRate base = echoThrough(plainStream, repeats, true, frames);
+        add(plain, base, base);
+        add(verified, echoThrough(checkedStream, repeats, true, frames), base);
+        add(passed, echoThrough(checkedStream, repeats, false, frames), base);
+    }
+    auto median = [](std::vector<double> values) {
+        std::sort(values.begin(), values.end());
+        return values[values.size() / 2];
+    };
+    auto spread = [](std::vector<double> values) {
+        auto [low, high] = std::minmax_element(values.begin(), values.end());
+        return std::to_string(*low) + "% to " + std::to_string(*high) + "%";
+    };
+    auto report = [&](const char* label, const Series& series, bool costs) {
+        std::cout << "echo 65536 B frames, " << label << " " << static_cast<size_t>(median(series.wall)) << " frames/s, "
+                  << static_cast<size_t>(median(series.cpu)) << " per CPU second, median of " << RUNS << " runs of " << frames
+                  << " frames" << std::endl;
+        if (costs) {
+            std::cout << "  costs " << median(series.wallCosts) << "% of frames/s (" << spread(series.wallCosts) << "), "
+                      << median(series.cpuCosts) << "% of frames per CPU second (" << spread(series.cpuCosts) << ")" << std::endl;
+        }
+    };
+    report("no checksum:           ", plain, false);
+    report("CRC-32C verified:      ", verified, true);
+    report("CRC-32C passed through:", passed, true);
+}
+
+static void benchEcho(size_t totalMB) {
+    for (size_t frameSize : {size_t(16), size_t(1024), size_t(65536)}) {
+        std::vector<char> stream = makeStream(frameSize, totalMB * 1048576);
+        std::string label = "echo " + std::to_string(frameSize) + " B frames, ";
+
+        // As workerThread did: a FrameEncoder and a send per frame, copied out in 4 KB chunks
+        runEcho(label + "per frame", [&](int fd, size_t recvSize, size_t& frames, size_t& calls) {
+            LegacyFrameDecoder decoder;
+            LegacyFrame frame;
+            char chunk[4096];
+            for (size_t offset = 0; offset < stream.size(); offset += recvSize) {
+                decoder.feed(stream.data() + offset, std::min(recvSize, stream.size() - offset));
+                while (decoder.nextFrame(frame)) {
+                    LegacyFrameEncoder encoder;
+                    encoder.feed(frame.data.get(), frame.length);
+                    std::vector<char> encoded = encoder.next();
+                    for (size_t sent = 0; sent < encoded.size(); sent += sizeof(chunk)) {
+                        size_t len = std::min(sizeof(chunk), encoded.size() - sent);
+                        memcpy(chunk, encoded.data() + sent, len);
+                        struct iovec iov = {chunk, len};
+                        if (!writeAll(fd, &iov, 1, calls)) return;
+                    }
+                    ++frames;
+                }
+            }
+        });
+
+        runEcho(label + "gathered ", [&](int fd, size_t recvSize, size_t& frames, size_t& calls) {
+            FrameDecoder decoder;
+            FrameEncoder encoder;
+            Frame frame;
+            std::vector<struct iovec> iov;
+            size_t offset = 0;
+            while (offset < stream.size()) {
+                FrameDecoder::Space space = decoder.writable();
+                size_t len = std::min({recvSize, stream.size() - offset, space.len});
+                memcpy(space.data, stream.data() + offset, len);
+                decoder.commit(len);
+                offset += len;
+                while (decoder.nextFrame(frame)) {
+                    encoder.add(frame.data, frame.length);
+                }
+                if (!encoder.empty()) {
+                    iov.clear();
+                    for (const FrameEncoder::Segment& segment : encoder.segments()) {
+                        iov.push_back({const_cast<char*>(segment.data), segment.len});
+                    }
+                    if (!writeAll(fd, iov.data(), iov.size(), calls)) return;
+                    frames += encoder.frames();
+                    encoder.clear();
+                }
+                decoder.release();
+            }
+        });
+    }
+}
+#endif
+
+
+int main(int argc, char* argv[]) {
+    size_t totalMB = 64;
+    size_t streamMB = 500;
+    if (argc >= 2) totalMB = std::stoul(argv[1]);
+    if (argc >= 3) streamMB = std::stoul(argv[2]);
+
+#ifndef _WIN32
+    // Before anything else raises the peak
+    benchStream(streamMB);
+#else
+    (void)streamMB;
+#endif
+
+    for (size_t frameSize : {size_t(16), size_t(1024), size_t(65536)}) {
+        std::vector<char> stream = makeStream(frameSize, totalMB * 1048576);
+        for (size_t recvSize : {size_t(4096), size_t(65536)}) {
+            std::string label = std::to_string(frameSize) + " B frames, " + std::to_string(recvSize) + " B recvs, ";
+
+            runBench(label + "legacy     ", stream.size(), [&](size_t& sink) {
+                LegacyFrameDecoder decoder;
+                LegacyFrame frame;
+                size_t frames = 0;
+                for (size_t offset = 0; offset < stream.size(); offset += recvSize) {
+                    decoder.feed(stream.data() + offset, std::min(recvSize, stream.size() - offset));
+                    while (decoder.nextFrame(frame)) {
+                        sink += static_cast<unsigned char>(frame.data[frame.length - 1]);
+                        ++frames;
+                    }
+                }
+                return frames;
+            });
+
+            // The copy into writable() stands in for the kernel's copy of a recv into the ring
+            runBench(label + "ring buffer", stream.size(), [&](size_t& sink) {
+                FrameDecoder decoder;
+                Frame frame;
+                size_t frames = 0;
+                size_t offset = 0;
+                while (offset < stream.size()) {
+                    size_t len = std::min(recvSize, stream.size() - offset);
+                    FrameDecoder::Space space = decoder.writable();
+                    len = std::min(len, space.len);
+                    memcpy(space.data, stream.data() + offset, len);
+                    decoder.commit(len);
+                    offset += len;
+                    while (decoder.nextFrame(frame)) {
+                        sink += static_cast<unsigned char>(frame.data[frame.length - 1]);
+                        ++frames;
+                    }
+                    decoder.release();
+                }
+                return frames;
+            });
+        }
+    }
+
+#ifndef _WIN32
+    benchEcho(totalMB);
+    benchChecksum(totalMB);
+#endif
+    return 0;
+}
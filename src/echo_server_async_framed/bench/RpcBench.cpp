@@ -0,0 +1,244 @@
+#include <chrono>
+#include <climits>
+#include <condition_variable>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "Framing.hpp"
+#include "Rpc.hpp"
+#include "RpcClient.hpp"
+
+/*
+Calls/sec of RpcClient over a socketpair with 1 to 256 calls in flight, depth 1 being
+the old one request, one response at a time.
+The server end stands in for the IOCP server, which needs Windows, with the same
+parts: a reader decoding requests into RpcRegistry, the deferred method answered by
+a pool of workers, and a writer sending whatever replies piled up in one writev, as
+the server does one WSASend per batch. The body carries the call's sequence number,
+responses that overtook an earlier call are counted as out of order.
+*/
+
+constexpr uint16_t RPC_ECHO = 1;
+constexpr uint16_t RPC_ECHO_DEFERRED = 2;
+constexpr int WORKERS = 2;
+
+
+class BenchServer : public RpcSink {
+
+    public:
+        explicit BenchServer(int fd) : fd_(fd) {
+            registry_.add(RPC_ECHO, [](std::string_view body, RpcReply reply) {
+                reply.send(std::string(body));
+            });
+            registry_.add(RPC_ECHO_DEFERRED, [this](std::string_view body, RpcReply reply) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                tasks_.push_back({std::string(body), std::move(reply)});
+                taskReady_.notify_one();
+            });
+
+            reader_ = std::thread([this] { readLoop(); });
+            writer_ = std::thread([this] { writeLoop(); });
+            for (int i = 0; i < WORKERS; ++i) {
+                workers_.emplace_back([this] { workLoop(); });
+            }
+        }
+
+        ~BenchServer() {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                stopping_ = true;
+                taskReady_.notify_all();
+                writable_.notify_one();
+            }
+            reader_.join();
+            writer_.join();
+            for (auto& worker : workers_) worker.join();
+        }
+
+        void retain() override {}
+
+        void send(const RpcHeader& header, std::string body) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queued_.add(header.payload(body));
+            writable_.notify_one();
+        }
+
+    private:
+        struct Task {
+            std::string body;
+            RpcReply reply;
+        };
+
+        void readLoop() {
+            FrameDecoder decoder;
+            Frame frame;
+            while (true) {
+                FrameDecoder::Space space = decoder.writable();
+                ssize_t got = recv(fd_, space.data, space.len, 0);
+                if (got <= 0) return;
+                decoder.commit(static_cast<size_t>(got));
+                while (decoder.nextFrame(frame)) {
+                    registry_.dispatch(frame.data, frame.length, this);
+                }
+                decoder.release();
+            }
+        }
+
+        void workLoop() {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                taskReady_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+                if (tasks_.empty()) return;
+                Task task = std::move(tasks_.front());
+                tasks_.pop_front();
+                lock.unlock();
+                task.reply.send(std::move(task.body));
+                lock.lock();
+            }
+        }
+
+        void writeLoop() {
+            FrameEncoder sending;
+            std::vector<struct iovec> iov;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (true) {
+                writable_.wait(lock, [this] { return stopping_ || !queued_.empty(); });
+                if (queued_.empty()) return;
+                std::swap(sending, queued_);
+                lock.unlock();
+
+                iov.clear();
+                for (const FrameEncoder::Segment& segment : sending.segments()) {
+                    iov.push_back({const_cast<char*>(segment.data), segment.len});
+                }
+                bool ok = writeAll(iov.data(), iov.size());
+                sending.clear();
+                lock.lock();
+                if (!ok) return;
+            }
+        }
+
+        bool writeAll(struct iovec* iov, size_t count) {
+            while (count > 0) {
+                ssize_t written = writev(fd_, iov, static_cast<int>(std::min<size_t>(count, IOV_MAX)));
+                if (written < 0) return false;
+                size_t left = static_cast<size_t>(written);
+                while (count > 0 && left >= iov->iov_len) {
+                    left -= iov->iov_len;
+                    ++iov;
+                    --count;
+                }
+                if (count > 0) {
+                    iov->iov_base = static_cast<char*>(iov->iov_base) + left;
+                    iov->iov_len -= left;
+                }
+            }
+            return true;
+        }
+
+        int fd_;
+        RpcRegistry registry_;
+
+        std::mutex mutex_;
+        std::condition_variable taskReady_;
+        std::condition_variable writable_;
+        std::deque<Task> tasks_;
+        FrameEncoder queued_;
+        bool stopping_ = false;
+
+        std::thread reader_;
+        std::thread writer_;
+        std::vector<std::thread> workers_;
+};
+
+
+// calls calls of method, depth of them in flight: each response issues the next call
+static void runBench(uint16_t method, size_t depth, size_t calls, size_t bodySize) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        std::cerr << "socketpair failed" << std::endl;
+        return;
+    }
+
+    size_t completed = 0, failed = 0, outOfOrder = 0;
+    uint64_t lastSeq = 0;
+    std::mutex doneMutex;
+    std::condition_variable done;
+    auto start = std::chrono::steady_clock::now();
+    {
+        BenchServer server(fds[1]);
+        RpcClient client(fds[0]);
+
+        size_t issued = 0;
+        std::string body(bodySize, 'x');
+        std::function<void()> issue;
+        RpcClient::Callback callback = [&](uint16_t status, std::string_view response) {
+            uint64_t seq = 0;
+            if (status == RPC_OK && response.size() >= sizeof(seq)) {
+                memcpy(&seq, response.data(), sizeof(seq));
+            }
+            bool next = false;
+            {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (status != RPC_OK) ++failed;
+                if (seq < lastSeq) ++outOfOrder;
+                lastSeq = std::max(lastSeq, seq);
+                next = issued < calls;
+                if (++completed == calls) done.notify_one();
+            }
+            if (next) issue();
+        };
+        issue = [&] {
+            uint64_t seq;
+            {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                if (issued == calls) return;
+                seq = ++issued;
+            }
+            std::string request = body;
+            memcpy(request.data(), &seq, sizeof(seq));
+            if (!client.call(method, request, callback)) {
+                std::lock_guard<std::mutex> lock(doneMutex);
+                ++failed;
+                if (++completed == calls) done.notify_one();
+            }
+        };
+
+        for (size_t i = 0; i < depth; ++i) issue();
+        std::unique_lock<std::mutex> lock(doneMutex);
+        done.wait(lock, [&] { return completed == calls; });
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    close(fds[0]);
+    close(fds[1]);
+
+    std::cout << (method == RPC_ECHO ? "inline  " : "deferred") << " depth " << depth << ": "
+              << static_cast<size_t>(static_cast<double>(calls) / seconds) << " calls/s, "
+              << outOfOrder << " out of order" << (failed != 0 ? ", FAILED " + std::to_string(failed) : "") << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t calls = 200000;
+    size_t bodySize = 64;
+    if (argc >= 2) calls = std::stoul(argv[1]);
+    if (argc >= 3) bodySize = std::max<size_t>(std::stoul(argv[2]), sizeof(uint64_t));
+
+    std::signal(SIGPIPE, SIG_IGN);
+    for (uint16_t method : {RPC_ECHO, RPC_ECHO_DEFERRED}) {
+        for (size_t depth : {size_t(1), size_t(4), size_t(16), size_t(64), size_t(256)}) {
+            runBench(method, depth, calls, bodySize);
+        }
+    }
+    return 0;
+}
@@ -9,12 +9,11 @@
 #include <vector>
 #include <algorithm>
 #include "Framing.hpp"
+#include "Rpc.hpp"
 
 constexpr int LISTEN_PORT = 8080;
 const char* const LISTEN_ADDR = "127.0.0.1";
 
-constexpr int BUFFER_SIZE = 4096;
-
 constexpr int MAX_WORKER_THREADS = 2;
 
 std::mutex logMutex;
@@ -42,29 +41,100 @@ struct WinSockGuard {
 
 enum class IOState {
     RECV,
-    SEND
+    SEND,
+    TASK    // an RpcTask posted to the port, no connection
 };
 
+struct Connection;
+
 struct IOContext {
-    SOCKET socket;
     OVERLAPPED overlapped;
-    WSABUF wsaBuf;
-    char buffer[BUFFER_SIZE];
-    std::vector<char> sendBuffer;
-    size_t sendOffset = 0;
-    IOState state = IOState::RECV;
-    FrameDecoder decoder;
-    FrameEncoder encoder;
+    IOState state;
+    Connection* connection;
 
-    IOContext(SOCKET s) : socket(s) {
+    IOContext(IOState s, Connection* c) : state(s), connection(c) {
         ZeroMemory(&overlapped, sizeof(overlapped));
-        wsaBuf.buf = buffer;
-        wsaBuf.len = BUFFER_SIZE;
     }
 };
 
 
+// A deferred RPC call: posted to the completion port, answered by whichever worker gets it
+struct RpcTask : IOContext {
+    std::string body;
+    RpcReply reply;
+
+    RpcTask(std::string b, RpcReply r) : IOContext(IOState::TASK, nullptr), body(std::move(b)), reply(std::move(r)) {}
+};
+
+
+/*
+One client. Recvs go straight into the decoder's ring, and every frame decoded from
+one joins a batch that goes out as a single WSASend of header and payload buffers,
+the payloads still in the ring. At most one send is in flight per connection so
+batches go out in order, frames decoded meanwhile collect in the queued batch.
+Their space in the ring is released when the send carrying them completes; a ring
+full of frames still being sent holds the next recv back until then. Frames past
+MAX_FRAME_SIZE are echoed as they stream in: the header first, then every chunk in
+the batch of the recv that brought it, so a slow reader slows the sender down and
+the connection never holds more than its ring.
+In RPC mode the frames are requests instead: dispatched as they're decoded and
+released right away, the responses join the queued batch whenever their handler
+answers, from any thread. Every reply owed counts as pending, so the connection
+outlives the calls it has to answer. The ring doesn't bound the replies then, past
+MAX_QUEUED_REPLY_BYTES queued or MAX_OWED_REPLIES owed the next recv waits for a
+send completion, a client that doesn't read its responses stops being read too.
+The recv and the send complete on whichever worker, hence the mutex. Recursive, a
+handler answering inline replies under the lock of the recv that dispatched it.
+*/
+struct Connection : RpcSink {
+    SOCKET socket;
+    std::recursive_mutex mutex;
+    IOContext recvCtx;
+    IOContext sendCtx;
+    FrameDecoder decoder;
+
+    FrameEncoder sending;          // in flight
+    FrameEncoder queued;           // goes next
+    uint64_t sendingMark = 0;      // decoder marks to release once the batch is sent
+    uint64_t queuedMark = 0;
+    std::vector<WSABUF> wsaBufs;   // of sending, from sendIndex on not sent yet
+    size_t sendIndex = 0;
+
+    int pendingIO = 0;
+    size_t owedReplies = 0;        // RPC calls dispatched, not answered yet
+    bool sendPosted = false;
+    bool recvWaiting = false;
+    bool closing = false;
+    bool dispatching = false;      // replies wait for the batch of the recv
+
+    // verifyChecksums: the payloads are read here (RPC), not just echoed with their checksum
+    Connection(SOCKET s, bool verifyChecksums)
+        : socket(s), recvCtx(IOState::RECV, this), sendCtx(IOState::SEND, this),
+          decoder(FrameDecoder::DEFAULT_CAPACITY, Frame::MAX_STREAM_SIZE, verifyChecksums) {}
+
+    void retain() override {
+        ++pendingIO;
+        ++owedReplies;
+    }
+    void send(const RpcHeader& header, std::string body) override;
+};
+
+
 std::atomic_bool running = true;
+bool rpcMode = false;
+HANDLE iocp = nullptr;
+RpcRegistry rpcRegistry;
+
+// RPC methods
+constexpr uint16_t RPC_ECHO = 1;             // answered inline
+constexpr uint16_t RPC_ECHO_DEFERRED = 2;    // answered by whichever worker picks up its task
+constexpr size_t MAX_QUEUED_REPLY_BYTES = 4 * FrameDecoder::DEFAULT_CAPACITY;
+constexpr size_t MAX_OWED_REPLIES = 256;
+
+// Shutdown stats
+std::atomic<uint64_t> framesEchoed = 0;
+std::atomic<uint64_t> sendCalls = 0;
+std::atomic<uint64_t> recvCalls = 0;
 
 void signalHandler(int signal) {
     logf("\nCaught signal ", signal, ", exiting..");
@@ -72,34 +142,192 @@ void signalHandler(int signal) {
 }
 
 
-void postRecv(IOContext* ctx, std::string threadStr) {
-    ctx->state = IOState::RECV;
-    ZeroMemory(&ctx->overlapped, sizeof(ctx->overlapped));
+// Pending operations complete with an error, the last one deletes the connection
+void closeConnection(Connection* conn) {
+    if (conn->closing) return;
+    conn->closing = true;
+    closesocket(conn->socket);
+}
+
+
+void postRecv(Connection* conn, const std::string& threadStr) {
+    FrameDecoder::Space space = conn->decoder.writable();
+    if (space.len == 0) {
+        // The ring is full of frames still being sent, their send completion posts it
+        conn->recvWaiting = true;
+        return;
+    }
+    if (rpcMode && (conn->queued.bytes() >= MAX_QUEUED_REPLY_BYTES || conn->owedReplies >= MAX_OWED_REPLIES)) {
+        // Replies pile up faster than the client reads them, a send completion posts it
+        conn->recvWaiting = true;
+        return;
+    }
+
+    ZeroMemory(&conn->recvCtx.overlapped, sizeof(conn->recvCtx.overlapped));
+    WSABUF wsaBuf;
+    wsaBuf.buf = space.data;
+    wsaBuf.len = static_cast<ULONG>(space.len);
     DWORD flags = 0, bytes = 0;
-    int r = WSARecv(ctx->socket, &ctx->wsaBuf, 1, &bytes, &flags, &ctx->overlapped, nullptr);
+    ++recvCalls;
+    int r = WSARecv(conn->socket, &wsaBuf, 1, &bytes, &flags, &conn->recvCtx.overlapped, nullptr);
     if (r == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
         logcerr(threadStr, "WSARecv failed: ", WSAGetLastError());
-        closesocket(ctx->socket);
-        delete ctx;
+        closeConnection(conn);
+        return;
     }
+    ++conn->pendingIO;
 }
 
-void postSend(IOContext* ctx, std::string threadStr) {
-    ctx->state = IOState::SEND;
-    ZeroMemory(&ctx->overlapped, sizeof(ctx->overlapped));
-
-    size_t remaining = ctx->sendBuffer.size() - ctx->sendOffset;
-    size_t toSend = std::min(remaining, static_cast<size_t>(BUFFER_SIZE));
-    memcpy(ctx->buffer, ctx->sendBuffer.data() + ctx->sendOffset, toSend);
-    ctx->wsaBuf.buf = ctx->buffer;
-    ctx->wsaBuf.len = static_cast<ULONG>(toSend);
-
+void postSend(Connection* conn, const std::string& threadStr) {
+    ZeroMemory(&conn->sendCtx.overlapped, sizeof(conn->sendCtx.overlapped));
     DWORD bytes = 0;
-    int r = WSASend(ctx->socket, &ctx->wsaBuf, 1, &bytes, 0, &ctx->overlapped, nullptr);
+    ++sendCalls;
+    int r = WSASend(conn->socket, conn->wsaBufs.data() + conn->sendIndex, static_cast<DWORD>(conn->wsaBufs.size() - conn->sendIndex),
+                    &bytes, 0, &conn->sendCtx.overlapped, nullptr);
     if (r == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
         logcerr(threadStr, "WSASend failed: ", WSAGetLastError());
-        closesocket(ctx->socket);
-        delete ctx;
+        closeConnection(conn);
+        return;
+    }
+    ++conn->pendingIO;
+    conn->sendPosted = true;
+}
+
+// The queued batch becomes the one in flight
+void sendQueued(Connection* conn, const std::string& threadStr) {
+    std::swap(conn->sending, conn->queued);
+    conn->queued.clear();
+    conn->sendingMark = conn->queuedMark;
+
+    conn->wsaBufs.clear();
+    conn->sendIndex = 0;
+    for (const FrameEncoder::Segment& segment : conn->sending.segments()) {
+        WSABUF wsaBuf;
+        wsaBuf.buf = const_cast<char*>(segment.data);
+        wsaBuf.len = static_cast<ULONG>(segment.len);
+        conn->wsaBufs.push_back(wsaBuf);
+    }
+    postSend(conn, threadStr);
+}
+
+void Connection::send(const RpcHeader& header, std::string body) {
+    bool done = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        --pendingIO;
+        --owedReplies;
+        if (!closing) {
+            queued.add(header.payload(body));
+            if (!sendPosted && !dispatching) {
+                sendQueued(this, "[Rpc] ");
+            }
+        }
+        done = closing && pendingIO == 0;
+    }
+    if (done) {
+        delete this;
+    }
+}
+
+
+// RPC mode: every frame is a request, nothing from the ring is held past the call
+void dispatchRequests(Connection* conn, const std::string& threadStr) {
+    FramePart part;
+    bool ok = true;
+    conn->dispatching = true;
+    while (ok && conn->decoder.nextPart(part)) {
+        ok = part.type == FramePart::FRAME && rpcRegistry.dispatch(part.data, part.len, conn);
+    }
+    conn->dispatching = false;
+    conn->decoder.release();
+    if (!ok) {
+        logcerr(threadStr, "Not an RPC request, closing client socket ", conn->socket);
+        closeConnection(conn);
+    }
+}
+
+void echoFrames(Connection* conn, const std::string& threadStr) {
+    FramePart part;
+    while (conn->decoder.nextPart(part)) {
+        // A frame that came with a checksum goes back with the same one, unverified: the client
+        // checks the echo against it, which covers the way here too
+        if (part.type == FramePart::FRAME) {
+            if (part.checked) {
+                conn->queued.addHeader(part.length, part.checksum);
+                conn->queued.addData(part.data, part.len);
+            } else {
+                conn->queued.add(part.data, part.length);
+            }
+        } else if (part.type == FramePart::STREAM_BEGIN) {
+            logf(threadStr, "Streaming frame of length ", part.length + Frame::HEADER_LEN);
+            if (part.checked) {
+                conn->queued.addHeader(part.length, part.checksum);
+            } else {
+                conn->queued.addHeader(part.length);
+            }
+        } else {
+            conn->queued.addData(part.data, part.len);
+        }
+    }
+    conn->queuedMark = conn->decoder.mark();
+}
+
+
+void handleRecv(Connection* conn, size_t bytesTransferred, const std::string& threadStr) {
+    conn->decoder.commit(bytesTransferred);
+    if (rpcMode) {
+        dispatchRequests(conn, threadStr);
+        if (conn->closing) return;
+    } else {
+        echoFrames(conn, threadStr);
+    }
+    if (conn->decoder.checksumMismatch()) {
+        logcerr(threadStr, "Frame failed its checksum, closing client socket ", conn->socket);
+        closeConnection(conn);
+        return;
+    }
+    if (conn->decoder.failed()) {
+        logcerr(threadStr, "Rejected frame of length ", conn->decoder.rejectedLength(), " (limit ", Frame::MAX_STREAM_SIZE,
+                "), closing client socket ", conn->socket);
+        closeConnection(conn);
+        return;
+    }
+
+    if (!conn->sendPosted && !conn->queued.empty()) {
+        sendQueued(conn, threadStr);
+    }
+    if (!conn->closing) {
+        postRecv(conn, threadStr);
+    }
+}
+
+void handleSend(Connection* conn, size_t bytesTransferred, const std::string& threadStr) {
+    conn->sendPosted = false;
+
+    // Skip what went out, a partial send goes on from there
+    size_t sent = bytesTransferred;
+    while (conn->sendIndex < conn->wsaBufs.size() && sent >= conn->wsaBufs[conn->sendIndex].len) {
+        sent -= conn->wsaBufs[conn->sendIndex].len;
+        ++conn->sendIndex;
+    }
+    if (conn->sendIndex < conn->wsaBufs.size()) {
+        WSABUF& wsaBuf = conn->wsaBufs[conn->sendIndex];
+        wsaBuf.buf += sent;
+        wsaBuf.len -= static_cast<ULONG>(sent);
+        postSend(conn, threadStr);
+        return;
+    }
+
+    framesEchoed += conn->sending.frames();
+    conn->sending.clear();
+    conn->decoder.release(conn->sendingMark);
+
+    if (!conn->queued.empty()) {
+        sendQueued(conn, threadStr);
+    }
+    if (conn->recvWaiting && !conn->closing) {
+        conn->recvWaiting = false;
+        postRecv(conn, threadStr);
     }
 }
 
@@ -129,41 +357,39 @@ void workerThread(HANDLE iocpHandle) {
         }
         
         auto* context = CONTAINING_RECORD(overlapped, IOContext, overlapped);
-
-        if (!completionResult || bytesTransferred == 0) {
-            if (bytesTransferred == 0) {
-                logf(threadStr, "Client socket ", context->socket, " disconnected gracefully.");
-            } else {
-                logcerr(threadStr, "Client socket ", context->socket, " disconnected with error: ", WSAGetLastError());
-            }
-            closesocket(context->socket);
-            delete context;
+        if (context->state == IOState::TASK) {
+            auto* task = static_cast<RpcTask*>(context);
+            task->reply.send(std::move(task->body));
+            delete task;
             continue;
         }
 
-        if (context->state == IOState::RECV) {
-            context->decoder.feed(context->buffer, bytesTransferred);
-            Frame frame;
-            while (context->decoder.nextFrame(frame)) {
-                logf(threadStr, "Received frame of length ", frame.length + Frame::HEADER_LEN);
-                FrameEncoder encoder;
-                encoder.feed(frame.data.get(), frame.length);
-                auto encoded = encoder.next();
-
-                logf(threadStr, "Sending frame of length ", encoded.size());
-                IOContext* sendCtx = new IOContext(context->socket);
-                sendCtx->sendBuffer = std::move(encoded);
-                sendCtx->sendOffset = 0;
-                postSend(sendCtx, threadStr);
-            }
-            postRecv(context, threadStr);
-        } else if (context->state == IOState::SEND) {
-            context->sendOffset += bytesTransferred;
-            if (context->sendOffset < context->sendBuffer.size()) {
-                postSend(context, threadStr);
+        Connection* conn = context->connection;
+        bool done = false;
+        {
+            // pendingIO counts this one until it's handled, an inline reply can't free the connection
+            std::lock_guard<std::recursive_mutex> lock(conn->mutex);
+            if (!completionResult || bytesTransferred == 0) {
+                if (!conn->closing) {
+                    if (bytesTransferred == 0) {
+                        logf(threadStr, "Client socket ", conn->socket, " disconnected gracefully.");
+                    } else {
+                        logcerr(threadStr, "Client socket ", conn->socket, " disconnected with error: ", WSAGetLastError());
+                    }
+                    closeConnection(conn);
+                }
+            } else if (conn->closing) {
+                // Completed before the close got to it, nothing more goes out
+            } else if (context->state == IOState::RECV) {
+                handleRecv(conn, bytesTransferred, threadStr);
             } else {
-                delete context;
+                handleSend(conn, bytesTransferred, threadStr);
             }
+            --conn->pendingIO;
+            done = conn->closing && conn->pendingIO == 0;
+        }
+        if (done) {
+            delete conn;
         }
     }
 }
@@ -232,7 +458,7 @@ SOCKET acceptClient(SOCKET listenSocket) {
 }
 
 
-int main() {
+int main(int argc, char* argv[]) {
     /*
     Length-prefix framed asynchronous multithreaded echo server using IOCP (I/O Completion Ports)
 
@@ -242,16 +468,36 @@ int main() {
     
     FrameDecoder reads first 4 bytes from input stream to message length,
     and message length amount to buffer.
+    Recvs land directly in the decoder's ring buffer, frames are views into it (see Framing.hpp).
+    Frames over MAX_FRAME_SIZE are streamed, echoed chunk by chunk as they arrive, up to MAX_STREAM_SIZE.
+    A larger one is rejected and the client disconnected.
+    A header with Frame::CHECKSUM_FLAG carries the payload's CRC-32C. The echo carries it back
+    unverified, the client checks the echo; in RPC mode the decoder checks it (SSE4.2 crc32
+    or a carry-less multiply fold when the CPU has it) and a mismatch disconnects.
 
-    FrameEncoder encodes buffer into frames.
-    When sending, we chunk encoder frames by buffer size.
+    FrameEncoder collects the frames of a recv, they're echoed with one WSASend
+    of header and payload buffers, payloads straight from the decoder's ring.
 
     Worker threads wait and handle completed I/O operations.
     Worker threads echo back only after full frame has been received.
-    IOContexts are short lived per each SEND,
-    and should be deleted after full frame has been sent, error happened or client disconnected.
+    Each Connection has one IOContext for its recv and one for its send, at most one send in flight.
+    The Connection is deleted after an error or disconnect, once its last operation completed.
     Communication happens via WSASend and WSARecv.
+
+    With --rpc frames carry the calls of Rpc.hpp instead: each payload an RpcHeader
+    (request id, method) and a body, answered with a frame of the same request id.
+    Method 1 echoes the body right away, method 2 posts it to the completion port and
+    whichever worker picks it up answers, so responses go out in the order calls finish,
+    not in the order they came in. RpcClient.hpp keeps many calls in flight on one connection.
     */
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]) == "--rpc") {
+            rpcMode = true;
+        } else {
+            logcerr("Usage: ", argv[0], " [--rpc]");
+            return 1;
+        }
+    }
     logf("[Main] Running length-prefix framed async multithreaded (IOCP) echo server!");
     
     std::signal(SIGINT, signalHandler);
@@ -269,6 +515,20 @@ int main() {
     }
     logf("[Main] iocpHandle created succesfully!");
 
+    if (rpcMode) {
+        iocp = iocpHandle;
+        rpcRegistry.add(RPC_ECHO, [](std::string_view body, RpcReply reply) {
+            reply.send(std::string(body));
+        });
+        rpcRegistry.add(RPC_ECHO_DEFERRED, [](std::string_view body, RpcReply reply) {
+            auto* task = new RpcTask(std::string(body), std::move(reply));
+            if (!PostQueuedCompletionStatus(iocp, 0, 0, &task->overlapped)) {
+                delete task;   // answers RPC_DROPPED
+            }
+        });
+        logf("[Main] RPC mode");
+    }
+
     std::vector<std::thread> workerThreads;
     for (int i = 0; i < MAX_WORKER_THREADS; i++) {
         workerThreads.emplace_back(workerThread, iocpHandle);
@@ -289,8 +549,16 @@ int main() {
         
         logf("[Main] New client socket associated with IOCP");
 
-        auto* context = new IOContext(clientSocket);
-        postRecv(context, "[Main]");
+        auto* conn = new Connection(clientSocket, rpcMode);
+        bool failed = false;
+        {
+            std::lock_guard<std::recursive_mutex> lock(conn->mutex);
+            postRecv(conn, "[Main]");
+            failed = conn->closing && conn->pendingIO == 0;
+        }
+        if (failed) {
+            delete conn;
+        }
     }
 
     logf("[Main] Stop worker threads");
@@ -305,6 +573,9 @@ int main() {
 
     CloseHandle(iocpHandle);
     closesocket(listenSocket);
+    uint64_t frames = framesEchoed.load();
+    logf("[Main] Echoed ", frames, " frames with ", sendCalls.load(), " WSASend and ", recvCalls.load(), " WSARecv calls (",
+         frames != 0 ? static_cast<double>(sendCalls.load() + recvCalls.load()) / static_cast<double>(frames) : 0.0, " per frame)");
     logf("[Main] Async echo server shut down gracefully!");
     return 0;
 }
@@ -0,0 +1,240 @@
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <thread>
+
+#include "EpollEventLoop.hpp"
+#include "log.hpp"
+
+
+static bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags != -1 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+
+
+EpollEventLoop::EpollEventLoop(HTTPServer& server) : EventLoop(server), recvBuffer_(RECV_BUFFER_SIZE) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ == -1) {
+        logcerr("epoll_create1() failed: ", strerror(errno));
+        throw std::runtime_error("Failed to init epoll");
+    }
+
+    wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd_ == -1) {
+        logcerr("eventfd() failed: ", strerror(errno));
+        close(epollFd_);
+        throw std::runtime_error("Failed to init epoll wakeup fd");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.ptr = &wakeupFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) == -1) {
+        logcerr("epoll_ctl(wakeup) failed: ", strerror(errno));
+        close(wakeupFd_);
+        close(epollFd_);
+        throw std::runtime_error("Failed to register epoll wakeup fd");
+    }
+}
+
+
+EpollEventLoop::~EpollEventLoop() {
+    for (Connection* conn : closed_) {
+        delete conn;
+    }
+    if (wakeupFd_ != -1) close(wakeupFd_);
+    if (epollFd_ != -1) close(epollFd_);
+}
+
+
+void EpollEventLoop::init(SOCKET listenSocket) {
+    listenSocket_ = listenSocket;
+    if (!setNonBlocking(listenSocket_)) {
+        logcerr("fcntl(O_NONBLOCK) failed for listening socket: ", strerror(errno));
+        throw std::runtime_error("Failed to make listening socket non-blocking");
+    }
+
+    // Listener stays level-triggered, each wakeup accepts until EAGAIN
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.ptr = nullptr;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenSocket_, &event) == -1) {
+        logcerr("epoll_ctl(listen) failed: ", strerror(errno));
+        throw std::runtime_error("Failed to register listening socket with epoll");
+    }
+}
+
+
+void EpollEventLoop::run() {
+    std::ostringstream oss;
+    oss << "[Thread " << std::this_thread::get_id() << "] ";
+    std::string threadStr = oss.str();
+    logf(threadStr, "Started worker");
+
+    epoll_event events[MAX_EVENTS];
+
+    while (server_.isRunning()) {
+        int timeout = ready_.empty() ? timers_.nextTimeoutMs(TimerWheel::clockMs()) : 0;
+        int n = epoll_wait(epollFd_, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            logcerr(threadStr, "epoll_wait() failed: ", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            void* ptr = events[i].data.ptr;
+            uint32_t flags = events[i].events;
+
+            if (ptr == &wakeupFd_) {
+                uint64_t value;
+                while (read(wakeupFd_, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+            if (ptr == nullptr) {
+                acceptAll(threadStr);
+                continue;
+            }
+
+            Connection* conn = static_cast<Connection*>(ptr);
+            bool failed = flags & (EPOLLERR | EPOLLHUP);
+            if ((conn->recvContext->pending && (failed || flags & (EPOLLIN | EPOLLRDHUP))) ||
+                (conn->sendContext->pending && (failed || flags & EPOLLOUT))) {
+                ready_.push_back(conn);
+            }
+        }
+
+        // Handlers post follow-up operations while we go, those get appended and attempted here too
+        for (size_t i = 0; i < ready_.size(); ++i) {
+            performIO(ready_[i], threadStr);
+        }
+        ready_.clear();
+
+        expireTimeouts(threadStr);
+
+        for (Connection* conn : closed_) {
+            delete conn;
+        }
+        closed_.clear();
+    }
+    logf(threadStr, "Shutdown signal received.");
+}
+
+
+void EpollEventLoop::wakeup() {
+    uint64_t value = 1;
+    if (write(wakeupFd_, &value, sizeof(value)) == -1) {
+        logcerr("eventfd write failed: ", strerror(errno));
+    }
+}
+
+
+void EpollEventLoop::acceptAll(const std::string& threadStr) {
+    while (true) {
+        SOCKET clientSocket = accept4(listenSocket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket == INVALID_SOCKET) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logcerr(threadStr, "accept4() failed: ", strerror(errno));
+            }
+            return;
+        }
+        server_.handleAccept(*this, clientSocket, threadStr);
+    }
+}
+
+
+bool EpollEventLoop::addConnection(Connection* conn, const std::string& threadStr) {
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.ptr = conn;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, conn->socket, &event) == -1) {
+        logcerr(threadStr, "epoll_ctl(ADD) failed for client socket: ", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+
+bool EpollEventLoop::postRecv(Connection* conn, const std::string& threadStr) {
+    (void)threadStr;
+    conn->recvContext->pending = true;
+    ready_.push_back(conn);
+    return true;
+}
+
+
+bool EpollEventLoop::postSend(Connection* conn, const std::string& threadStr) {
+    (void)threadStr;
+    conn->sendContext->pending = true;
+    ready_.push_back(conn);
+    return true;
+}
+
+
+void EpollEventLoop::performIO(Connection* conn, const std::string& threadStr) {
+    if (conn->closed) return;
+
+    if (conn->sendContext->pending) {
+        msghdr msg{};
+        msg.msg_iovlen = conn->sendQueue.prepare(conn->sendOffset);
+        msg.msg_iov = conn->sendQueue.segments();
+        ssize_t sent = sendmsg(conn->socket, &msg, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            conn->sendContext->pending = false;
+            server_.handleSend(conn, static_cast<size_t>(sent), threadStr);
+        } else if (errno == EINTR) {
+            ready_.push_back(conn);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            logcerr(threadStr, "sendmsg() failed: ", strerror(errno));
+            closeConnection(conn);
+        }
+        return;
+    }
+
+    if (conn->recvContext->pending) {
+        ssize_t received = recv(conn->socket, recvBuffer_.data(), recvBuffer_.size(), 0);
+        if (received >= 0) {
+            conn->recvContext->pending = false;
+            server_.handleRecv(conn, recvBuffer_.data(), static_cast<size_t>(received), threadStr);
+        } else if (errno == EINTR) {
+            ready_.push_back(conn);
+        } else if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            if (errno != ECONNRESET) {
+                logcerr(threadStr, "recv() failed: ", strerror(errno));
+            }
+            closeConnection(conn);
+        }
+    }
+}
+
+
+void EpollEventLoop::closeConnection(Connection* conn) {
+    if (conn->closed) return;
+    conn->closed = true;
+    timers_.cancel(&conn->timer);
+    // Closing the socket removes it from the epoll set, conn itself may still be in ready_
+    closesocket(conn->socket);
+    conn->socket = INVALID_SOCKET;
+    closed_.push_back(conn);
+}
+
+
+void EpollEventLoop::scheduleTimeout(Connection* conn, uint32_t timeoutMs) {
+    timers_.schedule(&conn->timer, timeoutMs);
+}
+
+
+void EpollEventLoop::cancelTimeout(Connection* conn) {
+    timers_.cancel(&conn->timer);
+}
+
+
+void EpollEventLoop::expireTimeouts(const std::string& threadStr) {
+    timers_.advance(TimerWheel::clockMs(), [&](Timer* timer) {
+        server_.handleTimeout(static_cast<Connection*>(timer->owner), threadStr);
+    });
+}
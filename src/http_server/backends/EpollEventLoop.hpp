@@ -0,0 +1,60 @@
+#pragma once
+
+#include <vector>
+#include <sys/epoll.h>
+
+#include "EventLoop.hpp"
+#include "HTTPServer.hpp"
+
+
+/*
+Linux backend, one epoll instance per worker thread.
+
+Connections are registered edge-triggered for both directions once and stay in the
+loop that accepted them. Posting a recv/send only marks the IOContext pending and
+queues the connection, the loop then does the actual recv()/send() and reports it
+to the server like a completion. If the socket would block the operation stays pending
+until the next edge.
+
+The shared listening socket is registered with EPOLLEXCLUSIVE so a new connection
+wakes up only one of the loops.
+Connection timeouts live in the loop's timer wheel, epoll_wait sleeps until the next
+one is due.
+*/
+class EpollEventLoop : public EventLoop {
+
+    public:
+        explicit EpollEventLoop(HTTPServer& server);
+        ~EpollEventLoop() override;
+
+        void init(SOCKET listenSocket) override;
+
+        bool addConnection(Connection* conn, const std::string& threadStr) override;
+        bool postRecv(Connection* conn, const std::string& threadStr) override;
+        bool postSend(Connection* conn, const std::string& threadStr) override;
+        void closeConnection(Connection* conn) override;
+
+        void scheduleTimeout(Connection* conn, uint32_t timeoutMs) override;
+        void cancelTimeout(Connection* conn) override;
+
+        void run() override;
+        void wakeup() override;
+
+    private:
+        static constexpr int MAX_EVENTS = 256;
+        static constexpr size_t RECV_BUFFER_SIZE = 16384;
+
+        void acceptAll(const std::string& threadStr);
+        void performIO(Connection* conn, const std::string& threadStr);
+        void expireTimeouts(const std::string& threadStr);
+
+        int epollFd_ = -1;
+        int wakeupFd_ = -1;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+
+        TimerWheel timers_;
+        std::vector<char> recvBuffer_;     // every recv of the loop lands here, the server copies what it keeps
+
+        std::vector<Connection*> ready_;   // connections with an operation to attempt
+        std::vector<Connection*> closed_;  // deleted at the end of the loop iteration
+};
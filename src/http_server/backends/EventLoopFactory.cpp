@@ -0,0 +1,45 @@
+#include <stdexcept>
+
+#include "EventLoop.hpp"
+#include "log.hpp"
+
+#ifdef _WIN32
+#include "IocpEventLoop.hpp"
+#else
+#include "EpollEventLoop.hpp"
+#include "UringEventLoop.hpp"
+#endif
+
+
+std::vector<std::unique_ptr<EventLoop>> createEventLoops(HTTPServer& server, size_t nThreads, const std::string& backend) {
+    std::vector<std::unique_ptr<EventLoop>> loops;
+
+#ifdef _WIN32
+    if (!backend.empty() && backend != "iocp") {
+        throw std::invalid_argument("Unknown event loop backend: '" + backend + "', available: iocp");
+    }
+    // One completion port serves every worker thread
+    (void)nThreads;
+    logf("[Main] Using iocp backend");
+    loops.push_back(std::make_unique<IocpEventLoop>(server));
+#else
+    if (backend.empty() || backend == "epoll") {
+        logf("[Main] Using epoll backend");
+        for (size_t i = 0; i < nThreads; ++i) {
+            loops.push_back(std::make_unique<EpollEventLoop>(server));
+        }
+    } else if (backend == "io_uring") {
+        if (!UringEventLoop::isSupported()) {
+            throw std::runtime_error("io_uring backend requested but the kernel doesn't support it");
+        }
+        logf("[Main] Using io_uring backend");
+        for (size_t i = 0; i < nThreads; ++i) {
+            loops.push_back(std::make_unique<UringEventLoop>(server));
+        }
+    } else {
+        throw std::invalid_argument("Unknown event loop backend: '" + backend + "', available: epoll, io_uring");
+    }
+#endif
+
+    return loops;
+}
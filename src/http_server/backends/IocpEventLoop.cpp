@@ -0,0 +1,276 @@
+#include <sstream>
+#include <thread>
+
+#include "IocpEventLoop.hpp"
+#include "log.hpp"
+
+
+IocpEventLoop::~IocpEventLoop() {
+    PoolStats acceptStats = ObjectPool<AcceptContext>::stats();
+    logf("[Main] AcceptContext pool hits: ", acceptStats.hits, ", misses: ", acceptStats.misses);
+
+    if (iocpHandle_ != nullptr) {
+        CloseHandle(iocpHandle_);
+        iocpHandle_ = nullptr;
+    }
+}
+
+
+void IocpEventLoop::init(SOCKET listenSocket) {
+    listenSocket_ = listenSocket;
+
+    iocpHandle_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (iocpHandle_ == nullptr) {
+        logcerr("CreateIoCompletionPort() failed: ", GetLastError());
+        throw std::runtime_error("Failed to init IOCP");
+    }
+    CreateIoCompletionPort((HANDLE)listenSocket_, iocpHandle_, 0, 0);
+
+    logf("[Main] Init lpfnAcceptEx");
+    initExtensions();
+
+    logf("[Main] Posting initial accepts");
+    for (int i = 0; i < NUM_ACCEPTS; ++i) {
+        if (!postAccept("[Main] ")) {
+            logcerr("[Main] Failed to post initial AcceptEx");
+        }
+    }
+}
+
+
+void IocpEventLoop::run() {
+    std::ostringstream oss;
+    oss << "[Thread " << std::this_thread::get_id() << "] ";
+    std::string threadStr = oss.str();
+    logf(threadStr, "Started worker");
+
+    while (server_.isRunning()) {
+        DWORD bytesTransferred;
+        ULONG_PTR key;
+        LPOVERLAPPED overlapped;
+
+        DWORD timeout = expireTimeouts(threadStr);
+        BOOL result = GetQueuedCompletionStatus(iocpHandle_, &bytesTransferred, &key, &overlapped, timeout);
+        logdebug(threadStr, "Completion status: ", result, ", bytesTransferred: ", bytesTransferred);
+        if (!result && overlapped == nullptr && GetLastError() == WAIT_TIMEOUT) {
+            continue;
+        }
+        if (!result && overlapped == nullptr) {
+            logf(threadStr, "Empty result..");
+            break;
+        }
+
+        if (overlapped == nullptr) {
+            logf(threadStr, "Shutdown signal received.");
+            break;
+        }
+
+        IOContext* context = CONTAINING_RECORD(overlapped, IOContext, overlapped);
+        context->pending = false;
+
+        switch (context->state) {
+            case IOType::ACCEPT:
+                if (!result) {
+                    logcerr(threadStr, "AcceptEx completion failed: ", GetLastError());
+                    delete static_cast<AcceptContext*>(context);
+                    postAccept(threadStr);
+                    break;
+                }
+                handleAccept(static_cast<AcceptContext*>(context), threadStr);
+                break;
+            case IOType::RECV:
+                server_.handleRecv(context->connection, context->connection->recvBuffer.data(), result ? bytesTransferred : 0, threadStr);
+                break;
+            case IOType::SEND:
+                if (!result) {
+                    closeConnection(context->connection);
+                    break;
+                }
+                server_.handleSend(context->connection, bytesTransferred, threadStr);
+                break;
+            default:
+                logcerr(threadStr, "Unknown IOType");
+                break;
+        }
+    }
+}
+
+
+void IocpEventLoop::wakeup() {
+    PostQueuedCompletionStatus(iocpHandle_, 0, 0, nullptr);
+}
+
+
+bool IocpEventLoop::postAccept(const std::string& threadStr) {
+    AcceptContext* context = new AcceptContext();
+    context->socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    if (context->socket == INVALID_SOCKET) {
+        logcerr(threadStr, "WSASocket() failed: ", WSAGetLastError());
+        delete context;
+        return false;
+    }
+
+    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
+
+    DWORD bytesReceived;
+    BOOL result = lpfnAcceptEx(
+        listenSocket_,
+        context->socket,
+        context->acceptBuffer,
+        0,
+        sizeof(SOCKADDR_IN) + 16,
+        sizeof(SOCKADDR_IN) + 16,
+        &bytesReceived,
+        &context->overlapped
+    );
+
+    if (!result && WSAGetLastError() != ERROR_IO_PENDING) {
+        logcerr(threadStr, "AcceptEx() failed: ", WSAGetLastError());
+        delete context;
+        return false;
+    }
+    return true;
+}
+
+
+void IocpEventLoop::handleAccept(AcceptContext* acceptContext, const std::string& threadStr) {
+    SOCKET clientSocket = acceptContext->socket;
+
+    if (setsockopt(clientSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                   (char*)&listenSocket_, sizeof(listenSocket_)) == SOCKET_ERROR) {
+        logcerr(threadStr, "setsockopt(SO_UPDATE_ACCEPT_CONTEXT) failed: ", WSAGetLastError());
+        delete acceptContext;
+        postAccept(threadStr);
+        return;
+    }
+
+    // Connection owns the socket from here on
+    acceptContext->socket = INVALID_SOCKET;
+    delete acceptContext;
+
+    server_.handleAccept(*this, clientSocket, threadStr);
+    postAccept(threadStr);
+}
+
+
+bool IocpEventLoop::addConnection(Connection* conn, const std::string& threadStr) {
+    if (CreateIoCompletionPort((HANDLE)conn->socket, iocpHandle_, (ULONG_PTR)conn, 0) == nullptr) {
+        logcerr(threadStr, "Failed to associate client socket with IOCP: ", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+
+bool IocpEventLoop::postRecv(Connection* conn, const std::string& threadStr) {
+    IOContext* context = conn->recvContext;
+    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
+    context->pending = true;
+
+    WSABUF wsaBuf;
+    wsaBuf.buf = conn->recvSpace();
+    wsaBuf.len = static_cast<ULONG>(conn->recvBuffer.size());
+
+    DWORD flags = 0;
+    DWORD bytesReceived = 0;
+
+    int result = WSARecv(
+        conn->socket,
+        &wsaBuf,
+        1,
+        &bytesReceived,
+        &flags,
+        &context->overlapped,
+        nullptr
+    );
+
+    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+        logcerr(threadStr, "WSARecv() failed: ", WSAGetLastError());
+        closeConnection(conn);
+        return false;
+    }
+    return true;
+}
+
+
+bool IocpEventLoop::postSend(Connection* conn, const std::string& threadStr) {
+    IOContext* context = conn->sendContext;
+    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
+    context->pending = true;
+
+    DWORD bufferCount = static_cast<DWORD>(conn->sendQueue.prepare(conn->sendOffset));
+
+    DWORD bytesSent = 0;
+    int result = WSASend(
+        conn->socket,
+        conn->sendQueue.segments(),
+        bufferCount,
+        &bytesSent,
+        0,
+        &context->overlapped,
+        nullptr
+    );
+    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
+        logcerr(threadStr, "WSASend() failed: ", WSAGetLastError());
+        closeConnection(conn);
+        return false;
+    }
+    return true;
+}
+
+
+void IocpEventLoop::closeConnection(Connection* conn) {
+    // Recv and send are never outstanding at the same time, only the timer wheel references conn
+    cancelTimeout(conn);
+    delete conn;
+}
+
+
+void IocpEventLoop::scheduleTimeout(Connection* conn, uint32_t timeoutMs) {
+    std::lock_guard<std::mutex> lock(timersMutex_);
+    timers_.schedule(&conn->timer, timeoutMs);
+}
+
+
+void IocpEventLoop::cancelTimeout(Connection* conn) {
+    std::lock_guard<std::mutex> lock(timersMutex_);
+    timers_.cancel(&conn->timer);
+}
+
+
+// Returns how long the worker may block until the next timeout is due
+DWORD IocpEventLoop::expireTimeouts(const std::string& threadStr) {
+    std::lock_guard<std::mutex> lock(timersMutex_);
+    uint64_t now = TimerWheel::clockMs();
+    timers_.advance(now, [&](Timer* timer) {
+        // conn can't be deleted while we hold the lock, closeConnection cancels the timer first
+        Connection* conn = static_cast<Connection*>(timer->owner);
+        logdebug(threadStr, "Connection timed out in phase ", static_cast<int>(conn->timeoutPhase));
+        CancelIoEx(reinterpret_cast<HANDLE>(conn->socket), nullptr);
+    });
+    int timeout = timers_.nextTimeoutMs(now);
+    return timeout < 0 ? INFINITE : static_cast<DWORD>(timeout);
+}
+
+
+void IocpEventLoop::initExtensions() {
+    GUID guidAcceptEx = WSAID_ACCEPTEX;
+    DWORD bytes = 0;
+
+    int result = WSAIoctl(
+        listenSocket_,
+        SIO_GET_EXTENSION_FUNCTION_POINTER,
+        &guidAcceptEx,
+        sizeof(guidAcceptEx),
+        &lpfnAcceptEx,
+        sizeof(lpfnAcceptEx),
+        &bytes,
+        nullptr,
+        nullptr
+    );
+
+    if (result == SOCKET_ERROR) {
+        logcerr("WSAIoctl() failed getting AcceptEx pointer: ", WSAGetLastError());
+        throw std::runtime_error("AcceptEx pointer is null!");
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <mutex>
+
+#include "EventLoop.hpp"
+#include "HTTPServer.hpp"
+
+
+struct AcceptContext : public IOContext {
+    SOCKET socket = INVALID_SOCKET;
+    char acceptBuffer[(sizeof(sockaddr_in) + 16) * 2];
+
+    AcceptContext() : IOContext(IOType::ACCEPT) {}
+    ~AcceptContext() {
+        if (socket != INVALID_SOCKET) {
+            closesocket(socket);
+        }
+    }
+
+    static void* operator new(size_t size) { return ObjectPool<AcceptContext>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<AcceptContext>::deallocate(p, size); }
+};
+
+
+/*
+Windows backend, single completion port shared by all worker threads.
+Accepts are pre-posted with AcceptEx and re-posted on every completion.
+
+Any worker may handle any connection, so the one timer wheel is shared under a mutex.
+Expired connections aren't closed from the timer, their pending I/O is cancelled and
+the failed completion closes them like any other error.
+*/
+class IocpEventLoop : public EventLoop {
+
+    public:
+        explicit IocpEventLoop(HTTPServer& server) : EventLoop(server) {}
+        ~IocpEventLoop() override;
+
+        void init(SOCKET listenSocket) override;
+
+        bool addConnection(Connection* conn, const std::string& threadStr) override;
+        bool postRecv(Connection* conn, const std::string& threadStr) override;
+        bool postSend(Connection* conn, const std::string& threadStr) override;
+        void closeConnection(Connection* conn) override;
+
+        void scheduleTimeout(Connection* conn, uint32_t timeoutMs) override;
+        void cancelTimeout(Connection* conn) override;
+
+        void run() override;
+        void wakeup() override;
+
+    private:
+        static constexpr int NUM_ACCEPTS = 10;
+
+        void initExtensions();
+        bool postAccept(const std::string& threadStr);
+        void handleAccept(AcceptContext* context, const std::string& threadStr);
+        DWORD expireTimeouts(const std::string& threadStr);
+
+        HANDLE iocpHandle_ = nullptr;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+        LPFN_ACCEPTEX lpfnAcceptEx = nullptr;  // AcceptEx func reference
+
+        std::mutex timersMutex_;
+        TimerWheel timers_;
+};
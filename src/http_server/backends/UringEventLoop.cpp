@@ -0,0 +1,589 @@
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <sstream>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <thread>
+
+#include "UringEventLoop.hpp"
+#include "log.hpp"
+
+
+static int ioUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int ioUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags,
+                        const void* arg = nullptr, size_t argSize = 0) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize));
+}
+
+static int ioUringRegister(int fd, unsigned opcode, void* arg, unsigned nrArgs) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, nrArgs));
+}
+
+static unsigned loadAcquire(const unsigned* p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void storeRelease(unsigned* p, unsigned v) { __atomic_store_n(p, v, __ATOMIC_RELEASE); }
+
+
+bool UringEventLoop::isSupported() {
+    // io_uring may be compiled out or disabled (kernel.io_uring_disabled, seccomp in containers)
+    io_uring_params params{};
+    int fd = ioUringSetup(4, &params);
+    if (fd < 0) {
+        logcerr("io_uring_setup() failed: ", strerror(errno));
+        return false;
+    }
+
+    // Provided buffer rings are the newest feature we rely on apart from multishot recv
+    size_t size = 2 * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    bool supported = false;
+    if (ring != MAP_FAILED) {
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(ring);
+        reg.ring_entries = 2;
+        supported = ioUringRegister(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+        if (!supported) {
+            logcerr("io_uring_register(PBUF_RING) failed: ", strerror(errno));
+        }
+        munmap(ring, size);
+    }
+    close(fd);
+    return supported;
+}
+
+
+UringEventLoop::UringEventLoop(HTTPServer& server) : EventLoop(server) {
+    setupRing();
+    setupBufferRing();
+
+    wakeupFd_ = eventfd(0, EFD_CLOEXEC);
+    if (wakeupFd_ == -1) {
+        logcerr("eventfd() failed: ", strerror(errno));
+        throw std::runtime_error("Failed to init io_uring wakeup fd");
+    }
+    submitWakeupRead();
+}
+
+
+UringEventLoop::~UringEventLoop() {
+    for (Connection* conn : closed_) {
+        delete conn;
+    }
+    if (wakeupFd_ != -1) close(wakeupFd_);
+    if (ringFd_ != -1) close(ringFd_);
+    if (buffers_ != nullptr) munmap(buffers_, static_cast<size_t>(NUM_BUFFERS) * RECV_BUFFER_SIZE);
+    if (bufRing_ != nullptr) munmap(bufRing_, bufRingSize_);
+    if (sqes_ != nullptr) munmap(sqes_, sqesSize_);
+    if (cqRing_ != nullptr && cqRing_ != sqRing_) munmap(cqRing_, cqRingSize_);
+    if (sqRing_ != nullptr) munmap(sqRing_, sqRingSize_);
+}
+
+
+void UringEventLoop::setupRing() {
+    io_uring_params params{};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = RING_ENTRIES * 4; // multishot ops produce many CQEs per SQE
+
+    ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+    if (ringFd_ < 0 && errno == EINVAL) {
+        // COOP_TASKRUN is 5.19+
+        params = {};
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = RING_ENTRIES * 4;
+        ringFd_ = ioUringSetup(RING_ENTRIES, &params);
+    }
+    if (ringFd_ < 0) {
+        logcerr("io_uring_setup() failed: ", strerror(errno));
+        throw std::runtime_error("Failed to init io_uring");
+    }
+
+    sqRingSize_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cqRingSize_ = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if (singleMmap) {
+        sqRingSize_ = cqRingSize_ = std::max(sqRingSize_, cqRingSize_);
+    }
+
+    sqRing_ = mmap(nullptr, sqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQ_RING);
+    if (sqRing_ == MAP_FAILED) {
+        sqRing_ = nullptr;
+        throw std::runtime_error("Failed to mmap io_uring SQ ring");
+    }
+    if (singleMmap) {
+        cqRing_ = sqRing_;
+    } else {
+        cqRing_ = mmap(nullptr, cqRingSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_CQ_RING);
+        if (cqRing_ == MAP_FAILED) {
+            cqRing_ = nullptr;
+            throw std::runtime_error("Failed to mmap io_uring CQ ring");
+        }
+    }
+
+    sqesSize_ = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, sqesSize_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd_, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        throw std::runtime_error("Failed to mmap io_uring SQEs");
+    }
+    sqes_ = static_cast<io_uring_sqe*>(sqes);
+
+    char* sq = static_cast<char*>(sqRing_);
+    sqHead_ = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+    sqTail_ = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+    sqArray_ = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+    sqMask_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+    sqEntries_ = *reinterpret_cast<unsigned*>(sq + params.sq_off.ring_entries);
+    sqLocalTail_ = *sqTail_;
+
+    char* cq = static_cast<char*>(cqRing_);
+    cqHead_ = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+    cqTail_ = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+    cqMask_ = *reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+}
+
+
+void UringEventLoop::setupBufferRing() {
+    bufRingSize_ = NUM_BUFFERS * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, bufRingSize_, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate io_uring buffer ring");
+    }
+    bufRing_ = static_cast<io_uring_buf_ring*>(ring);
+
+    void* buffers = mmap(nullptr, static_cast<size_t>(NUM_BUFFERS) * RECV_BUFFER_SIZE,
+                         PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (buffers == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate io_uring receive buffers");
+    }
+    buffers_ = static_cast<char*>(buffers);
+
+    io_uring_buf_reg reg{};
+    reg.ring_addr = reinterpret_cast<uint64_t>(bufRing_);
+    reg.ring_entries = NUM_BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (ioUringRegister(ringFd_, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+        logcerr("io_uring_register(PBUF_RING) failed: ", strerror(errno));
+        throw std::runtime_error("Failed to register io_uring buffer ring");
+    }
+
+    for (unsigned i = 0; i < NUM_BUFFERS; ++i) {
+        recycleBuffer(static_cast<uint16_t>(i));
+    }
+}
+
+
+void UringEventLoop::recycleBuffer(uint16_t bufferId) {
+    io_uring_buf* bufs = reinterpret_cast<io_uring_buf*>(bufRing_);
+    io_uring_buf& buf = bufs[bufTail_ & (NUM_BUFFERS - 1)];
+    buf.addr = reinterpret_cast<uint64_t>(buffers_ + static_cast<size_t>(bufferId) * RECV_BUFFER_SIZE);
+    buf.len = RECV_BUFFER_SIZE;
+    buf.bid = bufferId;
+    ++bufTail_;
+    __atomic_store_n(&bufRing_->tail, bufTail_, __ATOMIC_RELEASE);
+}
+
+
+void UringEventLoop::init(SOCKET listenSocket) {
+    listenSocket_ = listenSocket;
+    submitAccept();
+}
+
+
+io_uring_sqe* UringEventLoop::getSqe() {
+    // Queue full, push what we have to the kernel first. It may take none (EBUSY while
+    // completions are backed up, EAGAIN), without a free slot the caller fails the operation
+    for (int attempt = 0; sqLocalTail_ - loadAcquire(sqHead_) >= sqEntries_; ++attempt) {
+        if (attempt == SUBMIT_ATTEMPTS || !submitAndWait(0)) {
+            logcerr("io_uring submission queue full");
+            return nullptr;
+        }
+    }
+    unsigned index = sqLocalTail_ & sqMask_;
+    io_uring_sqe* sqe = &sqes_[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqArray_[index] = index;
+    ++sqLocalTail_;
+    storeRelease(sqTail_, sqLocalTail_);
+    ++toSubmit_;
+    return sqe;
+}
+
+
+bool UringEventLoop::submitAndWait(unsigned minComplete, int timeoutMs) {
+    unsigned flags = minComplete > 0 ? IORING_ENTER_GETEVENTS : 0;
+    int submitted;
+    if (minComplete > 0 && timeoutMs >= 0) {
+        // Bounded wait for the next connection timeout
+        __kernel_timespec ts{};
+        ts.tv_sec = timeoutMs / 1000;
+        ts.tv_nsec = (timeoutMs % 1000) * 1000000LL;
+        io_uring_getevents_arg arg{};
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = reinterpret_cast<uint64_t>(&ts);
+        submitted = ioUringEnter(ringFd_, toSubmit_, minComplete, flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+    } else {
+        submitted = ioUringEnter(ringFd_, toSubmit_, minComplete, flags);
+    }
+    if (submitted < 0) {
+        if (errno == ETIME || errno == EINTR || errno == EAGAIN || errno == EBUSY) {
+            return true;
+        }
+        logcerr("io_uring_enter() failed: ", strerror(errno));
+        return false;
+    }
+    toSubmit_ -= static_cast<unsigned>(submitted);
+    return true;
+}
+
+
+void UringEventLoop::submitAccept() {
+    io_uring_sqe* sqe = getSqe();
+    acceptDeferred_ = sqe == nullptr;
+    if (sqe == nullptr) return;
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listenSocket_;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = ACCEPT_TAG;
+}
+
+
+void UringEventLoop::submitWakeupRead() {
+    io_uring_sqe* sqe = getSqe();
+    wakeupDeferred_ = sqe == nullptr;
+    if (sqe == nullptr) return;
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeupFd_;
+    sqe->addr = reinterpret_cast<uint64_t>(&wakeupValue_);
+    sqe->len = sizeof(wakeupValue_);
+    sqe->user_data = WAKEUP_TAG;
+}
+
+
+bool UringEventLoop::submitRecv(Connection* conn) {
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr) {
+        closeConnection(conn);
+        return false;
+    }
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = conn->socket;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->user_data = reinterpret_cast<uint64_t>(conn->recvContext);
+    conn->recvContext->inFlight = true;
+    return true;
+}
+
+
+void UringEventLoop::submitCancel(Connection* conn) {
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr) {
+        // The recv would go on parking without a limit
+        closeConnection(conn);
+        return;
+    }
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = reinterpret_cast<uint64_t>(conn->recvContext);
+    sqe->user_data = CANCEL_TAG;
+}
+
+
+bool UringEventLoop::submitSend(Connection* conn) {
+    io_uring_sqe* sqe = getSqe();
+    if (sqe == nullptr) {
+        closeConnection(conn);
+        return false;
+    }
+    conn->sendMsg = msghdr{};
+    conn->sendMsg.msg_iovlen = conn->sendQueue.prepare(conn->sendOffset);
+    conn->sendMsg.msg_iov = conn->sendQueue.segments();
+
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = conn->socket;
+    sqe->addr = reinterpret_cast<uint64_t>(&conn->sendMsg);
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL;
+    sqe->user_data = reinterpret_cast<uint64_t>(conn->sendContext);
+    conn->sendContext->inFlight = true;
+    return true;
+}
+
+
+void UringEventLoop::run() {
+    std::ostringstream oss;
+    oss << "[Thread " << std::this_thread::get_id() << "] ";
+    std::string threadStr = oss.str();
+    logf(threadStr, "Started worker");
+
+    while (server_.isRunning()) {
+        // Submit everything queued last iteration and wait, unless there's work left to deliver
+        bool wait = ready_.empty();
+        if (!submitAndWait(wait ? 1 : 0, wait ? timers_.nextTimeoutMs(TimerWheel::clockMs()) : -1)) {
+            break;
+        }
+
+        reapCompletions(threadStr);
+
+        for (size_t i = 0; i < ready_.size(); ++i) {
+            deliverParked(ready_[i], threadStr);
+        }
+        ready_.clear();
+
+        for (Connection* conn : starved_) {
+            if (!conn->closed && !conn->recvContext->inFlight && conn->recvBuffer.size() < MAX_PARKED_BYTES) {
+                submitRecv(conn);
+            }
+        }
+        starved_.clear();
+
+        // Found the SQ full last time, it has been flushed since
+        if (acceptDeferred_ && server_.isRunning()) {
+            submitAccept();
+        }
+        if (wakeupDeferred_ && server_.isRunning()) {
+            submitWakeupRead();
+        }
+
+        timers_.advance(TimerWheel::clockMs(), [&](Timer* timer) {
+            server_.handleTimeout(static_cast<Connection*>(timer->owner), threadStr);
+        });
+
+        for (Connection* conn : closed_) {
+            delete conn;
+        }
+        closed_.clear();
+    }
+    logf(threadStr, "Shutdown signal received.");
+}
+
+
+void UringEventLoop::wakeup() {
+    uint64_t value = 1;
+    if (write(wakeupFd_, &value, sizeof(value)) == -1) {
+        logcerr("eventfd write failed: ", strerror(errno));
+    }
+}
+
+
+void UringEventLoop::reapCompletions(const std::string& threadStr) {
+    unsigned head = *cqHead_;
+    unsigned tail = loadAcquire(cqTail_);
+
+    while (head != tail) {
+        const io_uring_cqe& cqe = cqes_[head & cqMask_];
+
+        if (cqe.user_data == ACCEPT_TAG) {
+            handleAcceptCompletion(cqe, threadStr);
+        } else if (cqe.user_data == WAKEUP_TAG) {
+            if (server_.isRunning()) {
+                submitWakeupRead();
+            }
+        } else if (cqe.user_data == CANCEL_TAG) {
+            // The cancelled recv reports on its own CQE
+        } else {
+            IOContext* context = reinterpret_cast<IOContext*>(cqe.user_data);
+            if (context->state == IOType::RECV) {
+                handleRecvCompletion(context->connection, cqe, threadStr);
+            } else {
+                handleSendCompletion(context->connection, cqe, threadStr);
+            }
+        }
+
+        ++head;
+        // Handlers may queue SQEs, flushing a full SQ doesn't touch the CQ so it's fine to
+        // keep going, but publish the head regularly so the kernel has room for more CQEs
+        storeRelease(cqHead_, head);
+        if (head == tail) {
+            tail = loadAcquire(cqTail_);
+        }
+    }
+}
+
+
+void UringEventLoop::handleAcceptCompletion(const io_uring_cqe& cqe, const std::string& threadStr) {
+    if (cqe.res >= 0) {
+        server_.handleAccept(*this, cqe.res, threadStr);
+    } else if (cqe.res != -ECANCELED) {
+        logcerr(threadStr, "multishot accept failed: ", strerror(-cqe.res));
+    }
+
+    if (!(cqe.flags & IORING_CQE_F_MORE) && server_.isRunning()) {
+        submitAccept();
+    }
+}
+
+
+void UringEventLoop::handleRecvCompletion(Connection* conn, const io_uring_cqe& cqe, const std::string& threadStr) {
+    bool more = cqe.flags & IORING_CQE_F_MORE;
+    if (!more) {
+        conn->recvContext->inFlight = false;
+    }
+
+    const char* data = nullptr;
+    uint16_t bufferId = 0;
+    bool hasBuffer = cqe.flags & IORING_CQE_F_BUFFER;
+    if (hasBuffer) {
+        bufferId = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+        data = buffers_ + static_cast<size_t>(bufferId) * RECV_BUFFER_SIZE;
+    }
+
+    if (conn->closed) {
+        if (hasBuffer) recycleBuffer(bufferId);
+        releaseIfIdle(conn);
+        return;
+    }
+
+    if (cqe.res > 0) {
+        size_t len = static_cast<size_t>(cqe.res);
+        if (conn->recvContext->pending && conn->recvBuffer.empty()) {
+            conn->recvContext->pending = false;
+            server_.handleRecv(conn, data, len, threadStr);
+        } else {
+            // Server is still busy with the previous request, park the data. Past the cap the
+            // recv is stopped and the client has to wait, as it would for epoll's next recv
+            bool underCap = conn->recvBuffer.size() < MAX_PARKED_BYTES;
+            conn->recvBuffer.insert(conn->recvBuffer.end(), data, data + len);
+            if (more && underCap && conn->recvBuffer.size() >= MAX_PARKED_BYTES) {
+                submitCancel(conn);
+            }
+        }
+        recycleBuffer(bufferId);
+        if (!more && !conn->closed && conn->recvBuffer.size() < MAX_PARKED_BYTES) {
+            submitRecv(conn);
+        }
+    } else if (cqe.res == 0) {
+        conn->peerClosed = true;
+        if (conn->recvContext->pending) {
+            ready_.push_back(conn);
+        }
+    } else if (cqe.res == -ENOBUFS) {
+        // Every provided buffer is in use, try again once this iteration has returned some
+        starved_.push_back(conn);
+    } else if (cqe.res == -ECANCELED) {
+        // Stopped at the parking cap, deliverParked() re-arms it unless it already ran
+        if (conn->recvBuffer.size() < MAX_PARKED_BYTES) {
+            submitRecv(conn);
+        }
+    } else {
+        if (cqe.res != -ECONNRESET) {
+            logcerr(threadStr, "recv failed: ", strerror(-cqe.res));
+        }
+        closeConnection(conn);
+    }
+}
+
+
+void UringEventLoop::handleSendCompletion(Connection* conn, const io_uring_cqe& cqe, const std::string& threadStr) {
+    conn->sendContext->inFlight = false;
+
+    if (conn->closed) {
+        releaseIfIdle(conn);
+        return;
+    }
+
+    if (cqe.res < 0) {
+        if (cqe.res != -EPIPE && cqe.res != -ECONNRESET) {
+            logcerr(threadStr, "send failed: ", strerror(-cqe.res));
+        }
+        closeConnection(conn);
+        return;
+    }
+
+    conn->sendContext->pending = false;
+    server_.handleSend(conn, static_cast<size_t>(cqe.res), threadStr);
+}
+
+
+void UringEventLoop::deliverParked(Connection* conn, const std::string& threadStr) {
+    if (conn->closed || !conn->recvContext->pending) return;
+
+    if (!conn->recvBuffer.empty()) {
+        // A recv's worth at a time, the responses to everything parked would pile up
+        // in the send queue otherwise
+        size_t len = std::min(conn->recvBuffer.size(), MAX_PARKED_BYTES);
+        conn->recvContext->pending = false;
+        server_.handleRecv(conn, conn->recvBuffer.data(), len, threadStr);
+        if (conn->closed) return;
+
+        if (len == conn->recvBuffer.size()) {
+            // Parking is the exception, don't keep the memory around
+            std::vector<char>().swap(conn->recvBuffer);
+        } else {
+            conn->recvBuffer.erase(conn->recvBuffer.begin(), conn->recvBuffer.begin() + static_cast<std::ptrdiff_t>(len));
+        }
+        if (!conn->recvContext->inFlight && !conn->peerClosed && conn->recvBuffer.size() < MAX_PARKED_BYTES) {
+            submitRecv(conn);
+        }
+    } else if (conn->peerClosed) {
+        conn->recvContext->pending = false;
+        server_.handleRecv(conn, nullptr, 0, threadStr);
+    }
+}
+
+
+bool UringEventLoop::addConnection(Connection* conn, const std::string& threadStr) {
+    // Nothing to register, the recv posted next arms the multishot recv
+    (void)conn;
+    (void)threadStr;
+    return true;
+}
+
+
+bool UringEventLoop::postRecv(Connection* conn, const std::string& threadStr) {
+    (void)threadStr;
+    if (conn->closed) return false;
+
+    conn->recvContext->pending = true;
+    if (!conn->recvBuffer.empty() || conn->peerClosed) {
+        ready_.push_back(conn);
+    } else if (!conn->recvContext->inFlight) {
+        return submitRecv(conn);
+    }
+    return true;
+}
+
+
+bool UringEventLoop::postSend(Connection* conn, const std::string& threadStr) {
+    (void)threadStr;
+    if (conn->closed) return false;
+
+    conn->sendContext->pending = true;
+    return submitSend(conn);
+}
+
+
+void UringEventLoop::closeConnection(Connection* conn) {
+    if (conn->closed) return;
+    conn->closed = true;
+    timers_.cancel(&conn->timer);
+    // Terminates the multishot recv and any in flight send, conn is released after their CQEs
+    shutdown(conn->socket, SHUT_RDWR);
+    releaseIfIdle(conn);
+}
+
+
+void UringEventLoop::scheduleTimeout(Connection* conn, uint32_t timeoutMs) {
+    timers_.schedule(&conn->timer, timeoutMs);
+}
+
+
+void UringEventLoop::cancelTimeout(Connection* conn) {
+    timers_.cancel(&conn->timer);
+}
+
+
+void UringEventLoop::releaseIfIdle(Connection* conn) {
+    if (conn->socket == INVALID_SOCKET) return; // already released
+    if (conn->recvContext->inFlight || conn->sendContext->inFlight) return;
+
+    closesocket(conn->socket);
+    conn->socket = INVALID_SOCKET;
+    closed_.push_back(conn);
+}
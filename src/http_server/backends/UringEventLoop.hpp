@@ -0,0 +1,131 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <linux/io_uring.h>
+
+#include "EventLoop.hpp"
+#include "HTTPServer.hpp"
+
+
+/*
+Linux io_uring backend, one ring per worker thread.
+
+Talks to the kernel with the raw syscalls, no liburing dependency.
+- A single multishot accept per loop replaces the pre-posted AcceptEx calls.
+- Every connection gets one multishot recv that picks buffers from a ring of kernel
+  provided buffers shared by the loop, so idle connections hold no receive memory.
+  Buffers go back to the ring as soon as the server has handled the data.
+- SQEs are only queued while handling completions, everything queued during an
+  iteration is submitted together with the wait for the next completions. A full SQ
+  is submitted early, if the kernel takes none a recv or send fails and closes its
+  connection, the accept and wakeup read are retried next iteration.
+
+Multishot recv keeps delivering while the server is busy sending, such data is parked
+in Connection::recvBuffer until the server posts its next recv, which gets at most
+MAX_PARKED_BYTES of it. Past MAX_PARKED_BYTES the recv is cancelled and only re-armed
+once the server has taken the parked data, a client that doesn't read its responses
+is held back like on epoll.
+Connections are deleted only after the kernel has completed every operation on them.
+Connection timeouts live in the loop's timer wheel, the wait for completions is
+bounded by the next one (IORING_ENTER_EXT_ARG).
+
+Needs kernel 6.0+ (multishot recv, provided buffer rings).
+*/
+class UringEventLoop : public EventLoop {
+
+    public:
+        explicit UringEventLoop(HTTPServer& server);
+        ~UringEventLoop() override;
+
+        static bool isSupported();
+
+        void init(SOCKET listenSocket) override;
+
+        bool addConnection(Connection* conn, const std::string& threadStr) override;
+        bool postRecv(Connection* conn, const std::string& threadStr) override;
+        bool postSend(Connection* conn, const std::string& threadStr) override;
+        void closeConnection(Connection* conn) override;
+
+        void scheduleTimeout(Connection* conn, uint32_t timeoutMs) override;
+        void cancelTimeout(Connection* conn) override;
+
+        void run() override;
+        void wakeup() override;
+
+    private:
+        static constexpr unsigned RING_ENTRIES = 1024;
+        static constexpr unsigned NUM_BUFFERS = 1024;   // power of two
+        static constexpr unsigned RECV_BUFFER_SIZE = 4096;
+        static constexpr uint16_t BUFFER_GROUP = 0;
+        static constexpr size_t MAX_PARKED_BYTES = 64 * 1024;
+
+        static constexpr uint64_t ACCEPT_TAG = 1;
+        static constexpr uint64_t WAKEUP_TAG = 2;
+        static constexpr uint64_t CANCEL_TAG = 3;
+
+        static constexpr int SUBMIT_ATTEMPTS = 3;   // for a slot in a full SQ
+
+        void setupRing();
+        void setupBufferRing();
+
+        io_uring_sqe* getSqe();
+        bool submitAndWait(unsigned minComplete, int timeoutMs = -1);
+        void reapCompletions(const std::string& threadStr);
+
+        void submitAccept();
+        void submitWakeupRead();
+        // Without an SQE the connection is closed
+        bool submitRecv(Connection* conn);
+        bool submitSend(Connection* conn);
+        void submitCancel(Connection* conn);
+
+        void handleAcceptCompletion(const io_uring_cqe& cqe, const std::string& threadStr);
+        void handleRecvCompletion(Connection* conn, const io_uring_cqe& cqe, const std::string& threadStr);
+        void handleSendCompletion(Connection* conn, const io_uring_cqe& cqe, const std::string& threadStr);
+        void deliverParked(Connection* conn, const std::string& threadStr);
+
+        void recycleBuffer(uint16_t bufferId);
+        void releaseIfIdle(Connection* conn);
+
+        int ringFd_ = -1;
+
+        // Submission queue
+        void* sqRing_ = nullptr;
+        size_t sqRingSize_ = 0;
+        unsigned* sqHead_ = nullptr;
+        unsigned* sqTail_ = nullptr;
+        unsigned* sqArray_ = nullptr;
+        unsigned sqMask_ = 0;
+        unsigned sqEntries_ = 0;
+        io_uring_sqe* sqes_ = nullptr;
+        size_t sqesSize_ = 0;
+        unsigned sqLocalTail_ = 0;
+        unsigned toSubmit_ = 0;
+
+        // Completion queue
+        void* cqRing_ = nullptr;
+        size_t cqRingSize_ = 0;
+        unsigned* cqHead_ = nullptr;
+        unsigned* cqTail_ = nullptr;
+        unsigned cqMask_ = 0;
+        io_uring_cqe* cqes_ = nullptr;
+
+        // Provided buffers
+        io_uring_buf_ring* bufRing_ = nullptr;
+        size_t bufRingSize_ = 0;
+        char* buffers_ = nullptr;
+        uint16_t bufTail_ = 0;
+
+        TimerWheel timers_;
+
+        int wakeupFd_ = -1;
+        uint64_t wakeupValue_ = 0;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+
+        std::vector<Connection*> ready_;    // posted recv with parked data or EOF to deliver
+        std::vector<Connection*> starved_;  // recv stopped on ENOBUFS, re-armed after buffers return
+        std::vector<Connection*> closed_;   // deleted at the end of the loop iteration
+        bool acceptDeferred_ = false;       // no SQE was free for them, retried next iteration
+        bool wakeupDeferred_ = false;
+};
@@ -0,0 +1,274 @@
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+/*
+Keep-alive HTTP load generator for benchmarking http_server on Linux.
+
+http_loadgen [--host=127.0.0.1] [--port=8080] [--connections=64] [--threads=1]
+             [--duration=10] [--pipeline=1] [--path=/customers/1] [--reconnect]
+
+Every connection sends --pipeline requests back to back, waits for all of the responses
+and repeats. Latency is measured per batch.
+--reconnect opens a new connection for every batch (connection storm).
+*/
+
+using Clock = std::chrono::steady_clock;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    int port = 8080;
+    size_t connections = 64;
+    size_t threads = 1;
+    double duration = 10.0;
+    size_t pipeline = 1;
+    std::string path = "/customers/1";
+    bool reconnect = false;
+};
+
+struct ClientConnection {
+    int fd = -1;
+    std::string sendData;
+    size_t sendOffset = 0;
+    std::string recvData;
+    size_t outstanding = 0;
+    Clock::time_point batchStart;
+};
+
+struct ThreadResult {
+    size_t responses = 0;
+    size_t errors = 0;
+    std::vector<double> latenciesUs;
+};
+
+
+static bool startsWith(const std::string& s, const char* prefix) {
+    return s.rfind(prefix, 0) == 0;
+}
+
+static Options parseOptions(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        std::string value = arg.substr(arg.find('=') + 1);
+        if (startsWith(arg, "--host=")) options.host = value;
+        else if (startsWith(arg, "--port=")) options.port = std::stoi(value);
+        else if (startsWith(arg, "--connections=")) options.connections = std::stoul(value);
+        else if (startsWith(arg, "--threads=")) options.threads = std::stoul(value);
+        else if (startsWith(arg, "--duration=")) options.duration = std::stod(value);
+        else if (startsWith(arg, "--pipeline=")) options.pipeline = std::max<size_t>(1, std::stoul(value));
+        else if (startsWith(arg, "--path=")) options.path = value;
+        else if (arg == "--reconnect") options.reconnect = true;
+        else {
+            std::cerr << "Unknown option: " << arg << std::endl;
+            exit(1);
+        }
+    }
+    return options;
+}
+
+
+static int connectTo(const Options& options) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) return -1;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(options.port));
+    addr.sin_addr.s_addr = inet_addr(options.host.c_str());
+    if (connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1 && errno != EINPROGRESS) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+
+// Returns the length of the complete response starting at offset, 0 if incomplete
+static size_t completeResponseLength(const std::string& data, size_t offset, bool& serverCloses) {
+    size_t headerEnd = data.find("\r\n\r\n", offset);
+    if (headerEnd == std::string::npos) return 0;
+
+    size_t contentLength = 0;
+    size_t pos = offset;
+    while (pos < headerEnd) {
+        size_t lineEnd = data.find("\r\n", pos);
+        if (lineEnd - pos > 15 && strncasecmp(data.c_str() + pos, "Content-Length:", 15) == 0) {
+            contentLength = std::stoul(data.substr(pos + 15, lineEnd - pos - 15));
+        } else if (lineEnd - pos == 17 && strncasecmp(data.c_str() + pos, "Connection: close", 17) == 0) {
+            serverCloses = true;
+        }
+        pos = lineEnd + 2;
+    }
+    size_t end = headerEnd + 4 + contentLength;
+    return data.size() >= end ? end - offset : 0;
+}
+
+
+static void startBatch(ClientConnection& conn, const std::string& batch) {
+    conn.sendData = batch;
+    conn.sendOffset = 0;
+    conn.outstanding = 0;
+    conn.batchStart = Clock::now();
+}
+
+// Returns false if the connection failed
+static bool flushSend(ClientConnection& conn, size_t pipeline) {
+    while (conn.sendOffset < conn.sendData.size()) {
+        ssize_t n = send(conn.fd, conn.sendData.data() + conn.sendOffset,
+                         conn.sendData.size() - conn.sendOffset, MSG_NOSIGNAL);
+        if (n < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        conn.sendOffset += static_cast<size_t>(n);
+    }
+    if (conn.outstanding == 0) conn.outstanding = pipeline;
+    return true;
+}
+
+
+static void runThread(const Options& options, size_t numConnections, std::atomic<bool>& running, ThreadResult& result) {
+    std::string request = "GET " + options.path + " HTTP/1.1\r\nHost: " + options.host + "\r\n\r\n";
+    std::string batch;
+    for (size_t i = 0; i < options.pipeline; ++i) batch += request;
+
+    int epollFd = epoll_create1(EPOLL_CLOEXEC);
+    std::vector<ClientConnection> conns(numConnections);
+
+    auto open = [&](size_t index) {
+        ClientConnection& conn = conns[index];
+        conn = ClientConnection{};
+        conn.fd = connectTo(options);
+        if (conn.fd == -1) {
+            ++result.errors;
+            return;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN | EPOLLOUT | EPOLLET;
+        event.data.u64 = index;
+        epoll_ctl(epollFd, EPOLL_CTL_ADD, conn.fd, &event);
+        startBatch(conn, batch);
+    };
+    auto reopen = [&](size_t index) {
+        close(conns[index].fd);
+        open(index);
+    };
+
+    for (size_t i = 0; i < numConnections; ++i) open(i);
+
+    std::vector<epoll_event> events(256);
+    char buffer[16384];
+    while (running) {
+        int n = epoll_wait(epollFd, events.data(), static_cast<int>(events.size()), 100);
+        for (int i = 0; i < n; ++i) {
+            size_t index = events[i].data.u64;
+            ClientConnection& conn = conns[index];
+
+            if (events[i].events & (EPOLLERR | EPOLLHUP) || !flushSend(conn, options.pipeline)) {
+                ++result.errors;
+                reopen(index);
+                continue;
+            }
+            if (!(events[i].events & EPOLLIN)) continue;
+
+            bool failed = false;
+            while (true) {
+                ssize_t received = recv(conn.fd, buffer, sizeof(buffer), 0);
+                if (received > 0) {
+                    conn.recvData.append(buffer, static_cast<size_t>(received));
+                    continue;
+                }
+                failed = received == 0 || (errno != EAGAIN && errno != EWOULDBLOCK);
+                break;
+            }
+
+            size_t consumed = 0;
+            bool batchDone = false;
+            bool serverCloses = false;
+            while (size_t len = completeResponseLength(conn.recvData, consumed, serverCloses)) {
+                consumed += len;
+                ++result.responses;
+                if (conn.outstanding > 0 && --conn.outstanding == 0) {
+                    auto elapsed = std::chrono::duration<double, std::micro>(Clock::now() - conn.batchStart);
+                    result.latenciesUs.push_back(elapsed.count());
+                    batchDone = true;
+                    if (options.reconnect || serverCloses) break;
+                    startBatch(conn, batch);
+                    if (!flushSend(conn, options.pipeline)) failed = true;
+                }
+            }
+            conn.recvData.erase(0, consumed);
+
+            // Keep-alive limit reached, not an error. With pipelining the limit can land
+            // in the middle of a batch, the rest of it is simply not answered
+            if ((batchDone && options.reconnect) || serverCloses) {
+                reopen(index);
+            } else if (failed) {
+                ++result.errors;
+                reopen(index);
+            }
+        }
+    }
+
+    for (auto& conn : conns) {
+        if (conn.fd != -1) close(conn.fd);
+    }
+    close(epollFd);
+}
+
+
+int main(int argc, char* argv[]) {
+    Options options = parseOptions(argc, argv);
+    options.threads = std::max<size_t>(1, std::min(options.threads, options.connections));
+
+    std::atomic<bool> running = true;
+    std::vector<ThreadResult> results(options.threads);
+    std::vector<std::thread> threads;
+
+    auto start = Clock::now();
+    for (size_t i = 0; i < options.threads; ++i) {
+        size_t share = options.connections / options.threads + (i < options.connections % options.threads ? 1 : 0);
+        threads.emplace_back(runThread, std::cref(options), share, std::ref(running), std::ref(results[i]));
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(options.duration));
+    running = false;
+    for (auto& t : threads) t.join();
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+    size_t responses = 0;
+    size_t errors = 0;
+    std::vector<double> latencies;
+    for (auto& r : results) {
+        responses += r.responses;
+        errors += r.errors;
+        latencies.insert(latencies.end(), r.latenciesUs.begin(), r.latenciesUs.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&](double p) {
+        if (latencies.empty()) return 0.0;
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(p * static_cast<double>(latencies.size())))];
+    };
+
+    std::cout << "connections: " << options.connections << ", pipeline: " << options.pipeline
+              << ", threads: " << options.threads << std::endl;
+    std::cout << "requests/sec: " << static_cast<size_t>(static_cast<double>(responses) / seconds)
+              << " (" << responses << " responses, " << errors << " errors)" << std::endl;
+    std::cout << "batch latency us: p50 " << percentile(0.50) << ", p99 " << percentile(0.99)
+              << ", max " << (latencies.empty() ? 0.0 : latencies.back()) << std::endl;
+    return 0;
+}
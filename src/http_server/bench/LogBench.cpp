@@ -0,0 +1,76 @@
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+
+/*
+Completion logging throughput: the old mutex + std::endl logger vs. the async logger
+vs. a level that is compiled out.
+Every worker logs the line the IOCP loop used to log for every completion.
+
+log_bench [threads] [messages per thread] > /dev/null
+Log lines go to stdout, results to stderr.
+*/
+
+namespace legacy {
+
+    // log.hpp before the async logger
+    std::mutex logMutex;
+
+    template <typename... Args>
+    void logf(Args&&... args) {
+        std::lock_guard<std::mutex> lock(logMutex);
+        (std::cout << ... << std::forward<Args>(args)) << std::endl;
+    }
+}
+
+
+template <typename LogFunc>
+static void run(const char* name, size_t nThreads, size_t messages, LogFunc logFunc) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < nThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            std::ostringstream oss;
+            oss << "[Thread " << t << "] ";
+            std::string threadStr = oss.str();
+            for (size_t i = 0; i < messages; ++i) {
+                logFunc(threadStr, i);
+            }
+        });
+    }
+    for (auto& t : threads) t.join();
+    logFlush();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::cerr << name << ": " << static_cast<size_t>(static_cast<double>(nThreads * messages) / seconds)
+              << " completions/s (" << seconds << " s)" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t nThreads = argc > 1 ? std::stoul(argv[1]) : 2;
+    size_t messages = argc > 2 ? std::stoul(argv[2]) : 500000;
+
+    std::cerr << nThreads << " threads x " << messages << " completions" << std::endl;
+
+    run("mutex + endl", nThreads, messages, [](const std::string& threadStr, size_t i) {
+        legacy::logf(threadStr, "Completion status: ", 1, ", bytesTransferred: ", i);
+    });
+    run("async logf  ", nThreads, messages, [](const std::string& threadStr, size_t i) {
+        logf(threadStr, "Completion status: ", 1, ", bytesTransferred: ", i);
+    });
+    run("logdebug    ", nThreads, messages, [](const std::string& threadStr, size_t i) {
+        logdebug(threadStr, "Completion status: ", 1, ", bytesTransferred: ", i);
+    });
+    if (COMPILED_LOG_LEVEL == LogLevel::Debug) {
+        std::cerr << "(built with HTTP_SERVER_LOG_LEVEL=0, logdebug is compiled in)" << std::endl;
+    }
+    return 0;
+}
@@ -0,0 +1,111 @@
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "HTTPParser.hpp"
+
+/*
+Single core requests/sec of HTTPRequestParser vs. the old istringstream based parseHTTPRequest.
+The old parser is kept here as-is (minus logging) only for comparison.
+*/
+
+struct LegacyHTTPRequest {
+    std::string method;
+    std::string path;
+    std::string version;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+};
+
+static LegacyHTTPRequest legacyParseHTTPRequest(const std::string& rawRequest) {
+    LegacyHTTPRequest req;
+
+    std::istringstream stream(rawRequest);
+    std::string line;
+
+    if (std::getline(stream, line)) {
+        std::istringstream lineStream(line);
+        lineStream >> req.method >> req.path >> req.version;
+    }
+
+    while(std::getline(stream, line) && line != "\r") {
+        auto colon = line.find(':');
+        if (colon != std::string::npos) {
+            std::string key = line.substr(0, colon);
+            std::string value = line.substr(colon + 1);
+
+            key.erase(key.find_last_not_of(" \r\n") + 1);
+            value.erase(0, value.find_first_not_of(" "));
+            value.erase(value.find_last_not_of(" \r\n") + 1);
+            req.headers.emplace_back(key, value);
+        }
+    }
+    std::stringstream ss;
+    for (const auto& [key, value] : req.headers) {
+        ss << key << ": " << value << "\n";
+    }
+
+    std::getline(stream, req.body, '\0');
+    return req;
+}
+
+
+static const std::string REQUEST =
+    "POST /customers/12345 HTTP/1.1\r\n"
+    "Host: localhost:8080\r\n"
+    "User-Agent: bench/1.0\r\n"
+    "Accept: */*\r\n"
+    "Accept-Encoding: gzip, deflate\r\n"
+    "Connection: keep-alive\r\n"
+    "Content-Type: application/json\r\n"
+    "Content-Length: 27\r\n"
+    "\r\n"
+    "{\"name\": \"bench customer\"}\n";
+
+
+template <typename Func>
+static void runBench(const char* name, size_t iterations, Func&& func) {
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink += func();
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    std::cout << name << ": " << static_cast<size_t>(static_cast<double>(iterations) / seconds)
+              << " req/s (" << seconds << " s, sink " << sink << ")" << std::endl;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t iterations = 1000000;
+    if (argc >= 2) iterations = std::stoul(argv[1]);
+
+    runBench("legacy parseHTTPRequest", iterations, [] {
+        LegacyHTTPRequest req = legacyParseHTTPRequest(REQUEST);
+        return req.headers.size() + req.body.size();
+    });
+
+    HTTPRequestParser parser;
+    HTTPRequest req;
+    runBench("HTTPRequestParser (whole)", iterations, [&] {
+        parser.reset();
+        if (parser.parse(REQUEST.data(), REQUEST.size(), req) != ParseResult::Complete) return size_t(0);
+        return req.headers.size() + req.body.size();
+    });
+
+    // Same request arriving in 64 byte pieces, parser resumes on each call
+    runBench("HTTPRequestParser (64 B segments)", iterations, [&] {
+        parser.reset();
+        for (size_t len = 64; ; len += 64) {
+            size_t available = std::min(len, REQUEST.size());
+            ParseResult result = parser.parse(REQUEST.data(), available, req);
+            if (result != ParseResult::NeedMore) break;
+        }
+        return req.headers.size() + req.body.size();
+    });
+
+    return 0;
+}
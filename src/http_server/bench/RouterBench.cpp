@@ -0,0 +1,143 @@
+#include <chrono>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Router.hpp"
+
+/*
+Route lookups/sec with 10, 100 and 1000 routes, segment trie Router vs. the old
+per-request regex scan (kept here only for comparison, copies the request per route like it used to).
+*/
+
+struct LegacyRequest {
+    std::string method;
+    std::string path;
+    std::vector<std::pair<std::string, std::string>> headers;
+    std::string body;
+    std::unordered_map<std::string, std::string> pathParams;
+};
+
+class LegacyRouter {
+    public:
+        using Handler = std::function<void(const LegacyRequest&, HTTPResponse&)>;
+
+        void add(const std::string& method, const std::string& path, Handler handler) {
+            std::string pathRegex = "^";
+            std::vector<std::string> paramNames;
+            size_t start = 1;
+            while (start < path.size()) {
+                size_t end = path.find('/', start);
+                if (end == std::string::npos) end = path.size();
+                std::string segment = path.substr(start, end - start);
+                if (segment.front() == '{') {
+                    paramNames.push_back(segment.substr(1, segment.size() - 2));
+                    pathRegex += "/([^/]+)";
+                } else {
+                    pathRegex += "/" + segment;
+                }
+                start = end + 1;
+            }
+            routes[method].push_back(Entry{std::regex(pathRegex), paramNames, handler});
+        }
+
+        bool handle(const LegacyRequest& request, HTTPResponse& response) {
+            auto it = routes.find(request.method);
+            if (it == routes.end()) return false;
+            for (const auto& entry : it->second) {
+                std::smatch match;
+                LegacyRequest requestWithParams = request;
+                if (std::regex_match(request.path, match, entry.pathRegex)) {
+                    for (size_t i = 0; i < entry.paramNames.size(); ++i) {
+                        requestWithParams.pathParams[entry.paramNames[i]] = match[i + 1];
+                    }
+                    entry.handler(requestWithParams, response);
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        struct Entry {
+            std::regex pathRegex;
+            std::vector<std::string> paramNames;
+            Handler handler;
+        };
+        std::unordered_map<std::string, std::vector<Entry>> routes;
+};
+
+
+static std::string routeTemplate(size_t i) {
+    std::string base = "/api/v1/resource" + std::to_string(i);
+    switch (i % 3) {
+        case 0: return base;
+        case 1: return base + "/{id}";
+        default: return base + "/{id}/items/{itemId}";
+    }
+}
+
+static std::string routePath(size_t i) {
+    std::string base = "/api/v1/resource" + std::to_string(i);
+    switch (i % 3) {
+        case 0: return base;
+        case 1: return base + "/42";
+        default: return base + "/42/items/7";
+    }
+}
+
+
+template <typename Func>
+static double runBench(size_t iterations, Func&& func) {
+    size_t sink = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink += func(i);
+    }
+    auto end = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(end - start).count();
+    if (sink == 0) std::cout << "no routes matched?" << std::endl;
+    return static_cast<double>(iterations) / seconds;
+}
+
+
+int main(int argc, char* argv[]) {
+    size_t iterations = 200000;
+    if (argc >= 2) iterations = std::stoul(argv[1]);
+
+    for (size_t numRoutes : {10, 100, 1000}) {
+        Router router;
+        LegacyRouter legacy;
+        std::vector<std::string> paths;
+        for (size_t i = 0; i < numRoutes; ++i) {
+            router.get_(routeTemplate(i), [](const HTTPRequest&, HTTPResponse& res) { res.statusCode = 200; });
+            legacy.add("GET", routeTemplate(i), [](const LegacyRequest&, HTTPResponse& res) { res.statusCode = 200; });
+            paths.push_back(routePath(i));
+        }
+
+        // Walk the routes with a stride so lookups aren't biased towards the front of the legacy list
+        HTTPRequest req;
+        req.method = "GET";
+        HTTPResponse res;
+        double trieRate = runBench(iterations, [&](size_t i) {
+            req.path = paths[(i * 7919) % numRoutes];
+            return router.handle(req, res) ? size_t(1) : size_t(0);
+        });
+
+        LegacyRequest legacyReq;
+        legacyReq.method = "GET";
+        legacyReq.headers = {{"Host", "localhost"}, {"Accept", "*/*"}, {"Connection", "keep-alive"}};
+        size_t legacyIterations = std::max<size_t>(iterations / numRoutes, 100);
+        double legacyRate = runBench(legacyIterations, [&](size_t i) {
+            legacyReq.path = paths[(i * 7919) % numRoutes];
+            return legacy.handle(legacyReq, res) ? size_t(1) : size_t(0);
+        });
+
+        std::cout << numRoutes << " routes: trie " << static_cast<size_t>(trieRate)
+                  << " lookups/s, legacy regex " << static_cast<size_t>(legacyRate)
+                  << " lookups/s" << std::endl;
+    }
+    return 0;
+}
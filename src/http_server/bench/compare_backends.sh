@@ -0,0 +1,18 @@
+#!/bin/sh
+# Runs http_loadgen against http_server once per Linux backend.
+# Usage: compare_backends.sh <build dir> [http_loadgen options...]
+set -e
+
+BUILD_DIR=${1:-build}
+[ $# -gt 0 ] && shift
+PORT=18080
+
+for backend in epoll io_uring; do
+    echo "== $backend"
+    "$BUILD_DIR/http_server" 127.0.0.1 $PORT --backend=$backend > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+    "$BUILD_DIR/http_loadgen" --port=$PORT "$@"
+    kill -INT $SERVER_PID
+    wait $SERVER_PID
+done
@@ -0,0 +1,86 @@
+import argparse
+import logging
+import resource
+import selectors
+import socket
+import time
+
+logger = logging.getLogger(__name__)
+
+HOST = "127.0.0.1"
+PORT = 8080
+REQUEST = b"GET /customers/1 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+
+
+def rss_kb(pid):
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def open_idle(count, first_index):
+    """
+    Opens count keep-alive connections that each make one request and then go idle.
+    Source addresses rotate over 127.0.0.x to stay clear of the ephemeral port limit.
+    """
+    sel = selectors.DefaultSelector()
+    socks = []
+    for i in range(count):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.bind((f"127.0.0.{2 + (first_index + i) % 200}", 0))
+        s.connect((HOST, PORT))
+        s.sendall(REQUEST)
+        s.setblocking(False)
+        sel.register(s, selectors.EVENT_READ)
+        socks.append(s)
+
+    pending = count
+    while pending:
+        for key, _ in sel.select(timeout=5):
+            key.fileobj.recv(4096)
+            sel.unregister(key.fileobj)
+            pending -= 1
+    sel.close()
+    return socks
+
+
+def main():
+    """
+    Memory of a running http_server while N idle keep-alive connections pile up.
+    Start the server first, e.g. http_server 127.0.0.1 8080 --backend=io_uring --threads=1
+    Needs a file descriptor limit above N on both sides (ulimit -n).
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--pid", type=int, required=True, help="http_server pid")
+    parser.add_argument("--connections", type=int, default=100000)
+    parser.add_argument("--step", type=int, default=10000)
+    parser.add_argument("--hold", type=float, default=0, help="seconds to keep the connections open at the end")
+    args = parser.parse_args()
+
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    resource.setrlimit(resource.RLIMIT_NOFILE, (hard, hard))
+
+    base = rss_kb(args.pid)
+    logger.info("Server RSS with no connections: %d KB", base)
+
+    socks = []
+    while len(socks) < args.connections:
+        step = min(args.step, args.connections - len(socks))
+        socks += open_idle(step, len(socks))
+        time.sleep(0.5)
+        rss = rss_kb(args.pid)
+        logger.info("%7d idle connections: RSS %7d KB, %5.0f bytes/connection",
+                    len(socks), rss, (rss - base) * 1024 / len(socks))
+
+    time.sleep(args.hold)
+    for s in socks:
+        s.close()
+    time.sleep(1)
+    logger.info("After closing all: RSS %d KB", rss_kb(args.pid))
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,23 @@
+#!/bin/sh
+# Requests/sec of sharded http_server with 1..N worker threads.
+# Usage: scaling.sh <build dir> [max threads] [backend] [http_loadgen options...]
+# Run the load generator on other cores (or another host) for meaningful numbers.
+set -e
+
+BUILD_DIR=${1:-build}
+MAX_THREADS=${2:-$(nproc)}
+BACKEND=${3:-epoll}
+[ $# -gt 3 ] && shift 3 || shift $#
+PORT=18080
+
+threads=1
+while [ $threads -le $MAX_THREADS ]; do
+    echo "== $threads thread(s), $BACKEND"
+    "$BUILD_DIR/http_server" 127.0.0.1 $PORT --backend=$BACKEND --threads=$threads --sharded > /dev/null 2>&1 &
+    SERVER_PID=$!
+    sleep 0.5
+    "$BUILD_DIR/http_loadgen" --port=$PORT --threads=$MAX_THREADS --connections=256 "$@" | grep requests/sec
+    kill -INT $SERVER_PID
+    wait $SERVER_PID
+    threads=$((threads + 1))
+done
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Platform.hpp"
+
+class HTTPServer;
+struct Connection;
+
+
+/*
+I/O backend of the HTTPServer.
+
+The server only deals with completions: a posted recv/send finishes with some amount
+of bytes and the loop calls HTTPServer::handleRecv / handleSend, accepted sockets
+are handed over with HTTPServer::handleAccept.
+IOCP and io_uring are completion based already, reactor backends (epoll) emulate it
+by doing the posted operation themselves once the socket is ready.
+
+Each worker thread runs one loop, backends that share a single kernel object between
+threads (IOCP) create one loop that every worker runs.
+*/
+class EventLoop {
+
+    public:
+        explicit EventLoop(HTTPServer& server) : server_(server) {}
+        virtual ~EventLoop() = default;
+
+        EventLoop(const EventLoop&) = delete;
+        EventLoop& operator=(const EventLoop&) = delete;
+
+        // Start accepting on the listening socket, throws on failure
+        virtual void init(SOCKET listenSocket) = 0;
+
+        virtual bool addConnection(Connection* conn, const std::string& threadStr) = 0;
+        virtual bool postRecv(Connection* conn, const std::string& threadStr) = 0;
+        virtual bool postSend(Connection* conn, const std::string& threadStr) = 0;
+        virtual void closeConnection(Connection* conn) = 0;
+
+        // One timeout per connection, re-arming replaces it. An expired connection gets
+        // closed (HTTPServer::handleTimeout), closing the connection cancels it
+        virtual void scheduleTimeout(Connection* conn, uint32_t timeoutMs) = 0;
+        virtual void cancelTimeout(Connection* conn) = 0;
+
+        // Worker thread body, returns after wakeup() once the server has stopped running
+        virtual void run() = 0;
+        virtual void wakeup() = 0;
+
+    protected:
+        HTTPServer& server_;
+};
+
+
+// Backends available on the platform, see backends/EventLoopFactory.cpp
+// Throws std::invalid_argument for unknown backends and std::runtime_error if the backend can't be used
+std::vector<std::unique_ptr<EventLoop>> createEventLoops(HTTPServer& server, size_t nThreads, const std::string& backend);
@@ -1,43 +1,493 @@
+#include <algorithm>
+#include <charconv>
+#include <cstring>
+
 #include "HTTPParser.hpp"
 
 
-HTTPRequest parseHTTPRequest(const std::string& rawRequest){
-    HTTPRequest req;
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        char ca = a[i];
+        char cb = b[i];
+        if (ca >= 'A' && ca <= 'Z') ca = static_cast<char>(ca + ('a' - 'A'));
+        if (cb >= 'A' && cb <= 'Z') cb = static_cast<char>(cb + ('a' - 'A'));
+        if (ca != cb) return false;
+    }
+    return true;
+}
 
-    std::istringstream stream(rawRequest);
-    std::string line;
+static bool isTokenChar(char c) {
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')) {
+        return true;
+    }
+    return std::strchr("!#$%&'*+-.^_`|~", c) != nullptr && c != '\0';
+}
 
-    // HTTP request line
-    if (std::getline(stream, line)) {
-        std::istringstream lineStream(line);
-        lineStream >> req.method >> req.path >> req.version;
-        logf("[Parser] HTTP request line: ", req.method, ", ", req.path, ", ", req.version);
+static bool parseContentLength(std::string_view value, size_t& out) {
+    if (value.empty()) return false;
+    size_t result = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return false;
+        result = result * 10 + static_cast<size_t>(c - '0');
+        if (result > HTTPRequestParser::MAX_BODY_BYTES) return false;
     }
+    out = result;
+    return true;
+}
+
+static int hexValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
 
-    // Optional headers
-    while(std::getline(stream, line) && line != "\r") {
-        auto colon = line.find(':');
-        if (colon != std::string::npos) {
-            std::string key = line.substr(0, colon);
-            std::string value = line.substr(colon + 1);
 
-            key.erase(key.find_last_not_of(" \r\n") + 1);
-            value.erase(0, value.find_first_not_of(" "));
-            value.erase(value.find_last_not_of(" \r\n") + 1);
-            req.headers.emplace_back(key, value);
+std::string_view HTTPRequest::header(std::string_view name) const {
+    for (const auto& [key, value] : headers) {
+        if (iequals(key, name)) {
+            return value;
         }
     }
-    std::stringstream ss;
-    for (const auto& [key, value] : req.headers) {
-        ss << key << ": " << value << "\n";
+    return {};
+}
+
+
+// Connection is a comma separated list of options
+static bool hasConnectionOption(std::string_view value, std::string_view option) {
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view item = value.substr(0, comma);
+        while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+        while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+        if (iequals(item, option)) {
+            return true;
+        }
+        if (comma == std::string_view::npos) break;
+        value.remove_prefix(comma + 1);
     }
-    //logf("[Parser] Headers:\n", ss.str());
+    return false;
+}
 
-    // Body
-    std::getline(stream, req.body, '\0');
-    //logf("[Parser] Body: ", req.body);
+bool HTTPRequest::keepAlive() const {
+    std::string_view connection = header("Connection");
+    if (version == "HTTP/1.0") {
+        return hasConnectionOption(connection, "keep-alive");
+    }
+    return !hasConnectionOption(connection, "close");
+}
 
-    return req;
+
+std::string_view PathParams::at(std::string_view name) const {
+    for (const auto& [key, value] : params_) {
+        if (key == name) {
+            return value;
+        }
+    }
+    throw std::out_of_range("Path param not found: '" + std::string(name) + "'");
+}
+
+bool PathParams::contains(std::string_view name) const {
+    for (const auto& param : params_) {
+        if (param.first == name) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+size_t ChunkedScanner::scan(const char* data, size_t len) {
+    size_t i = 0;
+    while (i < len && state_ != State::Done && state_ != State::Error) {
+        if (state_ == State::Data) {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(size_, len - i));
+            i += take;
+            size_ -= take;
+            if (size_ == 0) state_ = State::DataCR;
+            continue;
+        }
+
+        char c = data[i++];
+        switch (state_) {
+            case State::Size: {
+                int digit = hexValue(c);
+                if (digit >= 0) {
+                    // 15 hex digits is more than any body we'd frame
+                    if (++digits_ > 15) state_ = State::Error;
+                    size_ = size_ * 16 + static_cast<uint64_t>(digit);
+                } else if (digits_ == 0) {
+                    state_ = State::Error;
+                } else if (c == ';' || c == ' ' || c == '\t') {
+                    state_ = State::Extension;
+                } else if (c == '\r') {
+                    state_ = State::SizeLF;
+                } else if (c == '\n') {
+                    state_ = size_ == 0 ? State::TrailerStart : State::Data;
+                } else {
+                    state_ = State::Error;
+                }
+                break;
+            }
+            case State::Extension:
+                if (c == '\n') state_ = size_ == 0 ? State::TrailerStart : State::Data;
+                break;
+            case State::SizeLF:
+                state_ = c != '\n' ? State::Error : size_ == 0 ? State::TrailerStart : State::Data;
+                break;
+            case State::DataCR:
+                state_ = c == '\r' ? State::DataLF : c == '\n' ? State::Size : State::Error;
+                digits_ = 0;
+                break;
+            case State::DataLF:
+                state_ = c == '\n' ? State::Size : State::Error;
+                break;
+            case State::TrailerStart:
+                state_ = c == '\r' ? State::FinalLF : c == '\n' ? State::Done : State::Trailer;
+                break;
+            case State::Trailer:
+                if (c == '\n') state_ = State::TrailerStart;
+                break;
+            case State::FinalLF:
+                state_ = c == '\n' ? State::Done : State::Error;
+                break;
+            default:
+                break;
+        }
+    }
+    return i;
+}
+
+
+void HTTPRequestParser::reset() {
+    state_ = State::RequestLine;
+    pos_ = 0;
+    bodyStart_ = 0;
+    contentLength_ = 0;
+    consumed_ = 0;
+    chunked_ = false;
+    hasContentLength_ = false;
+    chunks_.reset();
+    method_ = {};
+    path_ = {};
+    version_ = {};
+    headers_.clear();
+}
+
+
+ParseResult HTTPRequestParser::fail() {
+    state_ = State::Error;
+    return ParseResult::Malformed;
+}
+
+
+ParseResult HTTPRequestParser::parse(const char* data, size_t len, HTTPRequest& req) {
+    if (state_ == State::Error) return ParseResult::Malformed;
+
+    while (state_ == State::RequestLine || state_ == State::Headers) {
+        const void* found = pos_ < len ? std::memchr(data + pos_, '\n', len - pos_) : nullptr;
+        if (found == nullptr) {
+            if (len > MAX_HEADER_BYTES) return fail();
+            return ParseResult::NeedMore;
+        }
+
+        size_t lineStart = pos_;
+        size_t lineEnd = static_cast<size_t>(static_cast<const char*>(found) - data);
+        pos_ = lineEnd + 1;
+        if (pos_ > MAX_HEADER_BYTES) return fail();
+
+        if (lineEnd > lineStart && data[lineEnd - 1] == '\r') {
+            --lineEnd;
+        }
+        size_t lineLen = lineEnd - lineStart;
+
+        if (state_ == State::RequestLine) {
+            if (lineLen == 0 && lineStart == 0) {
+                continue; // tolerate a stray CRLF before the request line
+            }
+            if (!parseRequestLine(data + lineStart, lineStart, lineLen)) return fail();
+            state_ = State::Headers;
+        } else if (lineLen == 0) {
+            // Both would leave it to the reader which one to believe
+            if (chunked_ && hasContentLength_) return fail();
+            bodyStart_ = pos_;
+            state_ = State::Body;
+        } else if (!parseHeaderLine(data + lineStart, lineStart, lineLen)) {
+            return fail();
+        }
+    }
+
+    if (state_ == State::Body && chunked_) {
+        pos_ += chunks_.scan(data + pos_, len - pos_);
+        if (chunks_.failed() || pos_ - bodyStart_ > MAX_BODY_BYTES) return fail();
+        if (!chunks_.done()) {
+            return ParseResult::NeedMore;
+        }
+        contentLength_ = pos_ - bodyStart_;
+        consumed_ = pos_;
+        state_ = State::Done;
+    } else if (state_ == State::Body) {
+        if (len - bodyStart_ < contentLength_) {
+            return ParseResult::NeedMore;
+        }
+        consumed_ = bodyStart_ + contentLength_;
+        state_ = State::Done;
+    }
+
+    req.method = std::string_view(data + method_.offset, method_.length);
+    req.path = std::string_view(data + path_.offset, path_.length);
+    req.version = std::string_view(data + version_.offset, version_.length);
+    req.headers.clear();
+    for (const auto& [key, value] : headers_) {
+        req.headers.emplace_back(
+            std::string_view(data + key.offset, key.length),
+            std::string_view(data + value.offset, value.length)
+        );
+    }
+    req.body = std::string_view(data + bodyStart_, contentLength_);
+    req.pathParams.clear();
+    return ParseResult::Complete;
+}
+
+
+bool HTTPRequestParser::parseRequestLine(const char* line, size_t lineStart, size_t lineLen) {
+    // <METHOD> SP <PATH> SP <VERSION>
+    std::string_view view(line, lineLen);
+
+    size_t methodEnd = view.find(' ');
+    if (methodEnd == std::string_view::npos || methodEnd == 0) return false;
+    for (size_t i = 0; i < methodEnd; ++i) {
+        if (!isTokenChar(view[i])) return false;
+    }
+
+    size_t pathEnd = view.find(' ', methodEnd + 1);
+    if (pathEnd == std::string_view::npos || pathEnd == methodEnd + 1) return false;
+
+    std::string_view version = view.substr(pathEnd + 1);
+    if (version.size() != 8 || version.substr(0, 5) != "HTTP/") return false;
+
+    method_ = {lineStart, methodEnd};
+    path_ = {lineStart + methodEnd + 1, pathEnd - methodEnd - 1};
+    version_ = {lineStart + pathEnd + 1, version.size()};
+    return true;
+}
+
+
+bool HTTPRequestParser::parseHeaderLine(const char* line, size_t lineStart, size_t lineLen) {
+    // <Name>: OWS <value> OWS
+    if (headers_.size() >= MAX_HEADERS) return false;
+
+    std::string_view view(line, lineLen);
+    size_t colon = view.find(':');
+    if (colon == std::string_view::npos || colon == 0) return false;
+    for (size_t i = 0; i < colon; ++i) {
+        if (!isTokenChar(view[i])) return false;
+    }
+
+    size_t valueStart = colon + 1;
+    size_t valueEnd = lineLen;
+    while (valueStart < valueEnd && (view[valueStart] == ' ' || view[valueStart] == '\t')) ++valueStart;
+    while (valueEnd > valueStart && (view[valueEnd - 1] == ' ' || view[valueEnd - 1] == '\t')) --valueEnd;
+
+    std::string_view name = view.substr(0, colon);
+    std::string_view value = view.substr(valueStart, valueEnd - valueStart);
+
+    if (iequals(name, "Content-Length")) {
+        size_t length = 0;
+        if (!parseContentLength(value, length)) return false;
+        // Repeats that disagree would leave it to the reader which one to believe
+        if (hasContentLength_ && length != contentLength_) return false;
+        contentLength_ = length;
+        hasContentLength_ = true;
+    } else if (iequals(name, "Transfer-Encoding")) {
+        // chunked is the only coding a request can end with
+        if (!chunkedBodies_ || !iequals(value, "chunked")) return false;
+        chunked_ = true;
+    }
+
+    headers_.push_back({Span{lineStart, colon}, Span{lineStart + valueStart, value.size()}});
+    return true;
+}
+
+
+void HTTPResponseParser::reset(bool headRequest) {
+    head_.clear();
+    headRequest_ = headRequest;
+    state_ = State::Head;
+    statusCode_ = 0;
+    keepAlive_ = false;
+    lengthIgnored_ = false;
+    headOffset_ = 0;
+    remaining_ = 0;
+    chunks_.reset();
+}
+
+
+ParseResult HTTPResponseParser::fail() {
+    state_ = State::Error;
+    return ParseResult::Malformed;
+}
+
+
+ParseResult HTTPResponseParser::parse(const char* data, size_t len, size_t& used) {
+    used = 0;
+    while (used < len) {
+        switch (state_) {
+            case State::Head: {
+                // The blank line may have started in the previous piece
+                size_t searchFrom = head_.size() < 3 ? 0 : head_.size() - 3;
+                size_t before = head_.size();
+                head_.append(data + used, len - used);
+                size_t end = head_.find("\r\n\r\n", searchFrom);
+                if (end == std::string::npos) {
+                    if (head_.size() > MAX_HEADER_BYTES) return fail();
+                    used = len;
+                    return ParseResult::NeedMore;
+                }
+                used += end + 4 - before;
+                head_.resize(end + 4);
+                if (!parseHead()) return fail();
+                if (statusCode_ >= 100 && statusCode_ < 200) {
+                    // Interim, the final response follows on the same connection
+                    headOffset_ += head_.size();
+                    head_.clear();
+                    continue;
+                }
+                break;
+            }
+            case State::Length: {
+                size_t take = static_cast<size_t>(std::min<uint64_t>(remaining_, len - used));
+                used += take;
+                remaining_ -= take;
+                if (remaining_ == 0) state_ = State::Done;
+                break;
+            }
+            case State::Chunked:
+                used += chunks_.scan(data + used, len - used);
+                if (chunks_.failed()) return fail();
+                if (chunks_.done()) state_ = State::Done;
+                break;
+            case State::UntilClose:
+                used = len;
+                break;
+            case State::Done:
+                return ParseResult::Complete;
+            case State::Error:
+                return ParseResult::Malformed;
+        }
+    }
+    return state_ == State::Done ? ParseResult::Complete : ParseResult::NeedMore;
+}
+
+
+ParseResult HTTPResponseParser::finish() {
+    if (state_ == State::UntilClose) {
+        state_ = State::Done;
+        return ParseResult::Complete;
+    }
+    return state_ == State::Done ? ParseResult::Complete : fail();
+}
+
+
+std::string_view HTTPResponseParser::header(std::string_view name) const {
+    if (state_ == State::Head || state_ == State::Error) {
+        return {};
+    }
+    std::string_view view(head_);
+    size_t pos = view.find("\r\n") + 2;
+    while (pos < view.size()) {
+        size_t end = view.find("\r\n", pos);
+        if (end == std::string_view::npos) break;
+        std::string_view line = view.substr(pos, end - pos);
+        pos = end + 2;
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || !iequals(line.substr(0, colon), name)) continue;
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+        return value;
+    }
+    return {};
+}
+
+
+bool HTTPResponseParser::parseHead() {
+    // HTTP/1.x SP 3DIGIT SP reason
+    std::string_view view(head_);
+    size_t lineEnd = view.find("\r\n");
+    std::string_view statusLine = view.substr(0, lineEnd);
+    if (statusLine.size() < 12 || statusLine.substr(0, 7) != "HTTP/1." || statusLine[8] != ' ') return false;
+    int status = 0;
+    for (size_t i = 9; i < 12; ++i) {
+        if (statusLine[i] < '0' || statusLine[i] > '9') return false;
+        status = status * 10 + (statusLine[i] - '0');
+    }
+    // 101 would turn the connection into something else, not a relay of HTTP messages
+    if (status < 100 || status == 101) return false;
+    statusCode_ = status;
+
+    bool http10 = statusLine[7] == '0';
+    bool close = http10;
+    bool chunked = false;
+    bool hasLength = false;
+    uint64_t length = 0;
+
+    size_t pos = lineEnd + 2;
+    while (pos < view.size()) {
+        size_t end = view.find("\r\n", pos);
+        std::string_view line = view.substr(pos, end - pos);
+        pos = end + 2;
+        if (line.empty()) break;
+
+        size_t colon = line.find(':');
+        if (colon == std::string_view::npos || colon == 0) return false;
+        std::string_view name = line.substr(0, colon);
+        std::string_view value = line.substr(colon + 1);
+        while (!value.empty() && (value.front() == ' ' || value.front() == '\t')) value.remove_prefix(1);
+        while (!value.empty() && (value.back() == ' ' || value.back() == '\t')) value.remove_suffix(1);
+
+        if (iequals(name, "Content-Length")) {
+            if (value.empty() || value.size() > 18) return false;
+            uint64_t parsed = 0;
+            for (char c : value) {
+                if (c < '0' || c > '9') return false;
+                parsed = parsed * 10 + static_cast<uint64_t>(c - '0');
+            }
+            // Repeats that disagree would leave it to the client which one to believe
+            if (hasLength && parsed != length) return false;
+            length = parsed;
+            hasLength = true;
+        } else if (iequals(name, "Transfer-Encoding")) {
+            // chunked has to be the last coding, it frames the body
+            size_t comma = value.rfind(',');
+            std::string_view last = comma == std::string_view::npos ? value : value.substr(comma + 1);
+            while (!last.empty() && last.front() == ' ') last.remove_prefix(1);
+            chunked = iequals(last, "chunked");
+            if (!chunked) close = true;
+        } else if (iequals(name, "Connection")) {
+            if (hasConnectionOption(value, "close")) close = true;
+            if (http10 && hasConnectionOption(value, "keep-alive")) close = false;
+        }
+    }
+
+    keepAlive_ = !close;
+    if (headRequest_ || status < 200 || status == 204 || status == 304) {
+        state_ = status < 200 ? State::Head : State::Done;
+    } else if (chunked) {
+        // Transfer-Encoding overrides a Content-Length next to it (RFC 9112 6.3)
+        lengthIgnored_ = hasLength;
+        chunks_.reset();
+        state_ = State::Chunked;
+    } else if (hasLength) {
+        remaining_ = length;
+        state_ = length == 0 ? State::Done : State::Length;
+    } else {
+        // Ends when the backend closes, the connection can't be reused
+        keepAlive_ = false;
+        state_ = State::UntilClose;
+    }
+    return true;
 }
 
 
@@ -49,13 +499,50 @@ HTTPResponse makeHttpResponse(
     return HTTPResponse{status, std::string(reason), std::move(headers), std::move(body)};
 }
 
-std::string serializeResponse(const HTTPResponse& res) {
-    std::ostringstream ss;
-    ss << "HTTP/1.1 " << res.statusCode << " " << res.reasonPhrase << "\r\n";
+// Counts only unless Write, so sizing and writing can't disagree
+template <bool Write>
+static size_t writeResponseHead(const HTTPResponse& res, char* out) {
+    size_t n = 0;
+    auto put = [&](std::string_view s) {
+        if constexpr (Write) {
+            std::memcpy(out + n, s.data(), s.size());
+        }
+        n += s.size();
+    };
+    char number[24];
+    auto toString = [&](auto value) {
+        auto result = std::to_chars(number, number + sizeof(number), value);
+        return std::string_view(number, static_cast<size_t>(result.ptr - number));
+    };
+
+    put("HTTP/1.1 ");
+    put(toString(res.statusCode));
+    put(" ");
+    put(res.reasonPhrase);
+    put("\r\n");
     for (const auto& [key, val] : res.headers) {
-        ss << key << ": " << val << "\r\n";
+        put(key);
+        put(": ");
+        put(val);
+        put("\r\n");
     }
-    ss << "Content-Length: " << res.body.size() << "\r\n";
-    ss << "\r\n" << res.body;
-    return ss.str();
-}
\ No newline at end of file
+    put("Content-Length: ");
+    put(toString(res.body.size()));
+    put("\r\n\r\n");
+    return n;
+}
+
+size_t responseHeadSize(const HTTPResponse& res) {
+    return writeResponseHead<false>(res, nullptr);
+}
+
+size_t serializeResponseHead(const HTTPResponse& res, char* out) {
+    return writeResponseHead<true>(res, out);
+}
+
+std::string serializeResponse(const HTTPResponse& res) {
+    std::string out(responseHeadSize(res), '\0');
+    serializeResponseHead(res, out.data());
+    out += res.body;
+    return out;
+}
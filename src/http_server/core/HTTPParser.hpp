@@ -1,21 +1,57 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <sstream>
-#include <ostream>
 #include <unordered_map>
-#include "log.hpp"
 
 
+/*
+Path params captured by the Router, names view into the route table and values into the request path.
+*/
+class PathParams {
+
+    public:
+        // Throws std::out_of_range if the param doesn't exist
+        std::string_view at(std::string_view name) const;
+        bool contains(std::string_view name) const;
+
+        size_t size() const { return params_.size(); }
+        bool empty() const { return params_.empty(); }
+        void clear() { params_.clear(); }
+
+        auto begin() const { return params_.begin(); }
+        auto end() const { return params_.end(); }
+
+    private:
+        friend class Router;
+        std::vector<std::pair<std::string_view, std::string_view>> params_;
+};
+
+
+/*
+Request fields are views into the buffer the request was parsed from
+(the received data or Connection::requestBuffer in the server), so an HTTPRequest
+is only valid until that buffer is reused or modified.
+*/
 struct HTTPRequest {
 
-    std::string method;
-    std::string path;
-    std::string version;
-    std::vector<std::pair<std::string, std::string>> headers;
-    std::string body;
-    std::unordered_map<std::string, std::string> pathParams;
+    std::string_view method;
+    std::string_view path;
+    std::string_view version;
+    std::vector<std::pair<std::string_view, std::string_view>> headers;
+    std::string_view body;
+    PathParams pathParams;
+
+    // Case-insensitive header lookup, empty view if the header is missing
+    std::string_view header(std::string_view name) const;
+
+    // Persistent connection wanted: HTTP/1.1 unless "Connection: close",
+    // HTTP/1.0 only with "Connection: keep-alive"
+    bool keepAlive() const;
 };
 
 struct HTTPResponse {
@@ -25,7 +61,186 @@ struct HTTPResponse {
     std::string body;
 };
 
-HTTPRequest parseHTTPRequest(const std::string& rawRequest);
+
+enum class ParseResult {
+    NeedMore,   // request is not complete yet, call again with more bytes
+    Complete,   // request parsed, consumed() bytes belong to it
+    Malformed   // garbage or limits exceeded, connection should be dropped
+};
+
+
+/*
+Finds the end of a chunked body without decoding it: chunk sizes, extensions, data,
+the last (zero) chunk and the trailers. One byte at a time except for chunk data,
+so it resumes anywhere and never needs to see earlier bytes again.
+*/
+class ChunkedScanner {
+
+    public:
+        // Bytes of data that belong to the body, stops right after its end.
+        // Check failed() / done() afterwards
+        size_t scan(const char* data, size_t len);
+
+        bool done() const { return state_ == State::Done; }
+        bool failed() const { return state_ == State::Error; }
+        void reset() { *this = ChunkedScanner{}; }
+
+    private:
+        enum class State {
+            Size,       // hex digits of the chunk size
+            Extension,  // ;name=value up to the end of the line
+            SizeLF,
+            Data,
+            DataCR,
+            DataLF,
+            TrailerStart,
+            Trailer,
+            FinalLF,
+            Done,
+            Error
+        };
+
+        State state_ = State::Size;
+        uint64_t size_ = 0;
+        size_t digits_ = 0;
+};
+
+
+/*
+Incremental HTTP/1.1 request parser.
+
+parse() is called with the whole buffer received so far for the current request,
+(same start, growing length) and resumes scanning where the previous call stopped.
+Positions are kept as offsets until the request is complete, so the buffer is allowed
+to move (e.g. vector growth) between calls.
+
+Body length comes from Content-Length, a repeat has to have the same value. Chunked
+bodies are refused unless the parser is made with chunkedBodies, they're framed then
+but not decoded: body is the chunks as they came, for a proxy to pass on as they are.
+*/
+class HTTPRequestParser {
+
+    public:
+        static constexpr size_t MAX_HEADER_BYTES = 8192;
+        static constexpr size_t MAX_HEADERS = 64;
+        static constexpr size_t MAX_BODY_BYTES = 1048576;
+
+        explicit HTTPRequestParser(bool chunkedBodies = false) : chunkedBodies_(chunkedBodies) {}
+
+        ParseResult parse(const char* data, size_t len, HTTPRequest& req);
+
+        // Bytes of the buffer used by the last complete request
+        size_t consumed() const { return consumed_; }
+
+        // Headers are done and the parser waits for the rest of the body
+        bool inBody() const { return state_ == State::Body; }
+
+        // The last complete request had Transfer-Encoding: chunked
+        bool chunked() const { return chunked_; }
+
+        void reset();
+
+    private:
+        enum class State {
+            RequestLine,
+            Headers,
+            Body,
+            Done,
+            Error
+        };
+
+        struct Span {
+            size_t offset = 0;
+            size_t length = 0;
+        };
+
+        bool parseRequestLine(const char* line, size_t lineStart, size_t lineLen);
+        bool parseHeaderLine(const char* line, size_t lineStart, size_t lineLen);
+        ParseResult fail();
+
+        State state_ = State::RequestLine;
+        size_t pos_ = 0;
+        size_t bodyStart_ = 0;
+        size_t contentLength_ = 0;
+        size_t consumed_ = 0;
+
+        bool chunkedBodies_;
+        bool chunked_ = false;
+        bool hasContentLength_ = false;
+        ChunkedScanner chunks_;
+
+        Span method_;
+        Span path_;
+        Span version_;
+        std::vector<std::pair<Span, Span>> headers_;
+};
+
+
+/*
+Incremental HTTP/1.1 response framing, for relaying a backend's response while it
+arrives.
+
+parse() takes each received piece once (not the whole response so far like the
+request parser) and says how much of it belongs to the current response. Only the
+head is copied, to see it whole. The body is counted down from Content-Length (a
+repeat has to have the same value), scanned with a ChunkedScanner when it's chunked
+whatever Content-Length says, or runs until the backend closes if it has neither,
+after a HEAD request and for 204/304 there is none. Interim 1xx responses are
+passed over, the response ends with the final one.
+*/
+class HTTPResponseParser {
+
+    public:
+        static constexpr size_t MAX_HEADER_BYTES = 8192;
+
+        // Next response, headRequest: it answers a HEAD, no body whatever the headers say
+        void reset(bool headRequest = false);
+
+        // used: bytes of data that belong to this response, anything after them
+        // doesn't (Complete) or all of it does (NeedMore)
+        ParseResult parse(const char* data, size_t len, size_t& used);
+
+        // The backend closed the connection. Complete if that's how the body ends
+        ParseResult finish();
+
+        bool headersDone() const { return state_ != State::Head; }
+        int statusCode() const { return statusCode_; }
+        // Head of the final response, status line to the blank line, until the next reset()
+        std::string_view head() const { return head_; }
+        // Where head() starts in the bytes given to parse(), past the interim responses
+        size_t headOffset() const { return headOffset_; }
+        // The body is chunked but head() has a Content-Length too, which a relay has to
+        // drop before passing the head on
+        bool lengthIgnored() const { return lengthIgnored_; }
+        // Case-insensitive header lookup in head(), empty view if the header is missing
+        std::string_view header(std::string_view name) const;
+        // The backend connection can carry the next request
+        bool keepAlive() const { return keepAlive_ && state_ == State::Done; }
+
+    private:
+        enum class State {
+            Head,
+            Length,      // Content-Length bytes left
+            Chunked,
+            UntilClose,
+            Done,
+            Error
+        };
+
+        bool parseHead();
+        ParseResult fail();
+
+        std::string head_;  // keeps its capacity between responses
+        bool headRequest_ = false;
+        State state_ = State::Head;
+        int statusCode_ = 0;
+        bool keepAlive_ = false;
+        bool lengthIgnored_ = false;
+        size_t headOffset_ = 0;
+        uint64_t remaining_ = 0;
+        ChunkedScanner chunks_;
+};
+
 
 HTTPResponse makeHttpResponse(
     int status,
@@ -34,4 +249,10 @@ HTTPResponse makeHttpResponse(
     std::string body
 );
 
-std::string serializeResponse(const HTTPResponse& res);
\ No newline at end of file
+// Status line and headers (Content-Length added) up to the blank line, the body is sent on its own
+size_t responseHeadSize(const HTTPResponse& res);
+// out needs responseHeadSize(res) bytes, returns the bytes written
+size_t serializeResponseHead(const HTTPResponse& res, char* out);
+
+// Head and body in one string
+std::string serializeResponse(const HTTPResponse& res);
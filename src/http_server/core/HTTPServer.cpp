@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <chrono>
 #include <csignal>
 #include <sstream>
 
@@ -7,9 +9,13 @@
 
 HTTPServer* HTTPServer::instance_ = nullptr;
 
-HTTPServer::HTTPServer(const std::string& serverAddress, const u_short serverPort)
-    : address_(serverAddress), port_(serverPort) {
-    logf("Creating HTTPServer on: ", serverAddress, ":", serverPort);
+HTTPServer::HTTPServer(const std::string& serverAddress, const u_short serverPort, ServerOptions options)
+    : address_(serverAddress), port_(serverPort), options_(std::move(options)) {
+    n_threads = options_.threads;
+    if (n_threads == 0) {
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    logf("Creating HTTPServer on: ", serverAddress, ":", serverPort, " with ", n_threads, " worker threads");
     instance_ = this;
 }
 
@@ -22,52 +28,10 @@ HTTPServer::~HTTPServer() {
 
 
 void HTTPServer::signalHandler(int signal) {
-    logf("\nCaught signal ", signal, ", exiting..");
+    // Only flag the main loop here, on Linux this may run on any worker thread
+    (void)signal;
     if (instance_) {
-        instance_->shutdown();
-    }
-}
-
-
-void HTTPServer::workerThread() {
-    std::ostringstream oss;
-    oss << "[Thread " << std::this_thread::get_id() << "] ";
-    std::string threadStr = oss.str();
-    logf(threadStr, "Started worker");
-
-    while (running) {
-        DWORD bytesTransferred;
-        ULONG_PTR key;
-        LPOVERLAPPED overlapped;
-
-        BOOL result = GetQueuedCompletionStatus(iocpHandle_, &bytesTransferred, &key, &overlapped, INFINITE);
-        logf(threadStr, "Completion status: ", result, ", bytesTransferred: ", bytesTransferred);
-        if (!result && overlapped == nullptr) {
-            logf(threadStr, "Empty result..");
-            break;
-        }
-
-        if (overlapped == nullptr) {
-            logf(threadStr, "Shutdown signal received.");
-            break;
-        }
-
-        IOContext* context = CONTAINING_RECORD(overlapped, IOContext, overlapped);
-
-        switch (context->state) {
-            case IOType::ACCEPT:
-                handleAccept(static_cast<AcceptContext*>(context), threadStr);
-                break;
-            case IOType::RECV:
-                handleRecv(context, bytesTransferred, threadStr);
-                break;
-            case IOType::SEND:
-                handleSend(context, bytesTransferred, threadStr);
-                break;
-            default:
-                logcerr(threadStr, "Unknown IOType");
-                break;
-        }
+        instance_->running = false;
     }
 }
 
@@ -75,29 +39,54 @@ void HTTPServer::workerThread() {
 void HTTPServer::run() {
     logf("[Main] Running HTTPServer");
     std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
 
     running = true;
-    logf("[Main] Initialize IOCP");
-    initIOCP();
 
-    logf("[Main] Create listening socket");
-    listenSocket_ = createListenSocket();
-    CreateIoCompletionPort((HANDLE)listenSocket_, iocpHandle_, 0, 0);
-
-    logf("[Main] Init lpfnAcceptEx");
-    initExtensions();
+    logf("[Main] Initialize event loops");
+    loops_ = createEventLoops(*this, n_threads, options_.backend);
+    if (options_.sharded && loops_.size() != n_threads) {
+        running = false;
+        loops_.clear();
+        throw std::runtime_error("Sharded mode needs one event loop per thread, the backend shares one between threads");
+    }
 
-    logf("[Main] Posting initial accepts");
-    const int numAccepts = 10;
-    for (int i = 0; i < numAccepts; ++i) {
-        if (!postAccept("[Main] ")) {
-            logcerr("[Main] Failed to post initial AcceptEx");
+    // Shared mode: every loop accepts from the same socket
+    // Sharded: the kernel spreads new connections over one SO_REUSEPORT socket per loop
+    size_t nSockets = options_.sharded ? loops_.size() : 1;
+    logf("[Main] Create ", nSockets, " listening socket(s)");
+    for (size_t i = 0; i < nSockets; ++i) {
+        SOCKET listenSocket = createListenSocket(options_.sharded);
+        if (listenSocket == INVALID_SOCKET) {
+            running = false;
+            for (SOCKET s : listenSockets_) closesocket(s);
+            listenSockets_.clear();
+            loops_.clear();
+            throw std::runtime_error("Failed to create listening socket");
         }
+        listenSockets_.push_back(listenSocket);
+    }
+
+    for (size_t i = 0; i < loops_.size(); ++i) {
+        loops_[i]->init(listenSockets_[i % nSockets]);
     }
 
     logf("[Main] Creating worker threads");
-    for (int i = 0; i < n_threads; i++) {
-        workerThreads.emplace_back(&HTTPServer::workerThread, this);
+    size_t nCores = std::max(1u, std::thread::hardware_concurrency());
+    for (size_t i = 0; i < n_threads; i++) {
+        EventLoop* loop = loops_[i % loops_.size()].get();
+        if (options_.sharded) {
+            // Thread per core, the loop's connections never leave its core
+            size_t core = i % nCores;
+            workerThreads.emplace_back([loop, core]() {
+                if (!pinCurrentThread(core)) {
+                    logcerr("Failed to pin worker thread to core ", core);
+                }
+                loop->run();
+            });
+        } else {
+            workerThreads.emplace_back(&EventLoop::run, loop);
+        }
     }
 
     while (running) {
@@ -115,248 +104,221 @@ void HTTPServer::shutdown() {
     if (!shutdownCalled.compare_exchange_strong(expected, true)) {
         return;
     }
-    
+
     logf("[Main] Shutdown HTTPServer");
     logf("[Main] Cleaning up resources..");
     running = false;
-    
+
     logf("[Main] Signal worker threads to shutdown");
     for (size_t i = 0; i < workerThreads.size(); ++i) {
-        PostQueuedCompletionStatus(iocpHandle_, 0, 0, nullptr);
+        loops_[i % loops_.size()]->wakeup();
     }
-    
+
     logf("[Main] Joining worker threads");
     for (auto& t : workerThreads) {
         if (t.joinable()) { t.join(); }
     }
 
-    if (listenSocket_ != INVALID_SOCKET) {
-        logf("[Main] Closing listening socket");
-        closesocket(listenSocket_);
-        listenSocket_ = INVALID_SOCKET;
+    logf("[Main] Closing listening sockets");
+    for (SOCKET listenSocket : listenSockets_) {
+        closesocket(listenSocket);
     }
+    listenSockets_.clear();
 
-    if (iocpHandle_ != nullptr) {
-        logf("[Main] Closing IOCP handle");
-        CloseHandle(iocpHandle_);
-        iocpHandle_ = nullptr;
-    }
+    logf("[Main] Closing event loops");
+    loops_.clear();
+
+    PoolStats connStats = ObjectPool<Connection>::stats();
+    PoolStats contextStats = ObjectPool<IOContext>::stats();
+    logf("[Main] Connection pool hits: ", connStats.hits, ", misses: ", connStats.misses);
+    logf("[Main] IOContext pool hits: ", contextStats.hits, ", misses: ", contextStats.misses);
     logf("[Main] HTTPServer shutdown gracefully.");
 }
 
 
-bool HTTPServer::postAccept(std::string threadStr) {
-    AcceptContext* context = new AcceptContext();
-    context->socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
-    if (context->socket == INVALID_SOCKET) {
-        logcerr(threadStr, "WSASocket() failed: ", WSAGetLastError());
-        delete context;
-        return false;
-    }
-
-    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
-
-    DWORD bytesReceived;
-    BOOL result = lpfnAcceptEx(
-        listenSocket_,
-        context->socket,
-        context->acceptBuffer,
-        0,
-        sizeof(SOCKADDR_IN) + 16,
-        sizeof(SOCKADDR_IN) + 16,
-        &bytesReceived,
-        &context->overlapped
-    );
+void HTTPServer::handleAccept(EventLoop& loop, SOCKET clientSocket, const std::string& threadStr) {
+    auto conn = new Connection(clientSocket);
+    conn->loop = &loop;
 
-    if (!result && WSAGetLastError() != ERROR_IO_PENDING) {
-        logcerr(threadStr, "AcceptEx() failed: ", WSAGetLastError());
-        delete context;
-        return false;
+    if (!loop.addConnection(conn, threadStr)) {
+        delete conn;
+        return;
     }
-    return true;
-}
-
 
-bool HTTPServer::postRecv(Connection* conn, std::string threadStr) {
-    IOContext* context = conn->recvContext;
-    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
+    logdebug(threadStr, "New connection accepted");
+    // The first request has to arrive within the header timeout
+    setTimeout(conn, TimeoutPhase::Header);
+    loop.postRecv(conn, threadStr);
+}
 
-    WSABUF wsaBuf;
-    wsaBuf.buf = conn->recvBuffer.data();
-    wsaBuf.len = static_cast<ULONG>(conn->recvBuffer.size());
 
-    DWORD flags = 0;
-    DWORD bytesReceived = 0;
+void HTTPServer::handleRecv(Connection* conn, const char* data, size_t bytesTransferred, const std::string& threadStr) {
+    if (bytesTransferred == 0) {
+        conn->loop->closeConnection(conn);
+        return;
+    }
 
-    int result = WSARecv(
-        conn->socket,
-        &wsaBuf,
-        1,
-        &bytesReceived,
-        &flags,
-        &context->overlapped,
-        nullptr
-    );
-    //logf(threadStr, "WSARecv posted for socket: ", conn->socket,
-    //     ", buffer size: ", wsaBuf.len,
-    //     ", result: ", result,
-    //     ", error: ", (result == SOCKET_ERROR ? WSAGetLastError() : 0));
-    
-    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
-        logcerr(threadStr, "WSARecv() failed: ", WSAGetLastError());
-        delete conn;
-        return false;
+    if (conn->timeoutPhase == TimeoutPhase::Idle) {
+        setTimeout(conn, TimeoutPhase::Header);
     }
-    return true;
-}
 
+    // Requests are parsed in place, conn->request views into the received data.
+    // Only a request split over several recvs is collected into requestBuffer
+    const char* requestData = data;
+    size_t requestLen = bytesTransferred;
+    bool buffered = !conn->requestBuffer.empty();
+    if (buffered) {
+        conn->requestBuffer.insert(conn->requestBuffer.end(), data, data + bytesTransferred);
+        requestData = conn->requestBuffer.data();
+        requestLen = conn->requestBuffer.size();
+    }
 
-bool HTTPServer::postSend(Connection* conn, std::string threadStr) {
-    IOContext* context = conn->sendContext;
-    ZeroMemory(&context->overlapped, sizeof(OVERLAPPED));
+    // Pipelined requests: handle every complete request of this recv,
+    // their responses go out together in one send
+    size_t offset = 0;
+    while (offset < requestLen && !conn->closeAfterSend) {
+        ParseResult result = conn->parser.parse(requestData + offset, requestLen - offset, conn->request);
+        if (result == ParseResult::NeedMore) {
+            break;
+        }
 
-    WSABUF wsaBuf;
-    wsaBuf.buf = reinterpret_cast<CHAR*>(conn->sendBuffer.data() + conn->sendOffset);
-    wsaBuf.len = static_cast<ULONG>(conn->sendBuffer.size() - conn->sendOffset);
+        HTTPResponse res;
+        if (result == ParseResult::Complete) {
+            handleRequest(conn->request, res);
+            ++conn->requestsServed;
+            conn->closeAfterSend = !conn->request.keepAlive() ||
+                                   conn->requestsServed >= options_.maxKeepAliveRequests;
+            offset += conn->parser.consumed();
+        } else {
+            logcerr(threadStr, "Failed to parse request (", requestLen - offset, " bytes)");
+            res = makeHttpResponse(
+                400,
+                "Bad Request",
+                { {"Content-Type", "text/plain"} },
+                "Malformed request"
+            );
+            // Can't tell where the next request would start
+            conn->closeAfterSend = true;
+        }
+        res.headers["Connection"] = conn->closeAfterSend ? "close" : "keep-alive";
+        conn->sendQueue.push(res);
 
-    DWORD bytesSent = 0;
-    int result = WSASend(
-        conn->socket,
-        &wsaBuf,
-        1,
-        &bytesSent,
-        0,
-        &context->overlapped,
-        nullptr
-    );
-    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
-        logcerr(threadStr, "WSASend() failed: ", WSAGetLastError());
-        delete conn;
-        return false;
+        // The request views die with the buffers
+        conn->parser.reset();
     }
-    return true;
-}
-
 
-void HTTPServer::handleAccept(AcceptContext* acceptContext, std::string threadStr) {
-    SOCKET clientSocket = acceptContext->socket;
-    auto conn = new Connection(clientSocket);
-    acceptContext->socket = INVALID_SOCKET;
-    
-    if (CreateIoCompletionPort((HANDLE)clientSocket, iocpHandle_, (ULONG_PTR)conn, 0) == nullptr) {
-        logcerr(threadStr, "Failed to associate client socket with IOCP: ", GetLastError());
-        closesocket(clientSocket);
-        delete acceptContext;
-        delete conn;
-        return;
+    // Keep the unfinished tail for the next recv, the parser offsets stay relative to its start
+    if (conn->closeAfterSend || offset == requestLen) {
+        conn->requestBuffer.clear();
+    } else if (buffered) {
+        conn->requestBuffer.erase(conn->requestBuffer.begin(),
+                                  conn->requestBuffer.begin() + static_cast<std::ptrdiff_t>(offset));
+    } else {
+        conn->requestBuffer.assign(data + offset, data + requestLen);
     }
 
-    if (setsockopt(clientSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
-                   (char*)&listenSocket_, sizeof(listenSocket_)) == SOCKET_ERROR) {
-        logcerr(threadStr, "setsockopt(SO_UPDATE_ACCEPT_CONTEXT) failed: ", WSAGetLastError());
-        closesocket(clientSocket);
-        delete acceptContext;
-        delete conn;
+    if (conn->sendQueue.empty()) {
+        if (conn->parser.inBody() && conn->timeoutPhase != TimeoutPhase::Body) {
+            setTimeout(conn, TimeoutPhase::Body);
+        }
+        conn->loop->postRecv(conn, threadStr);
         return;
     }
 
-    logf(threadStr, "New connection accepted");
-    postRecv(conn, threadStr);
-
-    delete acceptContext;
-    postAccept(threadStr);
+    setTimeout(conn, TimeoutPhase::None);
+    conn->loop->postSend(conn, threadStr);
 }
 
 
-void HTTPServer::handleRecv(IOContext* context, DWORD bytesTransferred, std::string threadStr) {
-    Connection* conn = context->connection;
-    if (bytesTransferred == 0) {
-        delete conn;
+void HTTPServer::handleSend(Connection* conn, size_t bytesTransferred, const std::string& threadStr) {
+    conn->sendOffset += bytesTransferred;
+
+    // Partial writes just continue from sendOffset, which may be in any segment
+    if (conn->sendOffset < conn->sendQueue.bytes()) {
+        conn->loop->postSend(conn, threadStr);
         return;
     }
-    std::string data(conn->recvBuffer.data(), bytesTransferred);
-    HTTPRequest req = parseHTTPRequest(data);
-
-    HTTPResponse res;
-    handleRequest(req, res);
-
-    std::string response = serializeResponse(res);
 
-    conn->sendBuffer.assign(response.begin(), response.end());
+    conn->sendQueue.clear();
     conn->sendOffset = 0;
+    if (conn->closeAfterSend) {
+        conn->loop->closeConnection(conn);
+        return;
+    }
 
-    postSend(conn, threadStr);
-}
-
-
-void HTTPServer::handleSend(IOContext* context, DWORD bytesTransferred, std::string threadStr) {
-    Connection* conn = context->connection;
-    conn->sendOffset += bytesTransferred;
-
-    if (conn->sendOffset < conn->sendBuffer.size()) {
-        postSend(conn, threadStr);
+    // A pipelined request may already be partly here, its clock started with the recv
+    if (conn->requestBuffer.empty()) {
+        setTimeout(conn, TimeoutPhase::Idle);
     } else {
-        postRecv(conn, threadStr);
+        setTimeout(conn, conn->parser.inBody() ? TimeoutPhase::Body : TimeoutPhase::Header);
     }
+    conn->loop->postRecv(conn, threadStr);
 }
 
 
-void HTTPServer::initIOCP() {
-    iocpHandle_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
-    if (iocpHandle_ == nullptr) {
-        logcerr("CreateIoCompletionPort() failed: ", GetLastError());
-        throw std::runtime_error("Failed to init IOCP");
-    }
+void HTTPServer::handleTimeout(Connection* conn, const std::string& threadStr) {
+    logdebug(threadStr, "Connection timed out in phase ", static_cast<int>(conn->timeoutPhase));
+    conn->loop->closeConnection(conn);
 }
 
 
-void HTTPServer::initExtensions() {
-    GUID guidAcceptEx = WSAID_ACCEPTEX;
-    DWORD bytes = 0;
-    
-    int result = WSAIoctl(
-        listenSocket_,
-        SIO_GET_EXTENSION_FUNCTION_POINTER,
-        &guidAcceptEx,
-        sizeof(guidAcceptEx),
-        &lpfnAcceptEx,
-        sizeof(lpfnAcceptEx),
-        &bytes,
-        nullptr,
-        nullptr
-    );
-
-    if (result == SOCKET_ERROR) {
-        logcerr("WSAIoctl() failed getting AcceptEx pointer: ", WSAGetLastError());
-        throw std::runtime_error("AcceptEx pointer is null!");
+void HTTPServer::setTimeout(Connection* conn, TimeoutPhase phase) {
+    conn->timeoutPhase = phase;
+    switch (phase) {
+        case TimeoutPhase::Idle:
+            conn->loop->scheduleTimeout(conn, options_.idleTimeoutMs);
+            break;
+        case TimeoutPhase::Header:
+            conn->loop->scheduleTimeout(conn, options_.headerTimeoutMs);
+            break;
+        case TimeoutPhase::Body:
+            conn->loop->scheduleTimeout(conn, options_.bodyTimeoutMs);
+            break;
+        case TimeoutPhase::None:
+            conn->loop->cancelTimeout(conn);
+            break;
     }
 }
 
 
-SOCKET HTTPServer::createListenSocket() {
+SOCKET HTTPServer::createListenSocket(bool reusePort) {
 
     SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
     if (listenSocket == INVALID_SOCKET) {
-        logcerr("socket() failed: ", WSAGetLastError());
+        logcerr("socket() failed: ", lastSocketError());
+        return INVALID_SOCKET;
+    }
+
+#ifndef _WIN32
+    // Allow quick restarts while old connections sit in TIME_WAIT
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    if (reusePort && setsockopt(listenSocket, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) == SOCKET_ERROR) {
+        logcerr("setsockopt(SO_REUSEPORT) failed: ", lastSocketError());
+        closesocket(listenSocket);
         return INVALID_SOCKET;
     }
+#else
+    // Unreachable, run() rejects sharded mode for the shared IOCP loop
+    (void)reusePort;
+#endif
 
-    sockaddr_in serverAddr;
+    sockaddr_in serverAddr{};
     serverAddr.sin_family = AF_INET;
     serverAddr.sin_port = htons(port_);
     serverAddr.sin_addr.s_addr = inet_addr(address_.c_str());
     if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        logcerr("bind() failed: ", WSAGetLastError());
+        logcerr("bind() failed: ", lastSocketError());
         closesocket(listenSocket);
         return INVALID_SOCKET;
     }
 
     if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
-        logcerr("listen() failed: ", WSAGetLastError());
+        logcerr("listen() failed: ", lastSocketError());
         closesocket(listenSocket);
         return INVALID_SOCKET;
     }
-    
+
     return listenSocket;
 }
 
@@ -366,7 +328,7 @@ void HTTPServer::includeRouter(std::unique_ptr<Router> router) {
 }
 
 
-void HTTPServer::handleRequest(const HTTPRequest& request, HTTPResponse& response) {
+void HTTPServer::handleRequest(HTTPRequest& request, HTTPResponse& response) {
 
     for (const auto& router : routers) {
         if (router->handle(request, response)) {
@@ -379,4 +341,4 @@ void HTTPServer::handleRequest(const HTTPRequest& request, HTTPResponse& respons
         { {"Content-Type", "text/plain"} },
         "Route not found"
     );
-}
\ No newline at end of file
+}
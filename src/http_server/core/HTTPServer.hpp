@@ -1,28 +1,20 @@
 #pragma once
 
 #include <atomic>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <thread>
 #include <vector>
-#include <winsock2.h>
-#include <windows.h>
-#include <mswsock.h>
 
+#include "Platform.hpp"
+#include "EventLoop.hpp"
+#include "ObjectPool.hpp"
+#include "SendQueue.hpp"
+#include "TimerWheel.hpp"
 #include "Router.hpp"
 
 
-struct WinSockGuard {
-
-    WinSockGuard() { 
-        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
-            throw std::runtime_error("WSAStartup failed");
-        }
-    }
-    ~WinSockGuard() { WSACleanup(); }
-    WSAData wsaData;
-};
-
-
 enum class IOType {
     RECV,
     SEND,
@@ -31,49 +23,88 @@ enum class IOType {
 
 struct Connection;
 
-struct IOContext {
+// Which timeout runs on the connection, the durations are in ServerOptions
+enum class TimeoutPhase {
+    Idle,   // keep-alive connection waiting for the next request
+    Header, // request line and headers, from the first byte (or the accept)
+    Body,   // rest of the body once the headers are in
+    None    // request being handled or response being sent
+};
+
+/*
+Connections and their contexts come from per-thread pools (ObjectPool.hpp),
+connection churn doesn't go through the global allocator.
+Both are cache line aligned so completions of different connections on different
+threads don't share lines.
+*/
+struct alignas(CACHE_LINE_SIZE) IOContext {
+#ifdef _WIN32
     OVERLAPPED overlapped;
+#endif
     IOType state = IOType::RECV;
     Connection* connection = nullptr;
+    bool pending = false;  // posted by the server but not completed yet
+    bool inFlight = false; // kernel still owns the operation (io_uring)
 
     IOContext(IOType ioType) : state(ioType) {
+#ifdef _WIN32
         ZeroMemory(&overlapped, sizeof(overlapped));
+#endif
     }
 
     virtual ~IOContext() = default;
-};
-
 
-struct AcceptContext : public IOContext {
-    SOCKET socket = INVALID_SOCKET;
-    char acceptBuffer[(sizeof(sockaddr_in) + 16) * 2];
-
-    AcceptContext() : IOContext(IOType::ACCEPT) {}
-    ~AcceptContext() {
-        if (socket != INVALID_SOCKET) {
-            closesocket(socket);
-        }
-    }
+    // Derived contexts need their own pool, see AcceptContext
+    static void* operator new(size_t size) { return ObjectPool<IOContext>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<IOContext>::deallocate(p, size); }
 };
 
 
-struct Connection {
+struct alignas(CACHE_LINE_SIZE) Connection {
+    // Touched on every completion, keep within the first cache line
     SOCKET socket = INVALID_SOCKET;
+    bool closed = false;
+    bool peerClosed = false;
+    EventLoop* loop = nullptr;
     IOContext* recvContext = nullptr;
     IOContext* sendContext = nullptr;
+    size_t sendOffset = 0;
 
     static constexpr int BUFFER_SIZE = 4096;
-    std::vector<char> recvBuffer;
-    std::vector<char> sendBuffer;
-    size_t sendOffset = 0;
+    std::vector<char> recvBuffer; // sized on first use, see recvSpace()
+    std::vector<char> requestBuffer; // request split over several recvs, empty otherwise
+
+    SendQueue sendQueue;    // responses of the last recv, sent together
+#ifndef _WIN32
+    msghdr sendMsg{};       // io_uring reads it when the SENDMSG is submitted
+#endif
+
+    HTTPRequestParser parser;
+    HTTPRequest request;
 
-    Connection(SOCKET s) : socket(s), recvBuffer(BUFFER_SIZE), sendBuffer(BUFFER_SIZE) {
+    // Keep-alive state, see HTTPServer::handleRecv
+    TimeoutPhase timeoutPhase = TimeoutPhase::Header;
+    Timer timer;
+    size_t requestsServed = 0;
+    bool closeAfterSend = false;
+
+    Connection(SOCKET s) : socket(s) {
+        timer.owner = this;
         recvContext = new IOContext(IOType::RECV);
         sendContext = new IOContext(IOType::SEND);
         recvContext->connection = this;
         sendContext->connection = this;
     }
 
+    // Only IOCP receives into connection memory, epoll receives into a per-loop buffer and
+    // io_uring into kernel provided buffers so idle connections hold none
+    char* recvSpace() {
+        if (recvBuffer.size() < BUFFER_SIZE) {
+            recvBuffer.resize(BUFFER_SIZE);
+        }
+        return recvBuffer.data();
+    }
+
     ~Connection() {
         if (socket != INVALID_SOCKET) {
             closesocket(socket);
@@ -85,63 +116,86 @@ struct Connection {
             delete sendContext;
         }
     }
+
+    static void* operator new(size_t size) { return ObjectPool<Connection>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<Connection>::deallocate(p, size); }
 };
 
 
-/*
-Fully asynchronous multithreaded HTTP server using IOCP
-Previous async servers weren't fully async due to accept()
-Here we use AcceptEx instead, making this fully async.
+struct ServerOptions {
+    // Event loop backend, empty picks the platform default (iocp on Windows, epoll on Linux)
+    // Linux also has "io_uring"
+    std::string backend;
 
+    // Worker threads, 0 uses std::thread::hardware_concurrency
+    size_t threads = 0;
 
+    // Shared-nothing mode: every worker gets its own SO_REUSEPORT listening socket and
+    // event loop and is pinned to a core. Needs a backend with one loop per thread (not iocp)
+    bool sharded = false;
 
+    // Keep-alive and timeouts, a timeout closes the connection
+    size_t maxKeepAliveRequests = 1000;
+    uint32_t idleTimeoutMs = 60000;
+    uint32_t headerTimeoutMs = 10000;
+    uint32_t bodyTimeoutMs = 30000;
+};
+
+
+/*
+Fully asynchronous multithreaded HTTP server
+Previous async servers weren't fully async due to accept()
+Here accepts go through the event loop too (AcceptEx on IOCP, listener readiness on epoll),
+making this fully async.
+
+Socket I/O lives in EventLoop backends (backends/), the server
+only parses requests, routes them and queues the responses.
 */
 
 class HTTPServer {
 
     public:
-        HTTPServer(const std::string& serverAddress, const u_short serverPort);
+        HTTPServer(const std::string& serverAddress, const u_short serverPort, ServerOptions options = {});
         ~HTTPServer();
 
         void run();
         void shutdown();
+        bool isRunning() const { return running; }
 
         void includeRouter(std::unique_ptr<Router> router);
 
         static void signalHandler(int signal);
 
+        // Completion handlers, called by the EventLoop backends
+        void handleAccept(EventLoop& loop, SOCKET clientSocket, const std::string& threadStr);
+        void handleRecv(Connection* conn, const char* data, size_t bytesTransferred, const std::string& threadStr);
+        void handleSend(Connection* conn, size_t bytesTransferred, const std::string& threadStr);
+        void handleTimeout(Connection* conn, const std::string& threadStr);
+
     private:
-        SOCKET createListenSocket();
-        
-        // IOCP stuff
-        void initIOCP();
-        void initExtensions();
-        bool postAccept(std::string threadStr);
-        bool postRecv(Connection* conn, std::string threadStr);
-        bool postSend(Connection* conn, std::string threadStr);
-        void handleAccept(AcceptContext* context, std::string threadStr);
-        void handleRecv(IOContext* context, DWORD bytesTransferred, std::string threadStr);
-        void handleSend(IOContext* context, DWORD bytesTransferred, std::string threadStr);
-        HANDLE iocpHandle_;
-        LPFN_ACCEPTEX lpfnAcceptEx = nullptr;  // AcceptEx func reference
-
-        void workerThread();
-        void handleRequest(const HTTPRequest& req, HTTPResponse& res);
+        SOCKET createListenSocket(bool reusePort);
+
+        void handleRequest(HTTPRequest& req, HTTPResponse& res);
+        void setTimeout(Connection* conn, TimeoutPhase phase);
 
         std::string address_;
         u_short port_;
-        SOCKET listenSocket_;
+        ServerOptions options_;
+        std::vector<SOCKET> listenSockets_; // one per loop when sharded
 
         std::vector<std::unique_ptr<Router>> routers;
 
-        const int n_threads = 2; // maybe as args?
-        std::vector<std::thread> workerThreads; 
+        size_t n_threads;
+        std::vector<std::unique_ptr<EventLoop>> loops_;
+        std::vector<std::thread> workerThreads;
 
         std::atomic<bool> running = false;
         std::atomic<bool> shutdownCalled = false;
 
+#ifdef _WIN32
         WinSockGuard winSockGuard;
+#endif
 
         // Workaround for signal handler
         static HTTPServer* instance_;
-};
\ No newline at end of file
+};
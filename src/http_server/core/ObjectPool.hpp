@@ -0,0 +1,152 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <vector>
+
+
+// Hot objects are aligned to this so objects used by different threads never share a line
+constexpr size_t CACHE_LINE_SIZE = 64;
+
+
+struct PoolStats {
+    uint64_t hits = 0;      // allocations served from a free list
+    uint64_t misses = 0;    // allocations that went to the heap
+};
+
+
+/*
+Per-thread free lists for one object type.
+
+Types route their class operator new/delete here:
+    static void* operator new(size_t size) { return ObjectPool<T>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<T>::deallocate(p, size); }
+
+Freed objects go to the free list of the freeing thread, with IOCP a connection may be
+freed on another thread than the one that accepted it, the memory just moves over.
+Every thread keeps at most MAX_FREE objects, the rest go back to the heap.
+Derived types that don't declare their own operators have a different size and
+bypass the pool.
+
+Counters are only written by the owning thread, stats() sums them over all threads.
+*/
+template <typename T>
+class ObjectPool {
+
+    public:
+        static constexpr size_t MAX_FREE = 1024;
+
+        static void* allocate(size_t size) {
+            if (size != sizeof(T)) {
+                return heapAllocate(size);
+            }
+            ThreadCache& cache = threadCache();
+            if (cache.head != nullptr) {
+                FreeNode* node = cache.head;
+                cache.head = node->next;
+                --cache.count;
+                bump(cache.hits);
+                return node;
+            }
+            bump(cache.misses);
+            return heapAllocate(size);
+        }
+
+        static void deallocate(void* p, size_t size) {
+            if (p == nullptr) {
+                return;
+            }
+            if (size != sizeof(T)) {
+                heapFree(p);
+                return;
+            }
+            ThreadCache& cache = threadCache();
+            if (cache.count >= MAX_FREE) {
+                heapFree(p);
+                return;
+            }
+            FreeNode* node = static_cast<FreeNode*>(p);
+            node->next = cache.head;
+            cache.head = node;
+            ++cache.count;
+        }
+
+        static PoolStats stats() {
+            Registry& registry = getRegistry();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            PoolStats total = registry.retired;
+            for (ThreadCache* cache : registry.caches) {
+                total.hits += cache->hits.load(std::memory_order_relaxed);
+                total.misses += cache->misses.load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+
+    private:
+        static constexpr size_t ALIGNMENT = std::max(alignof(T), alignof(void*));
+
+        struct FreeNode {
+            FreeNode* next;
+        };
+        static_assert(sizeof(T) >= sizeof(FreeNode), "Pooled type too small for the free list");
+
+        struct ThreadCache {
+            FreeNode* head = nullptr;
+            size_t count = 0;
+            std::atomic<uint64_t> hits = 0;
+            std::atomic<uint64_t> misses = 0;
+
+            ThreadCache() {
+                Registry& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.caches.push_back(this);
+            }
+
+            ~ThreadCache() {
+                while (head != nullptr) {
+                    FreeNode* next = head->next;
+                    heapFree(head);
+                    head = next;
+                }
+                Registry& registry = getRegistry();
+                std::lock_guard<std::mutex> lock(registry.mutex);
+                registry.retired.hits += hits.load(std::memory_order_relaxed);
+                registry.retired.misses += misses.load(std::memory_order_relaxed);
+                registry.caches.erase(std::find(registry.caches.begin(), registry.caches.end(), this));
+            }
+        };
+
+        struct Registry {
+            std::mutex mutex;
+            std::vector<ThreadCache*> caches;
+            PoolStats retired;  // counters of threads that have exited
+        };
+
+        // Function statics so the registry outlives every thread cache
+        static Registry& getRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        static ThreadCache& threadCache() {
+            thread_local ThreadCache cache;
+            return cache;
+        }
+
+        // Single writer, no need for an atomic read-modify-write
+        static void bump(std::atomic<uint64_t>& counter) {
+            counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        static void* heapAllocate(size_t size) {
+            return ::operator new(size, std::align_val_t(ALIGNMENT));
+        }
+
+        static void heapFree(void* p) {
+            ::operator delete(p, std::align_val_t(ALIGNMENT));
+        }
+};
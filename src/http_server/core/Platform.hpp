@@ -0,0 +1,59 @@
+#pragma once
+
+/*
+Minimal socket portability layer.
+Windows keeps the WinSock names, elsewhere we provide the same names on top of BSD sockets
+so the server code can stay the same on both.
+*/
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <windows.h>
+#include <mswsock.h>
+#include <stdexcept>
+
+inline int lastSocketError() { return WSAGetLastError(); }
+
+inline bool pinCurrentThread(size_t core) {
+    return SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << core) != 0;
+}
+
+struct WinSockGuard {
+
+    WinSockGuard() {
+        if (WSAStartup(MAKEWORD(2, 2), &wsaData) != 0) {
+            throw std::runtime_error("WSAStartup failed");
+        }
+    }
+    ~WinSockGuard() { WSACleanup(); }
+    WSAData wsaData;
+};
+
+#else
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using SOCKET = int;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+
+inline int closesocket(SOCKET s) { return ::close(s); }
+inline int lastSocketError() { return errno; }
+
+inline bool pinCurrentThread(size_t core) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+#endif
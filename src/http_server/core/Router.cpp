@@ -1,4 +1,5 @@
-#include <sstream>
+#include <algorithm>
+#include <stdexcept>
 
 #include "Router.hpp"
 #include "log.hpp"
@@ -33,46 +34,120 @@ void Router::delete_(const std::string& path, RouteHandler handler) {
     registerRoute("DELETE", path, handler);
 }
 
-bool Router::handle(const HTTPRequest& request, HTTPResponse& response) {
-    auto it = routes.find(request.method);
-    if (it == routes.end()) return false;
-    
-    for (const auto& routeEntry : it->second) {
-        std::smatch match;
-        HTTPRequest requestWithParams = request;
-        if (std::regex_match(request.path, match, routeEntry.pathRegex)) {
-            for (size_t i = 0; i < routeEntry.paramNames.size(); ++i) {
-                requestWithParams.pathParams[routeEntry.paramNames[i]] = match[i + 1];
-            }
-            routeEntry.handler(requestWithParams, response);
-            return true;
+
+Router::RouteNode* Router::RouteNode::findStatic(std::string_view segment) const {
+    auto it = std::lower_bound(staticChildren.begin(), staticChildren.end(), segment,
+        [](const auto& child, std::string_view seg) { return std::string_view(child.first) < seg; });
+    if (it != staticChildren.end() && it->first == segment) {
+        return it->second.get();
+    }
+    return nullptr;
+}
+
+Router::RouteNode& Router::RouteNode::addStatic(const std::string& segment) {
+    auto it = std::lower_bound(staticChildren.begin(), staticChildren.end(), segment,
+        [](const auto& child, const std::string& seg) { return child.first < seg; });
+    if (it != staticChildren.end() && it->first == segment) {
+        return *it->second;
+    }
+    it = staticChildren.emplace(it, segment, std::make_unique<RouteNode>());
+    return *it->second;
+}
+
+
+Router::RouteNode* Router::findMethod(std::string_view method) {
+    for (auto& [name, root] : routes) {
+        if (name == method) {
+            return root.get();
+        }
+    }
+    return nullptr;
+}
+
+
+bool Router::handle(HTTPRequest& request, HTTPResponse& response) {
+    const RouteNode* root = findMethod(request.method);
+    if (root == nullptr) return false;
+
+    std::string_view path = request.path;
+    path = path.substr(0, path.find('?'));
+    if (path.empty() || path.front() != '/') return false;
+
+    request.pathParams.clear();
+    const RouteNode* node = match(*root, path.substr(1), request.pathParams);
+    if (node == nullptr) {
+        request.pathParams.clear();
+        return false;
+    }
+
+    // Values were captured on the way down, names come from the matched route
+    for (size_t i = 0; i < node->paramNames.size(); ++i) {
+        request.pathParams.params_[i].first = node->paramNames[i];
+    }
+    node->handler(request, response);
+    return true;
+}
+
+
+const Router::RouteNode* Router::match(const RouteNode& node, std::string_view path, PathParams& params) const {
+    if (path.empty()) {
+        return node.handler ? &node : nullptr;
+    }
+
+    size_t slash = path.find('/');
+    std::string_view segment = path.substr(0, slash);
+    std::string_view rest = slash == std::string_view::npos ? std::string_view() : path.substr(slash + 1);
+    if (segment.empty()) return nullptr;
+
+    // Static segments win over params, fall back to the param branch if the static one dead ends
+    if (const RouteNode* child = node.findStatic(segment)) {
+        if (const RouteNode* found = match(*child, rest, params)) {
+            return found;
         }
     }
-    return false;
+
+    if (node.paramChild) {
+        params.params_.emplace_back(std::string_view(), segment);
+        if (const RouteNode* found = match(*node.paramChild, rest, params)) {
+            return found;
+        }
+        params.params_.pop_back();
+    }
+    return nullptr;
 }
 
+
 void Router::registerRoute(const std::string& method, const std::string& path, RouteHandler handler) {
     /*
     Static routes were fine with just map<path, func>
-    Path params require regex matching
+    Path params used to be regex matched per request, now the templates are compiled into
+    a segment trie so matching is a single walk over the request path.
     We are going for fastapi style path params using curly braces: e.g., /customers/{id}
+    Trailing slashes are allowed both in routes and request paths.
     TODO param typing + validation + exceptions
     */
-    std::string pathRegex = "^";
+    RouteNode* root = findMethod(method);
+    if (root == nullptr) {
+        routes.emplace_back(method, std::make_unique<RouteNode>());
+        root = routes.back().second.get();
+    }
+
     std::vector<std::string> paramNames;
-    
+
     std::string fullPath = prefix + path;
     if (!fullPath.empty() && fullPath[0] == '/') {
         fullPath.erase(0, 1);
     }
 
-    std::stringstream ss(fullPath);
-    std::string segment;
-    while(std::getline(ss, segment, '/')) {
+    RouteNode* node = root;
+    size_t start = 0;
+    while (start < fullPath.size()) {
+        size_t slash = fullPath.find('/', start);
+        size_t end = slash == std::string::npos ? fullPath.size() : slash;
+        std::string segment = fullPath.substr(start, end - start);
+        start = end + 1;
+
         if (segment.empty()) {
-            if (ss.peek() == EOF) {
-                continue; // allow trailing slashes
-            }
             throw std::invalid_argument("Route path contains empty segment: '" + fullPath + "'");
         }
         if (segment.front() == '{' && segment.back() == '}') {
@@ -81,13 +156,20 @@ void Router::registerRoute(const std::string& method, const std::string& path, R
                 throw std::invalid_argument("Route path contains empty path param: '" + fullPath + "'");
             }
             paramNames.push_back(paramName);
-            pathRegex += "/([^/]+)";
+            if (!node->paramChild) {
+                node->paramChild = std::make_unique<RouteNode>();
+            }
+            node = node->paramChild.get();
         } else {
-            pathRegex += "/" + segment;
+            node = &node->addStatic(segment);
         }
     }
-    logf("[Router] Created ", method," path regex: ", pathRegex);
-    std::regex pattern(pathRegex);
-    routes[method].push_back(RouteEntry{fullPath, pattern, paramNames, handler});
-}
 
+    if (node->handler) {
+        throw std::invalid_argument("Route already registered: " + method + " '" + fullPath + "'");
+    }
+    node->path = "/" + fullPath;
+    node->paramNames = std::move(paramNames);
+    node->handler = std::move(handler);
+    logf("[Router] Registered ", method, " ", node->path);
+}
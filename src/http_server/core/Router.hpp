@@ -1,9 +1,10 @@
 #pragma once
 
+#include <memory>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <functional>
-#include <regex>
+#include <vector>
 
 #include "HTTPParser.hpp"
 
@@ -14,26 +15,39 @@ class Router {
         Router(const std::string& routePrefix);
 
         using RouteHandler = std::function<void(const HTTPRequest&, HTTPResponse&)>;
-        
+
         void get_(const std::string& path, RouteHandler handler);
         void post_(const std::string& path, RouteHandler handler);
         void patch_(const std::string& path, RouteHandler handler);
         void put_(const std::string& path, RouteHandler handler);
         void delete_(const std::string& path, RouteHandler handler);
 
-        bool handle(const HTTPRequest& request, HTTPResponse& response);
+        // Fills request.pathParams on match
+        bool handle(HTTPRequest& request, HTTPResponse& response);
 
     private:
 
-        struct RouteEntry {
-            std::string path;
-            std::regex pathRegex;
+        /*
+        Segment trie, one per method.
+        Static children are kept sorted for binary search, {param} segments share a single
+        wildcard child. Param names live in the node that ends the route, since different
+        routes may name the same position differently.
+        */
+        struct RouteNode {
+            std::vector<std::pair<std::string, std::unique_ptr<RouteNode>>> staticChildren;
+            std::unique_ptr<RouteNode> paramChild;
             std::vector<std::string> paramNames;
+            std::string path;
             RouteHandler handler;
+
+            RouteNode* findStatic(std::string_view segment) const;
+            RouteNode& addStatic(const std::string& segment);
         };
 
         void registerRoute(const std::string& method, const std::string& path, RouteHandler handler);
-        
+        const RouteNode* match(const RouteNode& node, std::string_view path, PathParams& params) const;
+        RouteNode* findMethod(std::string_view method);
+
         std::string prefix;
-        std::unordered_map<std::string, std::vector<RouteEntry>> routes;
-};
\ No newline at end of file
+        std::vector<std::pair<std::string, std::unique_ptr<RouteNode>>> routes;
+};
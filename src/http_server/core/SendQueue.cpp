@@ -0,0 +1,80 @@
+#include <cstring>
+
+#include "SendQueue.hpp"
+
+
+void SendQueue::push(HTTPResponse& res) {
+    size_t headLen = responseHeadSize(res);
+    char* head = headSpace(headLen);
+    serializeResponseHead(res, head);
+
+    bytes_ += headLen + res.body.size();
+    responses_.push_back(Response{headUsed_ - headLen, headLen, std::move(res.body)});
+}
+
+
+size_t SendQueue::prepare(size_t offset) {
+    segments_.clear();
+    const char* heads = headBase();
+
+    auto add = [&](const char* data, size_t len) {
+        if (offset >= len) {
+            offset -= len;
+            return;
+        }
+        SendVec vec;
+#ifdef _WIN32
+        vec.buf = const_cast<char*>(data) + offset;
+        vec.len = static_cast<ULONG>(len - offset);
+#else
+        vec.iov_base = const_cast<char*>(data) + offset;
+        vec.iov_len = len - offset;
+#endif
+        offset = 0;
+        segments_.push_back(vec);
+    };
+
+    for (const Response& response : responses_) {
+        add(heads + response.headOffset, response.headLen);
+        add(response.body.data(), response.body.size());
+        if (segments_.size() + 2 > MAX_SEGMENTS) {
+            break;
+        }
+    }
+    return segments_.size();
+}
+
+
+void SendQueue::clear() {
+    headBuffer_.reset();
+    std::string().swap(headSpill_);
+    headUsed_ = 0;
+    responses_.clear();
+    segments_.clear();
+    bytes_ = 0;
+}
+
+
+char* SendQueue::headSpace(size_t len) {
+    size_t offset = headUsed_;
+    headUsed_ += len;
+
+    if (headSpill_.empty() && headUsed_ <= HeadBuffer::CAPACITY) {
+        if (!headBuffer_) {
+            headBuffer_.reset(new HeadBuffer);
+        }
+        return headBuffer_->data + offset;
+    }
+    if (headSpill_.empty() && headBuffer_) {
+        // Outgrew the pooled buffer, move what's there
+        headSpill_.assign(headBuffer_->data, offset);
+        headBuffer_.reset();
+    }
+    headSpill_.resize(headUsed_);
+    return headSpill_.data() + offset;
+}
+
+
+const char* SendQueue::headBase() const {
+    return headBuffer_ ? headBuffer_->data : headSpill_.data();
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Platform.hpp"
+#include "HTTPParser.hpp"
+#include "ObjectPool.hpp"
+
+
+// Pooled storage for response heads (status line and headers)
+struct HeadBuffer {
+    static constexpr size_t CAPACITY = 512;
+    char data[CAPACITY];
+
+    static void* operator new(size_t size) { return ObjectPool<HeadBuffer>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<HeadBuffer>::deallocate(p, size); }
+};
+
+#ifdef _WIN32
+using SendVec = WSABUF;
+#else
+using SendVec = iovec;
+#endif
+
+
+/*
+Responses waiting to go out on one connection, written with a single gathered send
+(sendmsg / IORING_OP_SENDMSG / WSASend).
+
+Heads are serialized back to back into a pooled HeadBuffer, or into a string once
+they outgrow it. Bodies are moved in from the HTTPResponse and sent from where they
+are, so each response is two segments: head, body.
+The sender keeps a byte offset across all segments, prepare() turns what's left into
+the segment array, partial writes continue wherever they stopped.
+*/
+class SendQueue {
+
+    public:
+        // Segments handed to one send call, stays below IOV_MAX
+        static constexpr size_t MAX_SEGMENTS = 256;
+
+        // Takes the body, no copy
+        void push(HTTPResponse& res);
+
+        bool empty() const { return responses_.empty(); }
+        size_t bytes() const { return bytes_; }
+
+        // Fills segments() with what's left after offset, returns the segment count
+        size_t prepare(size_t offset);
+        SendVec* segments() { return segments_.data(); }
+
+        // Gives the head buffer back to the pool, idle connections hold none
+        void clear();
+
+    private:
+        struct Response {
+            size_t headOffset;
+            size_t headLen;
+            std::string body;
+        };
+
+        char* headSpace(size_t len);
+        const char* headBase() const;
+
+        std::unique_ptr<HeadBuffer> headBuffer_;
+        std::string headSpill_;
+        size_t headUsed_ = 0;
+
+        std::vector<Response> responses_;
+        std::vector<SendVec> segments_;
+        size_t bytes_ = 0;
+};
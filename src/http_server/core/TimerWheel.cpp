@@ -0,0 +1,103 @@
+#include <algorithm>
+#include <chrono>
+
+#include "TimerWheel.hpp"
+
+
+uint64_t TimerWheel::clockMs() {
+    auto now = std::chrono::steady_clock::now().time_since_epoch();
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+
+TimerWheel::TimerWheel(uint64_t nowMs) : current_(nowMs / TICK_MS) {
+    for (auto& level : slots_) {
+        for (Timer& head : level) {
+            head.prev = &head;
+            head.next = &head;
+        }
+    }
+}
+
+
+void TimerWheel::schedule(Timer* timer, uint64_t delayMs) {
+    if (timer->armed()) {
+        unlink(timer);
+        --count_;
+    }
+    // Round up, a timer never fires early. The wheel may lag behind the clock while the
+    // loop sleeps, so count from the clock rather than from the last advance
+    uint64_t expiry = (clockMs() + delayMs + TICK_MS - 1) / TICK_MS;
+    timer->expiry = std::clamp(expiry, current_ + 1, current_ + MAX_DELAY_TICKS);
+    insert(timer);
+    ++count_;
+}
+
+
+void TimerWheel::cancel(Timer* timer) {
+    if (timer->armed()) {
+        unlink(timer);
+        --count_;
+    }
+}
+
+
+int TimerWheel::nextTimeoutMs(uint64_t nowMs) const {
+    if (count_ == 0) {
+        return -1;
+    }
+    // First non-empty slot of the lowest level, otherwise wake up for the next cascade
+    uint64_t ticks = SLOTS - (current_ & (SLOTS - 1));
+    for (uint64_t i = 1; i < SLOTS; ++i) {
+        const Timer& head = slots_[0][(current_ + i) & (SLOTS - 1)];
+        if (head.next != &head) {
+            ticks = i;
+            break;
+        }
+    }
+    uint64_t dueMs = (current_ + ticks) * TICK_MS;
+    return dueMs > nowMs ? static_cast<int>(dueMs - nowMs) : 0;
+}
+
+
+void TimerWheel::insert(Timer* timer) {
+    uint64_t delta = timer->expiry > current_ ? timer->expiry - current_ : 0;
+    unsigned level = 0;
+    while (level + 1 < LEVELS && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+    // Already due timers land in the next slot to be processed
+    uint64_t expiry = std::max(timer->expiry, current_ + 1);
+    pushBack(slots_[level][(expiry >> (SLOT_BITS * level)) & (SLOTS - 1)], timer);
+}
+
+
+void TimerWheel::unlink(Timer* timer) {
+    timer->prev->next = timer->next;
+    timer->next->prev = timer->prev;
+    timer->prev = nullptr;
+    timer->next = nullptr;
+}
+
+
+void TimerWheel::pushBack(Timer& head, Timer* timer) {
+    timer->prev = head.prev;
+    timer->next = &head;
+    head.prev->next = timer;
+    head.prev = timer;
+}
+
+
+void TimerWheel::cascade(unsigned level) {
+    Timer& head = slots_[level][(current_ >> (SLOT_BITS * level)) & (SLOTS - 1)];
+    while (head.next != &head) {
+        Timer* timer = head.next;
+        unlink(timer);
+        if (timer->expiry <= current_) {
+            // Due on the tick being processed right now
+            pushBack(slots_[0][current_ & (SLOTS - 1)], timer);
+        } else {
+            insert(timer);
+        }
+    }
+}
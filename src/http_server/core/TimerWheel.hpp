@@ -0,0 +1,97 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+
+// Intrusive timer, embedded in the object it times out
+struct Timer {
+    Timer* prev = nullptr;
+    Timer* next = nullptr;
+    uint64_t expiry = 0;    // in ticks
+    void* owner = nullptr;
+
+    bool armed() const { return next != nullptr; }
+};
+
+
+/*
+Hierarchical timer wheel, O(1) schedule and cancel.
+
+LEVELS wheels of SLOTS slots each, level n slots span SLOTS^n ticks. A timer goes to
+the lowest level that can hold its delay and moves down a level when the slot it sits
+in comes up (cascading), so every timer is touched at most LEVELS times.
+With 100 ms ticks the wheel covers ~19 days, longer delays are clamped.
+
+Not thread safe, every worker thread owns its own wheel.
+*/
+class TimerWheel {
+
+    public:
+        static constexpr uint64_t TICK_MS = 100;
+
+        // Monotonic milliseconds to drive the wheel with
+        static uint64_t clockMs();
+
+        explicit TimerWheel(uint64_t nowMs = clockMs());
+        TimerWheel(const TimerWheel&) = delete;
+        TimerWheel& operator=(const TimerWheel&) = delete;
+
+        // (Re)arms the timer to expire delayMs from now
+        void schedule(Timer* timer, uint64_t delayMs);
+        void cancel(Timer* timer);
+
+        // Expires every timer due by nowMs, onExpired(Timer*) may schedule or cancel timers
+        template <typename Callback>
+        void advance(uint64_t nowMs, Callback&& onExpired);
+
+        // Milliseconds until the next tick that has work, -1 if there are no timers
+        int nextTimeoutMs(uint64_t nowMs) const;
+
+        bool empty() const { return count_ == 0; }
+        size_t size() const { return count_; }
+
+    private:
+        static constexpr unsigned SLOT_BITS = 6;
+        static constexpr unsigned SLOTS = 1u << SLOT_BITS;
+        static constexpr unsigned LEVELS = 4;
+        static constexpr uint64_t MAX_DELAY_TICKS = (uint64_t(1) << (SLOT_BITS * LEVELS)) - 1;
+
+        void insert(Timer* timer);
+        static void unlink(Timer* timer);
+        static void pushBack(Timer& head, Timer* timer);
+        void cascade(unsigned level);
+
+        Timer slots_[LEVELS][SLOTS];   // list heads, circular
+        uint64_t current_;             // last processed tick
+        size_t count_ = 0;
+};
+
+
+template <typename Callback>
+void TimerWheel::advance(uint64_t nowMs, Callback&& onExpired) {
+    uint64_t target = nowMs / TICK_MS;
+    while (current_ < target) {
+        if (count_ == 0) {
+            current_ = target;
+            break;
+        }
+        ++current_;
+
+        // Crossing a boundary brings the matching slots of the upper levels down
+        for (unsigned level = 1; level < LEVELS; ++level) {
+            if ((current_ & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) {
+                break;
+            }
+            cascade(level);
+        }
+
+        Timer& head = slots_[0][current_ & (SLOTS - 1)];
+        while (head.next != &head) {
+            Timer* timer = head.next;
+            unlink(timer);
+            --count_;
+            onExpired(timer);
+        }
+    }
+}
@@ -1,3 +1,222 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "log.hpp"
 
-std::mutex logMutex;
\ No newline at end of file
+
+namespace {
+
+    // Outlives the Logger, constant initialized and trivially destructible
+    std::atomic<bool> loggerStopped = false;
+
+    // Single producer (the owning thread), single consumer (the writer)
+    // Records are a 4 byte header (length, top bit set for stderr) followed by the line
+    struct LogRing {
+        static constexpr size_t CAPACITY = 64 * 1024;  // power of two
+        static constexpr size_t MAX_LINE = CAPACITY / 2;
+        static constexpr uint32_t ERR_BIT = 0x80000000u;
+
+        alignas(64) std::atomic<size_t> head = 0;  // written by the writer
+        alignas(64) std::atomic<size_t> tail = 0;  // written by the owner
+        std::atomic<bool> alive = true;            // cleared when the owning thread exits
+        char data[CAPACITY];
+
+        void copyIn(size_t pos, const void* src, size_t len) {
+            size_t offset = pos & (CAPACITY - 1);
+            size_t first = std::min(len, CAPACITY - offset);
+            memcpy(data + offset, src, first);
+            memcpy(data, static_cast<const char*>(src) + first, len - first);
+        }
+
+        void copyOut(size_t pos, void* dst, size_t len) const {
+            size_t offset = pos & (CAPACITY - 1);
+            size_t first = std::min(len, CAPACITY - offset);
+            memcpy(dst, data + offset, first);
+            memcpy(static_cast<char*>(dst) + first, data, len - first);
+        }
+    };
+
+
+    class Logger {
+
+        public:
+            static Logger& instance() {
+                static Logger logger;
+                return logger;
+            }
+
+            ~Logger() {
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    stop_ = true;
+                }
+                wakeCv_.notify_one();
+                writer_.join();
+                loggerStopped = true;
+            }
+
+            std::shared_ptr<LogRing> registerRing() {
+                auto ring = std::make_shared<LogRing>();
+                std::lock_guard<std::mutex> lock(mutex_);
+                rings_.push_back(ring);
+                return ring;
+            }
+
+            void wake() { wakeCv_.notify_one(); }
+
+            void flush() {
+                std::unique_lock<std::mutex> lock(mutex_);
+                uint64_t generation = ++flushRequested_;
+                wakeCv_.notify_one();
+                flushedCv_.wait(lock, [&] { return flushed_ >= generation; });
+            }
+
+        private:
+            Logger() : writer_(&Logger::writerLoop, this) {}
+
+            // Moves every complete record out of the ring, returns false if it was empty
+            static bool drain(LogRing& ring, std::string& out, std::string& err) {
+                size_t head = ring.head.load(std::memory_order_relaxed);
+                size_t tail = ring.tail.load(std::memory_order_acquire);
+                if (head == tail) {
+                    return false;
+                }
+                while (head != tail) {
+                    uint32_t header;
+                    ring.copyOut(head, &header, sizeof(header));
+                    head += sizeof(header);
+
+                    std::string& dst = (header & LogRing::ERR_BIT) ? err : out;
+                    size_t len = header & ~LogRing::ERR_BIT;
+                    size_t offset = dst.size();
+                    dst.resize(offset + len);
+                    ring.copyOut(head, dst.data() + offset, len);
+                    head += len;
+                }
+                ring.head.store(head, std::memory_order_release);
+                return true;
+            }
+
+            void writerLoop() {
+                std::string out;
+                std::string err;
+                std::vector<std::shared_ptr<LogRing>> rings;
+
+                std::unique_lock<std::mutex> lock(mutex_);
+                while (true) {
+                    uint64_t generation = flushRequested_;
+                    bool stopping = stop_;
+                    rings = rings_;
+                    lock.unlock();
+
+                    bool drained = false;
+                    for (auto& ring : rings) {
+                        drained |= drain(*ring, out, err);
+                    }
+                    // One write per stream per pass
+                    if (!out.empty()) {
+                        fwrite(out.data(), 1, out.size(), stdout);
+                        fflush(stdout);
+                        out.clear();
+                    }
+                    if (!err.empty()) {
+                        fwrite(err.data(), 1, err.size(), stderr);
+                        fflush(stderr);
+                        err.clear();
+                    }
+                    rings.clear();
+
+                    lock.lock();
+                    // Rings of exited threads go away once they are empty
+                    rings_.erase(std::remove_if(rings_.begin(), rings_.end(), [](const std::shared_ptr<LogRing>& ring) {
+                        return !ring->alive && ring->head == ring->tail;
+                    }), rings_.end());
+
+                    flushed_ = generation;
+                    flushedCv_.notify_all();
+
+                    if (stopping) {
+                        break;
+                    }
+                    if (!drained && !stop_ && flushRequested_ == generation) {
+                        // Producers only wake us when a ring fills up, otherwise poll
+                        wakeCv_.wait_for(lock, std::chrono::milliseconds(10));
+                    }
+                }
+            }
+
+            std::mutex mutex_;
+            std::condition_variable wakeCv_;
+            std::condition_variable flushedCv_;
+            std::vector<std::shared_ptr<LogRing>> rings_;
+            uint64_t flushRequested_ = 0;
+            uint64_t flushed_ = 0;
+            bool stop_ = false;
+            std::thread writer_;
+    };
+
+
+    struct ThreadRing {
+        std::shared_ptr<LogRing> ring = Logger::instance().registerRing();
+
+        ~ThreadRing() {
+            ring->alive = false;
+        }
+    };
+
+    LogRing& threadRing() {
+        thread_local ThreadRing threadRing;
+        return *threadRing.ring;
+    }
+}
+
+
+logging::LineWriter& logging::threadLineWriter() {
+    thread_local LineWriter writer;
+    return writer;
+}
+
+
+void logging::enqueue(Stream stream, const char* data, size_t len) {
+    if (loggerStopped) {
+        // Logging during static destruction, write through
+        fwrite(data, 1, len, stream == Stream::Err ? stderr : stdout);
+        return;
+    }
+    Logger& logger = Logger::instance();
+
+    LogRing& ring = threadRing();
+    len = std::min(len, LogRing::MAX_LINE);
+    uint32_t header = static_cast<uint32_t>(len) | (stream == Stream::Err ? LogRing::ERR_BIT : 0);
+    size_t need = sizeof(header) + len;
+
+    size_t tail = ring.tail.load(std::memory_order_relaxed);
+    while (LogRing::CAPACITY - (tail - ring.head.load(std::memory_order_acquire)) < need) {
+        // Full, never drop lines, wait for the writer
+        logger.wake();
+        std::this_thread::yield();
+    }
+
+    ring.copyIn(tail, &header, sizeof(header));
+    ring.copyIn(tail + sizeof(header), data, len);
+    ring.tail.store(tail + need, std::memory_order_release);
+
+    size_t used = tail + need - ring.head.load(std::memory_order_relaxed);
+    if (used > LogRing::CAPACITY / 2) {
+        logger.wake();
+    }
+}
+
+
+void logFlush() {
+    Logger::instance().flush();
+}
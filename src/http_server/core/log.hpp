@@ -1,32 +1,105 @@
 #pragma once
 
-#include <mutex>
-#include <iostream>
+#include <cstddef>
+#include <ostream>
+#include <streambuf>
+#include <string>
+#include <utility>
 
 
-extern std::mutex logMutex;
+/*
+Asynchronous logging.
 
-//inline std::ostream& operator<<(std::ostream& out, const std::pair<std::string, std::string>& inPair) {
-//    out << inPair.first << ": " << inPair.second;
-//    return out
-//}
-//
-//inline std::ostream& operator<<(std::ostream& out, const std::vector<std::pair<std::string, std::string>>& inVec) {
-//    for (const auto& item : inVec) {
-//        out << item << "\n";
-//    }
-//    return out;
-//}
+Callers format into a thread local line buffer and copy the line into their own
+lock-free ring (one producer, one consumer), a background writer thread drains
+every ring and writes whole batches to stdout/stderr. Nothing on the logging path
+takes a lock or makes a syscall, unless the ring is full and the caller has to
+wait for the writer.
+Lines from one thread keep their order, lines from different threads may interleave
+differently than they were logged.
 
+Levels below HTTP_SERVER_LOG_LEVEL (0 debug, 1 info, 2 error, 3 off) compile to nothing.
+*/
+
+enum class LogLevel {
+    Debug = 0,
+    Info = 1,
+    Error = 2,
+    Off = 3
+};
+
+#ifndef HTTP_SERVER_LOG_LEVEL
+#define HTTP_SERVER_LOG_LEVEL 1
+#endif
+
+constexpr LogLevel COMPILED_LOG_LEVEL = static_cast<LogLevel>(HTTP_SERVER_LOG_LEVEL);
+
+
+namespace logging {
+
+    enum class Stream : unsigned char {
+        Out,
+        Err
+    };
+
+    // Appends into a string that keeps its capacity between lines
+    class LineBuffer : public std::streambuf {
+        public:
+            std::string line;
+
+        protected:
+            int_type overflow(int_type c) override {
+                if (c != traits_type::eof()) {
+                    line.push_back(static_cast<char>(c));
+                }
+                return c;
+            }
+
+            std::streamsize xsputn(const char* s, std::streamsize n) override {
+                line.append(s, static_cast<size_t>(n));
+                return n;
+            }
+    };
+
+    struct LineWriter {
+        LineBuffer buffer;
+        std::ostream out{&buffer};
+    };
+
+    LineWriter& threadLineWriter();
+
+    // Copies the line into the calling thread's ring, see log.cpp
+    void enqueue(Stream stream, const char* data, size_t len);
+
+    template <LogLevel Level, typename... Args>
+    void write(Stream stream, Args&&... args) {
+        if constexpr (Level >= COMPILED_LOG_LEVEL && Level != LogLevel::Off) {
+            LineWriter& writer = threadLineWriter();
+            writer.buffer.line.clear();
+            (writer.out << ... << std::forward<Args>(args)) << '\n';
+            enqueue(stream, writer.buffer.line.data(), writer.buffer.line.size());
+        } else {
+            ((void)args, ...);
+            (void)stream;
+        }
+    }
+}
+
+
+// Blocks until everything logged so far has been written
+void logFlush();
+
+template <typename... Args>
+void logdebug(Args&&... args) {
+    logging::write<LogLevel::Debug>(logging::Stream::Out, std::forward<Args>(args)...);
+}
 
 template <typename... Args>
 void logf(Args&&... args) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    (std::cout << ... << std::forward<Args>(args)) << std::endl;
+    logging::write<LogLevel::Info>(logging::Stream::Out, std::forward<Args>(args)...);
 }
 
 template <typename... Args>
 void logcerr(Args&&... args) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    (std::cerr << ... << std::forward<Args>(args)) << std::endl;
-}
\ No newline at end of file
+    logging::write<LogLevel::Error>(logging::Stream::Err, std::forward<Args>(args)...);
+}
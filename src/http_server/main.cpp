@@ -1,23 +1,51 @@
 #include <string>
+#include <vector>
 #include "HTTPServer.hpp"
 #include "Routers.hpp"
+#include "log.hpp"
 
 
 int main(int argc, char* argv[]) {
 
     std::string address = "127.0.0.1";
     u_short port = 8080;
+    ServerOptions options;
+
+    // http_server [address] [port] [--backend=<iocp|epoll|io_uring>] [--threads=N] [--sharded]
+    //             [--max-requests=N] [--idle-timeout=ms]
+    std::vector<std::string> positional;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        try {
+            if (arg.rfind("--backend=", 0) == 0) {
+                options.backend = arg.substr(10);
+            } else if (arg.rfind("--threads=", 0) == 0) {
+                options.threads = std::stoul(arg.substr(10));
+            } else if (arg == "--sharded") {
+                options.sharded = true;
+            } else if (arg.rfind("--max-requests=", 0) == 0) {
+                options.maxKeepAliveRequests = std::stoul(arg.substr(15));
+            } else if (arg.rfind("--idle-timeout=", 0) == 0) {
+                options.idleTimeoutMs = static_cast<uint32_t>(std::stoul(arg.substr(15)));
+            } else {
+                positional.push_back(arg);
+            }
+        } catch (const std::exception&) {
+            logcerr("Invalid value in option: ", arg);
+            return 1;
+        }
+    }
 
-    if (argc >= 2) address = argv[1];
-    if (argc >= 3) {
-        int portNum = std::stoi(argv[2]);
+    if (positional.size() >= 1) address = positional[0];
+    if (positional.size() >= 2) {
+        int portNum = std::stoi(positional[1]);
         if (portNum < 0 || portNum > 65535) {
             throw std::out_of_range("Port must be between 0 and 65535");
         }
         port = static_cast<u_short>(portNum);
     }
 
-    HTTPServer server(address, port);
+    HTTPServer server(address, port, options);
 
     auto customerRouter = createCustomerRouter();
     server.includeRouter(std::move(customerRouter));
@@ -25,4 +53,4 @@ int main(int argc, char* argv[]) {
     server.run();
 
     return 0;
-}
\ No newline at end of file
+}
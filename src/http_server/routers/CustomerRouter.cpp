@@ -15,7 +15,7 @@ static void registerGetCustomers(Router& router) {
 
 static void registerGetCustomerById(Router& router) {
     router.get_("/{id}", [](const HTTPRequest& req, HTTPResponse& res) {
-        const std::string& customerId = req.pathParams.at("id");
+        std::string customerId(req.pathParams.at("id"));
         res = makeHttpResponse(
             200,
             "OK",
@@ -39,7 +39,7 @@ static void registerCreateCustomer(Router& router) {
 
 static void registerPatchCustomer(Router& router) {
     router.patch_("/{id}", [](const HTTPRequest& req, HTTPResponse& res) {
-        const std::string& customerId = req.pathParams.at("id");
+        std::string customerId(req.pathParams.at("id"));
         res = makeHttpResponse(
             200,
             "OK",
@@ -52,7 +52,7 @@ static void registerPatchCustomer(Router& router) {
 
 static void registerDeleteCustomer(Router& router) {
     router.delete_("/{id}", [](const HTTPRequest& req, HTTPResponse& res) {
-        const std::string& customerId = req.pathParams.at("id");
+        std::string customerId(req.pathParams.at("id"));
         res = makeHttpResponse(
             200,
             "OK",
@@ -0,0 +1,85 @@
+#include <iostream>
+#include <string>
+
+#include "HTTPParser.hpp"
+
+/*
+HTTPRequestParser and HTTPResponseParser on messages whose framing a proxy must not
+get wrong: Content-Length repeated with the same or a different value, or next to a
+chunked body. Exits non-zero if any check failed.
+*/
+
+static int failures = 0;
+
+static void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << std::endl;
+        ++failures;
+    }
+}
+
+static ParseResult parse(const std::string& raw, HTTPRequest& req, bool chunkedBodies = false) {
+    HTTPRequestParser parser(chunkedBodies);
+    return parser.parse(raw.data(), raw.size(), req);
+}
+
+// The whole response in one piece, used: the bytes that belong to it
+static ParseResult parseResponse(HTTPResponseParser& parser, const std::string& raw, size_t& used) {
+    parser.reset();
+    return parser.parse(raw.data(), raw.size(), used);
+}
+
+
+int main() {
+    HTTPRequest req;
+
+    check(parse("POST /a HTTP/1.1\r\nContent-Length: 3\r\n\r\nabc", req) == ParseResult::Complete && req.body == "abc",
+          "single Content-Length");
+
+    check(parse("POST /a HTTP/1.1\r\nContent-Length: 3\r\ncontent-length: 3\r\n\r\nabc", req) == ParseResult::Complete &&
+          req.body == "abc",
+          "repeated Content-Length with the same value");
+
+    // The smuggling case: a backend believing the first header would read the body as a second request
+    std::string smuggled = "GET /admin HTTP/1.1\r\nHost: x\r\n\r\n";
+    check(parse("POST /a HTTP/1.1\r\nContent-Length: 0\r\nContent-Length: " + std::to_string(smuggled.size()) +
+                "\r\n\r\n" + smuggled, req) == ParseResult::Malformed,
+          "repeated Content-Length with different values");
+    check(parse("POST /a HTTP/1.1\r\nContent-Length: 32\r\nContent-Length: 0\r\n\r\n", req) == ParseResult::Malformed,
+          "repeated Content-Length, the last one 0");
+
+    check(parse("POST /a HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n0\r\n\r\n", req, true) ==
+          ParseResult::Malformed,
+          "Content-Length with Transfer-Encoding");
+
+    HTTPResponseParser response;
+    size_t used = 0;
+
+    std::string same = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nContent-Length: 2\r\n\r\nok";
+    check(parseResponse(response, same, used) == ParseResult::Complete && used == same.size(),
+          "response with repeated Content-Length of the same value");
+
+    check(parseResponse(response, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\nContent-Length: 20\r\n\r\nok", used) ==
+          ParseResult::Malformed,
+          "response with repeated Content-Length of different values");
+
+    // Chunked wins, the 3 bytes of Content-Length would end the body in the chunk size line
+    std::string both = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\nTransfer-Encoding: chunked\r\n\r\n"
+                       "5\r\nhello\r\n0\r\n\r\n";
+    check(parseResponse(response, both, used) == ParseResult::Complete && used == both.size() && response.lengthIgnored(),
+          "response with Content-Length next to chunked");
+
+    std::string interim = "HTTP/1.1 100 Continue\r\n\r\n";
+    check(parseResponse(response, interim + both, used) == ParseResult::Complete &&
+          response.headOffset() == interim.size() && response.lengthIgnored(),
+          "head offset past an interim response");
+
+    check(parseResponse(response, "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok", used) == ParseResult::Complete &&
+          !response.lengthIgnored(),
+          "response with Content-Length only");
+
+    if (failures == 0) {
+        std::cout << "parser_test: all passed" << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
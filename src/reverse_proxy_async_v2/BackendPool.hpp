@@ -0,0 +1,187 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+#include "Platform.hpp"
+
+
+struct PoolOptions {
+    size_t minIdle = 4;          // kept warm, see ReverseProxy::handleTick
+    size_t maxIdle = 64;         // released connections above this are closed, 0 disables pooling
+    uint32_t idleTimeoutMs = 30000; // stay below the backend's own keep-alive timeout
+};
+
+
+struct PoolStats {
+    size_t connects = 0;   // new TCP handshakes
+    size_t reuses = 0;     // checkouts served from the idle list
+    size_t discarded = 0;  // idle connections that failed validation or expired
+    size_t idle = 0;
+};
+
+
+/*
+Warm backend connections, so a new client doesn't cost a handshake (and a TIME_WAIT
+on close) at the backend.
+
+A connection comes back on release() only when its session ended cleanly without
+sending anything on it, the byte relay can't tell whether a request is still
+waiting for its answer. So the pool hands out fresh connections: warmed up by
+maintain(), or released by clients that left before sending. Checkout validates:
+an idle backend connection must have nothing to read, readable means the backend
+closed it, reset it or sent something nobody asked for.
+
+The pool doesn't connect itself, the loop it belongs to does that asynchronously
+(ProxyLoop::postConnect) and hands warm-up connections over with warmedUp().
+Pooled sockets stay registered with their loop, each loop has its own pool.
+On IOCP all workers share one loop and so one pool, the idle list is guarded by a
+mutex held only for the push/pop.
+*/
+class BackendPool {
+
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit BackendPool(PoolOptions options) : options_(options) {}
+
+        ~BackendPool() {
+            for (const IdleConnection& conn : idle_) {
+                closesocket(conn.socket);
+            }
+        }
+
+        BackendPool(const BackendPool&) = delete;
+        BackendPool& operator=(const BackendPool&) = delete;
+
+        // Most recently released healthy connection, INVALID_SOCKET if there's none
+        SOCKET acquire() {
+            while (true) {
+                IdleConnection conn;
+                {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    if (idle_.empty()) return INVALID_SOCKET;
+                    conn = idle_.back();
+                    idle_.pop_back();
+                }
+                if (!expired(conn, Clock::now()) && healthy(conn.socket)) {
+                    std::lock_guard<std::mutex> lock(mutex_);
+                    ++stats_.reuses;
+                    return conn.socket;
+                }
+                closesocket(conn.socket);
+                std::lock_guard<std::mutex> lock(mutex_);
+                ++stats_.discarded;
+            }
+        }
+
+        // Connection of a cleanly ended session that never sent on it, no I/O may be pending
+        void release(SOCKET socket) {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (idle_.size() < options_.maxIdle) {
+                    idle_.push_back({socket, Clock::now()});
+                    return;
+                }
+            }
+            closesocket(socket);
+        }
+
+        // Drops expired connections, returns how many warm-up connects to start.
+        // Those count as in progress until warmedUp() / warmUpFailed()
+        size_t maintain() {
+            auto now = Clock::now();
+            std::vector<SOCKET> expiredSockets;
+            size_t missing = 0;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                // Oldest are at the front
+                size_t keep = 0;
+                while (keep < idle_.size() && expired(idle_[keep], now)) {
+                    expiredSockets.push_back(idle_[keep].socket);
+                    ++keep;
+                }
+                idle_.erase(idle_.begin(), idle_.begin() + static_cast<std::ptrdiff_t>(keep));
+                stats_.discarded += expiredSockets.size();
+
+                size_t target = std::min(options_.minIdle, options_.maxIdle);
+                size_t have = idle_.size() + warmingUp_;
+                missing = target > have ? target - have : 0;
+                warmingUp_ += missing;
+            }
+            for (SOCKET socket : expiredSockets) {
+                closesocket(socket);
+            }
+            return missing;
+        }
+
+        void warmedUp(SOCKET socket) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --warmingUp_;
+            ++stats_.connects;
+            idle_.push_back({socket, Clock::now()});
+        }
+
+        void warmUpFailed() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            --warmingUp_;
+        }
+
+        // A client had to wait for a new connection
+        void connected() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ++stats_.connects;
+        }
+
+        PoolStats stats() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            PoolStats result = stats_;
+            result.idle = idle_.size();
+            return result;
+        }
+
+    private:
+        struct IdleConnection {
+            SOCKET socket = INVALID_SOCKET;
+            Clock::time_point since;
+        };
+
+        bool expired(const IdleConnection& conn, Clock::time_point now) const {
+            return now - conn.since >= std::chrono::milliseconds(options_.idleTimeoutMs);
+        }
+
+        static bool healthy(SOCKET socket) {
+#ifdef _WIN32
+            fd_set readSet;
+            FD_ZERO(&readSet);
+            FD_SET(socket, &readSet);
+            timeval noWait{0, 0};
+            if (select(0, &readSet, nullptr, nullptr, &noWait) != 0) {
+                return false;
+            }
+#else
+            // select() can't take descriptors above FD_SETSIZE, peek instead
+            char byte;
+            if (recv(socket, &byte, 1, MSG_PEEK | MSG_DONTWAIT) != -1 ||
+                (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                return false;
+            }
+#endif
+            int error = 0;
+            socklen_t errorLen = sizeof(error);
+            if (getsockopt(socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) == SOCKET_ERROR) {
+                return false;
+            }
+            return error == 0;
+        }
+
+        PoolOptions options_;
+
+        std::mutex mutex_;
+        std::vector<IdleConnection> idle_; // oldest first, checkouts take the back
+        size_t warmingUp_ = 0;
+        PoolStats stats_;
+};
@@ -0,0 +1,393 @@
+#include <chrono>
+#include <cstring>
+#include <fcntl.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/eventfd.h>
+#include <thread>
+
+#include "EpollProxyLoop.hpp"
+#include "log.hpp"
+
+
+EpollProxyLoop::EpollProxyLoop(ReverseProxy& proxy, PoolOptions poolOptions, size_t backends)
+    : ProxyLoop(proxy, poolOptions, backends) {
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epollFd_ == -1) {
+        logcerr("epoll_create1() failed: ", strerror(errno));
+        throw std::runtime_error("Failed to init epoll");
+    }
+
+    wakeupFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wakeupFd_ == -1) {
+        logcerr("eventfd() failed: ", strerror(errno));
+        close(epollFd_);
+        throw std::runtime_error("Failed to init epoll wakeup fd");
+    }
+
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.fd = wakeupFd_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, wakeupFd_, &event) == -1) {
+        logcerr("epoll_ctl(wakeup) failed: ", strerror(errno));
+        close(wakeupFd_);
+        close(epollFd_);
+        throw std::runtime_error("Failed to register epoll wakeup fd");
+    }
+}
+
+
+EpollProxyLoop::~EpollProxyLoop() {
+    for (Pipe& pipe : freePipes_) {
+        close(pipe.readFd);
+        close(pipe.writeFd);
+    }
+    if (wakeupFd_ != -1) close(wakeupFd_);
+    if (epollFd_ != -1) close(epollFd_);
+}
+
+
+void EpollProxyLoop::init(SOCKET listenSocket) {
+    listenSocket_ = listenSocket;
+    if (!setNonBlocking(listenSocket_)) {
+        logcerr("fcntl(O_NONBLOCK) failed for listening socket: ", strerror(errno));
+        throw std::runtime_error("Failed to make listening socket non-blocking");
+    }
+
+    // Listener stays level-triggered, each wakeup accepts until EAGAIN
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLEXCLUSIVE;
+    event.data.fd = listenSocket_;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, listenSocket_, &event) == -1) {
+        logcerr("epoll_ctl(listen) failed: ", strerror(errno));
+        throw std::runtime_error("Failed to register listening socket with epoll");
+    }
+}
+
+
+void EpollProxyLoop::run() {
+    std::ostringstream oss;
+    oss << "[Thread " << std::this_thread::get_id() << "] ";
+    std::string threadStr = oss.str();
+    logf(threadStr, "Started worker");
+
+    epoll_event events[MAX_EVENTS];
+    auto lastTick = std::chrono::steady_clock::now();
+
+    while (proxy_.isRunning()) {
+        int timeout = ready_.empty() && done_.empty() ? TICK_MS : 0;
+        int n = epoll_wait(epollFd_, events, MAX_EVENTS, timeout);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            logcerr(threadStr, "epoll_wait() failed: ", strerror(errno));
+            break;
+        }
+
+        for (int i = 0; i < n; ++i) {
+            int fd = events[i].data.fd;
+            uint32_t flags = events[i].events;
+
+            if (fd == wakeupFd_) {
+                uint64_t value;
+                while (read(wakeupFd_, &value, sizeof(value)) > 0) {}
+                continue;
+            }
+            if (fd == listenSocket_) {
+                acceptAll(threadStr);
+                continue;
+            }
+
+            bool failed = flags & (EPOLLERR | EPOLLHUP);
+            if (channels_[fd].connect != nullptr && (failed || flags & EPOLLOUT)) {
+                finishConnect(fd);
+            }
+            const Channel& channel = channels_[fd];
+            if ((channel.recv != nullptr && (failed || flags & (EPOLLIN | EPOLLRDHUP))) ||
+                (!channel.sends.empty() && (failed || flags & EPOLLOUT)) ||
+                channel.splice != nullptr) {
+                ready_.push_back(fd);
+            }
+            if (channel.feeding != INVALID_SOCKET && (failed || flags & EPOLLOUT)) {
+                ready_.push_back(channel.feeding);
+            }
+        }
+
+        dispatch(threadStr);
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastTick >= std::chrono::milliseconds(TICK_MS)) {
+            lastTick = now;
+            proxy_.handleTick(*this, threadStr);
+        }
+    }
+    logf(threadStr, "Shutdown signal received.");
+}
+
+
+void EpollProxyLoop::wakeup() {
+    uint64_t value = 1;
+    if (write(wakeupFd_, &value, sizeof(value)) == -1) {
+        logcerr("eventfd write failed: ", strerror(errno));
+    }
+}
+
+
+// Attempts what's ready and hands the completions over, until handlers stop posting
+// anything that can finish right away
+void EpollProxyLoop::dispatch(const std::string& threadStr) {
+    while (!ready_.empty() || !done_.empty()) {
+        // performIO only records completions, ready_ can't grow under us
+        for (SOCKET fd : ready_) {
+            performIO(fd);
+        }
+        ready_.clear();
+
+        handling_.swap(done_);
+        for (const Completion& completion : handling_) {
+            proxy_.handleCompletion(completion.context, completion.ok, completion.bytes, completion.error, threadStr);
+        }
+        handling_.clear();
+    }
+}
+
+
+void EpollProxyLoop::acceptAll(const std::string& threadStr) {
+    while (true) {
+        SOCKET clientSocket = accept4(listenSocket_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (clientSocket == INVALID_SOCKET) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                logcerr(threadStr, "accept4() failed: ", strerror(errno));
+            }
+            return;
+        }
+        if (!addSocket(clientSocket, threadStr)) {
+            closesocket(clientSocket);
+            continue;
+        }
+        proxy_.handleAccept(*this, clientSocket, threadStr);
+    }
+}
+
+
+bool EpollProxyLoop::addSocket(SOCKET socket, const std::string& threadStr) {
+    size_t index = static_cast<size_t>(socket);
+    if (index >= channels_.size()) {
+        channels_.resize(std::max(index + 1, channels_.size() * 2));
+    }
+    channels_[index] = Channel{};
+
+    epoll_event event{};
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = socket;
+    if (epoll_ctl(epollFd_, EPOLL_CTL_ADD, socket, &event) == -1) {
+        logcerr(threadStr, "epoll_ctl(ADD) failed: ", strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+
+bool EpollProxyLoop::postConnect(ProxyContext* context, const sockaddr_in& addr, const std::string& threadStr) {
+    SOCKET socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, IPPROTO_TCP);
+    context->srcSocket = socket;
+    if (socket == INVALID_SOCKET || !addSocket(socket, threadStr)) {
+        return false;
+    }
+
+    if (connect(socket, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == 0) {
+        done_.push_back({context, true, 0, 0});
+        return true;
+    }
+    if (errno != EINPROGRESS) {
+        return false;
+    }
+    // Registered before connect(), the writable edge can't be missed
+    channels_[socket].connect = context;
+    return true;
+}
+
+
+bool EpollProxyLoop::postRecv(ProxyContext* context) {
+    channels_[context->srcSocket].recv = context;
+    ready_.push_back(context->srcSocket);
+    return true;
+}
+
+
+bool EpollProxyLoop::postSend(ProxyContext* context) {
+    channels_[context->srcSocket].sends.push_back(context);
+    ready_.push_back(context->srcSocket);
+    return true;
+}
+
+
+bool EpollProxyLoop::postSplice(ProxyContext* context) {
+    Channel& channel = channels_[context->srcSocket];
+    if (!acquirePipe(channel.pipe)) {
+        return false;
+    }
+    channel.splice = context;
+    channel.pipeBytes = 0;
+    channels_[context->dstSocket].feeding = context->srcSocket;
+    ready_.push_back(context->srcSocket);
+    return true;
+}
+
+
+void EpollProxyLoop::cancelIO(SOCKET socket) {
+    Channel& channel = channels_[socket];
+    if (channel.splice != nullptr) {
+        finishSplice(socket, false, IO_ABORTED);
+    }
+    if (channel.connect != nullptr) {
+        done_.push_back({channel.connect, false, 0, IO_ABORTED});
+    }
+    if (channel.recv != nullptr) {
+        done_.push_back({channel.recv, false, 0, IO_ABORTED});
+    }
+    for (ProxyContext* context : channel.sends) {
+        done_.push_back({context, false, 0, IO_ABORTED});
+    }
+    channel = Channel{};
+}
+
+
+void EpollProxyLoop::finishConnect(SOCKET socket) {
+    Channel& channel = channels_[socket];
+    int error = 0;
+    socklen_t errorLen = sizeof(error);
+    if (getsockopt(socket, SOL_SOCKET, SO_ERROR, &error, &errorLen) == -1) {
+        error = errno;
+    }
+    done_.push_back({channel.connect, error == 0, 0, error});
+    channel.connect = nullptr;
+}
+
+
+void EpollProxyLoop::performIO(SOCKET socket) {
+    Channel& channel = channels_[socket];
+
+    while (!channel.sends.empty()) {
+        ProxyContext* context = channel.sends.front();
+        ssize_t sent = send(socket, context->data() + channel.sendOffset,
+                            context->bufferLen - channel.sendOffset, MSG_NOSIGNAL);
+        if (sent >= 0) {
+            channel.sendOffset += static_cast<size_t>(sent);
+            if (channel.sendOffset == context->bufferLen) {
+                done_.push_back({context, true, context->bufferLen, 0});
+                channel.sends.erase(channel.sends.begin());
+                channel.sendOffset = 0;
+            }
+            continue;
+        }
+        if (errno == EINTR) continue;
+        if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+
+        // The stream is broken, nothing queued behind the failed send can go out either
+        int error = errno;
+        for (ProxyContext* failed : channel.sends) {
+            done_.push_back({failed, false, 0, error});
+        }
+        channel.sends.clear();
+        channel.sendOffset = 0;
+    }
+
+    if (channel.splice != nullptr) {
+        performSplice(socket);
+    }
+
+    while (channel.recv != nullptr) {
+        ssize_t received = recv(socket, channel.recv->buffer, BUFFER_SIZE, 0);
+        if (received >= 0) {
+            done_.push_back({channel.recv, true, static_cast<size_t>(received), 0});
+        } else if (errno == EINTR) {
+            continue;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            break;
+        } else {
+            done_.push_back({channel.recv, false, 0, errno});
+        }
+        channel.recv = nullptr;
+    }
+}
+
+
+// Moves what's in the pipe on to dst, and only with the pipe empty reads more from src.
+// Returns waiting for whichever side said EAGAIN
+void EpollProxyLoop::performSplice(SOCKET socket) {
+    Channel& channel = channels_[socket];
+    SOCKET dstSocket = channel.splice->dstSocket;
+
+    while (true) {
+        while (channel.pipeBytes > 0) {
+            ssize_t moved = splice(channel.pipe.readFd, nullptr, dstSocket, nullptr, channel.pipeBytes,
+                                   SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (moved > 0) {
+                channel.pipeBytes -= static_cast<size_t>(moved);
+                continue;
+            }
+            if (moved == -1 && errno == EINTR) continue;
+            if (moved == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) return;
+            finishSplice(socket, false, moved == 0 ? EPIPE : errno);
+            return;
+        }
+
+        ssize_t moved = splice(socket, nullptr, channel.pipe.writeFd, nullptr, SPLICE_CHUNK,
+                               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (moved > 0) {
+            channel.pipeBytes = static_cast<size_t>(moved);
+            continue;
+        }
+        if (moved == 0) {
+            finishSplice(socket, true, 0);
+            return;
+        }
+        if (errno == EINTR) continue;
+        // The pipe is empty here, EAGAIN can only be the socket
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+        finishSplice(socket, false, errno);
+        return;
+    }
+}
+
+
+void EpollProxyLoop::finishSplice(SOCKET socket, bool ok, int error) {
+    Channel& channel = channels_[socket];
+    ProxyContext* context = channel.splice;
+    context->unsent = channel.pipeBytes;
+    done_.push_back({context, ok, 0, error});
+
+    releasePipe(channel.pipe, channel.pipeBytes == 0);
+    channel.splice = nullptr;
+    channel.pipeBytes = 0;
+    channels_[context->dstSocket].feeding = INVALID_SOCKET;
+}
+
+
+bool EpollProxyLoop::acquirePipe(Pipe& pipe) {
+    if (!freePipes_.empty()) {
+        pipe = freePipes_.back();
+        freePipes_.pop_back();
+        return true;
+    }
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        return false;
+    }
+    pipe.readFd = fds[0];
+    pipe.writeFd = fds[1];
+    return true;
+}
+
+
+// A pipe with bytes left in it goes, they belong to a connection that's over
+void EpollProxyLoop::releasePipe(Pipe& pipe, bool empty) {
+    if (empty && freePipes_.size() < MAX_FREE_PIPES) {
+        freePipes_.push_back(pipe);
+    } else {
+        close(pipe.readFd);
+        close(pipe.writeFd);
+    }
+    pipe = Pipe{};
+}
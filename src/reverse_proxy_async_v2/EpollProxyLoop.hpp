@@ -0,0 +1,95 @@
+#pragma once
+
+#include <vector>
+#include <sys/epoll.h>
+
+#include "ProxyLoop.hpp"
+#include "ReverseProxy.hpp"
+
+
+/*
+Linux backend, one epoll instance per worker thread.
+
+Sockets are registered edge-triggered for both directions once, and stay in the loop
+that accepted or connected them (pooled backend connections included).
+Posting only records the operation on the socket's channel, the loop does the actual
+recv()/send() and reports it as a completion. A connect is a non-blocking connect()
+that completes when the socket turns writable.
+
+A splice relays one direction for as long as it lasts: src -> pipe -> dst, with the
+pipe drained before src is read again, so a slow dst stops the reading on its own.
+Pipes are kept for the next splice when they come back empty.
+
+Completions are collected first and handed to the proxy afterwards, so handlers can
+post, cancel and close freely without pulling a channel out from under the loop.
+The shared listening socket is registered with EPOLLEXCLUSIVE, a new client wakes up
+only one of the loops.
+*/
+class EpollProxyLoop : public ProxyLoop {
+
+    public:
+        EpollProxyLoop(ReverseProxy& proxy, PoolOptions poolOptions, size_t backends);
+        ~EpollProxyLoop() override;
+
+        void init(SOCKET listenSocket) override;
+
+        bool postConnect(ProxyContext* context, const sockaddr_in& addr, const std::string& threadStr) override;
+        bool postRecv(ProxyContext* context) override;
+        bool postSend(ProxyContext* context) override;
+        bool postSplice(ProxyContext* context) override;
+        void cancelIO(SOCKET socket) override;
+
+        void run() override;
+        void wakeup() override;
+
+    private:
+        static constexpr int MAX_EVENTS = 256;
+        static constexpr int TICK_MS = 1000;
+        static constexpr size_t SPLICE_CHUNK = 65536;  // default pipe capacity
+        static constexpr size_t MAX_FREE_PIPES = 256;
+
+        struct Pipe {
+            int readFd = -1;
+            int writeFd = -1;
+        };
+
+        // Pending operations of one socket
+        struct Channel {
+            ProxyContext* connect = nullptr;
+            ProxyContext* recv = nullptr;
+            std::vector<ProxyContext*> sends;  // in posting order
+            size_t sendOffset = 0;             // bytes of sends.front() already written
+
+            ProxyContext* splice = nullptr;    // relaying from this socket
+            Pipe pipe;
+            size_t pipeBytes = 0;
+            SOCKET feeding = INVALID_SOCKET;   // socket whose splice writes into this one
+        };
+
+        struct Completion {
+            ProxyContext* context;
+            bool ok;
+            size_t bytes;
+            int error;
+        };
+
+        bool addSocket(SOCKET socket, const std::string& threadStr);
+        void acceptAll(const std::string& threadStr);
+        void finishConnect(SOCKET socket);
+        void performIO(SOCKET socket);
+        void performSplice(SOCKET socket);
+        void finishSplice(SOCKET socket, bool ok, int error);
+        bool acquirePipe(Pipe& pipe);
+        void releasePipe(Pipe& pipe, bool empty);
+        void dispatch(const std::string& threadStr);
+
+        int epollFd_ = -1;
+        int wakeupFd_ = -1;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+
+        std::vector<Channel> channels_;    // indexed by descriptor
+        std::vector<SOCKET> ready_;        // sockets with an operation to attempt
+        std::vector<Completion> done_;     // waiting to be handed to the proxy
+        std::vector<Completion> handling_;
+        std::vector<Pipe> freePipes_;
+};
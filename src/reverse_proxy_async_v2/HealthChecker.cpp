@@ -0,0 +1,179 @@
+#include <chrono>
+#include <cstdlib>
+#include <vector>
+
+#include "HealthChecker.hpp"
+
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+HealthChecker::HealthChecker(LoadBalancer& balancer) : balancer_(balancer), options_(balancer.health()) {
+    if (!options_.checkPath.empty()) {
+        request_ = "GET " + options_.checkPath + " HTTP/1.1\r\nHost: health\r\nConnection: close\r\n\r\n";
+    }
+}
+
+
+HealthChecker::~HealthChecker() {
+    stop();
+}
+
+
+void HealthChecker::start() {
+    thread_ = std::thread(&HealthChecker::run, this);
+}
+
+
+void HealthChecker::stop() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wake_.notify_all();
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+}
+
+
+void HealthChecker::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        lock.unlock();
+        checkAll();
+        lock.lock();
+        wake_.wait_for(lock, std::chrono::milliseconds(options_.checkIntervalMs), [this] { return stopping_; });
+    }
+}
+
+
+void HealthChecker::checkAll() {
+    std::vector<Probe> probes;
+    int64_t startMs = nowMs();
+
+    for (size_t backend = 0; backend < balancer_.size(); ++backend) {
+        if (!balancer_.beginCheck(backend)) {
+            continue;
+        }
+        Probe probe;
+        probe.backend = backend;
+        probe.socket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (probe.socket == INVALID_SOCKET || !setNonBlocking(probe.socket)) {
+            // Our problem, not the backend's. Give a claimed trial back as a failure
+            // rather than leaving the circuit half-open for good
+            finish(probe, false, startMs);
+            continue;
+        }
+        const sockaddr_in& addr = balancer_.address(backend);
+        if (connect(probe.socket, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) == SOCKET_ERROR &&
+            !connectInProgress(lastSocketError())) {
+            finish(probe, false, startMs);
+            continue;
+        }
+        probes.push_back(std::move(probe));
+    }
+
+    int64_t deadline = startMs + options_.checkTimeoutMs;
+    std::vector<PollFd> fds;
+    std::vector<Probe*> polled;
+    while (true) {
+        fds.clear();
+        polled.clear();
+        for (Probe& probe : probes) {
+            if (probe.state == ProbeState::DONE) {
+                continue;
+            }
+            PollFd fd{};
+            fd.fd = probe.socket;
+            fd.events = probe.state == ProbeState::READING ? POLLIN : POLLOUT;
+            fds.push_back(fd);
+            polled.push_back(&probe);
+        }
+        int64_t left = deadline - nowMs();
+        if (fds.empty() || left <= 0) {
+            break;
+        }
+        if (pollSockets(fds.data(), fds.size(), static_cast<int>(left)) == SOCKET_ERROR) {
+            break;
+        }
+        for (size_t i = 0; i < fds.size(); ++i) {
+            if (fds[i].revents != 0) {
+                advance(*polled[i], startMs);
+            }
+        }
+    }
+
+    // Whatever hasn't answered by now timed out
+    for (Probe& probe : probes) {
+        if (probe.state != ProbeState::DONE) {
+            finish(probe, false, startMs);
+        }
+    }
+}
+
+
+void HealthChecker::advance(Probe& probe, int64_t startMs) {
+    if (probe.state == ProbeState::CONNECTING) {
+        int error = 0;
+        socklen_t errorLen = sizeof(error);
+        if (getsockopt(probe.socket, SOL_SOCKET, SO_ERROR, reinterpret_cast<char*>(&error), &errorLen) == SOCKET_ERROR ||
+            error != 0) {
+            finish(probe, false, startMs);
+        } else if (request_.empty()) {
+            finish(probe, true, startMs);
+        } else {
+            probe.state = ProbeState::SENDING;
+        }
+        return;
+    }
+
+    if (probe.state == ProbeState::SENDING) {
+        auto sent = send(probe.socket, request_.data() + probe.sent, static_cast<int>(request_.size() - probe.sent), 0);
+        if (sent == SOCKET_ERROR) {
+            finish(probe, false, startMs);
+            return;
+        }
+        probe.sent += static_cast<size_t>(sent);
+        if (probe.sent == request_.size()) {
+            probe.state = ProbeState::READING;
+        }
+        return;
+    }
+
+    // Only the status line matters, "HTTP/1.1 200 OK\r\n"
+    char buffer[512];
+    auto received = recv(probe.socket, buffer, sizeof(buffer), 0);
+    if (received <= 0) {
+        finish(probe, false, startMs);
+        return;
+    }
+    probe.response.append(buffer, static_cast<size_t>(received));
+    size_t lineEnd = probe.response.find("\r\n");
+    if (lineEnd == std::string::npos) {
+        if (probe.response.size() > 1024) {
+            finish(probe, false, startMs);
+        }
+        return;
+    }
+    size_t space = probe.response.find(' ');
+    int status = space < lineEnd ? std::atoi(probe.response.c_str() + space + 1) : 0;
+    finish(probe, status >= 200 && status < 400, startMs);
+}
+
+
+void HealthChecker::finish(Probe& probe, bool healthy, int64_t startMs) {
+    if (probe.socket != INVALID_SOCKET) {
+        closesocket(probe.socket);
+        probe.socket = INVALID_SOCKET;
+    }
+    probe.state = ProbeState::DONE;
+    if (healthy) {
+        balancer_.reportSuccess(probe.backend, static_cast<uint32_t>(nowMs() - startMs));
+    } else {
+        balancer_.reportFailure(probe.backend);
+    }
+}
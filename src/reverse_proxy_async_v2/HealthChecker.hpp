@@ -0,0 +1,66 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "LoadBalancer.hpp"
+
+
+/*
+Active health checks, one background thread for all backends.
+
+Every checkIntervalMs it probes each backend the LoadBalancer wants checked (in
+rotation, or ejected and due for its half-open trial), all of them at once:
+a non-blocking connect, and with a checkPath a "GET checkPath" whose status line
+must be 2xx or 3xx, everything within checkTimeoutMs. The outcome and the time it
+took go to LoadBalancer::reportSuccess / reportFailure, which keeps the circuits.
+
+Probes are a handful of sockets once a second, plain poll() is enough and it stays
+off the worker loops.
+*/
+class HealthChecker {
+
+    public:
+        explicit HealthChecker(LoadBalancer& balancer);
+        ~HealthChecker();
+
+        HealthChecker(const HealthChecker&) = delete;
+        HealthChecker& operator=(const HealthChecker&) = delete;
+
+        void start();
+        void stop();
+
+    private:
+        enum class ProbeState {
+            CONNECTING,
+            SENDING,
+            READING,
+            DONE
+        };
+
+        struct Probe {
+            size_t backend = 0;
+            SOCKET socket = INVALID_SOCKET;
+            ProbeState state = ProbeState::CONNECTING;
+            size_t sent = 0;
+            std::string response;
+        };
+
+        void run();
+        void checkAll();
+        // Moves the probe along after poll() flagged its socket, DONE once reported
+        void advance(Probe& probe, int64_t startMs);
+        void finish(Probe& probe, bool healthy, int64_t startMs);
+
+        LoadBalancer& balancer_;
+        const HealthOptions& options_;
+        std::string request_;
+
+        std::thread thread_;
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool stopping_ = false;
+};
@@ -0,0 +1,954 @@
+#include <algorithm>
+#include <cstring>
+
+#include "HttpRelay.hpp"
+#include "ReverseProxy.hpp"
+#include "log.hpp"
+
+
+static bool iequalsAscii(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((a[i] | 0x20) != (b[i] | 0x20)) return false;
+    }
+    return true;
+}
+
+// Headers about the connection they came on, they don't go on to the upstream
+static bool isHopByHop(std::string_view name) {
+    static constexpr std::string_view HOP_BY_HOP[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Upgrade"};
+    for (std::string_view hop : HOP_BY_HOP) {
+        if (iequalsAscii(name, hop)) return true;
+    }
+    return false;
+}
+
+// How the body is framed, sent once as the parser read it. Chunked bodies are passed
+// on still chunked
+static bool isFraming(std::string_view name) {
+    return iequalsAscii(name, "Content-Length") || iequalsAscii(name, "Transfer-Encoding");
+}
+
+// Whether a stored response may answer the request, and its response be stored
+static bool cacheableRequest(const HTTPRequest& request) {
+    if (request.method != "GET" && request.method != "HEAD") {
+        return false;
+    }
+    return request.header("Authorization").empty() && !parseCacheControl(request.header("Cache-Control")).noStore;
+}
+
+// Whether identical concurrent requests may share an exchange: idempotent, and nothing
+// in them the response could be made for one client only. The key leaves out ranges
+// and validators, a 206 or 304 made for one client would reach the others
+static bool collapsibleRequest(const HTTPRequest& request) {
+    static constexpr std::string_view CONDITIONAL[] = {"Range", "If-None-Match", "If-Modified-Since", "If-Match",
+                                                       "If-Unmodified-Since", "If-Range"};
+    if (request.method != "GET" && request.method != "HEAD") {
+        return false;
+    }
+    for (std::string_view name : CONDITIONAL) {
+        if (!request.header(name).empty()) return false;
+    }
+    return request.body.empty() && request.header("Authorization").empty() && request.header("Cookie").empty();
+}
+
+// Whether the followers may get the leader's response too, only a full 200 answers
+// them all
+static bool shareableResponse(const HTTPResponseParser& response) {
+    return response.statusCode() == 200 && response.header("Set-Cookie").empty() && response.header("Vary").empty() &&
+           !parseCacheControl(response.header("Cache-Control")).noStore;
+}
+
+// Takes the Content-Length lines out of the head in the response bytes so far, held
+// and then context, in place. The body is chunked, a client going by the length would
+// read it wrong
+static void dropContentLength(const HTTPResponseParser& response, const std::vector<std::shared_ptr<ProxyContext>>& held,
+                              ProxyContext* context) {
+    std::vector<std::pair<size_t, size_t>> drops;  // offsets in the bytes so far, [first, second)
+    std::string_view head = response.head();
+    size_t pos = head.find("\r\n") + 2;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos) + 2;
+        size_t colon = head.find(':', pos);
+        if (colon < end && iequalsAscii(head.substr(pos, colon - pos), "Content-Length")) {
+            drops.emplace_back(response.headOffset() + pos, response.headOffset() + end);
+        }
+        pos = end;
+    }
+
+    size_t start = 0;  // of the chunk in the bytes so far
+    auto compact = [&](ProxyContext* chunk) {
+        size_t kept = 0;
+        for (size_t i = 0; i < chunk->bufferLen; ++i) {
+            size_t at = start + i;
+            bool dropped = std::any_of(drops.begin(), drops.end(), [at](const auto& drop) {
+                return at >= drop.first && at < drop.second;
+            });
+            if (!dropped) chunk->buffer[kept++] = chunk->buffer[i];
+        }
+        start += chunk->bufferLen;
+        chunk->bufferLen = kept;
+    };
+    for (const auto& chunk : held) {
+        compact(chunk.get());
+    }
+    compact(context);
+}
+
+// The head a cached response is refetched with: the one that fetched it without what
+// belonged to that client (Cookie), would turn the answer into a 304 or 206 instead of
+// one to store (If-*, Range), or framed a body
+static std::string revalidationHead(std::string_view head) {
+    std::string out;
+    size_t pos = 0;
+    while (pos < head.size()) {
+        size_t end = head.find("\r\n", pos);
+        end = end == std::string_view::npos ? head.size() : end + 2;
+        std::string_view line = head.substr(pos, end - pos);
+        size_t colon = line.find(':');
+        std::string_view name = line.substr(0, colon);
+        bool drop = pos != 0 && colon != std::string_view::npos &&
+                    (iequalsAscii(name, "Cookie") || iequalsAscii(name, "Range") || isFraming(name) ||
+                     (name.size() > 3 && iequalsAscii(name.substr(0, 3), "If-")));
+        if (!drop) out.append(line);
+        pos = end;
+    }
+    return out;
+}
+
+static void cacheKey(const HTTPRequest& request, std::string& key) {
+    key.assign(request.method).append(" ").append(request.header("Host")).append(request.path);
+}
+
+
+HttpRelay::HttpRelay(ProxyLoop& loop, LoadBalancer& balancer, ResponseCache* cache, size_t maxUpstreams, size_t maxInFlight,
+                     bool collapse)
+    : loop_(loop), balancer_(balancer), cache_(cache), maxUpstreams_(std::max<size_t>(maxUpstreams, 1)), maxInFlight_(maxInFlight),
+      collapse_(collapse),
+      idle_(balancer.size()), queued_(balancer.size()), upstreams_(balancer.size(), 0) {}
+
+
+RelayStats HttpRelay::stats() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return stats_;
+}
+
+
+void HttpRelay::accept(SOCKET clientSocket, const std::string& threadStr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    setNoDelay(clientSocket);
+    auto* client = new HttpClient(this, clientSocket);
+    if (balancer_.needsClientAddress()) {
+        socklen_t addrLen = sizeof(client->addr);
+        getpeername(clientSocket, reinterpret_cast<sockaddr*>(&client->addr), &addrLen);
+    }
+    recvOn(client, threadStr);
+    reap();
+}
+
+
+void HttpRelay::handleCompletion(ProxyContext* context, bool ok, size_t bytesTransferred, int error, const std::string& threadStr) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    HttpPeer* peer = context->peer;
+    --peer->pendingIO;
+
+    if (peer->isUpstream) {
+        auto* upstream = static_cast<HttpUpstream*>(peer);
+        switch (context->state) {
+            case IOState::CONNECT:
+                delete context;
+                onUpstreamConnect(upstream, ok, error, threadStr);
+                break;
+            case IOState::RECV:
+                onUpstreamRecv(upstream, context, ok, bytesTransferred, threadStr);
+                break;
+            default:
+                // The request went out, the response comes on the recv
+                delete context;
+                if (!ok) {
+                    closeUpstream(upstream, threadStr);
+                }
+                break;
+        }
+    } else {
+        auto* client = static_cast<HttpClient*>(peer);
+        if (context->state == IOState::RECV) {
+            onClientRecv(client, context, ok, bytesTransferred, threadStr);
+        } else {
+            onClientSend(client, context, ok, threadStr);
+        }
+    }
+    reap();
+}
+
+
+bool HttpRelay::post(ProxyContext* context, HttpPeer* peer, const std::string& threadStr) {
+    context->peer = peer;
+    bool posted = false;
+    if (!peer->closing) {
+        posted = context->state == IOState::RECV ? loop_.postRecv(context) : loop_.postSend(context);
+    }
+    if (posted) {
+        ++peer->pendingIO;
+        if (context->state == IOState::SEND && !peer->isUpstream) {
+            static_cast<HttpClient*>(peer)->inFlight += context->bufferLen;
+        }
+        return true;
+    }
+    if (!peer->closing) {
+        logcerr(threadStr, context->state == IOState::SEND ? "Send" : "Recv", " failed with error: ", lastSocketError());
+    }
+    delete context;
+    return false;
+}
+
+
+void HttpRelay::recvOn(HttpPeer* peer, const std::string& threadStr) {
+    if (peer->recvPosted || peer->closing) {
+        return;
+    }
+    if (post(new ProxyContext(IOState::RECV, nullptr, peer->socket, INVALID_SOCKET), peer, threadStr)) {
+        peer->recvPosted = true;
+    } else {
+        closePeer(peer, threadStr);
+    }
+}
+
+
+bool HttpRelay::queueSend(HttpPeer* peer, ProxyContext*& pending, std::string_view data, const std::string& threadStr) {
+    while (!data.empty()) {
+        if (pending == nullptr) {
+            pending = new ProxyContext(IOState::SEND, nullptr, peer->socket, INVALID_SOCKET);
+        }
+        size_t take = std::min(data.size(), static_cast<size_t>(BUFFER_SIZE) - pending->bufferLen);
+        std::memcpy(pending->buffer + pending->bufferLen, data.data(), take);
+        pending->bufferLen += take;
+        data.remove_prefix(take);
+        if (pending->bufferLen == static_cast<size_t>(BUFFER_SIZE) && !flush(peer, pending, threadStr)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+bool HttpRelay::flush(HttpPeer* peer, ProxyContext*& pending, const std::string& threadStr) {
+    if (pending == nullptr) {
+        return true;
+    }
+    ProxyContext* context = pending;
+    pending = nullptr;
+    return post(context, peer, threadStr);
+}
+
+
+bool HttpRelay::sendShared(HttpPeer* peer, std::shared_ptr<const void> owner, std::string_view data, const std::string& threadStr) {
+    if (data.empty()) {
+        return true;
+    }
+    auto* context = new ProxyContext(IOState::SEND, nullptr, peer->socket, INVALID_SOCKET);
+    context->external = data.data();
+    context->bufferLen = data.size();
+    context->owner = std::move(owner);
+    return post(context, peer, threadStr);
+}
+
+
+// The next request out of what the client sent, or another recv for the rest of it
+void HttpRelay::nextRequest(HttpClient* client, const std::string& threadStr) {
+    if (client->closing) {
+        return;
+    }
+    ParseResult result = client->parser.parse(client->in.data(), client->in.size(), client->request);
+    if (result == ParseResult::NeedMore) {
+        recvOn(client, threadStr);
+        return;
+    }
+    if (result == ParseResult::Malformed) {
+        client->requestLen = client->in.size();
+        respondError(client, 400, "Bad Request", threadStr);
+        return;
+    }
+    client->requestLen = client->parser.consumed();
+    client->closeAfter = !client->request.keepAlive();
+    client->cacheable = cache_ != nullptr && cacheableRequest(client->request);
+    if (client->cacheable && serveCached(client, threadStr)) {
+        return;
+    }
+    if (collapse_ && collapsibleRequest(client->request) && joinFlight(client)) {
+        return;
+    }
+    dispatch(client, threadStr);
+}
+
+
+void HttpRelay::dispatch(HttpClient* client, const std::string& threadStr) {
+    bool trial = false;
+    size_t backend = balancer_.acquire(client->addr, trial);
+    if (backend == LoadBalancer::NONE) {
+        respondError(client, 503, "Service Unavailable", threadStr);
+        return;
+    }
+    client->backend = backend;
+
+    if (!trial && !idle_[backend].empty()) {
+        HttpUpstream* upstream = idle_[backend].back();
+        idle_[backend].pop_back();
+        upstream->idle = false;
+        startExchange(upstream, client, threadStr);
+        return;
+    }
+
+    client->queued = true;
+    queued_[backend].push_back(client);
+    // A trial has to prove the backend takes connections again, it gets a new one
+    if (trial || upstreams_[backend] < maxUpstreams_) {
+        connectUpstream(backend, threadStr);
+    }
+}
+
+
+void HttpRelay::startExchange(HttpUpstream* upstream, HttpClient* client, const std::string& threadStr) {
+    client->queued = false;
+    client->upstream = upstream;
+    client->responseStarted = false;
+    client->responseDone = false;
+    upstream->client = client;
+    upstream->recvPaused = false;
+
+    const HTTPRequest& request = client->request;
+    upstream->response.reset(request.method == "HEAD");
+
+    // The framing goes out as the parser understood it, one header, so the backend
+    // can't read the body differently (repeated or conflicting headers, smuggling)
+    std::string& head = upstream->requestHead;
+    head.assign(request.method).append(" ").append(request.path).append(" ").append(request.version).append("\r\n");
+    for (const auto& [name, value] : request.headers) {
+        if (isHopByHop(name) || isFraming(name)) continue;
+        head.append(name).append(": ").append(value).append("\r\n");
+    }
+    if (client->parser.chunked()) {
+        head.append("Transfer-Encoding: chunked\r\n");
+    } else if (!request.body.empty() || !request.header("Content-Length").empty()) {
+        head.append("Content-Length: ").append(std::to_string(request.body.size())).append("\r\n");
+    }
+    head.append("\r\n");
+
+    upstream->capturing = client->cacheable;
+    upstream->cacheChecked = false;
+    upstream->capture.clear();
+    if (upstream->capturing) {
+        cacheKey(request, upstream->cacheKey);
+    }
+    sendRequest(upstream, request.body, threadStr);
+}
+
+
+void HttpRelay::sendRequest(HttpUpstream* upstream, std::string_view body, const std::string& threadStr) {
+    ProxyContext* pending = nullptr;
+    if (!queueSend(upstream, pending, upstream->requestHead, threadStr) ||
+        !queueSend(upstream, pending, body, threadStr) ||
+        !flush(upstream, pending, threadStr)) {
+        delete pending;
+        closeUpstream(upstream, threadStr);
+        return;
+    }
+    recvOn(upstream, threadStr);
+}
+
+
+void HttpRelay::respondError(HttpClient* client, int status, std::string_view reason, const std::string& threadStr) {
+    // The followers waited for the same exchange
+    endFlight(client);
+    std::vector<HttpClient*> followers = std::move(client->followers);
+    client->followers.clear();
+    for (HttpClient* follower : followers) {
+        follower->leader = nullptr;
+        respondError(follower, status, reason, threadStr);
+    }
+
+    client->closeAfter = true;
+    client->responseStarted = true;
+    client->responseDone = true;
+    std::string response = serializeResponse(makeHttpResponse(status, reason, {{"Connection", "close"}}, ""));
+    ProxyContext* pending = nullptr;
+    if (!queueSend(client, pending, response, threadStr) || !flush(client, pending, threadStr)) {
+        delete pending;
+        closeClient(client, threadStr);
+    }
+}
+
+
+// The whole response is sent
+void HttpRelay::finishRequest(HttpClient* client, const std::string& threadStr) {
+    if (client->backend != LoadBalancer::NONE) {
+        balancer_.release(client->backend);
+        client->backend = LoadBalancer::NONE;
+    }
+    ++stats_.requests;
+    client->in.erase(client->in.begin(), client->in.begin() + static_cast<std::ptrdiff_t>(client->requestLen));
+    client->requestLen = 0;
+    client->responseStarted = false;
+    client->responseDone = false;
+    client->parser.reset();
+    if (client->closeAfter) {
+        closeClient(client, threadStr);
+        return;
+    }
+    nextRequest(client, threadStr);
+}
+
+
+bool HttpRelay::joinFlight(HttpClient* client) {
+    cacheKey(client->request, client->flightKey);
+    auto found = flights_.find(client->flightKey);
+    if (found == flights_.end()) {
+        flights_.emplace(client->flightKey, client);
+        client->leading = true;
+        return false;
+    }
+    HttpClient* leader = found->second;
+    leader->followers.push_back(client);
+    client->leader = leader;
+    ++stats_.collapsed;
+    return true;
+}
+
+
+void HttpRelay::endFlight(HttpClient* client) {
+    if (client->leading) {
+        flights_.erase(client->flightKey);
+        client->leading = false;
+    }
+}
+
+
+void HttpRelay::handOver(HttpClient* leader) {
+    HttpClient* next = leader->followers.front();
+    next->leader = nullptr;
+    next->followers.assign(leader->followers.begin() + 1, leader->followers.end());
+    leader->followers.clear();
+    for (HttpClient* follower : next->followers) {
+        follower->leader = next;
+    }
+
+    if (leader->leading) {
+        flights_[leader->flightKey] = next;
+        leader->leading = false;
+        next->leading = true;
+    }
+    next->backend = leader->backend;
+    leader->backend = LoadBalancer::NONE;
+    if (leader->queued) {
+        std::deque<HttpClient*>& queue = queued_[next->backend];
+        *std::find(queue.begin(), queue.end(), leader) = next;
+        leader->queued = false;
+        next->queued = true;
+    }
+    if (leader->upstream != nullptr) {
+        next->upstream = leader->upstream;
+        next->upstream->client = next;
+        leader->upstream = nullptr;
+    }
+}
+
+
+void HttpRelay::relayResponse(HttpUpstream* upstream, ProxyContext* context, size_t used, bool headEnded,
+                              const std::string& threadStr) {
+    HttpClient* client = upstream->client;
+    context->bufferLen = used;
+    // Nothing goes out before the head has been checked, a bad one is still a 502 then
+    if (!upstream->response.headersDone()) {
+        upstream->held.emplace_back(context);
+        return;
+    }
+    if (headEnded && upstream->response.lengthIgnored()) {
+        dropContentLength(upstream->response, upstream->held, context);
+    }
+    if (client->leading) {
+        endFlight(client);
+        if (!client->followers.empty() && !shareableResponse(upstream->response)) {
+            std::vector<HttpClient*> followers = std::move(client->followers);
+            client->followers.clear();
+            for (HttpClient* follower : followers) {
+                follower->leader = nullptr;
+                dispatch(follower, threadStr);
+            }
+        }
+    }
+
+    if (client->followers.empty() && upstream->held.empty()) {
+        // The recv buffer goes on to the client as it is
+        context->state = IOState::SEND;
+        context->srcSocket = client->socket;
+        client->responseStarted = true;
+        if (!post(context, client, threadStr)) {
+            closeClient(client, threadStr);
+        }
+        return;
+    }
+
+    // Every waiter gets sends of the same buffers
+    std::vector<std::shared_ptr<ProxyContext>> chunks = std::move(upstream->held);
+    upstream->held.clear();
+    chunks.emplace_back(context);
+    std::vector<HttpClient*> waiters = client->followers;
+    waiters.push_back(client);
+    for (HttpClient* waiter : waiters) {
+        waiter->responseStarted = true;
+        for (const auto& chunk : chunks) {
+            if (!sendShared(waiter, chunk, std::string_view(chunk->buffer, chunk->bufferLen), threadStr)) {
+                closeClient(waiter, threadStr);
+                break;
+            }
+        }
+    }
+}
+
+
+void HttpRelay::endResponse(HttpUpstream* upstream, bool closeAfter, const std::string& threadStr) {
+    HttpClient* client = upstream->client;
+    upstream->client = nullptr;
+    client->upstream = nullptr;
+    std::vector<HttpClient*> waiters = std::move(client->followers);
+    client->followers.clear();
+    waiters.push_back(client);
+    for (HttpClient* waiter : waiters) {
+        waiter->leader = nullptr;
+        waiter->responseDone = true;
+        waiter->closeAfter = waiter->closeAfter || closeAfter;
+        if (waiter->inFlight == 0 && !waiter->closing) {
+            finishRequest(waiter, threadStr);
+        }
+    }
+}
+
+
+bool HttpRelay::overInFlight(const HttpClient* client) const {
+    if (maxInFlight_ == 0) {
+        return false;
+    }
+    if (client->inFlight >= maxInFlight_) {
+        return true;
+    }
+    return std::any_of(client->followers.begin(), client->followers.end(),
+                       [this](const HttpClient* follower) { return follower->inFlight >= maxInFlight_; });
+}
+
+
+bool HttpRelay::serveCached(HttpClient* client, const std::string& threadStr) {
+    cacheKey(client->request, key_);
+    CacheHit hit = cache_->lookup(key_);
+    if (hit.result == CacheHit::MISS) {
+        return false;
+    }
+    if (hit.revalidate) {
+        revalidate(key_, *hit.response, threadStr);
+    }
+
+    // Stored bytes go out as they are, only the Age line is new
+    std::string_view bytes(hit.response->bytes);
+    size_t statusLineEnd = hit.response->statusLineEnd;
+    std::string age = "Age: " + std::to_string(hit.ageS) + "\r\n";
+    client->responseStarted = true;
+    client->responseDone = true;
+    ProxyContext* pending = nullptr;
+    if (!sendShared(client, hit.response, bytes.substr(0, statusLineEnd), threadStr) ||
+        !queueSend(client, pending, age, threadStr) ||
+        !flush(client, pending, threadStr) ||
+        !sendShared(client, hit.response, bytes.substr(statusLineEnd), threadStr)) {
+        delete pending;
+        closeClient(client, threadStr);
+    }
+    return true;
+}
+
+
+void HttpRelay::revalidate(const std::string& key, const CachedResponse& stale, const std::string& threadStr) {
+    bool trial = false;
+    size_t backend = balancer_.acquire(sockaddr_in{}, trial);
+    if (backend == LoadBalancer::NONE) {
+        cache_->abandon(key, false);
+        return;
+    }
+
+    HttpUpstream* upstream = nullptr;
+    if (!trial && !idle_[backend].empty()) {
+        upstream = idle_[backend].back();
+        idle_[backend].pop_back();
+        upstream->idle = false;
+    } else if (trial || upstreams_[backend] < maxUpstreams_) {
+        upstream = connectUpstream(backend, threadStr);
+    }
+    if (upstream == nullptr) {
+        // Every connection busy, a later stale hit tries again
+        balancer_.release(backend);
+        cache_->abandon(key, false);
+        return;
+    }
+
+    upstream->revalidating = true;
+    upstream->cacheKey = key;
+    upstream->requestHead = stale.request;
+    if (upstream->connected) {
+        startRevalidation(upstream, threadStr);
+    }
+}
+
+
+void HttpRelay::startRevalidation(HttpUpstream* upstream, const std::string& threadStr) {
+    upstream->response.reset(upstream->requestHead.rfind("HEAD ", 0) == 0);
+    upstream->capturing = true;
+    upstream->cacheChecked = false;
+    upstream->capture.clear();
+    sendRequest(upstream, {}, threadStr);
+}
+
+
+void HttpRelay::endRevalidation(HttpUpstream* upstream, bool stored, bool drop) {
+    if (!upstream->revalidating) {
+        return;
+    }
+    upstream->revalidating = false;
+    balancer_.release(upstream->backend);
+    if (!stored) {
+        cache_->abandon(upstream->cacheKey, drop);
+    }
+}
+
+
+void HttpRelay::capture(HttpUpstream* upstream, const char* data, size_t len) {
+    std::string& bytes = upstream->capture;
+    bytes.append(data, len);
+    bool keep = bytes.size() <= cache_->maxEntryBytes();
+    if (keep && !upstream->cacheChecked && upstream->response.headersDone()) {
+        upstream->cacheChecked = true;
+        const HTTPResponseParser& response = upstream->response;
+        upstream->cacheControl = parseCacheControl(response.header("Cache-Control"));
+        // The backend's own Age would go out twice. Interim responses in front of the
+        // final one aren't part of it
+        keep = response.statusCode() == 200 && !response.lengthIgnored() &&
+               !upstream->cacheControl.noStore && upstream->cacheControl.maxAgeS > 0 &&
+               response.header("Set-Cookie").empty() && response.header("Vary").empty() &&
+               response.header("Age").empty() &&
+               bytes.compare(0, response.head().size(), response.head()) == 0;
+    }
+    if (!keep) {
+        upstream->capturing = false;
+        bytes.clear();
+    }
+}
+
+
+bool HttpRelay::storeCaptured(HttpUpstream* upstream) {
+    if (!upstream->capturing) {
+        return false;
+    }
+    upstream->capturing = false;
+    auto cached = std::make_shared<CachedResponse>();
+    cached->bytes = std::move(upstream->capture);
+    upstream->capture.clear();
+    cached->statusLineEnd = cached->bytes.find("\r\n") + 2;
+    cached->request = revalidationHead(upstream->requestHead);
+    cache_->store(upstream->cacheKey, std::move(cached), upstream->cacheControl);
+    return true;
+}
+
+
+HttpUpstream* HttpRelay::connectUpstream(size_t backend, const std::string& threadStr) {
+    auto* upstream = new HttpUpstream(this, backend);
+    ++upstreams_[backend];
+    ++openUpstreams_;
+    ++stats_.connects;
+    stats_.peakUpstreams = std::max(stats_.peakUpstreams, openUpstreams_);
+
+    auto* context = new ProxyContext(IOState::CONNECT, nullptr, INVALID_SOCKET, INVALID_SOCKET);
+    context->peer = upstream;
+    bool posted = loop_.postConnect(context, balancer_.address(backend), threadStr);
+    upstream->socket = context->srcSocket;
+    if (!posted) {
+        logcerr(threadStr, "connect() to backend server failed with error: ", lastSocketError());
+        delete context;
+        balancer_.reportFailure(backend);
+        closeUpstream(upstream, threadStr);
+        return nullptr;
+    }
+    ++upstream->pendingIO;
+    return upstream;
+}
+
+
+void HttpRelay::onUpstreamConnect(HttpUpstream* upstream, bool ok, int error, const std::string& threadStr) {
+    if (upstream->closing) {
+        return;
+    }
+    if (!ok) {
+        logcerr(threadStr, "connect() to backend server failed with error: ", error);
+        balancer_.reportFailure(upstream->backend);
+        closeUpstream(upstream, threadStr);
+        return;
+    }
+    setNoDelay(upstream->socket);
+    balancer_.reportSuccess(upstream->backend);
+    upstream->connected = true;
+    upstreamReady(upstream, threadStr);
+}
+
+
+void HttpRelay::upstreamReady(HttpUpstream* upstream, const std::string& threadStr) {
+    if (upstream->revalidating) {
+        // Connected for it
+        startRevalidation(upstream, threadStr);
+        return;
+    }
+    std::deque<HttpClient*>& queue = queued_[upstream->backend];
+    if (!queue.empty()) {
+        HttpClient* client = queue.front();
+        queue.pop_front();
+        startExchange(upstream, client, threadStr);
+        return;
+    }
+    upstream->idle = true;
+    idle_[upstream->backend].push_back(upstream);
+    recvOn(upstream, threadStr);
+}
+
+
+void HttpRelay::failQueued(size_t backend, const std::string& threadStr) {
+    std::deque<HttpClient*>& queue = queued_[backend];
+    while (!queue.empty()) {
+        HttpClient* client = queue.front();
+        queue.pop_front();
+        client->queued = false;
+        respondError(client, 502, "Bad Gateway", threadStr);
+    }
+}
+
+
+void HttpRelay::onClientRecv(HttpClient* client, ProxyContext* context, bool ok, size_t bytes, const std::string& threadStr) {
+    client->recvPosted = false;
+    if (!ok || bytes == 0) {
+        delete context;
+        closeClient(client, threadStr);
+        return;
+    }
+    client->in.insert(client->in.end(), context->buffer, context->buffer + bytes);
+    delete context;
+    nextRequest(client, threadStr);
+}
+
+
+void HttpRelay::onClientSend(HttpClient* client, ProxyContext* context, bool ok, const std::string& threadStr) {
+    client->inFlight -= context->bufferLen;
+    delete context;
+    if (!ok) {
+        closeClient(client, threadStr);
+        return;
+    }
+    if (client->closing) {
+        return;
+    }
+
+    // A follower's bytes come from its leader's upstream
+    HttpClient* exchange = client->leader != nullptr ? client->leader : client;
+    HttpUpstream* upstream = exchange->upstream;
+    if (upstream != nullptr && upstream->recvPaused && !overInFlight(exchange)) {
+        upstream->recvPaused = false;
+        recvOn(upstream, threadStr);
+    }
+    if (client->responseDone && client->inFlight == 0) {
+        finishRequest(client, threadStr);
+    }
+}
+
+
+void HttpRelay::onUpstreamRecv(HttpUpstream* upstream, ProxyContext* context, bool ok, size_t bytes, const std::string& threadStr) {
+    upstream->recvPosted = false;
+    HttpClient* client = upstream->client;
+    if (upstream->closing) {
+        delete context;
+        return;
+    }
+
+    if (!ok || bytes == 0) {
+        delete context;
+        if (client != nullptr && ok && upstream->held.empty() && upstream->response.finish() == ParseResult::Complete) {
+            // The body ran until the backend closed, the client learns the end the same way
+            endResponse(upstream, true, threadStr);
+        }
+        closeUpstream(upstream, threadStr);
+        return;
+    }
+
+    if (client == nullptr && !upstream->revalidating) {
+        // Idle, and the backend sent something nobody asked for
+        delete context;
+        closeUpstream(upstream, threadStr);
+        return;
+    }
+
+    size_t used = 0;
+    bool headDone = upstream->response.headersDone();
+    ParseResult result = upstream->response.parse(context->buffer, bytes, used);
+    if (result == ParseResult::Malformed) {
+        logcerr(threadStr, "Malformed response from backend ", balancer_.name(upstream->backend));
+        delete context;
+        closeUpstream(upstream, threadStr);
+        return;
+    }
+
+    if (upstream->capturing) {
+        capture(upstream, context->buffer, used);
+    }
+
+    if (client != nullptr) {
+        relayResponse(upstream, context, used, !headDone && upstream->response.headersDone(), threadStr);
+        if (upstream->closing) {
+            return;
+        }
+        client = upstream->client;
+    } else {
+        delete context;
+    }
+
+    if (result == ParseResult::Complete) {
+        // Bytes past the response: the connection is out of step with its requests
+        if (used < bytes) {
+            upstream->reusable = false;
+        }
+        bool stored = storeCaptured(upstream);
+        if (client != nullptr) {
+            endResponse(upstream, false, threadStr);
+        }
+        // A complete answer that can't be kept replaces the stale one too
+        endRevalidation(upstream, stored, true);
+        if (upstream->reusable && upstream->response.keepAlive()) {
+            upstreamReady(upstream, threadStr);
+        } else {
+            closeUpstream(upstream, threadStr);
+        }
+        return;
+    }
+
+    if (client != nullptr && overInFlight(client)) {
+        upstream->recvPaused = true;
+    } else {
+        recvOn(upstream, threadStr);
+    }
+}
+
+
+void HttpRelay::closePeer(HttpPeer* peer, const std::string& threadStr) {
+    if (peer->isUpstream) {
+        closeUpstream(static_cast<HttpUpstream*>(peer), threadStr);
+    } else {
+        closeClient(static_cast<HttpClient*>(peer), threadStr);
+    }
+}
+
+
+void HttpRelay::closeClient(HttpClient* client, const std::string& threadStr) {
+    if (client->closing) {
+        return;
+    }
+    startClose(client);
+
+    if (client->leader != nullptr) {
+        std::vector<HttpClient*>& followers = client->leader->followers;
+        followers.erase(std::find(followers.begin(), followers.end(), client));
+        client->leader = nullptr;
+    } else if (!client->followers.empty()) {
+        handOver(client);
+    }
+    endFlight(client);
+
+    if (client->queued) {
+        std::deque<HttpClient*>& queue = queued_[client->backend];
+        queue.erase(std::find(queue.begin(), queue.end(), client));
+        client->queued = false;
+    }
+    if (client->upstream != nullptr) {
+        // Mid-response, the rest of it would have nowhere to go
+        HttpUpstream* upstream = client->upstream;
+        upstream->client = nullptr;
+        client->upstream = nullptr;
+        closeUpstream(upstream, threadStr);
+    }
+    if (client->backend != LoadBalancer::NONE) {
+        balancer_.release(client->backend);
+        client->backend = LoadBalancer::NONE;
+    }
+}
+
+
+void HttpRelay::closeUpstream(HttpUpstream* upstream, const std::string& threadStr) {
+    if (upstream->closing) {
+        return;
+    }
+    startClose(upstream);
+
+    size_t backend = upstream->backend;
+    if (upstream->idle) {
+        std::vector<HttpUpstream*>& idle = idle_[backend];
+        idle.erase(std::find(idle.begin(), idle.end(), upstream));
+        upstream->idle = false;
+    }
+    --upstreams_[backend];
+    --openUpstreams_;
+    endRevalidation(upstream, false, false);
+
+    upstream->held.clear();
+    if (upstream->client != nullptr) {
+        HttpClient* client = upstream->client;
+        upstream->client = nullptr;
+        client->upstream = nullptr;
+        endFlight(client);
+        std::vector<HttpClient*> waiters = std::move(client->followers);
+        client->followers.clear();
+        waiters.push_back(client);
+        for (HttpClient* waiter : waiters) {
+            waiter->leader = nullptr;
+            if (waiter->responseStarted) {
+                closeClient(waiter, threadStr);
+            } else {
+                respondError(waiter, 502, "Bad Gateway", threadStr);
+            }
+        }
+    }
+
+    // Queued requests still need a connection. One that never connected means the
+    // backend is gone, and with no other connection left nothing will serve them
+    if (!queued_[backend].empty()) {
+        if (upstream->connected) {
+            connectUpstream(backend, threadStr);
+        } else if (upstreams_[backend] == 0) {
+            failQueued(backend, threadStr);
+        }
+    }
+}
+
+
+void HttpRelay::startClose(HttpPeer* peer) {
+    peer->closing = true;
+    if (peer->socket != INVALID_SOCKET) {
+        shutdown(peer->socket, SD_BOTH);
+        loop_.cancelIO(peer->socket);
+    }
+    closed_.push_back(peer);
+}
+
+
+void HttpRelay::reap() {
+    size_t kept = 0;
+    for (HttpPeer* peer : closed_) {
+        if (peer->pendingIO > 0) {
+            closed_[kept++] = peer;
+            continue;
+        }
+        if (peer->socket != INVALID_SOCKET) {
+            closesocket(peer->socket);
+        }
+        delete peer;
+    }
+    closed_.resize(kept);
+}
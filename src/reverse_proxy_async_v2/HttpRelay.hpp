@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "Platform.hpp"
+#include "HTTPParser.hpp"
+#include "LoadBalancer.hpp"
+#include "ObjectPool.hpp"
+#include "ProxyLoop.hpp"
+#include "ResponseCache.hpp"
+
+class HttpRelay;
+struct ProxyContext;
+
+
+// A socket of the HTTP mode, a client or a backend connection (upstream)
+struct HttpPeer {
+    HttpRelay* relay;
+    SOCKET socket;
+    const bool isUpstream;
+    int pendingIO = 0;
+    bool recvPosted = false;
+    bool closing = false;
+
+    HttpPeer(HttpRelay* peerRelay, SOCKET peerSocket, bool upstream)
+        : relay(peerRelay), socket(peerSocket), isUpstream(upstream) {}
+    virtual ~HttpPeer() = default;
+};
+
+struct HttpUpstream;
+
+struct HttpClient : public HttpPeer {
+    sockaddr_in addr{};                 // for hashing, when the policy needs it
+    std::vector<char> in;               // received, the request being served first
+    HTTPRequestParser parser{true};     // chunked bodies pass through as they are
+    HTTPRequest request;
+    size_t requestLen = 0;              // bytes of in the current request takes, 0 between requests
+    size_t backend = LoadBalancer::NONE;
+    HttpUpstream* upstream = nullptr;   // carrying the exchange
+    bool queued = false;                // waiting for an upstream
+    bool responseStarted = false;       // bytes of the response went out
+    bool responseDone = false;          // all of it is posted
+    bool closeAfter = false;            // no next request on this connection
+    bool cacheable = false;             // the cache may answer it, or keep its response
+    size_t inFlight = 0;                // response bytes posted, not sent yet
+
+    // Request collapsing
+    bool leading = false;               // its key is in the relay's flights, identical requests join it
+    HttpClient* leader = nullptr;       // following its exchange instead of having one
+    std::vector<HttpClient*> followers; // of a leader, get the same response bytes
+    std::string flightKey;
+
+    HttpClient(HttpRelay* peerRelay, SOCKET peerSocket) : HttpPeer(peerRelay, peerSocket, false) {}
+
+    static void* operator new(size_t size) { return ObjectPool<HttpClient>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<HttpClient>::deallocate(p, size); }
+};
+
+struct HttpUpstream : public HttpPeer {
+    size_t backend;
+    bool connected = false;
+    bool idle = false;                  // in the idle list
+    bool recvPaused = false;            // client side has maxInFlight to send
+    bool reusable = true;
+    HTTPResponseParser response;
+    HttpClient* client = nullptr;       // whose response is coming
+    std::string requestHead;            // as sent, kept for a cached response
+
+    // Response cache
+    bool capturing = false;             // the response may be stored, its bytes go to capture too
+    bool cacheChecked = false;          // its head has been looked at
+    bool revalidating = false;          // refetching a stale entry, no client
+    std::string cacheKey;
+    std::string capture;
+    CacheControl cacheControl;
+
+    // Response bytes kept back while the head isn't complete
+    std::vector<std::shared_ptr<ProxyContext>> held;
+
+    HttpUpstream(HttpRelay* peerRelay, size_t upstreamBackend)
+        : HttpPeer(peerRelay, INVALID_SOCKET, true), backend(upstreamBackend) {}
+};
+
+
+struct RelayStats {
+    uint64_t requests = 0;
+    uint64_t connects = 0;     // upstream connections opened
+    size_t peakUpstreams = 0;  // most open at once, all backends
+    uint64_t collapsed = 0;    // requests that followed another one's exchange
+};
+
+
+/*
+HTTP mode (--http) of one ProxyLoop: requests instead of bytes.
+
+Client connections are read until HTTPRequestParser has a whole request (Content-Length
+or chunked body, up to its limits), which then goes to the next idle keep-alive
+upstream of the backend the LoadBalancer picks for that request. At most maxUpstreams
+connections per backend are open in a loop; past that the request waits in the
+backend's queue for the first one that finishes. So thousands of client connections
+share a handful of backend connections, a backend socket is busy only while a request
+is actually in flight.
+
+The request head is written out again without the hop-by-hop headers (Connection,
+Keep-Alive, ...), a client's "Connection: close" is for us, not for the upstream.
+The response is relayed while it arrives, HTTPResponseParser says where it ends.
+Its head is held back until it's complete and checked, a malformed one (conflicting
+Content-Length, ...) is a 502 and a Content-Length next to a chunked body is taken
+out. After that the recv buffer turns into the send to the client as in the L4
+relay, and past maxInFlight unsent bytes the upstream isn't read until the client
+catches up. An upstream whose response ended cleanly and kept the connection alive
+takes the next queued request, or goes idle with a recv posted to see the backend
+close it.
+A response that runs until the backend closes ends the client's connection too.
+
+A client gets one request served at a time; pipelined ones stay buffered and go next.
+Errors before any response byte went out become a 502 (503 with every backend
+ejected), after that only closing the client is left.
+
+With a ResponseCache, GET and HEAD requests (without Authorization or a no-cache
+of their own) are looked up first and a hit is sent from the stored bytes, no
+backend involved. On a miss the response is also captured while it's relayed and
+stored if it turns out cacheable: 200 with a max-age, no no-store/private, Set-Cookie
+or Vary. A stale hit may have to revalidate, the relay then sends the stored
+request head again on an idle upstream (or a new one, within maxUpstreams) and
+stores what comes back, with no client attached.
+
+With collapsing, a GET or HEAD without a body, Authorization, Cookie, Range or a
+conditional (If-*) header that finds an identical request (same key as the cache's) already on its way upstream doesn't get
+an exchange of its own: it follows that leader's. The leader's recvs are then shared
+instead of turned into its send, each follower gets a send of the same buffer (no
+copy per follower) and the upstream isn't read until the slowest of them is under
+maxInFlight. Followers may join until the response head is complete, up to then the
+response is held back. A status other than 200, or a head with Set-Cookie, Vary or a
+no-store/no-cache/private may differ per client, the followers are then dispatched
+on their own. A leader
+that leaves hands the exchange over to its first follower.
+
+Everything of a relay runs under its mutex: uncontended on epoll (the loop's own
+thread), on IOCP the workers take turns. Peers are freed once closed and with no
+operation pending, after the completion at hand has been handled.
+*/
+class HttpRelay {
+
+    public:
+        // cache: shared by the loops' relays, nullptr for none. collapse: identical
+        // concurrent requests share one exchange
+        HttpRelay(ProxyLoop& loop, LoadBalancer& balancer, ResponseCache* cache, size_t maxUpstreams, size_t maxInFlight,
+                  bool collapse);
+
+        HttpRelay(const HttpRelay&) = delete;
+        HttpRelay& operator=(const HttpRelay&) = delete;
+
+        void accept(SOCKET clientSocket, const std::string& threadStr);
+        void handleCompletion(ProxyContext* context, bool ok, size_t bytesTransferred, int error, const std::string& threadStr);
+
+        RelayStats stats();
+
+    private:
+        bool post(ProxyContext* context, HttpPeer* peer, const std::string& threadStr);
+        void recvOn(HttpPeer* peer, const std::string& threadStr);
+        // Copies data into send contexts, posting the full ones. flush() posts the last
+        bool queueSend(HttpPeer* peer, ProxyContext*& pending, std::string_view data, const std::string& threadStr);
+        bool flush(HttpPeer* peer, ProxyContext*& pending, const std::string& threadStr);
+        // Sends data without copying it, owner keeps it alive
+        bool sendShared(HttpPeer* peer, std::shared_ptr<const void> owner, std::string_view data, const std::string& threadStr);
+
+        void nextRequest(HttpClient* client, const std::string& threadStr);
+        void dispatch(HttpClient* client, const std::string& threadStr);
+        void startExchange(HttpUpstream* upstream, HttpClient* client, const std::string& threadStr);
+        // requestHead and body to the upstream, then the recv for the response
+        void sendRequest(HttpUpstream* upstream, std::string_view body, const std::string& threadStr);
+        void respondError(HttpClient* client, int status, std::string_view reason, const std::string& threadStr);
+        void finishRequest(HttpClient* client, const std::string& threadStr);
+
+        // A request in flight with the same key takes the client as a follower, true then.
+        // Otherwise the client leads the key's flight
+        bool joinFlight(HttpClient* client);
+        void endFlight(HttpClient* client);
+        // A leader leaving: its first follower takes over queue slot, backend and upstream
+        void handOver(HttpClient* leader);
+        // The recv of a response on its way to the upstream's client (and followers),
+        // headEnded: the head was completed in it
+        void relayResponse(HttpUpstream* upstream, ProxyContext* context, size_t used, bool headEnded,
+                           const std::string& threadStr);
+        // The response is all posted, closeAfter if it ended with the connection
+        void endResponse(HttpUpstream* upstream, bool closeAfter, const std::string& threadStr);
+        // The client or one of its followers has maxInFlight to send
+        bool overInFlight(const HttpClient* client) const;
+
+        // A hit answers the client, true then
+        bool serveCached(HttpClient* client, const std::string& threadStr);
+        void revalidate(const std::string& key, const CachedResponse& stale, const std::string& threadStr);
+        void startRevalidation(HttpUpstream* upstream, const std::string& threadStr);
+        void endRevalidation(HttpUpstream* upstream, bool stored, bool drop);
+        // Response bytes as they're relayed, storing stops at the first sign it can't be kept
+        void capture(HttpUpstream* upstream, const char* data, size_t len);
+        bool storeCaptured(HttpUpstream* upstream);
+
+        // nullptr if it failed right away
+        HttpUpstream* connectUpstream(size_t backend, const std::string& threadStr);
+        // Connected or done with an exchange: the next queued request, or idle
+        void upstreamReady(HttpUpstream* upstream, const std::string& threadStr);
+        void failQueued(size_t backend, const std::string& threadStr);
+
+        void onClientRecv(HttpClient* client, ProxyContext* context, bool ok, size_t bytes, const std::string& threadStr);
+        void onClientSend(HttpClient* client, ProxyContext* context, bool ok, const std::string& threadStr);
+        void onUpstreamConnect(HttpUpstream* upstream, bool ok, int error, const std::string& threadStr);
+        void onUpstreamRecv(HttpUpstream* upstream, ProxyContext* context, bool ok, size_t bytes, const std::string& threadStr);
+
+        void closePeer(HttpPeer* peer, const std::string& threadStr);
+        void closeClient(HttpClient* client, const std::string& threadStr);
+        void closeUpstream(HttpUpstream* upstream, const std::string& threadStr);
+        void startClose(HttpPeer* peer);
+        void reap();
+
+        ProxyLoop& loop_;
+        LoadBalancer& balancer_;
+        ResponseCache* cache_;
+        size_t maxUpstreams_;
+        size_t maxInFlight_;
+        bool collapse_;
+
+        std::mutex mutex_;
+        std::vector<std::vector<HttpUpstream*>> idle_;  // per backend, most recent at the back
+        std::vector<std::deque<HttpClient*>> queued_;    // per backend
+        std::vector<size_t> upstreams_;                  // per backend, open or connecting
+        std::vector<HttpPeer*> closed_;                  // closing, freed with nothing pending
+        std::unordered_map<std::string, HttpClient*> flights_;  // leaders by key, while others may join
+        size_t openUpstreams_ = 0;
+        std::string key_;  // of the request looked up
+        RelayStats stats_;
+};
@@ -0,0 +1,219 @@
+#include <chrono>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+
+#include "IocpProxyLoop.hpp"
+#include "log.hpp"
+
+
+IocpProxyLoop::IocpProxyLoop(ReverseProxy& proxy, PoolOptions poolOptions, size_t backends)
+    : ProxyLoop(proxy, poolOptions, backends) {
+    iocpHandle_ = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
+    if (iocpHandle_ == NULL) {
+        logcerr("[Main] CreateIoCompletionPort() failed with error: ", GetLastError());
+        throw std::runtime_error("Failed to create IOCP");
+    }
+}
+
+
+IocpProxyLoop::~IocpProxyLoop() {
+    // Closing the accept sockets aborts their AcceptEx, nobody is left to dequeue it
+    for (auto& accept : accepts_) {
+        accept.reset();
+    }
+    CloseHandle(iocpHandle_);
+}
+
+
+void IocpProxyLoop::init(SOCKET listenSocket) {
+    listenSocket_ = listenSocket;
+    if (!associate(listenSocket_, "[Main] ")) {
+        throw std::runtime_error("Failed to associate listening socket with IOCP");
+    }
+
+    GUID acceptExId = WSAID_ACCEPTEX;
+    GUID connectExId = WSAID_CONNECTEX;
+    DWORD bytes = 0;
+    if (WSAIoctl(listenSocket_, SIO_GET_EXTENSION_FUNCTION_POINTER, &acceptExId, sizeof(acceptExId),
+                 &acceptEx_, sizeof(acceptEx_), &bytes, nullptr, nullptr) == SOCKET_ERROR ||
+        WSAIoctl(listenSocket_, SIO_GET_EXTENSION_FUNCTION_POINTER, &connectExId, sizeof(connectExId),
+                 &connectEx_, sizeof(connectEx_), &bytes, nullptr, nullptr) == SOCKET_ERROR) {
+        logcerr("[Main] WSAIoctl() failed to load AcceptEx/ConnectEx with error: ", WSAGetLastError());
+        throw std::runtime_error("Failed to load AcceptEx/ConnectEx");
+    }
+
+    for (auto& accept : accepts_) {
+        accept = std::make_unique<AcceptContext>();
+        if (!postAccept(accept.get(), "[Main] ")) {
+            throw std::runtime_error("Failed to post AcceptEx");
+        }
+    }
+}
+
+
+void IocpProxyLoop::run() {
+    std::ostringstream oss;
+    oss << "[Thread " << std::this_thread::get_id() << "] ";
+    std::string threadStr = oss.str();
+    logf(threadStr, "Started worker");
+
+    while (proxy_.isRunning()) {
+        maybeTick(threadStr);
+
+        DWORD bytesTransferred = 0;
+        ULONG_PTR completionKey = 0;
+        LPOVERLAPPED overlapped = nullptr;
+
+        BOOL completionResult = GetQueuedCompletionStatus(
+            iocpHandle_,
+            &bytesTransferred,
+            &completionKey,
+            &overlapped,
+            TICK_MS
+        );
+
+        if (overlapped == nullptr) {
+            // Timeout, or wakeup() for shutdown
+            continue;
+        }
+
+        auto* io = CONTAINING_RECORD(overlapped, IOContext, overlapped);
+        if (io->state == IOState::ACCEPT) {
+            handleAccept(static_cast<AcceptContext*>(io), completionResult, threadStr);
+            continue;
+        }
+
+        auto* context = static_cast<ProxyContext*>(io);
+        int error = completionResult ? 0 : static_cast<int>(GetLastError());
+        if (completionResult && context->state == IOState::CONNECT &&
+            setsockopt(context->srcSocket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT, nullptr, 0) == SOCKET_ERROR) {
+            // Without it shutdown() and friends don't work on the socket
+            completionResult = FALSE;
+            error = WSAGetLastError();
+        }
+        proxy_.handleCompletion(context, completionResult, bytesTransferred, error, threadStr);
+    }
+    logf(threadStr, "Shutdown signal received.");
+}
+
+
+void IocpProxyLoop::wakeup() {
+    PostQueuedCompletionStatus(iocpHandle_, 0, 0, nullptr);
+}
+
+
+void IocpProxyLoop::maybeTick(const std::string& threadStr) {
+    int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+    int64_t last = lastTickMs_.load();
+    if (now - last >= static_cast<int64_t>(TICK_MS) && lastTickMs_.compare_exchange_strong(last, now)) {
+        proxy_.handleTick(*this, threadStr);
+    }
+}
+
+
+bool IocpProxyLoop::associate(SOCKET socket, const std::string& threadStr) {
+    if (CreateIoCompletionPort((HANDLE)socket, iocpHandle_, (ULONG_PTR)socket, 0) == NULL) {
+        logcerr(threadStr, "CreateIoCompletionPort() failed for socket (", socket, ") with error: ", GetLastError());
+        return false;
+    }
+    return true;
+}
+
+
+bool IocpProxyLoop::postAccept(AcceptContext* context, const std::string& threadStr) {
+    context->socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    if (context->socket == INVALID_SOCKET) {
+        logcerr(threadStr, "WSASocket() failed with error: ", WSAGetLastError());
+        return false;
+    }
+
+    ZeroMemory(&context->overlapped, sizeof(context->overlapped));
+    DWORD bytes = 0;
+    if (!acceptEx_(listenSocket_, context->socket, context->addresses, 0, ADDRESS_LEN, ADDRESS_LEN,
+                   &bytes, &context->overlapped) &&
+        WSAGetLastError() != ERROR_IO_PENDING) {
+        logcerr(threadStr, "AcceptEx() failed with error: ", WSAGetLastError());
+        closesocket(context->socket);
+        context->socket = INVALID_SOCKET;
+        return false;
+    }
+    return true;
+}
+
+
+void IocpProxyLoop::handleAccept(AcceptContext* context, bool ok, const std::string& threadStr) {
+    SOCKET clientSocket = context->socket;
+    context->socket = INVALID_SOCKET;
+
+    if (!ok) {
+        logcerr(threadStr, "AcceptEx() completed with error: ", GetLastError());
+        closesocket(clientSocket);
+    } else if (setsockopt(clientSocket, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+                          reinterpret_cast<char*>(&listenSocket_), sizeof(listenSocket_)) == SOCKET_ERROR ||
+               !associate(clientSocket, threadStr)) {
+        closesocket(clientSocket);
+    } else {
+        proxy_.handleAccept(*this, clientSocket, threadStr);
+    }
+
+    // Keep the number of accepts in flight constant
+    if (proxy_.isRunning() && !postAccept(context, threadStr)) {
+        logcerr(threadStr, "Lost an accept slot");
+    }
+}
+
+
+bool IocpProxyLoop::postConnect(ProxyContext* context, const sockaddr_in& addr, const std::string& threadStr) {
+    SOCKET socket = WSASocket(AF_INET, SOCK_STREAM, IPPROTO_TCP, nullptr, 0, WSA_FLAG_OVERLAPPED);
+    context->srcSocket = socket;
+    if (socket == INVALID_SOCKET) {
+        return false;
+    }
+
+    // ConnectEx wants a bound socket
+    sockaddr_in local{};
+    local.sin_family = AF_INET;
+    local.sin_addr.s_addr = INADDR_ANY;
+    local.sin_port = 0;
+    if (bind(socket, reinterpret_cast<sockaddr*>(&local), sizeof(local)) == SOCKET_ERROR ||
+        !associate(socket, threadStr)) {
+        return false;
+    }
+
+    ZeroMemory(&context->overlapped, sizeof(context->overlapped));
+    if (!connectEx_(socket, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr), nullptr, 0, nullptr, &context->overlapped) &&
+        WSAGetLastError() != ERROR_IO_PENDING) {
+        return false;
+    }
+    return true;
+}
+
+
+bool IocpProxyLoop::postRecv(ProxyContext* context) {
+    context->wsaBuf.buf = context->buffer;
+    context->wsaBuf.len = BUFFER_SIZE;
+    ZeroMemory(&context->overlapped, sizeof(context->overlapped));
+
+    DWORD flags = 0;
+    DWORD bytesReceived = 0;
+    int result = WSARecv(context->srcSocket, &context->wsaBuf, 1, &bytesReceived, &flags, &context->overlapped, nullptr);
+    return result != SOCKET_ERROR || WSAGetLastError() == WSA_IO_PENDING;
+}
+
+
+bool IocpProxyLoop::postSend(ProxyContext* context) {
+    context->wsaBuf.buf = const_cast<char*>(context->data());
+    context->wsaBuf.len = static_cast<ULONG>(context->bufferLen);
+    ZeroMemory(&context->overlapped, sizeof(context->overlapped));
+
+    DWORD bytesSent = 0;
+    int result = WSASend(context->srcSocket, &context->wsaBuf, 1, &bytesSent, 0, &context->overlapped, nullptr);
+    return result != SOCKET_ERROR || WSAGetLastError() == WSA_IO_PENDING;
+}
+
+
+void IocpProxyLoop::cancelIO(SOCKET socket) {
+    CancelIoEx(reinterpret_cast<HANDLE>(socket), nullptr);
+}
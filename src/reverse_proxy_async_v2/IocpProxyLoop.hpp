@@ -0,0 +1,63 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+
+#include "ProxyLoop.hpp"
+#include "ReverseProxy.hpp"
+
+
+/*
+Windows backend, one completion port shared by every worker thread.
+
+Clients come in through a fixed set of AcceptEx calls kept posted on the listening
+socket, backend connections are made with ConnectEx. Both complete on the port like
+any recv/send, so the workers never block and there's no separate accept thread.
+*/
+class IocpProxyLoop : public ProxyLoop {
+
+    public:
+        IocpProxyLoop(ReverseProxy& proxy, PoolOptions poolOptions, size_t backends);
+        ~IocpProxyLoop() override;
+
+        void init(SOCKET listenSocket) override;
+
+        bool postConnect(ProxyContext* context, const sockaddr_in& addr, const std::string& threadStr) override;
+        bool postRecv(ProxyContext* context) override;
+        bool postSend(ProxyContext* context) override;
+        void cancelIO(SOCKET socket) override;
+
+        void run() override;
+        void wakeup() override;
+
+    private:
+        static constexpr size_t NUM_ACCEPTS = 16;
+        static constexpr DWORD TICK_MS = 1000;
+        static constexpr DWORD ADDRESS_LEN = sizeof(sockaddr_in) + 16;
+
+        struct AcceptContext : public IOContext {
+            SOCKET socket = INVALID_SOCKET;
+            char addresses[ADDRESS_LEN * 2];
+
+            AcceptContext() : IOContext(IOState::ACCEPT) {}
+            ~AcceptContext() {
+                if (socket != INVALID_SOCKET) closesocket(socket);
+            }
+        };
+
+        bool associate(SOCKET socket, const std::string& threadStr);
+        bool postAccept(AcceptContext* context, const std::string& threadStr);
+        void handleAccept(AcceptContext* context, bool ok, const std::string& threadStr);
+        void maybeTick(const std::string& threadStr);
+
+        HANDLE iocpHandle_ = nullptr;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+        LPFN_ACCEPTEX acceptEx_ = nullptr;
+        LPFN_CONNECTEX connectEx_ = nullptr;
+
+        std::array<std::unique_ptr<AcceptContext>, NUM_ACCEPTS> accepts_;
+
+        // Every worker runs this loop, only one of them ticks per second
+        std::atomic<int64_t> lastTickMs_ = 0;
+};
@@ -0,0 +1,277 @@
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <stdexcept>
+#include <thread>
+
+#include "LoadBalancer.hpp"
+#include "log.hpp"
+
+
+// splitmix64 finalizer, spreads neighbouring IPs all over the ring
+static uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// FNV-1a, ring points must not change between runs
+static uint64_t hashString(const std::string& s) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (char c : s) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// xorshift64*, one generator per thread
+static uint64_t nextRandom() {
+    thread_local uint64_t state = mix(std::hash<std::thread::id>{}(std::this_thread::get_id())) | 1;
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 0x2545f4914f6cdd1dULL;
+}
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+bool parseLoadBalancePolicy(const std::string& name, LoadBalancePolicy& policy) {
+    if (name == "round-robin") {
+        policy = LoadBalancePolicy::ROUND_ROBIN;
+    } else if (name == "least-conn") {
+        policy = LoadBalancePolicy::LEAST_CONNECTIONS;
+    } else if (name == "p2c") {
+        policy = LoadBalancePolicy::POWER_OF_TWO;
+    } else if (name == "hash") {
+        policy = LoadBalancePolicy::CONSISTENT_HASH;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+
+LoadBalancer::LoadBalancer(const std::vector<BackendAddress>& backends, LoadBalancePolicy policy, HealthOptions health)
+    : policy_(policy), health_(std::move(health)) {
+    if (backends.empty()) {
+        throw std::invalid_argument("No backends to balance over");
+    }
+
+    for (const BackendAddress& address : backends) {
+        auto backend = std::make_unique<Backend>();
+        backend->addr.sin_family = AF_INET;
+        backend->addr.sin_port = htons(address.port);
+        backend->addr.sin_addr.s_addr = inet_addr(address.host.c_str());
+        backend->name = address.host + ":" + std::to_string(address.port);
+        backends_.push_back(std::move(backend));
+    }
+
+    if (policy_ == LoadBalancePolicy::CONSISTENT_HASH) {
+        for (size_t i = 0; i < backends_.size(); ++i) {
+            for (size_t v = 0; v < VIRTUAL_NODES; ++v) {
+                ring_.emplace_back(hashString(backends_[i]->name + "#" + std::to_string(v)), i);
+            }
+        }
+        std::sort(ring_.begin(), ring_.end());
+    }
+}
+
+
+size_t LoadBalancer::acquire(const sockaddr_in& clientAddr, bool& trial) {
+    trial = false;
+    size_t backend = pick(clientAddr, trial);
+    if (backend == NONE) {
+        return NONE;
+    }
+    backends_[backend]->active.fetch_add(1, std::memory_order_relaxed);
+    backends_[backend]->picks.fetch_add(1, std::memory_order_relaxed);
+    return backend;
+}
+
+
+void LoadBalancer::release(size_t backend) {
+    backends_[backend]->active.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+void LoadBalancer::reportSuccess(size_t backend, uint32_t latencyMs) {
+    if (health_.maxLatencyMs != 0 && latencyMs > health_.maxLatencyMs) {
+        reportFailure(backend);
+        return;
+    }
+    Backend& b = *backends_[backend];
+    b.failures.store(0, std::memory_order_relaxed);
+    // While OPEN a success is a connect from before the ejection, only the trial closes it
+    int circuit = HALF_OPEN;
+    if (b.circuit.compare_exchange_strong(circuit, CLOSED)) {
+        notClosed_.fetch_sub(1, std::memory_order_relaxed);
+        logf("Backend ", b.name, " back in rotation");
+    }
+}
+
+
+void LoadBalancer::reportFailure(size_t backend) {
+    if (health_.maxFailures == 0) {
+        return;
+    }
+    Backend& b = *backends_[backend];
+    int circuit = b.circuit.load();
+    if (circuit == HALF_OPEN) {
+        open(b, HALF_OPEN);
+    } else if (circuit == CLOSED && b.failures.fetch_add(1, std::memory_order_relaxed) + 1 >= health_.maxFailures) {
+        open(b, CLOSED);
+    }
+}
+
+
+void LoadBalancer::open(Backend& b, int from) {
+    b.openUntilMs.store(nowMs() + health_.ejectMs);
+    if (!b.circuit.compare_exchange_strong(from, OPEN)) {
+        return;  // someone else got there first
+    }
+    b.failures.store(0, std::memory_order_relaxed);
+    b.trialTaken.store(false);
+    b.ejections.fetch_add(1, std::memory_order_relaxed);
+    if (from == CLOSED) {
+        notClosed_.fetch_add(1, std::memory_order_relaxed);
+        logf("Backend ", b.name, " ejected for ", health_.ejectMs, " ms");
+    } else {
+        logf("Backend ", b.name, " failed its trial, ejected for another ", health_.ejectMs, " ms");
+    }
+}
+
+
+bool LoadBalancer::beginCheck(size_t backend) {
+    Backend& b = *backends_[backend];
+    return available(b) || admitsTrial(b);
+}
+
+
+bool LoadBalancer::inRotation(size_t backend) const {
+    return available(*backends_[backend]);
+}
+
+
+bool LoadBalancer::available(const Backend& b) const {
+    return b.circuit.load(std::memory_order_relaxed) == CLOSED;
+}
+
+
+bool LoadBalancer::admitsTrial(Backend& b) {
+    int circuit = b.circuit.load();
+    if (circuit == OPEN) {
+        if (nowMs() < b.openUntilMs.load()) {
+            return false;
+        }
+        b.circuit.compare_exchange_strong(circuit, HALF_OPEN);
+    } else if (circuit != HALF_OPEN) {
+        return false;
+    }
+    bool taken = false;
+    return b.trialTaken.compare_exchange_strong(taken, true);
+}
+
+
+size_t LoadBalancer::pick(const sockaddr_in& clientAddr, bool& trial) {
+    // Without active checks the trials are clients, a due one goes first. With all
+    // circuits closed this is the one relaxed load
+    if (health_.checkIntervalMs == 0 && notClosed_.load(std::memory_order_relaxed) > 0) {
+        for (size_t i = 0; i < backends_.size(); ++i) {
+            if (admitsTrial(*backends_[i])) {
+                trial = true;
+                return i;
+            }
+        }
+    }
+    if (backends_.size() == 1) {
+        return available(*backends_[0]) ? 0 : NONE;
+    }
+    switch (policy_) {
+        case LoadBalancePolicy::LEAST_CONNECTIONS:
+            return leastConnections();
+        case LoadBalancePolicy::POWER_OF_TWO:
+            return powerOfTwo();
+        case LoadBalancePolicy::CONSISTENT_HASH:
+            return hashed(clientAddr.sin_addr.s_addr);
+        case LoadBalancePolicy::ROUND_ROBIN:
+        default:
+            return roundRobin();
+    }
+}
+
+
+size_t LoadBalancer::roundRobin() {
+    size_t count = backends_.size();
+    size_t start = next_.fetch_add(1, std::memory_order_relaxed) % count;
+    for (size_t i = 0; i < count; ++i) {
+        size_t candidate = (start + i) % count;
+        if (available(*backends_[candidate])) {
+            return candidate;
+        }
+    }
+    return NONE;
+}
+
+
+size_t LoadBalancer::leastConnections() {
+    size_t count = backends_.size();
+    size_t start = next_.fetch_add(1, std::memory_order_relaxed) % count;
+    size_t best = NONE;
+    int bestActive = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t candidate = (start + i) % count;
+        if (!available(*backends_[candidate])) {
+            continue;
+        }
+        int active = backends_[candidate]->active.load(std::memory_order_relaxed);
+        if (best == NONE || active < bestActive) {
+            best = candidate;
+            bestActive = active;
+        }
+    }
+    return best;
+}
+
+
+size_t LoadBalancer::powerOfTwo() {
+    size_t count = backends_.size();
+    uint64_t random = nextRandom();
+    size_t first = static_cast<size_t>(random % count);
+    // Second choice from the others, never the same backend twice
+    size_t second = (first + 1 + static_cast<size_t>((random >> 32) % (count - 1))) % count;
+    bool firstUp = available(*backends_[first]);
+    bool secondUp = available(*backends_[second]);
+    if (!firstUp && !secondUp) {
+        // Both ejected, whatever is left
+        return leastConnections();
+    }
+    if (!firstUp || !secondUp) {
+        return firstUp ? first : second;
+    }
+    int firstActive = backends_[first]->active.load(std::memory_order_relaxed);
+    int secondActive = backends_[second]->active.load(std::memory_order_relaxed);
+    return secondActive < firstActive ? second : first;
+}
+
+
+size_t LoadBalancer::hashed(uint64_t clientIp) const {
+    uint64_t point = mix(clientIp);
+    auto it = std::lower_bound(ring_.begin(), ring_.end(), std::make_pair(point, size_t{0}));
+    // Clockwise to the first backend in rotation, the clients of an ejected one
+    // spread over the others and come back once it's in again
+    for (size_t i = 0; i < ring_.size(); ++i, ++it) {
+        if (it == ring_.end()) {
+            it = ring_.begin();
+        }
+        if (available(*backends_[it->second])) {
+            return it->second;
+        }
+    }
+    return NONE;
+}
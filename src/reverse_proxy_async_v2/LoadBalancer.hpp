@@ -0,0 +1,137 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "Platform.hpp"
+
+
+struct BackendAddress {
+    std::string host;
+    u_short port;
+};
+
+enum class LoadBalancePolicy {
+    ROUND_ROBIN,
+    LEAST_CONNECTIONS,
+    POWER_OF_TWO,
+    CONSISTENT_HASH
+};
+
+// round-robin, least-conn, p2c or hash. false for anything else
+bool parseLoadBalancePolicy(const std::string& name, LoadBalancePolicy& policy);
+
+
+struct HealthOptions {
+    uint32_t checkIntervalMs = 1000;  // active checks, 0 leaves it to client connects
+    uint32_t checkTimeoutMs = 1000;
+    std::string checkPath;            // HTTP GET, 2xx/3xx is healthy. Empty for a plain TCP connect
+    uint32_t maxFailures = 3;         // in a row, opens the circuit. 0 never ejects
+    uint32_t maxLatencyMs = 500;      // slower checks count as failures
+    uint32_t ejectMs = 5000;          // open this long before a trial (half-open)
+};
+
+
+/*
+Picks the backend for each new client.
+
+Every backend counts the sessions currently using it (active) and how many it got
+in total. Both are relaxed atomics on their own cache line, acquire/release never
+take a lock, a pick may just see a count that's a moment old.
+
+ROUND_ROBIN        next backend in turn
+LEAST_CONNECTIONS  fewest active sessions, ties go round in turn
+POWER_OF_TWO       the less busy of two random backends, close to least
+                   connections without every worker piling onto the same one
+CONSISTENT_HASH    client IP on a ring of VIRTUAL_NODES points per backend, a client
+                   keeps its backend as long as the set of backends stays the same
+
+Every backend also has a circuit breaker fed by connect results, from clients,
+pool warm-ups and the HealthChecker:
+CLOSED     in rotation, maxFailures failures in a row (or slow checks) open it
+OPEN       ejected, policies skip it (hashing walks on to the next backend on the ring)
+           until ejectMs have passed
+HALF_OPEN  one trial: the next health check, or without active checks the next
+           client, which then always makes a fresh connect. Success closes the
+           circuit, failure opens it for another ejectMs
+With every circuit open acquire() returns NONE and the client is turned away.
+The state is atomics too, transitions are compare-exchanges.
+*/
+class LoadBalancer {
+
+    public:
+        static constexpr size_t VIRTUAL_NODES = 100;
+        static constexpr size_t NONE = SIZE_MAX;
+
+        LoadBalancer(const std::vector<BackendAddress>& backends, LoadBalancePolicy policy, HealthOptions health);
+
+        LoadBalancer(const LoadBalancer&) = delete;
+        LoadBalancer& operator=(const LoadBalancer&) = delete;
+
+        // Backend for a new client, counted active until release(). NONE if all are ejected.
+        // trial: the client is the half-open trial and must connect, its result reported
+        size_t acquire(const sockaddr_in& clientAddr, bool& trial);
+        void release(size_t backend);
+
+        // Connect or health check outcomes
+        void reportSuccess(size_t backend, uint32_t latencyMs = 0);
+        void reportFailure(size_t backend);
+
+        // Whether the HealthChecker should probe the backend now, claims the trial
+        // of a half-open one
+        bool beginCheck(size_t backend);
+        // Not ejected, worth keeping warm connections for
+        bool inRotation(size_t backend) const;
+
+        // Only hashing looks at the client address, the others skip getpeername()
+        bool needsClientAddress() const { return policy_ == LoadBalancePolicy::CONSISTENT_HASH; }
+
+        size_t size() const { return backends_.size(); }
+        const sockaddr_in& address(size_t backend) const { return backends_[backend]->addr; }
+        const std::string& name(size_t backend) const { return backends_[backend]->name; }
+        uint64_t picks(size_t backend) const { return backends_[backend]->picks.load(std::memory_order_relaxed); }
+        uint64_t ejections(size_t backend) const { return backends_[backend]->ejections.load(std::memory_order_relaxed); }
+        const HealthOptions& health() const { return health_; }
+
+    private:
+        enum Circuit : int {
+            CLOSED,
+            OPEN,
+            HALF_OPEN
+        };
+
+        struct alignas(64) Backend {
+            sockaddr_in addr{};
+            std::string name;
+            std::atomic<int> active = 0;
+            std::atomic<uint64_t> picks = 0;
+
+            std::atomic<int> circuit = CLOSED;
+            std::atomic<uint32_t> failures = 0;     // in a row
+            std::atomic<int64_t> openUntilMs = 0;
+            std::atomic<bool> trialTaken = false;   // HALF_OPEN
+            std::atomic<uint64_t> ejections = 0;
+        };
+
+        size_t pick(const sockaddr_in& clientAddr, bool& trial);
+        size_t roundRobin();
+        size_t leastConnections();
+        size_t powerOfTwo();
+        size_t hashed(uint64_t clientIp) const;
+
+        bool available(const Backend& b) const;
+        // Moves an OPEN circuit whose time is up to HALF_OPEN and claims its trial
+        bool admitsTrial(Backend& b);
+        void open(Backend& b, int from);
+
+        std::vector<std::unique_ptr<Backend>> backends_;
+        LoadBalancePolicy policy_;
+        HealthOptions health_;
+        std::atomic<size_t> next_ = 0;
+        std::atomic<int> notClosed_ = 0;  // circuits OPEN or HALF_OPEN
+        std::vector<std::pair<uint64_t, size_t>> ring_;  // (point, backend), sorted
+};
@@ -0,0 +1,75 @@
+#pragma once
+
+/*
+Minimal socket portability layer, same idea as http_server's.
+Windows keeps the WinSock names, elsewhere the same names sit on top of BSD sockets.
+*/
+
+#ifdef _WIN32
+
+#include <winsock2.h>
+#include <windows.h>
+#include <mswsock.h>
+#include <ws2tcpip.h>
+
+inline int lastSocketError() { return WSAGetLastError(); }
+
+// Error of an operation cancelled by ProxyLoop::cancelIO
+constexpr int IO_ABORTED = ERROR_OPERATION_ABORTED;
+
+using PollFd = WSAPOLLFD;
+inline int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return WSAPoll(fds, static_cast<ULONG>(count), timeoutMs); }
+
+inline bool setNonBlocking(SOCKET s) {
+    u_long mode = 1;
+    return ioctlsocket(s, FIONBIO, &mode) != SOCKET_ERROR;
+}
+inline bool connectInProgress(int error) { return error == WSAEWOULDBLOCK; }
+
+struct WinSockGuard {
+    WinSockGuard() { WSAStartup(MAKEWORD(2, 2), &wsaData); }
+    ~WinSockGuard() { WSACleanup(); }
+    WSADATA wsaData;
+};
+
+#else
+
+#include <arpa/inet.h>
+#include <cerrno>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+using SOCKET = int;
+using u_short = unsigned short;
+constexpr SOCKET INVALID_SOCKET = -1;
+constexpr int SOCKET_ERROR = -1;
+constexpr int SD_BOTH = SHUT_RDWR;
+
+inline int closesocket(SOCKET s) { return ::close(s); }
+inline int lastSocketError() { return errno; }
+
+constexpr int IO_ABORTED = ECANCELED;
+
+using PollFd = pollfd;
+inline int pollSockets(PollFd* fds, size_t count, int timeoutMs) { return ::poll(fds, count, timeoutMs); }
+
+inline bool setNonBlocking(SOCKET s) {
+    int flags = fcntl(s, F_GETFL, 0);
+    return flags != -1 && fcntl(s, F_SETFL, flags | O_NONBLOCK) != -1;
+}
+inline bool connectInProgress(int error) { return error == EINPROGRESS; }
+
+#endif
+
+
+// The relay writes whatever one recv returned, usually well below the MSS (64 KB on
+// loopback). With Nagle each of those waits for the ACK of the previous one
+inline void setNoDelay(SOCKET socket) {
+    int one = 1;
+    setsockopt(socket, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&one), sizeof(one));
+}
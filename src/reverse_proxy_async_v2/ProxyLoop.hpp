@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Platform.hpp"
+#include "BackendPool.hpp"
+
+class ReverseProxy;
+struct ProxyContext;
+
+
+enum class IOState {
+    RECV,
+    SEND,
+    CONNECT,
+    ACCEPT,
+    SPLICE
+};
+
+struct IOContext {
+#ifdef _WIN32
+    OVERLAPPED overlapped;
+#endif
+    IOState state;
+
+    explicit IOContext(IOState ioState) : state(ioState) {
+#ifdef _WIN32
+        ZeroMemory(&overlapped, sizeof(overlapped));
+#endif
+    }
+};
+
+
+/*
+I/O backend of the ReverseProxy, same split as http_server's EventLoop.
+
+The proxy posts operations on ProxyContexts and gets each one back exactly once through
+ReverseProxy::handleCompletion, cancelled ones included (error IO_ABORTED).
+Accepts and backend connects are asynchronous too: AcceptEx/ConnectEx on IOCP,
+accept4/non-blocking connect driven by readiness on epoll. Nothing on a worker
+ever blocks on the network.
+
+IOCP has one loop that every worker runs, epoll one loop per worker. Each loop owns
+a backend pool per backend, its sessions check connections out of those.
+*/
+class ProxyLoop {
+
+    public:
+        ProxyLoop(ReverseProxy& proxy, PoolOptions poolOptions, size_t backends) : proxy_(proxy) {
+            for (size_t i = 0; i < backends; ++i) {
+                pools_.push_back(std::make_unique<BackendPool>(poolOptions));
+            }
+        }
+        virtual ~ProxyLoop() = default;
+
+        ProxyLoop(const ProxyLoop&) = delete;
+        ProxyLoop& operator=(const ProxyLoop&) = delete;
+
+        // Start accepting on the listening socket, throws on failure
+        virtual void init(SOCKET listenSocket) = 0;
+
+        // Creates the backend socket into context->srcSocket and starts connecting.
+        // false if it failed right away, context->srcSocket is then closed by the caller
+        virtual bool postConnect(ProxyContext* context, const sockaddr_in& addr, const std::string& threadStr) = 0;
+
+        // false if the operation failed right away (error in lastSocketError()), no completion follows
+        virtual bool postRecv(ProxyContext* context) = 0;
+        virtual bool postSend(ProxyContext* context) = 0;
+
+        // Relays srcSocket -> dstSocket inside the kernel until srcSocket hits EOF or either
+        // side fails, then completes once (0 bytes, like a recv at EOF). Linux only
+        virtual bool postSplice(ProxyContext* context) { (void)context; return false; }
+
+        // Pending operations on the socket complete with IO_ABORTED
+        virtual void cancelIO(SOCKET socket) = 0;
+
+        // Worker thread body, returns after wakeup() once the proxy has stopped running
+        virtual void run() = 0;
+        virtual void wakeup() = 0;
+
+        BackendPool& pool(size_t backend) { return *pools_[backend]; }
+
+    protected:
+        ReverseProxy& proxy_;
+        std::vector<std::unique_ptr<BackendPool>> pools_;  // indexed like LoadBalancer's backends
+};
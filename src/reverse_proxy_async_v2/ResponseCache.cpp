@@ -0,0 +1,180 @@
+#include <chrono>
+#include <functional>
+#include <iterator>
+
+#include "ResponseCache.hpp"
+
+
+// Entry bookkeeping on top of the strings: list node, index slot, control block
+static constexpr size_t ENTRY_OVERHEAD = 192;
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static bool iequals(std::string_view a, std::string_view b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); ++i) {
+        if ((a[i] | 0x20) != (b[i] | 0x20)) return false;
+    }
+    return true;
+}
+
+static std::string_view trim(std::string_view s) {
+    while (!s.empty() && (s.front() == ' ' || s.front() == '\t')) s.remove_prefix(1);
+    while (!s.empty() && (s.back() == ' ' || s.back() == '\t')) s.remove_suffix(1);
+    return s;
+}
+
+// Delta-seconds, -1 if it isn't one
+static int64_t parseSeconds(std::string_view value) {
+    if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+        value = value.substr(1, value.size() - 2);
+    }
+    if (value.empty() || value.size() > 9) return -1;
+    int64_t seconds = 0;
+    for (char c : value) {
+        if (c < '0' || c > '9') return -1;
+        seconds = seconds * 10 + (c - '0');
+    }
+    return seconds;
+}
+
+
+CacheControl parseCacheControl(std::string_view value) {
+    CacheControl result;
+    int64_t maxAge = -1;
+    int64_t sharedMaxAge = -1;
+    while (!value.empty()) {
+        size_t comma = value.find(',');
+        std::string_view directive = trim(value.substr(0, comma));
+        value = comma == std::string_view::npos ? std::string_view{} : value.substr(comma + 1);
+
+        size_t equals = directive.find('=');
+        std::string_view name = trim(directive.substr(0, equals));
+        std::string_view argument = equals == std::string_view::npos ? std::string_view{} : trim(directive.substr(equals + 1));
+        if (iequals(name, "no-store") || iequals(name, "no-cache") || iequals(name, "private")) {
+            result.noStore = true;
+        } else if (iequals(name, "max-age")) {
+            maxAge = parseSeconds(argument);
+        } else if (iequals(name, "s-maxage")) {
+            sharedMaxAge = parseSeconds(argument);
+        } else if (iequals(name, "stale-while-revalidate")) {
+            result.staleS = parseSeconds(argument);
+        }
+    }
+    result.maxAgeS = sharedMaxAge >= 0 ? sharedMaxAge : maxAge;
+    return result;
+}
+
+
+ResponseCache::ResponseCache(size_t maxBytes, uint32_t staleMs)
+    : shardBytes_(maxBytes / SHARDS), maxEntryBytes_(maxBytes / SHARDS / 4), staleMs_(staleMs) {}
+
+
+ResponseCache::Shard& ResponseCache::shard(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) % SHARDS];
+}
+
+
+void ResponseCache::erase(Shard& shard, std::list<Entry>::iterator it) {
+    shard.bytes -= it->size;
+    shard.index.erase(it->key);
+    shard.lru.erase(it);
+}
+
+
+CacheHit ResponseCache::lookup(const std::string& key) {
+    CacheHit hit;
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(key);
+    if (found == s.index.end()) {
+        ++s.stats.misses;
+        return hit;
+    }
+    auto it = found->second;
+    int64_t now = nowMs();
+    if (now >= it->response->staleUntilMs) {
+        // Too old even to serve stale. A revalidation still going stores anew
+        erase(s, it);
+        ++s.stats.misses;
+        return hit;
+    }
+
+    s.lru.splice(s.lru.begin(), s.lru, it);
+    hit.response = it->response;
+    hit.ageS = static_cast<uint32_t>((now - it->response->storedMs) / 1000);
+    if (now < it->response->freshUntilMs) {
+        hit.result = CacheHit::FRESH;
+        ++s.stats.hits;
+    } else {
+        hit.result = CacheHit::STALE;
+        ++s.stats.staleHits;
+        if (!it->revalidating) {
+            it->revalidating = true;
+            hit.revalidate = true;
+            ++s.stats.revalidations;
+        }
+    }
+    return hit;
+}
+
+
+void ResponseCache::store(const std::string& key, std::shared_ptr<CachedResponse> response, const CacheControl& cacheControl) {
+    size_t size = key.size() + response->request.size() + response->bytes.size() + ENTRY_OVERHEAD;
+    response->storedMs = nowMs();
+    response->freshUntilMs = response->storedMs + cacheControl.maxAgeS * 1000;
+    response->staleUntilMs = response->freshUntilMs + (cacheControl.staleS >= 0 ? cacheControl.staleS * 1000 : staleMs_);
+
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(key);
+    if (found != s.index.end()) {
+        erase(s, found->second);
+    }
+    if (response->bytes.size() > maxEntryBytes_) {
+        return;
+    }
+    while (!s.lru.empty() && s.bytes + size > shardBytes_) {
+        erase(s, std::prev(s.lru.end()));
+        ++s.stats.evictions;
+    }
+    s.lru.push_front(Entry{key, std::move(response), size, false});
+    s.index.emplace(s.lru.front().key, s.lru.begin());
+    s.bytes += size;
+    ++s.stats.stores;
+}
+
+
+void ResponseCache::abandon(const std::string& key, bool drop) {
+    Shard& s = shard(key);
+    std::lock_guard<std::mutex> lock(s.mutex);
+    auto found = s.index.find(key);
+    if (found == s.index.end()) {
+        return;
+    }
+    if (drop) {
+        erase(s, found->second);
+    } else {
+        found->second->revalidating = false;
+    }
+}
+
+
+CacheStats ResponseCache::stats() {
+    CacheStats total;
+    for (Shard& s : shards_) {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        total.hits += s.stats.hits;
+        total.staleHits += s.stats.staleHits;
+        total.misses += s.stats.misses;
+        total.stores += s.stats.stores;
+        total.evictions += s.stats.evictions;
+        total.revalidations += s.stats.revalidations;
+        total.entries += s.lru.size();
+        total.bytes += s.bytes;
+    }
+    return total;
+}
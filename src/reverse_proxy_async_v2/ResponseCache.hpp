@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+
+// Cache-Control as far as a shared cache cares
+struct CacheControl {
+    bool noStore = false;  // no-store, no-cache or private: neither from nor into a shared cache
+    int64_t maxAgeS = -1;  // s-maxage, else max-age. -1 if neither
+    int64_t staleS = -1;   // stale-while-revalidate, -1 if not given
+};
+
+CacheControl parseCacheControl(std::string_view value);
+
+
+// A stored response, shared by the cache and the sends serving it
+struct CachedResponse {
+    std::string bytes;          // status line, headers and body as the backend sent them
+    size_t statusLineEnd = 0;   // Age goes in after it
+    std::string request;        // head to revalidate with, the one that got it minus Cookie, If-* and Range
+    int64_t storedMs = 0;
+    int64_t freshUntilMs = 0;
+    int64_t staleUntilMs = 0;   // served stale, while revalidating, until then
+};
+
+struct CacheHit {
+    enum Result {
+        MISS,
+        FRESH,
+        STALE
+    };
+    Result result = MISS;
+    std::shared_ptr<const CachedResponse> response;
+    uint32_t ageS = 0;
+    bool revalidate = false;    // STALE: this caller refetches it, then store() or abandon()
+};
+
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t staleHits = 0;
+    uint64_t misses = 0;
+    uint64_t stores = 0;
+    uint64_t evictions = 0;     // pushed out to make room, not replaced or expired
+    uint64_t revalidations = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+
+/*
+Responses of the HTTP mode, shared by all loops.
+
+Keys are "method host path". Each key hashes to one of SHARDS shards, a mutex,
+an index and an LRU list each, so loops serving different keys rarely meet on the
+same lock. The memory bound (key, request head and response bytes of every entry)
+is split evenly over the shards, storing past a shard's share evicts its least
+recently used entries. A response larger than maxEntryBytes() isn't kept at all.
+
+An entry is fresh for its max-age (s-maxage), then stale for stale-while-revalidate
+seconds, the response's own or staleMs without one. A stale entry is still served,
+and the first lookup to see it stale gets to revalidate: it refetches the response
+in the background and store()s the new one or abandon()s the attempt, the lookups
+meanwhile keep getting the stale one without starting fetches of their own. Past
+the stale window the entry is gone and the lookup a miss.
+
+Entries are immutable once stored and shared_ptr'd, a send still going out keeps
+its response alive after the entry is evicted or replaced.
+*/
+class ResponseCache {
+
+    public:
+        static constexpr size_t SHARDS = 16;
+
+        ResponseCache(size_t maxBytes, uint32_t staleMs);
+
+        ResponseCache(const ResponseCache&) = delete;
+        ResponseCache& operator=(const ResponseCache&) = delete;
+
+        CacheHit lookup(const std::string& key);
+        // cacheControl: of the response, parsed, with a positive max-age
+        void store(const std::string& key, std::shared_ptr<CachedResponse> response, const CacheControl& cacheControl);
+        // A revalidation that brought nothing to store. drop: the entry has to go,
+        // the backend's answer may not be cached
+        void abandon(const std::string& key, bool drop);
+
+        size_t maxEntryBytes() const { return maxEntryBytes_; }
+        CacheStats stats();
+
+    private:
+        struct Entry {
+            std::string key;
+            std::shared_ptr<const CachedResponse> response;
+            size_t size = 0;
+            bool revalidating = false;
+        };
+
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::list<Entry> lru;  // most recently used first
+            std::unordered_map<std::string_view, std::list<Entry>::iterator> index;  // views of Entry::key
+            size_t bytes = 0;
+            CacheStats stats;
+        };
+
+        Shard& shard(const std::string& key);
+        void erase(Shard& shard, std::list<Entry>::iterator it);
+
+        Shard shards_[SHARDS];
+        size_t shardBytes_;
+        size_t maxEntryBytes_;
+        uint32_t staleMs_;
+};
@@ -0,0 +1,511 @@
+#include <chrono>
+#include <csignal>
+#include <stdexcept>
+
+#include "ReverseProxy.hpp"
+#include "log.hpp"
+
+#ifdef _WIN32
+#include "IocpProxyLoop.hpp"
+#else
+#include "EpollProxyLoop.hpp"
+#endif
+
+ReverseProxy* ReverseProxy::instance_ = nullptr;
+
+
+ReverseProxy::ReverseProxy(ProxyOptions options) : options_(std::move(options)) {
+    if (options_.backends.empty()) {
+        options_.backends.push_back({"127.0.0.1", 8080});
+    }
+    balancer_ = std::make_unique<LoadBalancer>(options_.backends, options_.policy, options_.health);
+    instance_ = this;
+}
+
+
+ReverseProxy::~ReverseProxy() {
+    if (listenSocket_ != INVALID_SOCKET) {
+        closesocket(listenSocket_);
+    }
+}
+
+
+void ReverseProxy::signalHandler(int signal) {
+    // Only flag the main loop, it does the shutdown
+    (void)signal;
+    if (instance_) {
+        instance_->running_ = false;
+    }
+}
+
+
+void ReverseProxy::run() {
+    logf("[Main] Running V2 async multithreaded reverse proxy!");
+    std::signal(SIGINT, signalHandler);
+    std::signal(SIGTERM, signalHandler);
+
+    listenSocket_ = createListenSocket();
+    running_ = true;
+
+#ifdef _WIN32
+    loops_.push_back(std::make_unique<IocpProxyLoop>(*this, options_.pool, balancer_->size()));
+#else
+    for (size_t i = 0; i < options_.threads; ++i) {
+        loops_.push_back(std::make_unique<EpollProxyLoop>(*this, options_.pool, balancer_->size()));
+    }
+#endif
+    if (options_.http && options_.cacheBytes != 0) {
+        cache_ = std::make_unique<ResponseCache>(options_.cacheBytes, options_.cacheStaleMs);
+    }
+    for (auto& loop : loops_) {
+        loop->init(listenSocket_);
+        if (options_.http) {
+            relays_.push_back(std::make_unique<HttpRelay>(*loop, *balancer_, cache_.get(),
+                                                          options_.httpUpstreams, options_.maxInFlight, options_.collapse));
+        }
+    }
+
+    logf("Reverse proxy listening on ", options_.listenAddress, ":", options_.listenPort,
+         ", forwarding to ", balancer_->size(), " backend(s)",
+         options_.http ? " (HTTP mode)" : options_.splice ? " (splice relay)" : "");
+
+    for (size_t i = 0; i < options_.threads; ++i) {
+        workerThreads_.emplace_back(&ProxyLoop::run, loops_[i % loops_.size()].get());
+    }
+    if (options_.health.checkIntervalMs != 0 && options_.health.maxFailures != 0) {
+        healthChecker_ = std::make_unique<HealthChecker>(*balancer_);
+        healthChecker_->start();
+    }
+
+    while (running_) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    logf("[Main] Stop worker threads");
+    for (size_t i = 0; i < workerThreads_.size(); ++i) {
+        loops_[i % loops_.size()]->wakeup();
+    }
+
+    logf("[Main] Waiting for worker threads to finish.");
+    for (auto& t : workerThreads_) {
+        if (t.joinable()) t.join();
+    }
+    healthChecker_.reset();
+
+    PoolStats total;
+    for (auto& loop : loops_) {
+        for (size_t backend = 0; backend < balancer_->size(); ++backend) {
+            PoolStats stats = loop->pool(backend).stats();
+            total.connects += stats.connects;
+            total.reuses += stats.reuses;
+            total.discarded += stats.discarded;
+            total.idle += stats.idle;
+        }
+    }
+    for (size_t backend = 0; backend < balancer_->size(); ++backend) {
+        logf("[Main] Backend ", balancer_->name(backend), " clients: ", balancer_->picks(backend),
+             ", ejections: ", balancer_->ejections(backend));
+    }
+    logf("[Main] Clients rejected with every backend ejected: ", rejected_.load());
+    logf("[Main] Backend pool connects: ", total.connects, ", reuses: ", total.reuses,
+         ", discarded: ", total.discarded, ", idle: ", total.idle);
+    if (options_.http) {
+        RelayStats relayed;
+        for (auto& relay : relays_) {
+            RelayStats stats = relay->stats();
+            relayed.requests += stats.requests;
+            relayed.connects += stats.connects;
+            relayed.peakUpstreams += stats.peakUpstreams;
+            relayed.collapsed += stats.collapsed;
+        }
+        logf("[Main] HTTP requests: ", relayed.requests, ", backend connects: ", relayed.connects,
+             ", peak backend connections: ", relayed.peakUpstreams, ", collapsed: ", relayed.collapsed);
+    }
+    if (cache_) {
+        CacheStats cached = cache_->stats();
+        logf("[Main] Response cache hits: ", cached.hits, ", stale hits: ", cached.staleHits,
+             ", misses: ", cached.misses, ", stores: ", cached.stores, ", evictions: ", cached.evictions,
+             ", revalidations: ", cached.revalidations, ", entries: ", cached.entries, " (", cached.bytes, " bytes)");
+    }
+
+    // Worker caches have retired by now, their counts are in
+    AllocStats contexts = ObjectPool<ProxyContext>::stats();
+    AllocStats sessions = ObjectPool<ProxySession>::stats();
+    logf("[Main] Relayed bytes: ", relayedBytes_.load(),
+         ", context allocations: ", contexts.hits + contexts.misses, " (heap ", contexts.misses, ")",
+         ", session allocations: ", sessions.hits + sessions.misses, " (heap ", sessions.misses, ")");
+
+    relays_.clear();
+    loops_.clear();
+    cache_.reset();
+    closesocket(listenSocket_);
+    listenSocket_ = INVALID_SOCKET;
+    logf("[Main] Async reverse proxy shut down gracefully!");
+}
+
+
+void ReverseProxy::handleAccept(ProxyLoop& loop, SOCKET clientSocket, const std::string& threadStr) {
+    if (options_.http) {
+        // Few loops, one relay each
+        for (size_t i = 0; i < loops_.size(); ++i) {
+            if (loops_[i].get() == &loop) {
+                relays_[i]->accept(clientSocket, threadStr);
+                return;
+            }
+        }
+    }
+
+    sockaddr_in clientAddr{};
+    if (balancer_->needsClientAddress()) {
+        socklen_t clientAddrLen = sizeof(clientAddr);
+        getpeername(clientSocket, reinterpret_cast<sockaddr*>(&clientAddr), &clientAddrLen);
+    }
+    bool trial = false;
+    size_t backend = balancer_->acquire(clientAddr, trial);
+    if (backend == LoadBalancer::NONE) {
+        ++rejected_;
+        closesocket(clientSocket);
+        return;
+    }
+
+    setNoDelay(clientSocket);
+    auto* session = new ProxySession(clientSocket, &loop);
+    session->backend = backend;
+
+    // A trial has to prove the backend takes connections again, no pooled one
+    SOCKET backendSocket = trial ? INVALID_SOCKET : loop.pool(backend).acquire();
+    if (backendSocket == INVALID_SOCKET) {
+        connectBackend(session, threadStr);
+        return;
+    }
+    session->backendSocket = backendSocket;
+    // Held as one pending operation until both recvs are posted, see startRelay
+    session->pendingIO = 1;
+    startRelay(session);
+}
+
+
+void ReverseProxy::handleTick(ProxyLoop& loop, const std::string& threadStr) {
+    // The HTTP mode keeps its own backend connections
+    if (!options_.http) {
+        warmUp(loop, threadStr);
+    }
+}
+
+
+void ReverseProxy::connectBackend(ProxySession* session, const std::string& threadStr) {
+    auto* context = new ProxyContext(IOState::CONNECT, session, INVALID_SOCKET, session->clientSocket);
+    // The connect is the session's only pending operation until the relay starts
+    session->pendingIO = 1;
+    if (!session->loop->postConnect(context, balancer_->address(session->backend), threadStr)) {
+        logcerr(threadStr, "connect() to backend server failed with error: ", lastSocketError());
+        balancer_->reportFailure(session->backend);
+        session->backendSocket = context->srcSocket;
+        delete context;
+        closeSession(session, false);
+        dropPending(session);
+    }
+}
+
+
+void ReverseProxy::warmUp(ProxyLoop& loop, const std::string& threadStr) {
+    for (size_t backend = 0; backend < balancer_->size(); ++backend) {
+        // No use keeping connections to an ejected backend warm
+        if (!balancer_->inRotation(backend)) {
+            continue;
+        }
+        BackendPool& pool = loop.pool(backend);
+        size_t missing = pool.maintain();
+        for (size_t i = 0; i < missing; ++i) {
+            auto* context = new ProxyContext(IOState::CONNECT, nullptr, INVALID_SOCKET, INVALID_SOCKET);
+            context->warmUpPool = &pool;
+            context->backend = backend;
+            if (!loop.postConnect(context, balancer_->address(backend), threadStr)) {
+                if (context->srcSocket != INVALID_SOCKET) {
+                    closesocket(context->srcSocket);
+                }
+                balancer_->reportFailure(backend);
+                pool.warmUpFailed();
+                delete context;
+            }
+        }
+    }
+}
+
+
+void ReverseProxy::handleConnect(ProxyContext* context, bool ok, int error, const std::string& threadStr) {
+    ProxySession* session = context->session;
+    SOCKET backendSocket = context->srcSocket;
+
+    // Client and warm-up connects feed the circuit breaker too, a dead backend is
+    // usually noticed here before the next health check
+    size_t backend = session ? session->backend : context->backend;
+    if (ok) {
+        setNoDelay(backendSocket);
+        balancer_->reportSuccess(backend);
+    } else {
+        balancer_->reportFailure(backend);
+    }
+
+    if (session == nullptr) {
+        if (ok) {
+            context->warmUpPool->warmedUp(backendSocket);
+        } else {
+            closesocket(backendSocket);
+            context->warmUpPool->warmUpFailed();
+        }
+        delete context;
+        return;
+    }
+
+    delete context;
+    session->backendSocket = backendSocket;
+    if (!ok) {
+        logcerr(threadStr, "connect() to backend server failed with error: ", error);
+        closeSession(session, false);
+        dropPending(session);
+        return;
+    }
+    session->loop->pool(session->backend).connected();
+    startRelay(session);
+}
+
+
+// The caller holds one pending operation on the session, a failing first recv
+// can't end the session under us
+void ReverseProxy::startRelay(ProxySession* session) {
+    if (options_.splice) {
+        issueIO(new ProxyContext(IOState::SPLICE, session, session->clientSocket, session->backendSocket));
+        issueIO(new ProxyContext(IOState::SPLICE, session, session->backendSocket, session->clientSocket));
+    } else {
+        startRecv(session, session->clientSocket, session->backendSocket);
+        startRecv(session, session->backendSocket, session->clientSocket);
+    }
+    dropPending(session);
+}
+
+
+void ReverseProxy::handleCompletion(ProxyContext* context, bool ok, size_t bytesTransferred, int error, const std::string& threadStr) {
+    if (context->peer != nullptr) {
+        context->peer->relay->handleCompletion(context, ok, bytesTransferred, error, threadStr);
+        return;
+    }
+    if (context->state == IOState::CONNECT) {
+        handleConnect(context, ok, error, threadStr);
+        return;
+    }
+
+    ProxySession* session = context->session;
+
+    if (!ok || bytesTransferred == 0) {
+        const char* side = context->onBackend() ? " Backend" : " Client";
+        if (!ok && error == IO_ABORTED) {
+            // Cancelled by closeSession
+        } else if (ok) {
+            logf(threadStr, side, " disconnected gracefully (bytesTransferred == 0)");
+        } else {
+            logf(threadStr, side, " disconnected with error: ", error);
+        }
+
+        // A connection nothing was sent on (see issueIO) survives only the client
+        // going away, or our own cancel of the recv that was waiting on it. Anything
+        // else on the backend side (EOF, reset) leaves it in an unknown state.
+        // A splice counts as a recv, as long as its pipe was empty when it ended
+        bool waitingRecv = context->state == IOState::RECV ||
+                           (context->state == IOState::SPLICE && context->unsent == 0);
+        bool backendReusable = waitingRecv && (!context->onBackend() || (!ok && error == IO_ABORTED));
+        closeSession(session, backendReusable);
+        completeIO(context);
+        return;
+    }
+
+    if (context->state == IOState::RECV) {
+        bool keepReceiving = true;
+        {
+            std::lock_guard<std::mutex> lock(session->mutex);
+            ProxySession::Flow& flow = session->flow(context->towardsBackend());
+            flow.inFlight += bytesTransferred;
+            if (options_.maxInFlight != 0 && flow.inFlight >= options_.maxInFlight) {
+                flow.recvPaused = true;
+                keepReceiving = false;
+            }
+        }
+
+        // Hand the buffer over as the send, the recv goes on in a new context
+        SOCKET srcSocket = context->srcSocket;
+        SOCKET dstSocket = context->dstSocket;
+        context->state = IOState::SEND;
+        context->srcSocket = dstSocket;
+        context->dstSocket = srcSocket;
+        context->bufferLen = bytesTransferred;
+
+        issueIO(context);
+        if (keepReceiving) {
+            startRecv(session, srcSocket, dstSocket);
+        }
+        dropPending(session);
+        return;
+    }
+
+    bool resumeRecv = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        ProxySession::Flow& flow = session->flow(context->towardsBackend());
+        flow.inFlight -= bytesTransferred;
+        if (flow.recvPaused && flow.inFlight < options_.maxInFlight) {
+            flow.recvPaused = false;
+            resumeRecv = true;
+        }
+    }
+    relayedBytes_.fetch_add(bytesTransferred, std::memory_order_relaxed);
+    if (resumeRecv) {
+        // The send wrote to srcSocket, the data came from dstSocket
+        startRecv(session, context->dstSocket, context->srcSocket);
+    }
+    completeIO(context);
+}
+
+
+void ReverseProxy::startRecv(ProxySession* session, SOCKET srcSocket, SOCKET dstSocket) {
+    issueIO(new ProxyContext(IOState::RECV, session, srcSocket, dstSocket));
+}
+
+
+// Posts the context's recv/send/splice unless the session is closing. On failure the
+// context is deleted and the session closed
+void ReverseProxy::issueIO(ProxyContext* context) {
+    ProxySession* session = context->session;
+    bool posted = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (session->closing) {
+            // Backend bytes nobody will forward, the connection is mid-response
+            if (context->state == IOState::SEND && !context->onBackend()) {
+                session->backendReusable = false;
+            }
+            delete context;
+            return;
+        }
+
+        // Bytes relayed blindly could be a request still waiting for its answer, which
+        // would go to the next client of the connection. Once anything goes to the
+        // backend the connection is this client's alone and gets closed at the end
+        if (context->state != IOState::RECV && context->towardsBackend()) {
+            session->backendReusable = false;
+        }
+
+        switch (context->state) {
+            case IOState::RECV: posted = session->loop->postRecv(context); break;
+            case IOState::SEND: posted = session->loop->postSend(context); break;
+            case IOState::SPLICE: posted = session->loop->postSplice(context); break;
+            default: break;
+        }
+        if (posted) {
+            ++session->pendingIO;
+        }
+    }
+
+    if (!posted) {
+        logcerr(context->state == IOState::SEND ? "Send" : "Recv", " failed with error: ", lastSocketError());
+        bool backendReusable = !context->onBackend();
+        delete context;
+        closeSession(session, backendReusable);
+    }
+}
+
+
+void ReverseProxy::completeIO(ProxyContext* context) {
+    ProxySession* session = context->session;
+    delete context;
+    dropPending(session);
+}
+
+
+// One operation less, the last one ends a closing session
+void ReverseProxy::dropPending(ProxySession* session) {
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        --session->pendingIO;
+        done = session->closing && session->pendingIO == 0 && !session->finished;
+        session->finished = session->finished || done;
+    }
+    if (done) {
+        endSession(session);
+    }
+}
+
+
+// Only ever lowers backendReusable, the first call starts the close
+void ReverseProxy::closeSession(ProxySession* session, bool backendReusable) {
+    bool done = false;
+    {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        if (!backendReusable) {
+            session->backendReusable = false;
+        }
+        if (!session->closing) {
+            session->closing = true;
+            // Client side ops complete with an error or 0 bytes, the pending backend recv
+            // with IO_ABORTED. The backend socket stays open for the pool
+            shutdown(session->clientSocket, SD_BOTH);
+            session->loop->cancelIO(session->clientSocket);
+            if (session->backendSocket != INVALID_SOCKET) {
+                session->loop->cancelIO(session->backendSocket);
+            }
+        }
+        done = session->pendingIO == 0 && !session->finished;
+        session->finished = session->finished || done;
+    }
+    if (done) {
+        endSession(session);
+    }
+}
+
+
+void ReverseProxy::endSession(ProxySession* session) {
+    closesocket(session->clientSocket);
+    if (session->backendSocket != INVALID_SOCKET) {
+        if (session->backendReusable) {
+            session->loop->pool(session->backend).release(session->backendSocket);
+        } else {
+            closesocket(session->backendSocket);
+        }
+    }
+    balancer_->release(session->backend);
+    delete session;
+}
+
+
+SOCKET ReverseProxy::createListenSocket() {
+    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (listenSocket == INVALID_SOCKET) {
+        logcerr("[Main] Failed to create socket");
+        throw std::runtime_error("Failed to create listening socket");
+    }
+
+#ifndef _WIN32
+    // Restarts shouldn't wait for TIME_WAIT, on Windows the option would allow port stealing
+    int reuse = 1;
+    setsockopt(listenSocket, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+#endif
+
+    sockaddr_in serverAddr{};
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_port = htons(options_.listenPort);
+    serverAddr.sin_addr.s_addr = inet_addr(options_.listenAddress.c_str());
+
+    if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
+        logcerr("[Main] bind() failed with error: ", lastSocketError());
+        closesocket(listenSocket);
+        throw std::runtime_error("Failed to bind listening socket");
+    }
+
+    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
+        logcerr("[Main] listen() failed with error: ", lastSocketError());
+        closesocket(listenSocket);
+        throw std::runtime_error("Failed to listen");
+    }
+
+    return listenSocket;
+}
@@ -0,0 +1,200 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Platform.hpp"
+#include "BackendPool.hpp"
+#include "HealthChecker.hpp"
+#include "HttpRelay.hpp"
+#include "LoadBalancer.hpp"
+#include "ObjectPool.hpp"
+#include "ProxyLoop.hpp"
+#include "ResponseCache.hpp"
+
+
+constexpr int BUFFER_SIZE = 4096;
+
+
+struct ProxyOptions {
+    std::string listenAddress = "127.0.0.1";
+    u_short listenPort = 9000;
+    std::vector<BackendAddress> backends;  // 127.0.0.1:8080 if empty
+    LoadBalancePolicy policy = LoadBalancePolicy::ROUND_ROBIN;
+    HealthOptions health;
+
+    size_t threads = 2;
+    PoolOptions pool;
+
+    bool splice = false;  // relay with splice() through a pipe per direction (Linux)
+
+    // HTTP mode: relay requests over shared keep-alive backend connections (HttpRelay.hpp),
+    // at most httpUpstreams per backend and loop
+    bool http = false;
+    size_t httpUpstreams = 8;
+    // HTTP mode: identical concurrent GET/HEAD requests of a loop share one upstream exchange
+    bool collapse = true;
+    // HTTP mode: ResponseCache of this many bytes, 0 for none. Responses without a
+    // stale-while-revalidate of their own may be served stale for cacheStaleMs
+    size_t cacheBytes = 0;
+    uint32_t cacheStaleMs = 0;
+
+    // Per direction, bytes received but not sent on yet. At the cap the recv on that
+    // side waits until sends complete. 0 for no limit
+    size_t maxInFlight = 64 * 1024;
+};
+
+
+/*
+One client and the backend connection it got from the pool (or is still connecting),
+to the backend the LoadBalancer picked for it.
+
+Contexts still come and go per I/O, the session only counts them. A received buffer
+isn't copied: the recv context turns into the send to the other side and a fresh
+context takes over the recv. Both types come from per-thread free lists
+(ObjectPool.hpp), in steady state relaying allocates nothing. Once either side
+ends, the session closes: no new I/O gets posted, the pending ones are cancelled,
+and when the last one completes the backend connection is closed. It goes back to
+the pool only if the client never sent anything on it: a byte relay doesn't know
+where messages end, a request sent last could still be waiting for its answer.
+
+Each direction counts the bytes it has received but not sent on. Past
+ProxyOptions::maxInFlight no new recv is posted on that side, the sender gets
+pushed back by TCP instead of the proxy buffering for it, and the send completion
+that brings the count back under the cap posts it again.
+
+Posting and cancelling both happen under the session mutex, so an operation is either
+posted before the cancel (and cancelled by it) or not posted at all.
+*/
+struct ProxySession {
+    SOCKET clientSocket;
+    SOCKET backendSocket = INVALID_SOCKET;
+    size_t backend = 0;  // LoadBalancer index
+    ProxyLoop* loop;
+
+    std::mutex mutex;
+    int pendingIO = 0;
+    bool closing = false;
+    bool finished = false;
+    bool backendReusable = true;
+
+    struct Flow {
+        size_t inFlight = 0;
+        bool recvPaused = false;
+    };
+    Flow flows[2];  // client -> backend, backend -> client
+
+    Flow& flow(bool towardsBackend) { return flows[towardsBackend ? 0 : 1]; }
+
+    ProxySession(SOCKET client, ProxyLoop* sessionLoop) : clientSocket(client), loop(sessionLoop) {}
+
+    static void* operator new(size_t size) { return ObjectPool<ProxySession>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<ProxySession>::deallocate(p, size); }
+};
+
+struct ProxyContext : public IOContext {
+    ProxySession* session;  // nullptr for pool warm-up connects and the HTTP mode
+    HttpPeer* peer = nullptr;  // HTTP mode
+    BackendPool* warmUpPool = nullptr;
+    size_t backend = 0;     // of a warm-up connect
+    SOCKET srcSocket;
+    SOCKET dstSocket;
+#ifdef _WIN32
+    WSABUF wsaBuf;
+#endif
+    char buffer[BUFFER_SIZE];
+    size_t bufferLen = 0;   // bytes to send
+    size_t unsent = 0;      // SPLICE: bytes still in the pipe when it ended
+    // HTTP mode: a send of someone else's bytes (a cached response) instead of buffer,
+    // owner keeps them alive until it completes
+    const char* external = nullptr;
+    std::shared_ptr<const void> owner;
+
+    ProxyContext(IOState ioState, ProxySession* s, SOCKET srcSock, SOCKET dstSock)
+        : IOContext(ioState), session(s), srcSocket(srcSock), dstSocket(dstSock) {
+#ifdef _WIN32
+        wsaBuf.buf = buffer;
+        wsaBuf.len = BUFFER_SIZE;
+#endif
+    }
+
+    const char* data() const { return external != nullptr ? external : buffer; }
+
+    // I/O on the backend socket, for sends srcSocket is the socket written to
+    bool onBackend() const { return srcSocket == session->backendSocket; }
+    // Direction of the data, recvs read it on the client side, sends write it to the backend
+    bool towardsBackend() const { return (state == IOState::SEND) == onBackend(); }
+
+    static void* operator new(size_t size) { return ObjectPool<ProxyContext>::allocate(size); }
+    static void operator delete(void* p, size_t size) { ObjectPool<ProxyContext>::deallocate(p, size); }
+};
+
+
+/*
+V2 asynchronous multithreaded reverse proxy.
+
+Everything runs on the worker loops (ProxyLoop.hpp): accepting clients, connecting to
+the backend (or checking a warm connection out of the pool) and relaying in both
+directions. Connect results go to the LoadBalancer's circuit breakers, next to the
+probes of the HealthChecker thread. The main thread only sets things up and waits
+for SIGINT.
+With ProxyOptions::http the loops hand clients to their HttpRelay instead, which
+relays requests rather than bytes and gets the completions of its own contexts,
+and answers what it can from the ResponseCache they all share.
+*/
+class ReverseProxy {
+
+    public:
+        explicit ReverseProxy(ProxyOptions options);
+        ~ReverseProxy();
+
+        void run();
+        bool isRunning() const { return running_; }
+
+        static void signalHandler(int signal);
+
+        // Called by the loops
+        void handleAccept(ProxyLoop& loop, SOCKET clientSocket, const std::string& threadStr);
+        void handleCompletion(ProxyContext* context, bool ok, size_t bytesTransferred, int error, const std::string& threadStr);
+        // About once a second per loop
+        void handleTick(ProxyLoop& loop, const std::string& threadStr);
+
+    private:
+        SOCKET createListenSocket();
+
+        void connectBackend(ProxySession* session, const std::string& threadStr);
+        void warmUp(ProxyLoop& loop, const std::string& threadStr);
+        void startRelay(ProxySession* session);
+        void handleConnect(ProxyContext* context, bool ok, int error, const std::string& threadStr);
+
+        void startRecv(ProxySession* session, SOCKET srcSocket, SOCKET dstSocket);
+        void issueIO(ProxyContext* context);
+        void completeIO(ProxyContext* context);
+        void dropPending(ProxySession* session);
+        void closeSession(ProxySession* session, bool backendReusable);
+        void endSession(ProxySession* session);
+
+        ProxyOptions options_;
+        std::unique_ptr<LoadBalancer> balancer_;
+        std::unique_ptr<HealthChecker> healthChecker_;
+        SOCKET listenSocket_ = INVALID_SOCKET;
+
+        std::vector<std::unique_ptr<ProxyLoop>> loops_;
+        std::unique_ptr<ResponseCache> cache_;            // HTTP mode, shared by the relays
+        std::vector<std::unique_ptr<HttpRelay>> relays_;  // HTTP mode, one per loop
+        std::vector<std::thread> workerThreads_;
+
+        std::atomic<bool> running_ = false;
+        std::atomic<uint64_t> relayedBytes_ = 0;  // completed sends, for the shutdown stats
+        std::atomic<uint64_t> rejected_ = 0;      // clients turned away, every backend ejected
+
+#ifdef _WIN32
+        WinSockGuard winSockGuard_;
+#endif
+
+        static ReverseProxy* instance_;
+};
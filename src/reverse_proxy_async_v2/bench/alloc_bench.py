@@ -0,0 +1,60 @@
+import argparse
+import logging
+import re
+import subprocess
+import threading
+import time
+
+from splice_bench import BACKEND_PORT, SIZES, BlobBackend, client_loop
+
+logger = logging.getLogger(__name__)
+
+STATS = re.compile(r"Relayed bytes: (\d+), context allocations: (\d+) \(heap (\d+)\), "
+                   r"session allocations: (\d+) \(heap (\d+)\)")
+
+
+def main():
+    """
+    ProxyContext allocations per forwarded MB in reverse_proxy_async_v2, from the counters
+    the proxy logs on shutdown. Starts the length-prefixed backend of splice_bench.py on 8080
+    and runs the proxy itself, e.g.
+        alloc_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --size=64KB
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--size", choices=SIZES.keys(), default="64KB", help="response size")
+    parser.add_argument("--clients", type=int, default=4, help="concurrent connections")
+    parser.add_argument("--duration", type=float, default=5)
+    args = parser.parse_args()
+
+    backend = BlobBackend(BACKEND_PORT)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+
+    process = subprocess.Popen([args.proxy], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    time.sleep(0.5)
+    received = []
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=client_loop, args=(SIZES[args.size], deadline, received))
+               for _ in range(args.clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    process.send_signal(subprocess.signal.SIGINT)
+    output, _ = process.communicate()
+    backend.shutdown()
+
+    match = STATS.search(output)
+    if not match:
+        logger.error("No allocation stats in the proxy output")
+        return
+    relayed, contexts, context_heap, sessions, session_heap = map(int, match.groups())
+    mb = relayed / (1024 * 1024)
+    logger.info("relayed %.1f MB in %s responses", mb, args.size)
+    logger.info("ProxyContext allocations per MB: %.1f (heap %.3f)", contexts / mb, context_heap / mb)
+    logger.info("ProxySession allocations: %d (heap %d)", sessions, session_heap)
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,166 @@
+import argparse
+import logging
+import random
+import socket
+import socketserver
+import subprocess
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+PROXY_HOST = "127.0.0.1"
+PROXY_PORT = 9000
+BACKEND_PORT = 8081
+
+
+class CachingBackend(socketserver.ThreadingTCPServer):
+    """
+    Keep-alive HTTP backend that takes delay seconds per request. Paths under /hot/ are
+    cacheable (max-age, stale-while-revalidate), everything else is no-store.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 128
+
+    def __init__(self, port, delay, max_age, stale, body_size):
+        super().__init__(("127.0.0.1", port), CachingHandler)
+        self.delay = delay
+        self.max_age = max_age
+        self.stale = stale
+        self.body = b"x" * body_size
+        self.requests = 0
+        self.lock = threading.Lock()
+
+
+class CachingHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        server = self.server
+        data = b""
+        while True:
+            chunk = self.request.recv(4096)
+            if not chunk:
+                return
+            data += chunk
+            while b"\r\n\r\n" in data:
+                head, _, data = data.partition(b"\r\n\r\n")
+                path = head.split(b" ", 2)[1]
+                with server.lock:
+                    server.requests += 1
+                time.sleep(server.delay)
+                if path.startswith(b"/hot/"):
+                    cache_control = f"max-age={server.max_age}, stale-while-revalidate={server.stale}"
+                else:
+                    cache_control = "no-store"
+                self.request.sendall(f"HTTP/1.1 200 OK\r\nCache-Control: {cache_control}\r\n"
+                                     f"Content-Length: {len(server.body)}\r\n\r\n".encode() + server.body)
+
+
+def read_response(s, buffered):
+    """
+    One Content-Length response off a keep-alive connection, returns what came after it.
+    """
+    data = buffered
+    while b"\r\n\r\n" not in data:
+        chunk = s.recv(65536)
+        if not chunk:
+            raise ConnectionError("closed before the response")
+        data += chunk
+    head, _, rest = data.partition(b"\r\n\r\n")
+    length = 0
+    for line in head.split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            length = int(value)
+    while len(rest) < length:
+        chunk = s.recv(65536)
+        if not chunk:
+            raise ConnectionError("closed in the body")
+        rest += chunk
+    return rest[length:]
+
+
+def client_loop(hot_keys, hit_rate, deadline, latencies, errors):
+    """
+    Keep-alive client, hit_rate of its requests go to a hot key, the rest to a path never seen before.
+    """
+    rng = random.Random()
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=5) as s:
+                buffered = b""
+                while time.monotonic() < deadline:
+                    if rng.random() < hit_rate:
+                        path = f"/hot/{rng.randrange(hot_keys)}"
+                    else:
+                        path = f"/cold/{rng.getrandbits(48)}"
+                    start = time.perf_counter()
+                    s.sendall(f"GET {path} HTTP/1.1\r\nHost: bench\r\n\r\n".encode())
+                    buffered = read_response(s, buffered)
+                    latencies.append(time.perf_counter() - start)
+        except OSError:
+            errors.append(1)
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p))] * 1000
+
+
+def main():
+    """
+    Backend offload and client latency of reverse_proxy_async_v2's response cache,
+    HTTP mode without and with --cache-size. Starts a stand-in backend on 8081 that
+    takes --delay ms per request, hit-rate of the requests go to --hot-keys cacheable
+    paths (max-age 1 s, served stale while revalidating), the rest are never repeated.
+    Runs the proxy itself, e.g.
+        cache_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --hit-rate=0.9
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--clients", type=int, default=16, help="concurrent keep-alive client threads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--delay", type=float, default=5, help="backend ms per request")
+    parser.add_argument("--hit-rate", type=float, default=0.9, help="share of requests to hot keys")
+    parser.add_argument("--hot-keys", type=int, default=100)
+    parser.add_argument("--body-size", type=int, default=4096)
+    parser.add_argument("--cache-size", type=int, default=64, help="MB")
+    args = parser.parse_args()
+
+    backend = CachingBackend(BACKEND_PORT, args.delay / 1000, 1, 10, args.body_size)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+
+    for cache_size in (0, args.cache_size):
+        command = [args.proxy, "--http", f"--backend=127.0.0.1:{BACKEND_PORT}", f"--cache-size={cache_size}"]
+        process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        try:
+            time.sleep(1)
+            before = backend.requests
+            latencies, errors = [], []
+            deadline = time.monotonic() + args.duration
+            threads = [threading.Thread(target=client_loop,
+                                        args=(args.hot_keys, args.hit_rate, deadline, latencies, errors))
+                       for _ in range(args.clients)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+            backend_requests = backend.requests - before
+        finally:
+            process.send_signal(subprocess.signal.SIGINT)
+            output, _ = process.communicate()
+
+        latencies.sort()
+        logger.info("%-8s %6.0f req/s  p50 %6.2f  p90 %6.2f  p99 %6.2f ms  errors %d  backend requests %d (%.0f%% offloaded)",
+                    f"cache {cache_size}" if cache_size else "no cache", len(latencies) / args.duration,
+                    percentile(latencies, 0.5), percentile(latencies, 0.9), percentile(latencies, 0.99), len(errors),
+                    backend_requests, 100 * (1 - backend_requests / max(1, len(latencies))))
+        for line in output.splitlines():
+            if "Response cache" in line:
+                logger.info("         %s", line.split("] ", 1)[-1])
+
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,82 @@
+import argparse
+import logging
+import threading
+import time
+
+from pool_bench import BACKEND_PORT, StandInBackend, client_loop
+
+logger = logging.getLogger(__name__)
+
+
+class SlowBackend(StandInBackend):
+    """
+    Stand-in backend whose accept loop stalls for `stall` seconds every `period` seconds.
+    With a tiny listen backlog the kernel stops completing handshakes during a stall,
+    connects that hit one take until the stall ends (or the SYN retransmit) while the
+    others go through right away.
+    """
+
+    def __init__(self, port, backlog, stall, period):
+        self.request_queue_size = backlog
+        self.stall = stall
+        self.period = period
+        self.started = time.monotonic()
+        super().__init__(port)
+
+    def get_request(self):
+        into_period = (time.monotonic() - self.started) % self.period
+        if into_period < self.stall:
+            time.sleep(self.stall - into_period)
+        return super().get_request()
+
+
+def main():
+    """
+    Client connection rate through reverse_proxy_async_v2 when some backend handshakes are slow.
+    Starts the stand-in backend on 8080, then start the proxy without a pool so every client
+    needs its own backend connect:
+        reverse_proxy_async_v2 --pool-max-idle=0
+
+    Connects are overlapped by the worker loops, a slow one only delays its own client.
+    With connects done one at a time before the next accept, every client queued behind
+    a stalled handshake would wait for it too, the median would follow the stalls.
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--clients", type=int, default=32, help="concurrent client threads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--wait", type=float, default=5, help="seconds to start the proxy after the backend is up")
+    parser.add_argument("--backlog", type=int, default=1, help="backend listen backlog")
+    parser.add_argument("--stall", type=float, default=0.2, help="seconds the backend stops accepting per period, 0 for a fast backend")
+    parser.add_argument("--period", type=float, default=1.0)
+    args = parser.parse_args()
+
+    backend = SlowBackend(BACKEND_PORT, args.backlog, args.stall, args.period)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+    logger.info("Stand-in backend on port %d (backlog %d, stalls %.0f ms every %.1f s), start the proxy now",
+                BACKEND_PORT, args.backlog, args.stall * 1000, args.period)
+    time.sleep(args.wait)
+
+    accepted_before = backend.accepted
+    latencies, errors = [], []
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=client_loop, args=(deadline, latencies, errors)) for _ in range(args.clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    latencies.sort()
+    count = len(latencies)
+    handshakes = backend.accepted - accepted_before
+    logger.info("client connections/sec: %.0f (%d ok, %d errors)", count / args.duration, count, len(errors))
+    if count:
+        logger.info("latency ms: p50 %.2f, p90 %.2f, p99 %.2f, max %.2f",
+                    latencies[count // 2] * 1000, latencies[int(count * 0.9)] * 1000,
+                    latencies[int(count * 0.99)] * 1000, latencies[-1] * 1000)
+        logger.info("backend handshakes: %d", handshakes)
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,128 @@
+import argparse
+import logging
+import signal
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+from pool_bench import BODY, PROXY_HOST, PROXY_PORT, REQUEST, StandInBackend
+
+logger = logging.getLogger(__name__)
+
+FIRST_PORT = 8081
+SIGNALS = {"kill": signal.SIGKILL, "stop": signal.SIGSTOP}
+
+
+def client_loop(deadline, results, timeout):
+    """
+    New connection per request, records (finish time, ok, latency).
+    """
+    while time.monotonic() < deadline:
+        start = time.monotonic()
+        ok = True
+        try:
+            with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=timeout) as s:
+                s.sendall(REQUEST)
+                data = b""
+                while not data.endswith(BODY):
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        raise ConnectionError("closed before the response")
+                    data += chunk
+        except OSError:
+            ok = False
+        end = time.monotonic()
+        results.append((end, ok, end - start))
+        if not ok:
+            time.sleep(0.01)
+
+
+def percentile(values, p):
+    if not values:
+        return 0
+    return values[min(len(values) - 1, int(len(values) * p))] * 1000
+
+
+def run(proxy, extra_args, args):
+    backends = [subprocess.Popen([sys.executable, __file__, f"--serve={FIRST_PORT + i}"])
+                for i in range(args.backends)]
+    backend_args = [f"--backend=127.0.0.1:{FIRST_PORT + i}" for i in range(args.backends)]
+    process = subprocess.Popen([proxy, *backend_args, *extra_args], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    results = []
+    try:
+        time.sleep(1.5)  # backends up, pools warm
+        start = time.monotonic()
+        deadline = start + args.duration
+        threads = [threading.Thread(target=client_loop, args=(deadline, results, args.timeout))
+                   for _ in range(args.clients)]
+        for t in threads:
+            t.start()
+        time.sleep(args.kill_after)
+        killed_at = time.monotonic()
+        backends[0].send_signal(SIGNALS[args.signal])
+        for t in threads:
+            t.join()
+    finally:
+        process.send_signal(signal.SIGINT)
+        process.wait()
+        for backend in backends:
+            backend.kill()
+            backend.wait()
+
+    before = sorted(latency for end, ok, latency in results if ok and end < killed_at)
+    after = sorted(latency for end, ok, latency in results if ok and end >= killed_at)
+    failures = [end for end, ok, _ in results if not ok and end >= killed_at]
+    # Kill to the last failed request, the whole rest of the run if it never stops failing
+    failover = (max(failures) - killed_at) if failures else 0
+    return {
+        "before": len(before) / args.kill_after,
+        "after": len(after) / (deadline - killed_at),
+        "errors": len(failures),
+        "failover": failover,
+        "p50": percentile(after, 0.5),
+        "p99": percentile(after, 0.99),
+        "max": after[-1] * 1000 if after else 0,
+    }
+
+
+def main():
+    """
+    Failover through reverse_proxy_async_v2 when one of its backends dies under load.
+    Starts stand-in backends on 8081, 8082, ... as processes of their own, runs the proxy,
+    and sends SIGKILL (or SIGSTOP for a hung backend) to the first one mid-run. Reports the
+    requests that failed after that and how long until the last of them (failover time),
+    with ejection disabled vs. the health checks and circuit breaker, e.g.
+        failover_bench.py --proxy=build_proxy/reverse_proxy_async_v2
+        failover_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --signal=stop --extra=--health-path=/
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--serve", type=int, help=argparse.SUPPRESS)
+    parser.add_argument("--backends", type=int, default=3)
+    parser.add_argument("--clients", type=int, default=8, help="concurrent client threads")
+    parser.add_argument("--duration", type=float, default=12)
+    parser.add_argument("--kill-after", type=float, default=4, help="seconds into the run")
+    parser.add_argument("--signal", choices=SIGNALS, default="kill")
+    parser.add_argument("--timeout", type=float, default=2, help="client timeout per request")
+    parser.add_argument("--extra", action="append", default=[], help="proxy option for the checked run")
+    args = parser.parse_args()
+
+    if args.serve:
+        StandInBackend(args.serve).serve_forever()
+        return
+    if not args.proxy:
+        parser.error("--proxy is required")
+
+    for label, extra_args in (("no ejection", ["--eject-failures=0"]), ("breaker", args.extra)):
+        r = run(args.proxy, extra_args, args)
+        logger.info("%-11s %6.0f req/s before, %6.0f after  errors %4d  failover %6.0f ms  "
+                    "after: p50 %6.2f  p99 %7.2f  max %7.2f ms",
+                    label, r["before"], r["after"], r["errors"], r["failover"] * 1000,
+                    r["p50"], r["p99"], r["max"])
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
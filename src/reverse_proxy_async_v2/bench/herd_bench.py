@@ -0,0 +1,149 @@
+import argparse
+import logging
+import socket
+import socketserver
+import subprocess
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+PROXY_HOST = "127.0.0.1"
+PROXY_PORT = 9000
+BACKEND_PORT = 8081
+
+
+class SlowBackend(socketserver.ThreadingTCPServer):
+    """
+    Keep-alive HTTP backend that takes delay seconds per request and counts them.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 1024
+
+    def __init__(self, port, delay, body_size):
+        super().__init__(("127.0.0.1", port), SlowHandler)
+        self.delay = delay
+        self.body = b"x" * body_size
+        self.requests = 0
+        self.lock = threading.Lock()
+
+
+class SlowHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        server = self.server
+        data = b""
+        while True:
+            chunk = self.request.recv(4096)
+            if not chunk:
+                return
+            data += chunk
+            while b"\r\n\r\n" in data:
+                _, _, data = data.partition(b"\r\n\r\n")
+                with server.lock:
+                    server.requests += 1
+                time.sleep(server.delay)
+                self.request.sendall(f"HTTP/1.1 200 OK\r\nCache-Control: max-age=1\r\n"
+                                     f"Content-Length: {len(server.body)}\r\n\r\n".encode() + server.body)
+
+
+def read_response(s):
+    """
+    One Content-Length response, returns its body.
+    """
+    data = b""
+    while b"\r\n\r\n" not in data:
+        chunk = s.recv(65536)
+        if not chunk:
+            raise ConnectionError("closed before the response")
+        data += chunk
+    head, _, body = data.partition(b"\r\n\r\n")
+    length = 0
+    for line in head.split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            length = int(value)
+    while len(body) < length:
+        chunk = s.recv(65536)
+        if not chunk:
+            raise ConnectionError("closed in the body")
+        body += chunk
+    return body
+
+
+def client(barrier, path, expected, latencies, errors):
+    """
+    Connects, waits for every other client, then sends one GET of the shared path.
+    """
+    try:
+        with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=30) as s:
+            barrier.wait()
+            start = time.perf_counter()
+            s.sendall(f"GET {path} HTTP/1.1\r\nHost: bench\r\n\r\n".encode())
+            if read_response(s) != expected:
+                errors.append(1)
+            else:
+                latencies.append(time.perf_counter() - start)
+    except (OSError, threading.BrokenBarrierError):
+        errors.append(1)
+
+
+def main():
+    """
+    Thundering herd through reverse_proxy_async_v2's HTTP mode: --clients connections
+    send the same GET at once to a stand-in backend on 8081 that takes --delay ms per
+    request. Upstream requests per herd with --no-collapse vs. request collapsing, the
+    latter should be 1 per proxy worker. Runs the proxy itself, e.g.
+        herd_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --clients=500
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--clients", type=int, default=200, help="identical requests per herd")
+    parser.add_argument("--herds", type=int, default=5)
+    parser.add_argument("--threads", type=int, default=1, help="proxy worker threads")
+    parser.add_argument("--delay", type=float, default=200, help="backend ms per request")
+    parser.add_argument("--body-size", type=int, default=65536)
+    args = parser.parse_args()
+
+    backend = SlowBackend(BACKEND_PORT, args.delay / 1000, args.body_size)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+
+    for collapse in (False, True):
+        command = [args.proxy, "--http", f"--backend=127.0.0.1:{BACKEND_PORT}", f"--threads={args.threads}",
+                   f"--http-upstreams={args.clients}"]
+        if not collapse:
+            command.append("--no-collapse")
+        process = subprocess.Popen(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        try:
+            time.sleep(1)
+            upstream, latencies, errors = [], [], []
+            for herd in range(args.herds):
+                before = backend.requests
+                barrier = threading.Barrier(args.clients)
+                threads = [threading.Thread(target=client,
+                                            args=(barrier, f"/hot/{herd}", backend.body, latencies, errors))
+                           for _ in range(args.clients)]
+                for t in threads:
+                    t.start()
+                for t in threads:
+                    t.join()
+                upstream.append(backend.requests - before)
+        finally:
+            process.send_signal(subprocess.signal.SIGINT)
+            output, _ = process.communicate()
+
+        latencies.sort()
+        logger.info("%-11s %d clients x %d herds  upstream requests per herd %s  p50 %.0f  max %.0f ms  errors %d",
+                    "collapse" if collapse else "no collapse", args.clients, args.herds,
+                    ",".join(map(str, upstream)), latencies[len(latencies) // 2] * 1000 if latencies else 0,
+                    latencies[-1] * 1000 if latencies else 0, len(errors))
+        for line in output.splitlines():
+            if "HTTP requests" in line:
+                logger.info("            %s", line.split("] ", 1)[-1])
+
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
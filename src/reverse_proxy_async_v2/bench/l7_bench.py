@@ -0,0 +1,98 @@
+import argparse
+import logging
+import re
+import subprocess
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+BACKEND_PORT = 8080
+PROXY_PORT = 9000
+
+
+def backend_connections():
+    """
+    Established sockets towards the backend port, as seen from the proxy's side.
+    """
+    count = 0
+    for table in ("/proc/net/tcp", "/proc/net/tcp6"):
+        try:
+            with open(table) as f:
+                next(f)
+                for line in f:
+                    fields = line.split()
+                    if fields[2].endswith(f":{BACKEND_PORT:04X}") and fields[3] == "01":
+                        count += 1
+        except FileNotFoundError:
+            pass
+    return count
+
+
+def run(args, connections, extra_args):
+    proxy = subprocess.Popen([args.proxy, f"--threads={args.threads}", *extra_args],
+                             stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    peak = 0
+    try:
+        time.sleep(1.5)  # pools warm up on the first tick
+        loadgen = subprocess.Popen([args.loadgen, f"--port={PROXY_PORT}", f"--connections={connections}",
+                                    f"--duration={args.duration}", f"--path={args.path}"],
+                                   stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        stop = threading.Event()
+
+        def sample():
+            nonlocal peak
+            while not stop.wait(0.25):
+                peak = max(peak, backend_connections())
+
+        sampler = threading.Thread(target=sample)
+        sampler.start()
+        output, _ = loadgen.communicate()
+        stop.set()
+        sampler.join()
+    finally:
+        proxy.send_signal(subprocess.signal.SIGINT)
+        proxy.wait()
+
+    rate = re.search(r"requests/sec: (\d+) \(\d+ responses, (\d+) errors\)", output)
+    latency = re.search(r"p50 ([\d.]+), p99 ([\d.]+)", output)
+    if not rate or not latency:
+        raise RuntimeError(f"Unexpected loadgen output: {output}")
+    return int(rate.group(1)), int(rate.group(2)), float(latency.group(1)), float(latency.group(2)), peak
+
+
+def main():
+    """
+    Backend connections and requests/sec through reverse_proxy_async_v2, byte relay (L4)
+    vs. --http (L7, clients share keep-alive backend connections), with http_server as the
+    backend on 8080 and http_loadgen keep-alive clients, e.g.
+        l7_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --server=build/http_server --loadgen=build/http_loadgen
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--server", required=True, help="http_server binary, the backend")
+    parser.add_argument("--loadgen", required=True, help="http_loadgen binary")
+    parser.add_argument("--connections", default="100,1000", help="client connections per run")
+    parser.add_argument("--threads", type=int, default=2, help="proxy worker threads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--path", default="/customers/1")
+    args = parser.parse_args()
+
+    # No per-connection request limit, reconnects would blur the L7 counts
+    server = subprocess.Popen([args.server, "127.0.0.1", str(BACKEND_PORT), "--max-requests=1000000000"],
+                              stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        time.sleep(0.5)
+        for connections in (int(c) for c in args.connections.split(",")):
+            for label, extra_args in (("L4", []), ("L7 --http", ["--http"])):
+                rate, errors, p50, p99, peak = run(args, connections, extra_args)
+                logger.info("%5d clients  %-9s %7d req/s  p50 %7.0f us  p99 %7.0f us  errors %d  "
+                            "backend connections %d", connections, label, rate, p50, p99, errors, peak)
+    finally:
+        server.terminate()
+        server.wait()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,129 @@
+import argparse
+import logging
+import socket
+import socketserver
+import subprocess
+import threading
+import time
+
+from pool_bench import BODY, PROXY_HOST, PROXY_PORT, REQUEST, RESPONSE
+
+logger = logging.getLogger(__name__)
+
+POLICIES = ["round-robin", "least-conn", "p2c", "hash"]
+
+
+class DelayedBackend(socketserver.ThreadingTCPServer):
+    """
+    Keep-alive HTTP backend that takes delay seconds to answer each request.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 128
+
+    def __init__(self, port, delay):
+        super().__init__(("127.0.0.1", port), DelayedHandler)
+        self.delay = delay
+        self.requests = 0
+        self.lock = threading.Lock()
+
+
+class DelayedHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        data = b""
+        while True:
+            chunk = self.request.recv(4096)
+            if not chunk:
+                return
+            data += chunk
+            while b"\r\n\r\n" in data:
+                _, _, data = data.partition(b"\r\n\r\n")
+                with self.server.lock:
+                    self.server.requests += 1
+                time.sleep(self.server.delay)
+                self.request.sendall(RESPONSE)
+
+
+def client_loop(source_ip, deadline, latencies, errors):
+    """
+    New connection per request from its own source address, so hashing has clients to tell apart.
+    """
+    while time.monotonic() < deadline:
+        start = time.perf_counter()
+        try:
+            with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as s:
+                s.settimeout(5)
+                s.bind((source_ip, 0))
+                s.connect((PROXY_HOST, PROXY_PORT))
+                s.sendall(REQUEST)
+                data = b""
+                while not data.endswith(BODY):
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        raise ConnectionError("closed before the response")
+                    data += chunk
+        except OSError:
+            errors.append(1)
+            continue
+        latencies.append(time.perf_counter() - start)
+
+
+def percentile(values, p):
+    return values[min(len(values) - 1, int(len(values) * p))] * 1000
+
+
+def main():
+    """
+    Client latency through reverse_proxy_async_v2 with backends of differing latency,
+    one run per load balancing policy. Starts a stand-in backend per delay on 8081, 8082, ...
+    and runs the proxy itself, e.g.
+        lb_bench.py --proxy=build_proxy/reverse_proxy_async_v2 --delays=2,2,2,40
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--delays", default="2,2,2,40", help="ms per request for each backend")
+    parser.add_argument("--clients", type=int, default=16, help="concurrent client threads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--policies", default=",".join(POLICIES))
+    args = parser.parse_args()
+
+    delays = [float(d) / 1000 for d in args.delays.split(",")]
+    backends = [DelayedBackend(8081 + i, delay) for i, delay in enumerate(delays)]
+    for backend in backends:
+        threading.Thread(target=backend.serve_forever, daemon=True).start()
+    backend_args = [f"--backend=127.0.0.1:{8081 + i}" for i in range(len(backends))]
+
+    for policy in args.policies.split(","):
+        process = subprocess.Popen([args.proxy, f"--lb={policy}", *backend_args],
+                                   stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+        try:
+            time.sleep(1.5)  # pools warm up on the first tick
+            before = [backend.requests for backend in backends]
+            latencies, errors = [], []
+            deadline = time.monotonic() + args.duration
+            threads = [threading.Thread(target=client_loop, args=(f"127.0.0.{2 + i}", deadline, latencies, errors))
+                       for i in range(args.clients)]
+            for t in threads:
+                t.start()
+            for t in threads:
+                t.join()
+        finally:
+            process.send_signal(subprocess.signal.SIGINT)
+            process.wait()
+
+        latencies.sort()
+        shares = [backend.requests - b for backend, b in zip(backends, before)]
+        total = max(1, sum(shares))
+        logger.info("%-11s %6.0f req/s  p50 %6.2f  p90 %6.2f  p99 %6.2f  p99.9 %6.2f ms  errors %d  backend shares %s",
+                    policy, len(latencies) / args.duration,
+                    percentile(latencies, 0.5), percentile(latencies, 0.9),
+                    percentile(latencies, 0.99), percentile(latencies, 0.999), len(errors),
+                    "/".join(f"{100 * s / total:.0f}%" for s in shares))
+
+    for backend in backends:
+        backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,109 @@
+import argparse
+import logging
+import socket
+import socketserver
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+PROXY_HOST = "127.0.0.1"
+PROXY_PORT = 9000
+BACKEND_PORT = 8080
+
+REQUEST = b"GET / HTTP/1.1\r\nHost: localhost\r\n\r\n"
+BODY = b"ok"
+RESPONSE = b"HTTP/1.1 200 OK\r\nContent-Length: %d\r\nConnection: keep-alive\r\n\r\n%s" % (len(BODY), BODY)
+
+
+class StandInBackend(socketserver.ThreadingTCPServer):
+    """
+    Keep-alive HTTP backend that answers every request with a fixed response
+    and counts the TCP connections it accepted.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, port):
+        super().__init__(("127.0.0.1", port), BackendHandler)
+        self.accepted = 0
+        self.lock = threading.Lock()
+
+
+class BackendHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        with self.server.lock:
+            self.server.accepted += 1
+        data = b""
+        while True:
+            chunk = self.request.recv(4096)
+            if not chunk:
+                return
+            data += chunk
+            while b"\r\n\r\n" in data:
+                _, _, data = data.partition(b"\r\n\r\n")
+                self.request.sendall(RESPONSE)
+
+
+def client_loop(deadline, latencies, errors):
+    """
+    New connection per request, the pattern that makes the proxy connect to the backend
+    for every client without a pool.
+    """
+    while time.monotonic() < deadline:
+        start = time.perf_counter()
+        try:
+            with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=5) as s:
+                s.sendall(REQUEST)
+                data = b""
+                while not data.endswith(BODY):
+                    chunk = s.recv(4096)
+                    if not chunk:
+                        raise ConnectionError("closed before the response")
+                    data += chunk
+        except OSError:
+            errors.append(1)
+            continue
+        latencies.append(time.perf_counter() - start)
+
+
+def main():
+    """
+    Client connection rate through reverse_proxy_async_v2 and the backend handshakes it costs.
+    Starts the stand-in backend on 8080, then start the proxy and compare:
+        reverse_proxy_async_v2                     (pooled)
+        reverse_proxy_async_v2 --pool-max-idle=0   (connect per client)
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--clients", type=int, default=8, help="concurrent client threads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--wait", type=float, default=5, help="seconds to start the proxy after the backend is up")
+    args = parser.parse_args()
+
+    backend = StandInBackend(BACKEND_PORT)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+    logger.info("Stand-in backend on port %d, start the proxy now", BACKEND_PORT)
+    time.sleep(args.wait)
+
+    accepted_before = backend.accepted
+    latencies, errors = [], []
+    deadline = time.monotonic() + args.duration
+    threads = [threading.Thread(target=client_loop, args=(deadline, latencies, errors)) for _ in range(args.clients)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+
+    latencies.sort()
+    count = len(latencies)
+    handshakes = backend.accepted - accepted_before
+    logger.info("client connections/sec: %.0f (%d ok, %d errors)", count / args.duration, count, len(errors))
+    if count:
+        logger.info("latency ms: p50 %.2f, p99 %.2f", latencies[count // 2] * 1000, latencies[int(count * 0.99)] * 1000)
+        logger.info("backend handshakes: %d (%.3f per client connection)", handshakes, handshakes / count)
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
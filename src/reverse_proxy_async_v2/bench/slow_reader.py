@@ -0,0 +1,115 @@
+import argparse
+import logging
+import os
+import socket
+import socketserver
+import subprocess
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+PROXY_HOST = "127.0.0.1"
+PROXY_PORT = 9000
+BACKEND_PORT = 8080
+
+
+class FloodBackend(socketserver.ThreadingTCPServer):
+    """
+    Backend that sends as fast as it's allowed to, for as long as the connection lasts.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+
+    def __init__(self, port):
+        super().__init__(("127.0.0.1", port), FloodHandler)
+        self.blob = os.urandom(1024 * 1024)
+
+
+class FloodHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        try:
+            while True:
+                self.request.sendall(self.server.blob)
+        except OSError:
+            return
+
+
+def rss_kb(pid):
+    with open(f"/proc/{pid}/status") as f:
+        for line in f:
+            if line.startswith("VmRSS:"):
+                return int(line.split()[1])
+    return 0
+
+
+def slow_reader(deadline, rate, stop):
+    """
+    Reads rate bytes per second, in ten slices a second.
+    """
+    with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=10) as s:
+        slice_size = max(1, rate // 10)
+        while time.monotonic() < deadline and not stop.is_set():
+            left = slice_size
+            while left:
+                chunk = s.recv(left)
+                if not chunk:
+                    return
+                left -= len(chunk)
+            time.sleep(0.1)
+
+
+def run(proxy, extra_args, clients, rate, duration, rss_limit_kb):
+    process = subprocess.Popen([proxy, *extra_args], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    samples = []
+    try:
+        time.sleep(0.5)
+        stop = threading.Event()
+        deadline = time.monotonic() + duration
+        threads = [threading.Thread(target=slow_reader, args=(deadline, rate, stop)) for _ in range(clients)]
+        for t in threads:
+            t.start()
+        while time.monotonic() < deadline:
+            time.sleep(0.5)
+            samples.append(rss_kb(process.pid))
+            if samples[-1] > rss_limit_kb:
+                logger.info("  RSS limit reached, stopping early")
+                break
+        stop.set()
+        for t in threads:
+            t.join()
+    finally:
+        process.send_signal(subprocess.signal.SIGINT)
+        process.wait()
+    return samples
+
+
+def main():
+    """
+    Proxy RSS while clients read slowly from a backend that sends as fast as it can,
+    reverse_proxy_async_v2 with --max-in-flight=0 (no limit) vs. the in-flight cap.
+    Starts the backend on 8080 and runs the proxy itself, e.g.
+        slow_reader.py --proxy=build_proxy/reverse_proxy_async_v2
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--clients", type=int, default=10)
+    parser.add_argument("--rate", type=int, default=64 * 1024, help="bytes per second each client reads")
+    parser.add_argument("--duration", type=float, default=10)
+    parser.add_argument("--max-in-flight", type=int, default=64 * 1024, help="cap for the capped run")
+    parser.add_argument("--rss-limit-mb", type=int, default=1024, help="stop a run when the proxy gets this big")
+    args = parser.parse_args()
+
+    backend = FloodBackend(BACKEND_PORT)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+
+    for label, extra_args in (("unbounded", ["--max-in-flight=0"]), ("capped", [f"--max-in-flight={args.max_in_flight}"])):
+        samples = run(args.proxy, extra_args, args.clients, args.rate, args.duration, args.rss_limit_mb * 1024)
+        logger.info("%-9s RSS MB over time: %s", label, " ".join(f"{kb / 1024:.0f}" for kb in samples))
+        logger.info("%-9s peak RSS %.1f MB", label, max(samples, default=0) / 1024)
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,129 @@
+import argparse
+import logging
+import os
+import socket
+import socketserver
+import struct
+import subprocess
+import threading
+import time
+
+logger = logging.getLogger(__name__)
+
+PROXY_HOST = "127.0.0.1"
+PROXY_PORT = 9000
+BACKEND_PORT = 8080
+
+SIZES = {"1KB": 1024, "64KB": 64 * 1024, "1MB": 1024 * 1024}
+
+
+class BlobBackend(socketserver.ThreadingTCPServer):
+    """
+    Opaque L4 backend: every 8-byte big-endian length it reads is answered with that many bytes.
+    """
+    daemon_threads = True
+    allow_reuse_address = True
+    request_queue_size = 128
+
+    def __init__(self, port):
+        super().__init__(("127.0.0.1", port), BlobHandler)
+        self.blob = os.urandom(max(SIZES.values()))
+
+
+class BlobHandler(socketserver.BaseRequestHandler):
+    def handle(self):
+        blob = memoryview(self.server.blob)
+        while True:
+            header = recv_exact(self.request, 8)
+            if header is None:
+                return
+            (size,) = struct.unpack("!Q", header)
+            self.request.sendall(blob[:size])
+
+
+def recv_exact(sock, size):
+    data = b""
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            return None
+        data += chunk
+    return data
+
+
+def client_loop(size, deadline, received):
+    """
+    One keep-alive connection asking for size bytes at a time until the deadline.
+    """
+    buffer = bytearray(256 * 1024)
+    view = memoryview(buffer)
+    total = 0
+    with socket.create_connection((PROXY_HOST, PROXY_PORT), timeout=10) as s:
+        while time.monotonic() < deadline:
+            s.sendall(struct.pack("!Q", size))
+            left = size
+            while left:
+                n = s.recv_into(view[:min(left, len(buffer))])
+                if n == 0:
+                    raise ConnectionError("proxy closed the connection")
+                left -= n
+            total += size
+    received.append(total)
+
+
+def cpu_seconds(pid):
+    with open(f"/proc/{pid}/stat") as f:
+        fields = f.read().rsplit(")", 1)[1].split()
+    # utime and stime, fields 14 and 15 counting from 1
+    return (int(fields[11]) + int(fields[12])) / os.sysconf("SC_CLK_TCK")
+
+
+def run(proxy, extra_args, size, clients, duration):
+    process = subprocess.Popen([proxy, "--threads=1", *extra_args], stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL)
+    try:
+        time.sleep(0.5)
+        cpu_before = cpu_seconds(process.pid)
+        received = []
+        deadline = time.monotonic() + duration
+        threads = [threading.Thread(target=client_loop, args=(size, deadline, received)) for _ in range(clients)]
+        start = time.monotonic()
+        for t in threads:
+            t.start()
+        for t in threads:
+            t.join()
+        elapsed = time.monotonic() - start
+        cpu = cpu_seconds(process.pid) - cpu_before
+    finally:
+        process.send_signal(subprocess.signal.SIGINT)
+        process.wait()
+
+    mb = sum(received) / (1024 * 1024)
+    return mb / elapsed, cpu * 1000 / mb if mb else 0
+
+
+def main():
+    """
+    Throughput and proxy CPU per MB of reverse_proxy_async_v2, copying relay vs. --splice,
+    for 1 KB, 64 KB and 1 MB responses over keep-alive connections.
+    Starts the backend on 8080 and runs the proxy itself (one worker thread), e.g.
+        splice_bench.py --proxy=build_proxy/reverse_proxy_async_v2
+    """
+    parser = argparse.ArgumentParser()
+    parser.add_argument("--proxy", required=True, help="reverse_proxy_async_v2 binary")
+    parser.add_argument("--clients", type=int, default=4, help="concurrent connections")
+    parser.add_argument("--duration", type=float, default=5)
+    args = parser.parse_args()
+
+    backend = BlobBackend(BACKEND_PORT)
+    threading.Thread(target=backend.serve_forever, daemon=True).start()
+
+    for label, size in SIZES.items():
+        for mode, extra_args in (("copy", []), ("splice", ["--splice"])):
+            mb_per_sec, cpu_ms_per_mb = run(args.proxy, extra_args, size, args.clients, args.duration)
+            logger.info("%-5s %-6s  %8.1f MB/s  proxy CPU %6.3f ms/MB", label, mode, mb_per_sec, cpu_ms_per_mb)
+    backend.shutdown()
+
+
+if __name__ == "__main__":
+    logging.basicConfig(level=logging.INFO)
+    main()
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <mutex>
+#include <iostream>
+
+
+inline std::mutex logMutex;
+
+template <typename... Args>
+void logf(Args&&... args) {
+    std::lock_guard<std::mutex> lock(logMutex);
+    (std::cout << ... << std::forward<Args>(args)) << std::endl;
+}
+
+template <typename... Args>
+void logcerr(Args&&... args) {
+    std::lock_guard<std::mutex> lock(logMutex);
+    (std::cerr << ... << std::forward<Args>(args)) << std::endl;
+}
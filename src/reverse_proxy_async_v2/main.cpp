@@ -1,356 +1,123 @@
-#include <mutex>
-#include <atomic>
-#include <csignal>
-#include <iostream>
+#include <exception>
 #include <string>
-#include <sstream>
-#include <winsock2.h>
-#include <thread>
-#include <vector>
 
-const char* const LISTEN_ADDR = "127.0.0.1";
-constexpr int LISTEN_PORT = 9000;
+#include "ReverseProxy.hpp"
+#include "log.hpp"
 
-const char* const BACKEND_ADDR = "127.0.0.1";
-constexpr int BACKEND_PORT = 8080;
 
-constexpr int BUFFER_SIZE = 4096;
-
-constexpr int MAX_WORKER_THREADS = 2;
-
-std::mutex logMutex;
-
-template <typename... Args>
-void logf(Args&&... args) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    (std::cout << ... << std::forward<Args>(args)) << std::endl;
-}
-
-template <typename... Args>
-void logcerr(Args&&... args) {
-    std::lock_guard<std::mutex> lock(logMutex);
-    (std::cerr << ... << std::forward<Args>(args)) << std::endl;
-}
-
-
-struct WinSockGuard {
-    WinSockGuard() { WSAStartup(MAKEWORD(2, 2), &wsaData); }
-    ~WinSockGuard() { WSACleanup(); }
-    WSADATA wsaData;
-};
-
-
-enum class IOState {
-    RECV,
-    SEND
-};
-
-struct ProxyContext {
-    SOCKET srcSocket;
-    SOCKET dstSocket;
-    OVERLAPPED overlapped;
-    WSABUF wsaBuf;
-    char buffer[BUFFER_SIZE];
-    size_t bufferLen;
-    IOState state = IOState::RECV;
-
-
-    ProxyContext(SOCKET srcSock, SOCKET dstSock) : srcSocket(srcSock), dstSocket(dstSock) {
-        ZeroMemory(&overlapped, sizeof(overlapped));
-        wsaBuf.buf = buffer;
-        wsaBuf.len = BUFFER_SIZE;
-    }
-};
-
-
-std::atomic_bool running = true;
-
-void signalHandler(int signal) {
-    logf("\nCaught signal ", signal, ", exiting..");
-    running = false;
-}
-
-
-void startInitialRecv(SOCKET srcSocket, SOCKET dstSocket) {
-    ProxyContext* ctx = new ProxyContext(srcSocket, dstSocket);
-    ctx->state = IOState::RECV;
-    ctx->wsaBuf.buf = ctx->buffer;
-    ctx->wsaBuf.len = BUFFER_SIZE;
-
-    DWORD flags = 0;
-    DWORD bytesReceived = 0;
-    ZeroMemory(&ctx->overlapped, sizeof(ctx->overlapped));
-
-    int result = WSARecv(
-        srcSocket,
-        &ctx->wsaBuf,
-        1,
-        &bytesReceived,
-        &flags,
-        &ctx->overlapped,
-        nullptr
-    );
-
-    if (result == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
-        logcerr("Initial WSARecv failed: ", WSAGetLastError());
-        delete ctx;
-    }
-}
-
-
-void cleanUpContext(ProxyContext* context) {
-    closesocket(context->srcSocket);
-    closesocket(context->dstSocket);
-    delete context;
-}
-
-
-void workerThread(HANDLE iocpHandle) {
-    std::ostringstream oss;
-    oss << "[Thread " << std::this_thread::get_id() << "] ";
-    std::string threadStr = oss.str();
-    logf(threadStr, " Started worker");
-
-    while (true) {
-        DWORD bytesTransferred = 0;
-        ULONG_PTR completionKey = 0;
-        LPOVERLAPPED overlapped = nullptr;
-
-        BOOL completionResult = GetQueuedCompletionStatus(
-            iocpHandle,
-            &bytesTransferred,
-            &completionKey,
-            &overlapped,
-            INFINITE
-        );
-
-        if (overlapped == nullptr) {
-            logf(threadStr, " Shutdown signal received.");
-            break;
-        }
-        
-        auto* context = CONTAINING_RECORD(overlapped, ProxyContext, overlapped);
-
-        if (!completionResult) {
-            DWORD err = GetLastError();
-            if (bytesTransferred == 0) {
-                logf(threadStr, " Client disconnected (bytesTransferred == 0)");
-            } else if (err == ERROR_NETNAME_DELETED || err == ERROR_CONNECTION_ABORTED) {
-                logf(threadStr, " Client disconnected (connection closed)");
-            } else {
-                logcerr(threadStr, " GetQueuedCompletionStatus() failed with error: ", err);
-            }
-            cleanUpContext(context);
-            continue;
-        }
-
-        if (bytesTransferred == 0) {
-            logf(threadStr, " Client disconnected gracefully (bytesTransferred == 0)");
-            cleanUpContext(context);
-            continue;
-        }
-
-        if (context->state == IOState::RECV) {
-
-            std::string msg(context->buffer, bytesTransferred);
-            logf(threadStr, " Received ", bytesTransferred, " bytes: ", msg);
-            
-            ProxyContext* sendContext = new ProxyContext(context->dstSocket, context->srcSocket);
-            sendContext->state = IOState::SEND;
-            memcpy(sendContext->buffer, context->buffer, bytesTransferred);
-            sendContext->wsaBuf.buf = context->buffer;
-            sendContext->wsaBuf.len = bytesTransferred;
-
-            ZeroMemory(&sendContext->overlapped, sizeof(sendContext->overlapped));
-
-            DWORD bytesSent = 0;
-            int sendResult = WSASend(
-                sendContext->srcSocket,
-                &sendContext->wsaBuf,
-                1,
-                &bytesSent,
-                0,
-                &sendContext->overlapped,
-                nullptr
-            );
-
-            if (sendResult == SOCKET_ERROR && WSAGetLastError() != WSA_IO_PENDING) {
-                logcerr(threadStr, " WSASend() failed with error: ", WSAGetLastError());
-                cleanUpContext(sendContext);
-            }
-            startInitialRecv(context->srcSocket, context->dstSocket);
-
-        } else if (context->state == IOState::SEND) {
-            logf(threadStr, " Sent ", bytesTransferred, " bytes");
-            delete context;
-        }
-    }
-}
-
-
-SOCKET createListenSocket() {
-    SOCKET listenSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    if (listenSocket == INVALID_SOCKET) {
-        logcerr("[Main] Failed to create socket");
-        exit(1);
-    }
-    
-    sockaddr_in serverAddr{};
-    serverAddr.sin_family = AF_INET;
-    serverAddr.sin_port = htons(LISTEN_PORT);
-    serverAddr.sin_addr.s_addr = inet_addr(LISTEN_ADDR);
-
-    if (bind(listenSocket, (sockaddr*)&serverAddr, sizeof(serverAddr)) == SOCKET_ERROR) {
-        logcerr("[Main] bind() failed with error: ", WSAGetLastError());
-        closesocket(listenSocket);
-        exit(1);
-    }
-    
-    if (listen(listenSocket, SOMAXCONN) == SOCKET_ERROR) {
-        logcerr("[Main] listen() failed with error: ", WSAGetLastError());
-        closesocket(listenSocket);
-        exit(1);
-    }
-
-    return listenSocket;
-}
-
-
-SOCKET acceptClient(SOCKET listenSocket) {
-        fd_set readSet;
-        FD_ZERO(&readSet);
-        FD_SET(listenSocket, &readSet);
-
-        timeval timeout;
-        timeout.tv_sec = 1;
-        timeout.tv_usec = 0;
-        
-        int selectResult = select(0, &readSet, nullptr, nullptr, &timeout);
-        if (selectResult == SOCKET_ERROR) {
-            logcerr("[Main] select() failed with error: ", WSAGetLastError());
-            return INVALID_SOCKET;
-        }
-        
-        if (selectResult == 0) {
-            return INVALID_SOCKET;
-        }
-        
-        sockaddr_in clientAddr{};
-        int clientAddrLen = sizeof(clientAddr);
-
-        SOCKET clientSocket = accept(listenSocket, (sockaddr*)&clientAddr, &clientAddrLen);
-        if (clientSocket == INVALID_SOCKET) {
-            logcerr("[Main] accept() failed with error: ", WSAGetLastError());
-            return INVALID_SOCKET;
-        }
-        
-        char* clientIp = inet_ntoa(clientAddr.sin_addr);
-        int clientPort = ntohs(clientAddr.sin_port);
-        logf("[Main] New client connected from ", clientIp, ":", clientPort);
-        return clientSocket;
-}
-
-
-SOCKET connectToBackend() {
-    SOCKET backendSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    sockaddr_in backendAddr{};
-    backendAddr.sin_family = AF_INET;
-    backendAddr.sin_port = htons(BACKEND_PORT);
-    backendAddr.sin_addr.s_addr = inet_addr(BACKEND_ADDR);
-
-    if (connect(backendSocket, (sockaddr*)&backendAddr, sizeof(backendAddr)) == SOCKET_ERROR) {
-        logcerr("[Main] connect() to backend server failed with error: ", WSAGetLastError());
-        closesocket(backendSocket);
-        return INVALID_SOCKET;
-    }
-    logf("[Main] Connected to backend");
-    return backendSocket;
-}
-
-
-bool associateIOCP(SOCKET socket, HANDLE iocpHandle, std::string label) {
-    HANDLE result = CreateIoCompletionPort((HANDLE)socket, iocpHandle, (ULONG_PTR)socket, 0);
-    if (!result) {
-        logcerr("[Main] CreateIoCompletionPort() failed for ", label, " socket (", socket, ") with error: ", GetLastError());
-        return false;
-    }
-    logf("[Main] Associated ", label, " socket (", socket, ") with IOCP");
-    return true;
-}
-
-
-int main() {
+int main(int argc, char* argv[]) {
     /*
-    V2 Asynchronous multithreaded reverse proxy using IOCP (I/O Completion Ports)
-    
+    V2 Asynchronous multithreaded reverse proxy (IOCP on Windows, epoll on Linux)
+
     V1 tried to handle communication with persisting ProxyContexts by modifying the state,
     that quickly became unpleasant and caused funky behaviour due to thread syncing.
 
-    V2 handles communication per IO by creating and deleting ProxyContexts,
-    so, we don't need any thread syncing.
+    V2 gives every I/O its own ProxyContext, taken from a per-thread free list
+    (ObjectPool.hpp) and handed back when the I/O completes, so no context is shared
+    between threads. What a client's I/Os do share lives in its ProxySession
+    (pending count, flow control, closing), guarded by the session's mutex.
 
-    Create single IOCP handle
-    For each client, associate client and backend sockets with iocp
+    Worker loops accept clients asynchronously (AcceptEx / accept4 on readiness)
+    For each client, take a warm backend connection from the pool (see BackendPool.hpp),
+    or connect a new one without blocking (ConnectEx / non-blocking connect)
     Worker threads wait and handle completed I/O operations
-    Communication happens via WSASend and WSARecv
+    When the client leaves, the backend connection is closed (or goes back to the pool
+    if the client never sent anything on it, see BackendPool.hpp)
     */
-    logf("[Main] Running V2 async multithreaded (IOCP) reverse proxy!");
-    
-    std::signal(SIGINT, signalHandler);
-    WinSockGuard wsGuard;
 
-    SOCKET listenSocket = createListenSocket();
-
-    logf("Reverse proxy listening on ", LISTEN_ADDR, ":", LISTEN_PORT, ", forwarding to ", BACKEND_ADDR, ":", BACKEND_PORT);
-
-    HANDLE iocpHandle = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, 0);
-    if (iocpHandle == NULL) {
-        logcerr("[Main] CreateIoCompletionPort() failed with error: ", GetLastError());
-        closesocket(listenSocket);
-        return 1;
-    }
-    logf("[Main] iocpHandle created succesfully!");
-
-    std::vector<std::thread> workerThreads;
-    for (int i = 0; i < MAX_WORKER_THREADS; i++) {
-        workerThreads.emplace_back(workerThread, iocpHandle);
-    }
-
-    while (running) {
-        SOCKET clientSocket = acceptClient(listenSocket);
-        if (clientSocket == INVALID_SOCKET) {
-            continue;
-        } 
-
-        SOCKET backendSocket = connectToBackend();
-        if (backendSocket == INVALID_SOCKET) {
-            closesocket(clientSocket);
-            continue;
-        } 
-
-        if (!associateIOCP(clientSocket, iocpHandle, "client") ||
-            !associateIOCP(backendSocket, iocpHandle, "backend")) {
-            closesocket(clientSocket);
-            closesocket(backendSocket);
-            continue;
+    // reverse_proxy_async_v2 [--threads=N] [--pool-min-idle=N] [--pool-max-idle=N] [--pool-idle-timeout=ms]
+    //                        [--listen-port=N] [--backend=host:port]... [--lb=round-robin|least-conn|p2c|hash]
+    //                        [--max-in-flight=bytes] [--splice]
+    //                        [--health-interval=ms] [--health-timeout=ms] [--health-path=/path]
+    //                        [--eject-failures=N] [--eject-latency=ms] [--eject-time=ms]
+    //                        [--http] [--http-upstreams=N] [--no-collapse] [--cache-size=MB] [--cache-stale=ms]
+    // --backend can be given once per backend, default 127.0.0.1:8080
+    // --pool-max-idle=0 connects to the backend for every client
+    // --max-in-flight=0 buffers without limit when one side reads slower than the other sends
+    // --splice relays with splice() so the payload never enters user space (Linux)
+    // --health-interval=0 leaves ejection to failing client connects, --health-path checks with
+    // an HTTP GET instead of a bare connect, --eject-failures=0 never takes a backend out
+    // --http relays requests instead of bytes, all clients of a worker share at most
+    // --http-upstreams keep-alive connections per backend (default 8). --cache-size keeps
+    // cacheable responses in memory, --cache-stale serves them that long past their max-age
+    // while one request revalidates. --no-collapse sends identical concurrent requests upstream
+    // one by one instead of having them wait for the first one's response
+    ProxyOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        try {
+            if (arg.rfind("--threads=", 0) == 0) {
+                options.threads = std::stoul(arg.substr(10));
+            } else if (arg.rfind("--pool-min-idle=", 0) == 0) {
+                options.pool.minIdle = std::stoul(arg.substr(16));
+            } else if (arg.rfind("--pool-max-idle=", 0) == 0) {
+                options.pool.maxIdle = std::stoul(arg.substr(16));
+            } else if (arg.rfind("--pool-idle-timeout=", 0) == 0) {
+                options.pool.idleTimeoutMs = static_cast<uint32_t>(std::stoul(arg.substr(20)));
+            } else if (arg.rfind("--listen-port=", 0) == 0) {
+                options.listenPort = static_cast<u_short>(std::stoul(arg.substr(14)));
+            } else if (arg.rfind("--backend=", 0) == 0) {
+                std::string address = arg.substr(10);
+                size_t colon = address.rfind(':');
+                if (colon == std::string::npos) {
+                    logcerr("Backend without a port: ", address);
+                    return 1;
+                }
+                options.backends.push_back({address.substr(0, colon),
+                                            static_cast<u_short>(std::stoul(address.substr(colon + 1)))});
+            } else if (arg.rfind("--lb=", 0) == 0) {
+                if (!parseLoadBalancePolicy(arg.substr(5), options.policy)) {
+                    logcerr("Unknown load balancing policy: ", arg.substr(5));
+                    return 1;
+                }
+            } else if (arg.rfind("--max-in-flight=", 0) == 0) {
+                options.maxInFlight = std::stoul(arg.substr(16));
+            } else if (arg == "--http") {
+                options.http = true;
+            } else if (arg.rfind("--http-upstreams=", 0) == 0) {
+                options.httpUpstreams = std::stoul(arg.substr(17));
+            } else if (arg == "--no-collapse") {
+                options.collapse = false;
+            } else if (arg.rfind("--cache-size=", 0) == 0) {
+                options.cacheBytes = std::stoul(arg.substr(13)) * 1024 * 1024;
+            } else if (arg.rfind("--cache-stale=", 0) == 0) {
+                options.cacheStaleMs = static_cast<uint32_t>(std::stoul(arg.substr(14)));
+            } else if (arg.rfind("--health-interval=", 0) == 0) {
+                options.health.checkIntervalMs = static_cast<uint32_t>(std::stoul(arg.substr(18)));
+            } else if (arg.rfind("--health-timeout=", 0) == 0) {
+                options.health.checkTimeoutMs = static_cast<uint32_t>(std::stoul(arg.substr(17)));
+            } else if (arg.rfind("--health-path=", 0) == 0) {
+                options.health.checkPath = arg.substr(14);
+            } else if (arg.rfind("--eject-failures=", 0) == 0) {
+                options.health.maxFailures = static_cast<uint32_t>(std::stoul(arg.substr(17)));
+            } else if (arg.rfind("--eject-latency=", 0) == 0) {
+                options.health.maxLatencyMs = static_cast<uint32_t>(std::stoul(arg.substr(16)));
+            } else if (arg.rfind("--eject-time=", 0) == 0) {
+                options.health.ejectMs = static_cast<uint32_t>(std::stoul(arg.substr(13)));
+    #ifndef _WIN32
+            } else if (arg == "--splice") {
+                options.splice = true;
+    #endif
+            } else {
+                logcerr("Unknown option: ", arg);
+                return 1;
+            }
+        } catch (const std::exception&) {
+            // std::stoul on something that isn't a number, or out of range
+            logcerr("Invalid value in option: ", arg);
+            return 1;
         }
-        
-        startInitialRecv(clientSocket, backendSocket);
-        startInitialRecv(backendSocket, clientSocket);
     }
-
-    logf("[Main] Stop worker threads");
-    for (int i = 0; i < MAX_WORKER_THREADS; ++i) {
-        PostQueuedCompletionStatus(iocpHandle, 0, 0, nullptr);
+    if (options.threads == 0) {
+        options.threads = 1;
     }
 
-    logf("[Main] Waiting for worker threads to finish.");
-    for (auto& t : workerThreads) {
-        if (t.joinable()) t.join();
+    try {
+        ReverseProxy proxy(options);
+        proxy.run();
+    } catch (const std::exception& e) {
+        logcerr("[Main] ", e.what());
+        return 1;
     }
-
-    CloseHandle(iocpHandle);
-    closesocket(listenSocket);
-    logf("[Main] Async reverse proxy shut down gracefully!");
     return 0;
 }